@@ -398,7 +398,7 @@ createTaskList (void* argPtr)
         TM_SHARED_READ_F(learnerPtr->baseLogLikelihood);
     TM_SHARED_WRITE_F(learnerPtr->baseLogLikelihood,
                       (baseLogLikelihood + globalBaseLogLikelihood));
-    TM_END();
+    TM_END_ID(0);
 
     /*
      * For each variable, find if the addition of any edge _to_ it is better
@@ -490,7 +490,7 @@ createTaskList (void* argPtr)
             taskPtr->score = score;
             TM_BEGIN_ID(1);
             status = TMLIST_INSERT(taskListPtr, (void*)taskPtr);
-            TM_END();
+            TM_END_ID(1);
             assert(status);
         }
 
@@ -1198,7 +1198,7 @@ learnStructure (void* argPtr)
         learner_task_t* taskPtr;
         TM_BEGIN_ID(2);
         taskPtr = TMpopTask(TM_ARG  taskListPtr);
-        TM_END();
+        TM_END_ID(2);
         if (taskPtr == NULL) {
             break;
         }
@@ -1265,13 +1265,14 @@ learnStructure (void* argPtr)
             TMNET_APPLYOPERATION(netPtr, op, fromId, toId);
         }
 
-        TM_END();
+        TM_END_ID(3);
 
         float deltaLogLikelihood = 0.0;
 
         if (isTaskValid) {
 
             switch (op) {
+                float localBaseLogLikelihood;
                 float newBaseLogLikelihood;
                 case OPERATION_INSERT: {
                     TM_BEGIN_ID(4);
@@ -1288,17 +1289,18 @@ learnStructure (void* argPtr)
                                                   queries,
                                                   queryVectorPtr,
                                                   parentQueryVectorPtr);
-                    float toLocalBaseLogLikelihood =
+                    localBaseLogLikelihood =
                         (float)TM_SHARED_READ_F(localBaseLogLikelihoods[toId]);
-                    deltaLogLikelihood +=
-                        toLocalBaseLogLikelihood - newBaseLogLikelihood;
                     TM_SHARED_WRITE_F(localBaseLogLikelihoods[toId],
                                       newBaseLogLikelihood);
-                    TM_END();
+                    TM_END_ID(4);
+                    /* Outside the region, so a restart does not count it twice */
+                    deltaLogLikelihood +=
+                        localBaseLogLikelihood - newBaseLogLikelihood;
                     TM_BEGIN_ID(5);
                     long numTotalParent = (long)TM_SHARED_READ(learnerPtr->numTotalParent);
                     TM_SHARED_WRITE(learnerPtr->numTotalParent, (numTotalParent + 1));
-                    TM_END();
+                    TM_END_ID(5);
                     break;
                 }
 #ifdef LEARNER_TRY_REMOVE
@@ -1317,17 +1319,17 @@ learnStructure (void* argPtr)
                                                   queries,
                                                   queryVectorPtr,
                                                   parentQueryVectorPtr);
-                    float fromLocalBaseLogLikelihood =
+                    localBaseLogLikelihood =
                         (float)TM_SHARED_READ_F(localBaseLogLikelihoods[fromId]);
-                    deltaLogLikelihood +=
-                        fromLocalBaseLogLikelihood - newBaseLogLikelihood;
                     TM_SHARED_WRITE_F(localBaseLogLikelihoods[fromId],
                                       newBaseLogLikelihood);
-                    TM_END();
+                    TM_END_ID(6);
+                    deltaLogLikelihood +=
+                        localBaseLogLikelihood - newBaseLogLikelihood;
                     TM_BEGIN_ID(7);
                     long numTotalParent = (long)TM_SHARED_READ(learnerPtr->numTotalParent);
                     TM_SHARED_WRITE(learnerPtr->numTotalParent, (numTotalParent - 1));
-                    TM_END();
+                    TM_END_ID(7);
                     break;
                 }
 #endif /* LEARNER_TRY_REMOVE */
@@ -1347,13 +1349,13 @@ learnStructure (void* argPtr)
                                                   queries,
                                                   queryVectorPtr,
                                                   parentQueryVectorPtr);
-                    float fromLocalBaseLogLikelihood =
+                    localBaseLogLikelihood =
                         (float)TM_SHARED_READ_F(localBaseLogLikelihoods[fromId]);
-                    deltaLogLikelihood +=
-                        fromLocalBaseLogLikelihood - newBaseLogLikelihood;
                     TM_SHARED_WRITE_F(localBaseLogLikelihoods[fromId],
                                       newBaseLogLikelihood);
-                    TM_END();
+                    TM_END_ID(8);
+                    deltaLogLikelihood +=
+                        localBaseLogLikelihood - newBaseLogLikelihood;
 
                     TM_BEGIN_ID(9);
                     TMpopulateQueryVectors(TM_ARG
@@ -1369,13 +1371,13 @@ learnStructure (void* argPtr)
                                                   queries,
                                                   queryVectorPtr,
                                                   parentQueryVectorPtr);
-                    float toLocalBaseLogLikelihood =
+                    localBaseLogLikelihood =
                         (float)TM_SHARED_READ_F(localBaseLogLikelihoods[toId]);
-                    deltaLogLikelihood +=
-                        toLocalBaseLogLikelihood - newBaseLogLikelihood;
                     TM_SHARED_WRITE_F(localBaseLogLikelihoods[toId],
                                       newBaseLogLikelihood);
-                    TM_END();
+                    TM_END_ID(9);
+                    deltaLogLikelihood +=
+                        localBaseLogLikelihood - newBaseLogLikelihood;
                     break;
                 }
 #endif /* LEARNER_TRY_REVERSE */
@@ -1399,7 +1401,7 @@ learnStructure (void* argPtr)
         TM_SHARED_WRITE_F(learnerPtr->baseLogLikelihood, newBaseLogLikelihood);
         baseLogLikelihood = newBaseLogLikelihood;
         numTotalParent = (long)TM_SHARED_READ(learnerPtr->numTotalParent);
-        TM_END();
+        TM_END_ID(10);
 
         /*
          * Find next task
@@ -1423,7 +1425,7 @@ learnStructure (void* argPtr)
 
         TM_BEGIN_ID(11);
         newTask = TMfindBestInsertTask(TM_ARG  &arg);
-        TM_END();
+        TM_END_ID(11);
 
         if ((newTask.fromId != newTask.toId) &&
             (newTask.score > (bestTask.score / operationQualityFactor)))
@@ -1434,7 +1436,7 @@ learnStructure (void* argPtr)
 #ifdef LEARNER_TRY_REMOVE
         TM_BEGIN_ID(12);
         newTask = TMfindBestRemoveTask(TM_ARG  &arg);
-        TM_END();
+        TM_END_ID(12);
 
         if ((newTask.fromId != newTask.toId) &&
             (newTask.score > (bestTask.score / operationQualityFactor)))
@@ -1446,7 +1448,7 @@ learnStructure (void* argPtr)
 #ifdef LEARNER_TRY_REVERSE
         TM_BEGIN_ID(13);
         newTask = TMfindBestReverseTask(TM_ARG  &arg);
-        TM_END();
+        TM_END_ID(13);
 
         if ((newTask.fromId != newTask.toId) &&
             (newTask.score > (bestTask.score / operationQualityFactor)))
@@ -1460,7 +1462,7 @@ learnStructure (void* argPtr)
             tasks[toId] = bestTask;
             TM_BEGIN_ID(14);
             TMLIST_INSERT(taskListPtr, (void*)&tasks[toId]);
-            TM_END();
+            TM_END_ID(14);
 #ifdef TEST_LEARNER
             printf("[new]  op=%i from=%li to=%li score=%lf\n",
                    bestTask.op, bestTask.fromId, bestTask.toId, bestTask.score);
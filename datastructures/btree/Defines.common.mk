@@ -0,0 +1,14 @@
+PROG := btree
+
+SRCS += \
+	$(LIB)/btree.c \
+	$(LIB)/mt19937ar.c \
+	$(LIB)/random.c \
+	$(LIB)/thread.c \
+
+CXXSRCS := btree.cpp
+
+# BT_NODE_SIZE sets the bytes per node (default 256, see lib/btree.h)
+ifdef BT_NODE_SIZE
+CFLAGS += -DBTREE_NODE_SIZE=$(BT_NODE_SIZE)
+endif
@@ -0,0 +1,300 @@
+/*
+ * File:
+ *   btree.cpp
+ * Description:
+ *   Integer set stress test on the B+-tree of lib/btree.c.  Same driver
+ *   and flags as redblacktree.cpp, so the two run the same workloads.
+ */
+
+#include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include "timer.h"
+#include "random.h"
+#include <time.h>
+
+extern "C" {
+#include "tm.h"
+#include "btree.h"
+}
+
+#include "thread.h"
+
+#define DEFAULT_DURATION                10000
+#define DEFAULT_INITIAL                 256
+#define DEFAULT_NB_THREADS              1
+#define DEFAULT_RANGE                   0xFFFF
+#define DEFAULT_SEED                    0
+#define DEFAULT_UPDATE                  20
+#define DEFAULT_REPEAT                  1
+#define DEFAULT_ACCESSES_PER_OPERATION              1
+#define DEFAULT_ALPHA 1.0
+
+#define XSTR(s)                         STR(s)
+#define STR(s)                          #s
+
+/* ################################################################### *
+ * GLOBALS
+ * ################################################################### */
+
+typedef btree_t intset_t;
+
+intset_t *set_new()
+{
+  /* NULL compare: the values themselves are the keys */
+  return btree_alloc(NULL);
+}
+
+int set_add_seq(intset_t *set, intptr_t val) {
+    return btree_insert(set, (void*)val, (void*)val);
+}
+
+int set_add(TM_ARGDECL  intset_t *set, intptr_t val)
+{
+    return TMBTREE_INSERT(set, val, val);
+}
+
+int set_remove(TM_ARGDECL intset_t *set, intptr_t val)
+{
+    return TMBTREE_DELETE(set, val);
+}
+
+int set_contains(TM_ARGDECL  intset_t *set, intptr_t val)
+{
+    return TMBTREE_CONTAINS(set, val);
+}
+
+/* ################################################################### *
+ * STRESS TEST
+ * ################################################################### */
+
+  int range;
+  int update;
+  unsigned int nb_threads;
+  unsigned int seed;
+  unsigned int operations;
+  unsigned int accessesPerOperations;
+  double alpha_value;
+  intset_t *set;
+
+
+
+void test(void *data)
+{
+  int val;
+
+  TM_THREAD_ENTER();
+
+  random_t* randomPtr = random_alloc();
+
+  long myOps = operations / nb_threads;
+
+  while (myOps > 0) {
+
+      long pruned_range = ((long)(range*alpha_value));
+
+      unsigned int access;
+      for (access = 0; access < accessesPerOperations; access++) {
+          val = random_generate(randomPtr) % 100;
+          if (val < update) {
+              if (val < update / 2) {
+                  /* Add random value */
+                  val = (random_generate(randomPtr) % pruned_range) + 1;
+                  TM_BEGIN_ID(0);
+                  set_add(TM_ARG set, val);
+                  TM_END_ID(0);
+              } else {
+                  /* Remove random value */
+                  val = (random_generate(randomPtr) % pruned_range) + 1;
+                  TM_BEGIN_ID(1);
+                  set_remove(TM_ARG set, val);
+                  TM_END_ID(1);
+              }
+          } else {
+              /* Look for random value */
+              long tmp = (random_generate(randomPtr) % pruned_range) + 1;
+              TM_BEGIN_ROT(2);
+              set_contains(TM_ARG set, tmp);
+              TM_END_ID(2);
+          }
+
+      }
+      myOps -= accessesPerOperations;
+
+  }
+
+  random_free(randomPtr);
+
+  TM_THREAD_EXIT();
+
+}
+
+
+# define no_argument        0
+# define required_argument  1
+# define optional_argument  2
+
+MAIN(argc, argv) {
+    TIMER_T start;
+    TIMER_T stop;
+
+  struct option long_options[] = {
+    // These options don't set a flag
+    {"help",                      no_argument,       NULL, 'h'},
+    {"duration",                  required_argument, NULL, 'd'},
+    {"initial-size",              required_argument, NULL, 'i'},
+    {"num-threads",               required_argument, NULL, 'n'},
+    {"range",                     required_argument, NULL, 'r'},
+    {"seed",                      required_argument, NULL, 's'},
+    {"update-rate",               required_argument, NULL, 'u'},
+    {"repeats",                   optional_argument, NULL, 'a'},
+    {"zipfian-alpha-param",       optional_argument, NULL, 'z'},
+    {"accesses-per-op",           optional_argument, NULL, 'o'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int i, c, val;
+  operations = DEFAULT_DURATION;
+  unsigned int initial = DEFAULT_INITIAL;
+  nb_threads = DEFAULT_NB_THREADS;
+  range = DEFAULT_RANGE;
+  update = DEFAULT_UPDATE;
+  int attempts = DEFAULT_REPEAT;
+  accessesPerOperations = DEFAULT_ACCESSES_PER_OPERATION;
+  alpha_value = DEFAULT_ALPHA;
+
+  while(1) {
+    i = 0;
+    c = getopt_long(argc, argv, "hd:i:n:r:s:u:a:o:z:", long_options, &i);
+
+    if(c == -1)
+      break;
+
+    if(c == 0 && long_options[i].flag == 0)
+      c = long_options[i].val;
+
+    switch(c) {
+     case 0:
+       /* Flag is automatically set */
+       break;
+     case 'h':
+       printf("intset -- STM stress test "
+              "(B+-tree)\n"
+              "\n"
+              "Usage:\n"
+              "  intset [options...]\n"
+              "\n"
+              "Options:\n"
+              "  -h, --help\n"
+              "        Print this message\n"
+              "  -d, --duration <int>\n"
+              "        Number of operations (default=" XSTR(DEFAULT_DURATION) ")\n"
+              "  -i, --initial-size <int>\n"
+              "        Number of elements to insert before test (default=" XSTR(DEFAULT_INITIAL) ")\n"
+              "  -n, --num-threads <int>\n"
+              "        Number of threads (default=" XSTR(DEFAULT_NB_THREADS) ")\n"
+              "  -r, --range <int>\n"
+              "        Range of integer values inserted in set (default=" XSTR(DEFAULT_RANGE) ")\n"
+              "  -s, --seed <int>\n"
+              "        RNG seed (0=time-based, default=" XSTR(DEFAULT_SEED) ")\n"
+              "  -u, --update-rate <int>\n"
+              "        Percentage of update transactions (default=" XSTR(DEFAULT_UPDATE) ")\n"
+              "  -a, --repeats <int>\n"
+              "        Runs, each on a new set; the times add up (default=" XSTR(DEFAULT_REPEAT) ")\n"
+         );
+       exit(0);
+     case 'a':
+       attempts = atoi(optarg);
+       break;
+     case 'd':
+       operations = atoi(optarg);
+       break;
+     case 'i':
+       initial = atoi(optarg);
+       break;
+     case 'n':
+       nb_threads = atoi(optarg);
+       break;
+     case 'r':
+       range = atoi(optarg);
+       break;
+     case 's':
+       seed = atoi(optarg);
+       break;
+     case 'z':
+       alpha_value = atof(optarg);
+       break;
+     case 'u':
+       update = atoi(optarg);
+       break;
+     case 'o':
+       accessesPerOperations = atoi(optarg);
+       break;
+     case '?':
+       printf("Use -h or --help for help\n");
+       exit(0);
+     default:
+       exit(1);
+    }
+  }
+
+  if (seed == 0)
+    srand((int)time(0));
+  else
+    srand(seed);
+
+  printf("range after alpha: %ld\n", (long)(range*alpha_value));
+  printf("%d keys per %d-byte node\n", (int)BTREE_ORDER, (int)sizeof(btree_node_t));
+
+  /* Init STM */
+  SIM_GET_NUM_CPU(nb_threads);
+  TM_STARTUP(nb_threads);
+  P_MEMORY_STARTUP(nb_threads);
+  thread_startup(nb_threads);
+
+  double time_total = 0.0;
+  long size = 0;
+
+  for (; attempts > 0; --attempts) {
+
+    set = set_new();
+
+    /* Populate set */
+    for (i = 0; i < (int)initial; i++) {
+      val = (rand() % range) + 1;
+      set_add_seq(set, val);
+    }
+
+    seed = rand();
+    TIMER_READ(start);
+    GOTO_SIM();
+
+    thread_start(test, NULL);
+
+    GOTO_REAL();
+    TIMER_READ(stop);
+
+    time_total += TIMER_DIFF_SECONDS(start, stop);
+
+    size = btree_verify(set, 0);
+    if (size < 0) {
+      btree_verify(set, 1);
+      exit(1);
+    }
+  }
+
+  printf("Time = %0.6lf\n", time_total);
+  printf("Set size = %ld\n", size);
+
+  TM_SHUTDOWN();
+  P_MEMORY_SHUTDOWN();
+  GOTO_SIM();
+  thread_shutdown();
+  MAIN_RETURN(0);
+
+}
@@ -1,6 +1,6 @@
 #!/bin/sh
 #FOLDERS="hashmap linkedlist redblacktree"
-FOLDERS="hashmap hashmap-static redblacktree" # linkedlist"
+FOLDERS="hashmap hashmap-static redblacktree emptytx skiplist btree" # linkedlist"
 
 if [ $# -eq 0 ] ; then
     echo " === ERROR At the very least, we need the backend name in the first parameter. === "
@@ -21,11 +21,15 @@ fi
 rm common/Defines.common.mk
 rm common/Makefile.common
 rm common/Makefile.htm_ibm
+rm -f common/Makefile.stm
+rm -f common/Makefile.seq
 rm -rf lib/
 
 cp ../common/Defines.common.mk common
 cp ../common/Makefile.common common
 cp ../common/Makefile.htm_ibm common
+cp ../common/Makefile.stm common
+cp ../common/Makefile.seq common
 cp -r ../lib/ lib
 
 for F in $FOLDERS
@@ -34,6 +38,9 @@ do
 echo "executing make"
 	if [[ $backend == htm-sgl || $backend == tle ]] ; then
 		make_command="make -f Makefile.htm_ibm HTM_RETRIES=-DHTM_RETRIES=$htm_retries RETRY_POLICY=-DRETRY_POLICY=$rot_retries"
+	elif [[ $backend == norec || $backend == tl2 ]] ; then
+		make_clean="make -f Makefile.stm clean"
+		make_default="make -f Makefile.stm STM_BACKEND=$backend default"
 	else
         	make_clean="make -f Makefile.htm_ibm clean"
                 make_default="make -f Makefile.htm_ibm default"
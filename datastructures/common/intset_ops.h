@@ -0,0 +1,66 @@
+/* =============================================================================
+ *
+ * intset_ops.h
+ *
+ * The operation stream of the integer set benchmarks.  Each thread draws
+ * its operations from its own producer, which TM_PREFETCH_REGISTER (see
+ * lib/tm.h) hands to the prefetching helpers of the thread as well.
+ *
+ * =============================================================================
+ */
+
+#ifndef INTSET_OPS_H
+#define INTSET_OPS_H 1
+
+#include <stdlib.h>
+
+
+/* The draw in [0, 100) that picks the operation, and its value */
+typedef struct intset_op {
+    int op;
+    long val;
+} intset_op_t;
+
+typedef struct intset_producer {
+    unsigned int seed;
+    long ops;              /* left to draw */
+    unsigned long range;   /* values are drawn from [1, range] */
+} intset_producer_t;
+
+
+static inline void
+intset_producer_init (intset_producer_t* producerPtr,
+                      unsigned int seed, long ops, unsigned long range)
+{
+    producerPtr->seed = seed;
+    producerPtr->ops = ops;
+    producerPtr->range = range;
+}
+
+
+/* Fills next with the next operation; 0 after the last one */
+static inline int
+intset_next_op (void* producer, void* next)
+{
+    intset_producer_t* producerPtr = (intset_producer_t*)producer;
+    intset_op_t* opPtr = (intset_op_t*)next;
+
+    if (producerPtr->ops == 0) {
+        return 0;
+    }
+    producerPtr->ops--;
+    opPtr->op = rand_r(&producerPtr->seed) % 100;
+    opPtr->val = (rand_r(&producerPtr->seed) % producerPtr->range) + 1;
+    return 1;
+}
+
+
+#endif /* INTSET_OPS_H */
+
+
+/* =============================================================================
+ *
+ * End of intset_ops.h
+ *
+ * =============================================================================
+ */
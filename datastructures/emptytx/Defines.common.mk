@@ -0,0 +1,6 @@
+PROG := emptytx
+
+SRCS += \
+	$(LIB)/thread.c \
+
+CXXSRCS := emptytx.cpp
@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "timer.h"
+
+
+#define DEFAULT_DURATION                10000000
+#define DEFAULT_NB_THREADS              1
+#define DEFAULT_WRITES                  0
+
+#define XSTR(s)                         STR(s)
+#define STR(s)                          #s
+
+/* ################################################################### *
+ * GLOBALS
+ * ################################################################### */
+
+extern "C" {
+#include "tm.h"
+}
+
+#include "thread.h"
+
+
+#define PAD 128
+
+/* One per thread, so that regions that write do not conflict */
+typedef struct Counter_t
+{
+	long m_val;
+	char padding[PAD];
+} Counter;
+
+Counter* counter;
+
+  long operations;
+  unsigned int nb_threads;
+  int writes;
+
+/* -- Begin and commit of back-to-back regions: with -w 0 they are empty,
+ *    and all the time goes to tbegin/tend and the runtime around them */
+void test(void *data)
+{
+  TM_THREAD_ENTER();
+
+  long id = thread_getId();
+  Counter* mine = &counter[id];
+  long n = operations / nb_threads;
+  long i;
+  int w;
+
+  for (i = 0; i < n; i++) {
+    TM_BEGIN_ID(0);
+    for (w = 0; w < writes; w++) {
+      TM_SHARED_WRITE(mine->m_val, TM_SHARED_READ(mine->m_val) + 1);
+    }
+    TM_END_ID(0);
+  }
+
+  TM_THREAD_EXIT();
+}
+
+# define no_argument        0
+# define required_argument  1
+# define optional_argument  2
+
+MAIN(argc, argv) {
+    TIMER_T start;
+    TIMER_T stop;
+
+
+  struct option long_options[] = {
+    // These options don't set a flag
+    {"help",                      no_argument,       NULL, 'h'},
+    {"duration",                  required_argument, NULL, 'd'},
+    {"num-threads",               required_argument, NULL, 'n'},
+    {"writes",                    required_argument, NULL, 'w'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int i, c;
+  long total;
+  double seconds;
+  operations = DEFAULT_DURATION;
+  nb_threads = DEFAULT_NB_THREADS;
+  writes = DEFAULT_WRITES;
+
+  while(1) {
+    i = 0;
+    c = getopt_long(argc, argv, "hd:n:w:", long_options, &i);
+
+    if(c == -1)
+      break;
+
+    if(c == 0 && long_options[i].flag == 0)
+      c = long_options[i].val;
+
+    switch(c) {
+     case 0:
+       /* Flag is automatically set */
+       break;
+     case 'h':
+       printf("emptytx -- begin/commit overhead of the TM runtime\n"
+              "\n"
+              "Usage:\n"
+              "  emptytx [options...]\n"
+              "\n"
+              "Options:\n"
+              "  -h, --help\n"
+              "        Print this message\n"
+              "  -d, --duration <int>\n"
+              "        Number of transactions, over all threads (default=" XSTR(DEFAULT_DURATION) ")\n"
+              "  -n, --num-threads <int>\n"
+              "        Number of threads (default=" XSTR(DEFAULT_NB_THREADS) ")\n"
+              "  -w, --writes <int>\n"
+              "        Increments of a thread-private word per transaction (default=" XSTR(DEFAULT_WRITES) ")\n"
+         );
+       exit(0);
+     case 'd':
+       operations = atol(optarg);
+       break;
+     case 'n':
+       nb_threads = atoi(optarg);
+       break;
+     case 'w':
+       writes = atoi(optarg);
+       break;
+     case '?':
+       printf("Use -h or --help for help\n");
+       exit(0);
+     default:
+       exit(1);
+    }
+  }
+
+  SIM_GET_NUM_CPU(nb_threads);
+  TM_STARTUP(nb_threads);
+  P_MEMORY_STARTUP(nb_threads);
+  thread_startup(nb_threads);
+
+  counter = (Counter*) calloc(nb_threads, sizeof(Counter));
+  assert(counter);
+
+  TIMER_READ(start);
+  GOTO_SIM();
+
+  thread_start(test, NULL);
+
+  GOTO_REAL();
+  TIMER_READ(stop);
+
+  total = 0;
+  for (i = 0; i < (int)nb_threads; i++) {
+    total += counter[i].m_val;
+  }
+  assert(total == (operations / nb_threads) * nb_threads * writes);
+
+  seconds = TIMER_DIFF_SECONDS(start, stop);
+  puts("done.");
+  printf("\nTime = %0.6lf\n", seconds);
+  printf("Transactions per thread = %ld\n", operations / nb_threads);
+  printf("ns per transaction = %0.2lf\n", seconds * 1e9 / (operations / nb_threads));
+
+  fflush(stdout);
+
+  TM_SHUTDOWN();
+  P_MEMORY_SHUTDOWN();
+  GOTO_SIM();
+  thread_shutdown();
+  MAIN_RETURN(0);
+}
@@ -28,14 +28,8 @@ extern "C" {
 }
 
 #include "thread.h"
+#include "../common/intset_ops.h"
 
-__thread void* rot_readset[1024];
-__thread char crot_readset[8192];
-__thread int irot_readset[2048];
-__thread int16_t i2rot_readset[4096];
-
-unsigned int htm_rot_enabled = 1;
-unsigned int allow_rots_ros = 1;
 unsigned int allow_htms = 1;
 
 
@@ -43,18 +37,6 @@ __thread unsigned int local_exec_mode = 0;
 
 __thread unsigned int local_thread_id;
 
-__thread long rs_mask_2 = 0xffffffffffff0000;
-__thread long rs_mask_4 = 0xffffffff00000000;
-__thread long offset = 0;
-__thread char* p;
-__thread int* ip;
-__thread int16_t* i2p;
-__thread long moffset = 0;
-__thread long moffset_2 = 0;
-__thread long moffset_6 = 0;
-
-__thread unsigned long rs_counter = 0;
-
 unsigned int allow_stms = 0;
 
 unsigned int ucb_levers = 4;
@@ -175,14 +157,13 @@ long set_contains(TM_ARGDECL long  val)
     long res = 0;
 
     int ro = 1;
-    TM_BEGIN_ID(2);
+    TM_BEGIN_ROT(2);
     res = (local_exec_mode == 3 || local_exec_mode == 1 || local_exec_mode == 4) ? priv_lookup_stm(TM_ARG val) : priv_lookup_htm(TM_ARG val);
     TM_END_ID(2);
 
     return res;
 }
 
-#include <sched.h>
   long range;
   int update;
   unsigned long nb_add;
@@ -199,23 +180,20 @@ void test(void *data)
 
   TM_THREAD_ENTER();
 
-  unsigned int mySeed = getenv("PREFETCHING") ? seed + sched_getcpu()/8 : seed + sched_getcpu();
-  long myOps = getenv("PREFETCHING") ? operations / (nb_threads/2) : operations / nb_threads;
-
-  long val = -1;
-  int op;
-
-  while (myOps > 0) {
-    op = rand_r(&mySeed) % 100;
-    if (op < update) {
-        val = (rand_r(&mySeed) % range) + 1;
-        set_update(TM_ARG  val);
+  intset_producer_t producer;
+  intset_producer_init(&producer, seed + TM_PREFETCH_MASTER(),
+                       operations / nb_threads, range);
+  /* Helpers of this master replay its updates and lookups, one
+     bucket chain ahead */
+  TM_PREFETCH_REGISTER(intset_next_op, &producer, sizeof(intset_op_t));
+  intset_op_t o;
+
+  while (TM_PREFETCH_NEXT(&o)) {
+    if (o.op < update) {
+        set_update(TM_ARG  o.val);
     } else {
-      long tmp = (rand_r(&mySeed) % range) + 1;
-      set_contains(TM_ARG tmp);
+      set_contains(TM_ARG o.val);
     }
-
-    myOps--;
   }
 
   TM_THREAD_EXIT();
@@ -319,7 +297,6 @@ MAIN(argc, argv) {
     }
   }
 
-  nb_threads = getenv("PREFETCHING") ? nb_threads*2 : nb_threads;
   L_BUCKET = initial / N_BUCKETS;
 
   if (seed == 0)
@@ -329,8 +306,8 @@ MAIN(argc, argv) {
 
   SIM_GET_NUM_CPU(nb_threads);
   TM_STARTUP(nb_threads);
-  P_MEMORY_STARTUP(nb_threads);
-  thread_startup(nb_threads);
+  P_MEMORY_STARTUP(TM_PREFETCH_THREADS(nb_threads));
+  thread_startup(TM_PREFETCH_THREADS(nb_threads));
 
   hashmap = (long *) malloc(initial*sizeof(long));
 
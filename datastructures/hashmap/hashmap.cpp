@@ -28,6 +28,7 @@ extern "C" {
 }
 
 #include "thread.h"
+#include "../common/intset_ops.h"
 
 
 #define PAD 128
@@ -200,14 +201,13 @@ long set_contains(TM_ARGDECL long  val)
     long res = 0;
 
     int ro = 1;
-    TM_BEGIN_ID(2);
+    TM_BEGIN_ROT(2);
     res = priv_lookup_htm(TM_ARG val);
     TM_END_ID(2);
 
     return res;
 }
 
-#include <sched.h>
   unsigned long range;
   int update;
   unsigned long nb_add;
@@ -224,20 +224,24 @@ void test(void *data)
 
   TM_THREAD_ENTER();
 
-  unsigned int mySeed = getenv("PREFETCHING") ? seed + sched_getcpu()/8 : seed + sched_getcpu();
-  long myOps = getenv("PREFETCHING") ? operations / (nb_threads/2) : operations / nb_threads;
+  intset_producer_t producer;
+  intset_producer_init(&producer, seed + TM_PREFETCH_MASTER(),
+                       operations / nb_threads, range);
+  /* Seeded by the master, so that its helpers draw the same adds and
+     removes and warm the buckets before it gets there */
+  TM_PREFETCH_REGISTER(intset_next_op, &producer, sizeof(intset_op_t));
+  intset_op_t o;
 
   long val = -1;
-  int op;
 
-
-  while (myOps > 0) {
-    op = rand_r(&mySeed) % 100;
-    if (op < update) {
+  while (TM_PREFETCH_NEXT(&o)) {
+    if (o.op < update) {
       if (val == -1) {
         /* Add random value */  
-        val = (rand_r(&mySeed) % range) + 1;
-        if(set_add(TM_ARG val) == 0) {
+        val = o.val;
+        /* A helper learns nothing from its regions: it expects the add
+           of its master to succeed */
+        if(set_add(TM_ARG val) == 0 && !TM_PREFETCH_HELPER()) {
           val = -1;
         }
       } else {
@@ -247,11 +251,8 @@ void test(void *data)
       }
     } else {
       /* Look for random value */
-      long tmp = (rand_r(&mySeed) % range) + 1;
-      set_contains(TM_ARG tmp);
+      set_contains(TM_ARG o.val);
     }
-
-    myOps--;
   }
 
   TM_THREAD_EXIT();
@@ -360,12 +361,11 @@ MAIN(argc, argv) {
   else
     srand(seed);
 
-  nb_threads = getenv("PREFETCHING") ? nb_threads*2 : nb_threads;
 
   SIM_GET_NUM_CPU(nb_threads);
   TM_STARTUP(nb_threads);
-  P_MEMORY_STARTUP(nb_threads);
-  thread_startup(nb_threads);
+  P_MEMORY_STARTUP(TM_PREFETCH_THREADS(nb_threads));
+  thread_startup(TM_PREFETCH_THREADS(nb_threads));
 
   bucket = (List**) malloc(N_BUCKETS*sizeof(List*));
 
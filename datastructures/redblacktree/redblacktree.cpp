@@ -178,7 +178,7 @@ void test(void *data)
               /* Look for random value */
               long tmp = (random_generate(randomPtr) % pruned_range) + 1;
 	      ro = 1;
-	      TM_BEGIN_ID(2);
+	      TM_BEGIN_ROT(2);
               set_contains(TM_ARG set, tmp);
 	      TM_END_ID(2);
           }
@@ -16,6 +16,10 @@ benchmarks[13]="linkedlist"
 benchmarks[14]="linkedlist"
 benchmarks[15]="linkedlist"
 benchmarks[16]="linkedlist"
+benchmarks[17]="btree"
+benchmarks[18]="btree"
+benchmarks[19]="btree"
+benchmarks[20]="btree"
 
 bStr[1]="rbt-l-w"
 bStr[2]="rbt-l-r"
@@ -33,6 +37,10 @@ bStr[13]="ll-l-w"
 bStr[14]="ll-l-r"
 bStr[15]="ll-s-w"
 bStr[16]="ll-s-r"
+bStr[17]="bt-l-w"
+bStr[18]="bt-l-r"
+bStr[19]="bt-s-w"
+bStr[20]="bt-s-r"
 
 params[1]="-d 15000000 -i 1048576 -r 1000000 -u 90 -a 1 -n"
 params[2]="-d 25000000 -i 1048576 -r 1000000 -u 10 -a 1 -n"
@@ -50,6 +58,10 @@ params[13]="-d 200000 -i 10485 -r 1000000 -u 90 -n "
 params[14]="-d 400000 -i 10485 -r 1000000 -u 10 -n "
 params[15]="-d 50000000 -i 64 -r 1000000 -u 90 -n"
 params[16]="-d 100000000 -i 64 -r 1000000 -u 10 -n "
+params[17]="-d 15000000 -i 1048576 -r 1000000 -u 90 -a 1 -n"
+params[18]="-d 25000000 -i 1048576 -r 1000000 -u 10 -a 1 -n"
+params[19]="-d 15000000 -i 1024 -r 1000000 -u 90 -a 1 -n"
+params[20]="-d 25000000 -i 1024 -r 1000000 -u 10 -a 1 -n"
 
 wait_until_finish() {
     pid3=$1
@@ -69,7 +81,7 @@ wait_until_finish() {
 
 DIR=$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )
 
-for b in {1..16}
+for b in {1..20}
 do
     cd $DIR;
     cd ${benchmarks[$b]};
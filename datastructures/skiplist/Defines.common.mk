@@ -0,0 +1,24 @@
+PROG := skiplist
+
+SRCS += \
+	$(LIB)/mt19937ar.c \
+	$(LIB)/random.c \
+	$(LIB)/thread.c \
+
+CXXSRCS := skiplist.cpp
+
+# Node layout: SL_MAX_LEVEL caps the towers (default 16), SL_PAD sets the
+# bytes between a node's key and its links (default 128, see PAD in
+# hashmap.cpp)
+ifdef SL_MAX_LEVEL
+CFLAGS += -DMAX_LEVEL=$(SL_MAX_LEVEL)
+endif
+ifdef SL_PAD
+CFLAGS += -DPAD=$(SL_PAD)
+endif
+
+# SKIPLIST_LOCKFREE=yes replaces the transactions with a CAS-based skip
+# list; build it with Makefile.seq to leave out the TM runtime
+ifeq ($(SKIPLIST_LOCKFREE),yes)
+CFLAGS += -DSKIPLIST_LOCKFREE
+endif
@@ -0,0 +1,599 @@
+#include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <time.h>
+#include "timer.h"
+
+
+#define DEFAULT_DURATION                10000
+#define DEFAULT_INITIAL                 256
+#define DEFAULT_NB_THREADS              1
+#define DEFAULT_RANGE                   0xFFFF
+#define DEFAULT_SEED                    0
+#define DEFAULT_UPDATE                  20
+
+#define XSTR(s)                         STR(s)
+#define STR(s)                          #s
+
+/* ################################################################### *
+ * GLOBALS
+ * ################################################################### */
+
+extern "C" {
+#include "tm.h"
+}
+
+#include "thread.h"
+#include "../common/intset_ops.h"
+
+
+/* Tallest tower, in links; SL_MAX_LEVEL in Defines.common.mk */
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 16
+#endif
+#if MAX_LEVEL < 1 || MAX_LEVEL > 32
+#error "MAX_LEVEL must be in 1..32"
+#endif
+
+/* Bytes between the key and the links of a node; SL_PAD */
+#ifndef PAD
+#define PAD 128
+#endif
+
+typedef struct Node_SL_t
+{
+	long m_val;
+	long m_level;
+	char padding[PAD];
+	/* m_level links are allocated, see NODE_SIZE */
+	struct Node_SL_t* m_next[MAX_LEVEL];
+} Node_SL;
+
+#define NODE_SIZE(level) (offsetof(Node_SL, m_next) + (level) * sizeof(Node_SL*))
+
+/* The lock-free variant marks a link whose node is removed at that level */
+#define IS_MARKED(p)    (((uintptr_t)(p)) & 1)
+#define MARKED(p)       ((Node_SL*)(((uintptr_t)(p)) | 1))
+#define UNMARKED(p)     ((Node_SL*)(((uintptr_t)(p)) & ~(uintptr_t)1))
+
+/* Sentinel with MAX_LEVEL links, before every key */
+Node_SL* head;
+
+/* -- The height of the tower of val, with P(level > k) = 2^-k: taken from
+ *    a hash of the value, so an add that a transaction retries, or that
+ *    follows a remove of the same value, builds the same tower */
+static long random_level(long val)
+{
+	uint64_t h = (uint64_t)val * 0x9E3779B97F4A7C15ULL;
+	uint32_t bits = (uint32_t)(h >> 32) | (1U << (MAX_LEVEL - 1));
+	return __builtin_ctz(bits) + 1;
+}
+
+static Node_SL* node_alloc_seq(long val, long level)
+{
+	Node_SL* n = (Node_SL*)malloc(NODE_SIZE(level));
+	assert(n);
+	n->m_val = val;
+	n->m_level = level;
+	return n;
+}
+
+void sl_insert_seq(long val)
+{
+	Node_SL* preds[MAX_LEVEL];
+	Node_SL* pred = head;
+	Node_SL* curr = NULL;
+	long l;
+
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = pred->m_next[l];
+		while (curr != NULL && curr->m_val < val) {
+			pred = curr;
+			curr = pred->m_next[l];
+		}
+		preds[l] = pred;
+	}
+
+	if (curr && curr->m_val == val)
+		return;
+
+	long level = random_level(val);
+	Node_SL* i = node_alloc_seq(val, level);
+	for (l = 0; l < level; l++) {
+		i->m_next[l] = preds[l]->m_next[l];
+		preds[l]->m_next[l] = i;
+	}
+}
+
+#ifndef SKIPLIST_LOCKFREE
+
+TM_CALLABLE
+long sl_insert_htm(TM_ARGDECL long val)
+{
+	// find the predecessors of val at every level
+	Node_SL* preds[MAX_LEVEL];
+	Node_SL* pred = head;
+	Node_SL* curr = NULL;
+	long l;
+
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = TM_SHARED_READ_P(pred->m_next[l]);
+		while (curr != NULL && TM_SHARED_READ(curr->m_val) < val) {
+			pred = curr;
+			curr = TM_SHARED_READ_P(pred->m_next[l]);
+		}
+		preds[l] = pred;
+	}
+
+	if (curr && TM_SHARED_READ(curr->m_val) == val)
+		return 0;
+
+	// create the new node, then link it in bottom-up
+	long level = random_level(val);
+	Node_SL* i = (Node_SL*)TM_MALLOC(NODE_SIZE(level));
+	i->m_val = val;
+	i->m_level = level;
+	for (l = 0; l < level; l++) {
+		i->m_next[l] = TM_SHARED_READ_P(preds[l]->m_next[l]);
+		TM_SHARED_WRITE_P(preds[l]->m_next[l], i);
+	}
+	return 1;
+}
+
+TM_CALLABLE
+long sl_lookup_htm(TM_ARGDECL long val)
+{
+	const Node_SL* pred = head;
+	const Node_SL* curr = NULL;
+	long l;
+
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = TM_SHARED_READ_P(pred->m_next[l]);
+		while (curr != NULL && TM_SHARED_READ(curr->m_val) < val) {
+			pred = curr;
+			curr = TM_SHARED_READ_P(pred->m_next[l]);
+		}
+	}
+
+	return ((curr != NULL) && (TM_SHARED_READ(curr->m_val) == val));
+}
+
+TM_CALLABLE
+int sl_remove_htm(TM_ARGDECL long val)
+{
+	Node_SL* preds[MAX_LEVEL];
+	Node_SL* pred = head;
+	Node_SL* curr = NULL;
+	long l;
+
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = TM_SHARED_READ_P(pred->m_next[l]);
+		while (curr != NULL && TM_SHARED_READ(curr->m_val) < val) {
+			pred = curr;
+			curr = TM_SHARED_READ_P(pred->m_next[l]);
+		}
+		preds[l] = pred;
+	}
+
+	if (!curr || TM_SHARED_READ(curr->m_val) != val)
+		return 0;
+
+	long level = TM_SHARED_READ(curr->m_level);
+	for (l = level - 1; l >= 0; l--) {
+		TM_SHARED_WRITE_P(preds[l]->m_next[l], TM_SHARED_READ_P(curr->m_next[l]));
+	}
+	TM_FREE(curr);
+	return 1;
+}
+
+
+long set_add(TM_ARGDECL long val)
+{
+    int res = 0;
+
+    TM_BEGIN_ID(0);
+    res = sl_insert_htm(TM_ARG val);
+    TM_END_ID(0);
+
+    return res;
+}
+
+int set_remove(TM_ARGDECL long val)
+{
+    int res = 0;
+
+    TM_BEGIN_ID(1);
+    res = sl_remove_htm(TM_ARG val);
+    TM_END_ID(1);
+
+    return res;
+}
+
+long set_contains(TM_ARGDECL long  val)
+{
+    long res = 0;
+
+    TM_BEGIN_ROT(2);
+    res = sl_lookup_htm(TM_ARG val);
+    TM_END_ID(2);
+
+    return res;
+}
+
+#else /* SKIPLIST_LOCKFREE */
+
+/* Lock-free skiplist (Fraser; Herlihy and Shavit, ch. 14): the low bit of
+   a link marks its node as removed at that level.  Removed nodes are
+   unlinked by later traversals but never freed, as there is no safe
+   memory reclamation here. */
+
+#define LOAD(p)         __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define CAS(p, o, n)    __sync_bool_compare_and_swap(&(p), (o), (n))
+
+/* -- Fills the predecessors and successors of val at every level,
+ *    unlinking marked nodes on the way; returns whether val is present */
+static int lf_find(long val, Node_SL** preds, Node_SL** succs)
+{
+	Node_SL* pred;
+	Node_SL* curr = NULL;
+	Node_SL* succ;
+	long l;
+
+retry:
+	pred = head;
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = UNMARKED(LOAD(pred->m_next[l]));
+		while (curr != NULL) {
+			succ = LOAD(curr->m_next[l]);
+			while (IS_MARKED(succ)) {
+				if (!CAS(pred->m_next[l], curr, UNMARKED(succ)))
+					goto retry;
+				curr = UNMARKED(succ);
+				if (curr == NULL)
+					break;
+				succ = LOAD(curr->m_next[l]);
+			}
+			if (curr == NULL || curr->m_val >= val)
+				break;
+			pred = curr;
+			curr = UNMARKED(succ);
+		}
+		preds[l] = pred;
+		succs[l] = curr;
+	}
+	return (curr != NULL && curr->m_val == val);
+}
+
+static long lf_insert(long val)
+{
+	Node_SL* preds[MAX_LEVEL];
+	Node_SL* succs[MAX_LEVEL];
+	long level = random_level(val);
+	Node_SL* i = NULL;
+	long l;
+
+	while (1) {
+		if (lf_find(val, preds, succs)) {
+			free(i);
+			return 0;
+		}
+		if (i == NULL)
+			i = node_alloc_seq(val, level);
+		for (l = 0; l < level; l++)
+			i->m_next[l] = succs[l];
+		// linked at the bottom level, the node is in the set
+		if (CAS(preds[0]->m_next[0], succs[0], i))
+			break;
+	}
+
+	for (l = 1; l < level; l++) {
+		while (!CAS(preds[l]->m_next[l], succs[l], i)) {
+			lf_find(val, preds, succs);
+			if (succs[0] != i)
+				return 1; // already removed again
+			Node_SL* old = LOAD(i->m_next[l]);
+			if (IS_MARKED(old) ||
+			    (old != succs[l] && !CAS(i->m_next[l], old, succs[l])))
+				return 1; // being removed
+		}
+	}
+	return 1;
+}
+
+static long lf_lookup(long val)
+{
+	Node_SL* pred = head;
+	Node_SL* curr = NULL;
+	Node_SL* succ;
+	long l;
+
+	for (l = MAX_LEVEL - 1; l >= 0; l--) {
+		curr = UNMARKED(LOAD(pred->m_next[l]));
+		while (curr != NULL) {
+			succ = LOAD(curr->m_next[l]);
+			while (IS_MARKED(succ)) {
+				curr = UNMARKED(succ);
+				if (curr == NULL)
+					break;
+				succ = LOAD(curr->m_next[l]);
+			}
+			if (curr == NULL || curr->m_val >= val)
+				break;
+			pred = curr;
+			curr = UNMARKED(succ);
+		}
+	}
+	return (curr != NULL && curr->m_val == val);
+}
+
+static int lf_remove(long val)
+{
+	Node_SL* preds[MAX_LEVEL];
+	Node_SL* succs[MAX_LEVEL];
+	Node_SL* victim;
+	Node_SL* succ;
+	long l;
+
+	if (!lf_find(val, preds, succs))
+		return 0;
+	victim = succs[0];
+
+	// mark the upper levels top-down, then the bottom level decides
+	for (l = victim->m_level - 1; l >= 1; l--) {
+		succ = LOAD(victim->m_next[l]);
+		while (!IS_MARKED(succ)) {
+			CAS(victim->m_next[l], succ, MARKED(succ));
+			succ = LOAD(victim->m_next[l]);
+		}
+	}
+	succ = LOAD(victim->m_next[0]);
+	while (!IS_MARKED(succ)) {
+		if (CAS(victim->m_next[0], succ, MARKED(succ))) {
+			lf_find(val, preds, succs); // unlink it
+			return 1;
+		}
+		succ = LOAD(victim->m_next[0]);
+	}
+	return 0; // removed by another thread
+}
+
+
+long set_add(TM_ARGDECL long val)
+{
+    return lf_insert(val);
+}
+
+int set_remove(TM_ARGDECL long val)
+{
+    return lf_remove(val);
+}
+
+long set_contains(TM_ARGDECL long  val)
+{
+    return lf_lookup(val);
+}
+
+#endif /* SKIPLIST_LOCKFREE */
+
+
+long set_add_seq(long val) {
+	sl_insert_seq(val);
+ return 1;
+}
+
+/* -- Checks the links after the run, and returns the number of values */
+static long set_check_seq()
+{
+	long size = 0;
+	long l;
+
+	for (l = 0; l < MAX_LEVEL; l++) {
+		const Node_SL* prev = head;
+		const Node_SL* curr = UNMARKED(head->m_next[l]);
+		long n = 0;
+		while (curr != NULL) {
+			const Node_SL* next = curr->m_next[l];
+			// a removed node may still be linked at this level
+			if (!IS_MARKED(next)) {
+				assert(curr->m_level > l);
+				assert(prev == head || prev->m_val < curr->m_val);
+				prev = curr;
+				n++;
+			}
+			curr = UNMARKED(next);
+		}
+		if (l == 0)
+			size = n;
+	}
+	return size;
+}
+
+  unsigned long range;
+  int update;
+  unsigned int nb_threads;
+  unsigned int seed;
+  long operations;
+
+void test(void *data)
+{
+
+  TM_THREAD_ENTER();
+
+  intset_producer_t producer;
+  intset_producer_init(&producer, seed + TM_PREFETCH_MASTER(),
+                       operations / nb_threads, range);
+  /* Helpers walk the towers of the master's next values ahead of it */
+  TM_PREFETCH_REGISTER(intset_next_op, &producer, sizeof(intset_op_t));
+  intset_op_t o;
+
+  long val = -1;
+
+  while (TM_PREFETCH_NEXT(&o)) {
+    if (o.op < update) {
+      if (val == -1) {
+        /* Add random value */
+        val = o.val;
+        /* A helper learns nothing from its regions: it expects the add
+           of its master to succeed */
+        if(set_add(TM_ARG val) == 0 && !TM_PREFETCH_HELPER()) {
+          val = -1;
+        }
+      } else {
+        /* Remove random value */
+        set_remove(TM_ARG  val);
+        val = -1;
+      }
+    } else {
+      /* Look for random value */
+      set_contains(TM_ARG o.val);
+    }
+  }
+
+  TM_THREAD_EXIT();
+}
+
+# define no_argument        0
+# define required_argument  1
+# define optional_argument  2
+
+MAIN(argc, argv) {
+    TIMER_T start;
+    TIMER_T stop;
+
+
+  struct option long_options[] = {
+    // These options don't set a flag
+    {"help",                      no_argument,       NULL, 'h'},
+    {"duration",                  required_argument, NULL, 'd'},
+    {"initial-size",              required_argument, NULL, 'i'},
+    {"num-threads",               required_argument, NULL, 'n'},
+    {"range",                     required_argument, NULL, 'r'},
+    {"seed",                      required_argument, NULL, 's'},
+    {"update-rate",               required_argument, NULL, 'u'},
+    {NULL, 0, NULL, 0}
+  };
+
+  int i, c;
+  long val;
+  operations = DEFAULT_DURATION;
+  int initial = DEFAULT_INITIAL;
+  nb_threads = DEFAULT_NB_THREADS;
+  range = DEFAULT_RANGE;
+  update = DEFAULT_UPDATE;
+
+  while(1) {
+    i = 0;
+    c = getopt_long(argc, argv, "hd:i:n:r:s:u:", long_options, &i);
+
+    if(c == -1)
+      break;
+
+    if(c == 0 && long_options[i].flag == 0)
+      c = long_options[i].val;
+
+    switch(c) {
+     case 0:
+       /* Flag is automatically set */
+       break;
+     case 'h':
+       printf("intset -- STM stress test "
+              "(skip list)\n"
+              "\n"
+              "Usage:\n"
+              "  intset [options...]\n"
+              "\n"
+              "Options:\n"
+              "  -h, --help\n"
+              "        Print this message\n"
+              "  -d, --duration <int>\n"
+              "        Number of operations, over all threads (default=" XSTR(DEFAULT_DURATION) ")\n"
+              "  -i, --initial-size <int>\n"
+              "        Number of elements to insert before test (default=" XSTR(DEFAULT_INITIAL) ")\n"
+              "  -n, --num-threads <int>\n"
+              "        Number of threads (default=" XSTR(DEFAULT_NB_THREADS) ")\n"
+              "  -r, --range <int>\n"
+              "        Range of integer values inserted in set (default=" XSTR(DEFAULT_RANGE) ")\n"
+              "  -s, --seed <int>\n"
+              "        RNG seed (0=time-based, default=" XSTR(DEFAULT_SEED) ")\n"
+              "  -u, --update-rate <int>\n"
+              "        Percentage of update transactions (default=" XSTR(DEFAULT_UPDATE) ")\n"
+         );
+       exit(0);
+     case 'd':
+       operations = atoi(optarg);
+       break;
+     case 'i':
+       initial = atoi(optarg);
+       break;
+     case 'n':
+       nb_threads = atoi(optarg);
+       break;
+     case 'r':
+       range = atoi(optarg);
+       break;
+     case 's':
+       seed = atoi(optarg);
+       break;
+     case 'u':
+       update = atoi(optarg);
+       break;
+     case '?':
+       printf("Use -h or --help for help\n");
+       exit(0);
+     default:
+       exit(1);
+    }
+  }
+
+  if (seed == 0)
+    srand((int)time(0));
+  else
+    srand(seed);
+
+
+  SIM_GET_NUM_CPU(nb_threads);
+  TM_STARTUP(nb_threads);
+  P_MEMORY_STARTUP(TM_PREFETCH_THREADS(nb_threads));
+  thread_startup(TM_PREFETCH_THREADS(nb_threads));
+
+  head = (Node_SL*) malloc(sizeof(Node_SL));
+  head->m_val = LONG_MIN;
+  head->m_level = MAX_LEVEL;
+  for (i = 0; i < MAX_LEVEL; i++) {
+    head->m_next[i] = NULL;
+  }
+
+  /* Populate set */
+  for (i = 0; i < initial; i++) {
+    val = (rand() % range) + 1;
+    set_add_seq(val);
+  }
+  printf("Added %d entries to set\n", initial);
+
+  seed = rand();
+  TIMER_READ(start);
+  GOTO_SIM();
+
+  thread_start(test, NULL);
+
+  GOTO_REAL();
+  TIMER_READ(stop);
+
+  puts("done.");
+  printf("\nTime = %0.6lf\n", TIMER_DIFF_SECONDS(start, stop));
+  printf("Set size = %ld\n", set_check_seq());
+
+  fflush(stdout);
+
+  TM_SHUTDOWN();
+  P_MEMORY_SHUTDOWN();
+  GOTO_SIM();
+  thread_shutdown();
+  MAIN_RETURN(0);
+}
@@ -334,7 +334,7 @@ sequencer_run (void* argPtr)
                                    segment);
             } /* ii */
         }
-        TM_END();
+        TM_END_ID(0);
     }
 
     thread_barrier_wait();
@@ -400,16 +400,18 @@ sequencer_run (void* argPtr)
             long j;
             ulong_t startHash;
             bool_t status;
+            long emptyIndex;
 
             /* Find an empty constructEntries entry */
             TM_BEGIN_ID(1);
-            while (((void*)TM_SHARED_READ_P(constructEntries[entryIndex].segment)) != NULL) {
-                entryIndex = (entryIndex + 1) % numUniqueSegment; /* look for empty */
+            emptyIndex = entryIndex;
+            while (((void*)TM_SHARED_READ_P(constructEntries[emptyIndex].segment)) != NULL) {
+                emptyIndex = (emptyIndex + 1) % numUniqueSegment; /* look for empty */
             }
-            constructEntryPtr = &constructEntries[entryIndex];
+            constructEntryPtr = &constructEntries[emptyIndex];
             TM_SHARED_WRITE_P(constructEntryPtr->segment, segment);
-            TM_END();
-            entryIndex = (entryIndex + 1) % numUniqueSegment;
+            TM_END_ID(1);
+            entryIndex = (emptyIndex + 1) % numUniqueSegment;
 
             /*
              * Save hashes (sdbm algorithm) of segment substrings
@@ -432,7 +434,7 @@ sequencer_run (void* argPtr)
                 status = TMTABLE_INSERT(startHashToConstructEntryTables[j],
                                         (ulong_t)startHash,
                                         (void*)constructEntryPtr );
-                TM_END();
+                TM_END_ID(2);
                 assert(status);
             }
 
@@ -445,7 +447,7 @@ sequencer_run (void* argPtr)
             status = TMTABLE_INSERT(hashToConstructEntryTable,
                                     (ulong_t)startHash,
                                     (void*)constructEntryPtr);
-            TM_END();
+            TM_END_ID(3);
             assert(status);
         }
     }
@@ -547,7 +549,7 @@ sequencer_run (void* argPtr)
                     TM_SHARED_WRITE(endConstructEntry_startPtr->length, newLength);
                 } /* if (matched) */
 
-                TM_END();
+                TM_END_ID(4);
 
                 if (!endInfoEntries[entryIndex].isEnd) { /* if there was a match */
                     break;
@@ -24,8 +24,10 @@ SRCS += \
 	$(LIB)/queue.c \
 	$(LIB)/random.c \
 	$(LIB)/rbtree.c \
+	$(LIB)/btree.c \
 	$(LIB)/hashtable.c \
 	$(LIB)/conc_hashtable.c \
+	$(LIB)/open_hashtable.c \
 	$(LIB)/thread.c \
 	$(LIB)/vector.c \
 	$(LIB)/memory.c
@@ -34,13 +36,26 @@ OBJS := ${SRCS:.c=.o}
 
 CFLAGS += -DUSE_TLH
 
-ifeq ($(enable_IBM_optimizations),yes)
+# MAP=open_hashtable keeps the fragment and attack maps in
+# lib/open_hashtable.c, MAP=btree in the B+-tree of lib/btree.c
+ifeq ($(MAP),open_hashtable)
+CFLAGS += -DMAP_USE_OPEN_HASHTABLE
+else ifeq ($(MAP),btree)
+CFLAGS += -DMAP_USE_BTREE
+else ifeq ($(enable_IBM_optimizations),yes)
 CFLAGS += -DMAP_USE_CONCUREENT_HASHTABLE -DHASHTABLE_SIZE_FIELD -DHASHTABLE_RESIZABLE
-CFLAGS += -DUSE_RBTREE_FOR_FRAGMENT_REASSEMBLE -DRBTREE_SIZE_FIELD
 else
 CFLAGS += -DMAP_USE_RBTREE
 endif
 
+# HASHTABLE_STATS=yes reports the resize work of the hash table maps
+ifeq ($(HASHTABLE_STATS),yes)
+CFLAGS += -DHASHTABLE_STATS
+endif
+ifeq ($(enable_IBM_optimizations),yes)
+CFLAGS += -DUSE_RBTREE_FOR_FRAGMENT_REASSEMBLE -DRBTREE_SIZE_FIELD
+endif
+
 RUNPARAMS := -a10 -l128 -n262144 -s1
 
 .PHONY:	run1 run2 run4 run6 run8 run12 run16 run32 run64 run128 run-16 run-32 run-64
@@ -108,7 +108,12 @@ decoder_alloc ()
     decoderPtr = (decoder_t*)malloc(sizeof(decoder_t));
     if (decoderPtr) {
 	/* Modified by Odaira begin */
+#ifdef STM
+        /* No STM thread descriptor here; STM's TM_MALLOC is malloc() anyway. */
+        decoderPtr->fragmentedMapPtr = MAP_ALLOC(NULL, NULL);
+#else
         decoderPtr->fragmentedMapPtr = TMMAP_ALLOC(NULL, NULL);
+#endif
         /*decoderPtr->fragmentedMapPtr = MAP_ALLOC(NULL, NULL);*/
 	/* Modified by Odaira end */
         assert(decoderPtr->fragmentedMapPtr);
@@ -128,8 +133,15 @@ void
 decoder_free (decoder_t* decoderPtr)
 {
     queue_free(decoderPtr->decodedQueuePtr);
+#ifdef HASHTABLE_STATS
+    MAP_PRINT_STATS(decoderPtr->fragmentedMapPtr);
+#endif
     /* Modified by Odaira begin */
+#ifdef STM
+    MAP_FREE(decoderPtr->fragmentedMapPtr);
+#else
     TMMAP_FREE(decoderPtr->fragmentedMapPtr);
+#endif
     /*MAP_FREE(decoderPtr->fragmentedMapPtr);*/
     /* Modified by Odaira end */
     free(decoderPtr);
@@ -207,7 +207,7 @@ processPackets (void* argPtr)
         char* bytes;
         TM_BEGIN_ID(0);
         bytes = TMSTREAM_GETPACKET(streamPtr);
-        TM_END();
+        TM_END_ID(0);
         if (!bytes) {
             break;
         }
@@ -220,7 +220,7 @@ processPackets (void* argPtr)
         error = TMDECODER_PROCESS(decoderPtr,
                                   bytes,
                                   (PACKET_HEADER_LENGTH + packetPtr->length));
-        TM_END();
+        TM_END_ID(1);
         if (error) {
             /*
              * Currently, stream_generate() does not create these errors.
@@ -234,7 +234,7 @@ processPackets (void* argPtr)
         long decodedFlowId;
         TM_BEGIN_ID(2);
         data = TMDECODER_GETCOMPLETE(decoderPtr, &decodedFlowId);
-        TM_END();
+        TM_END_ID(2);
         if (data) {
             error_t error = PDETECTOR_PROCESS(detectorPtr, data);
             P_FREE(data);
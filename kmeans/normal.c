@@ -86,6 +86,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <float.h>
 #include <math.h>
 #ifdef ALIGNED_ALLOC_MEMORY
@@ -178,7 +179,7 @@ work (void* argPtr)
                     (TM_SHARED_READ_F(new_centers[index][j]) + feature[i][j])
                 );
             }
-            TM_END();
+            TM_END_ID(0);
         }
 
         /* Update task queue */
@@ -186,7 +187,7 @@ work (void* argPtr)
             TM_BEGIN_ID(1);
             start = (int)TM_SHARED_READ(global_i);
             TM_SHARED_WRITE(global_i, (start + CHUNK));
-            TM_END();
+            TM_END_ID(1);
         } else {
             break;
         }
@@ -194,7 +195,7 @@ work (void* argPtr)
 
     TM_BEGIN_ID(2);
     TM_SHARED_WRITE_F(global_delta, TM_SHARED_READ_F(global_delta) + delta);
-    TM_END();
+    TM_END_ID(2);
 
     TM_THREAD_EXIT();
 }
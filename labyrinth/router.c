@@ -383,7 +383,7 @@ router_solve (void* argPtr)
         } else {
             coordinatePairPtr = (pair_t*)TMQUEUE_POP(workQueuePtr);
         }
-        TM_END();
+        TM_END_ID(0);
         if (coordinatePairPtr == NULL) {
             break;
         }
@@ -391,10 +391,12 @@ router_solve (void* argPtr)
         coordinate_t* srcPtr = coordinatePairPtr->firstPtr;
         coordinate_t* dstPtr = coordinatePairPtr->secondPtr;
 
-        bool_t success = FALSE;
-        vector_t* pointVectorPtr = NULL;
+        bool_t success;
+        vector_t* pointVectorPtr;
 
         TM_BEGIN_ID(1);
+        success = FALSE;
+        pointVectorPtr = NULL;
         grid_copy(myGridPtr, gridPtr); /* ok if not most up-to-date */
         if (PdoExpansion(routerPtr, myGridPtr, myExpansionQueuePtr,
                          srcPtr, dstPtr)) {
@@ -409,7 +411,7 @@ router_solve (void* argPtr)
                 TM_LOCAL_WRITE(success, TRUE);
             }
         }
-        TM_END();
+        TM_END_ID(1);
 
         if (success) {
             bool_t status = PVECTOR_PUSHBACK(myPathVectorPtr,
@@ -425,7 +427,7 @@ router_solve (void* argPtr)
     list_t* pathVectorListPtr = routerArgPtr->pathVectorListPtr;
     TM_BEGIN_ID(2);
     TMLIST_INSERT(pathVectorListPtr, (void*)myPathVectorPtr);
-    TM_END();
+    TM_END_ID(2);
 
     PGRID_FREE(myGridPtr);
     PQUEUE_FREE(myExpansionQueuePtr);
@@ -0,0 +1,1099 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * btree.c
+ *
+ * B+-tree ordered map.  rbtree.c allocates a node per key, so a lookup in a
+ * large tree loads a line per level, and a rebalance writes the parent,
+ * sibling and uncle of the node it fixes.  Here a node holds up to
+ * BTREE_ORDER sorted keys in BTREE_NODE_SIZE bytes: a lookup binary searches
+ * a few lines per level over a tree that is log2(BTREE_ORDER) times less
+ * deep, and the values sit next to the keys in the leaves.
+ *
+ * Updates are optimistic.  Insert descends without touching the inner
+ * nodes, and only when the leaf is full splits it and the full ancestors
+ * above it, after allocating every node the split needs.  Delete only
+ * shifts the leaf; it never merges or borrows, and a node leaves the tree
+ * only once it is empty, so most updates write a single node and their
+ * transactions conflict only with the operations on the same leaf.  This
+ * is deletion without rebalancing (Sen and Tarjan): the leaves may end up
+ * sparse, but the height stays logarithmic in the number of inserts.
+ *
+ * The TM variants read and write the nodes through TM_SHARED_READ/WRITE;
+ * the nodes a split allocates are filled before they are published and
+ * need no instrumentation.
+ *
+ * =============================================================================
+ */
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "btree.h"
+#include "tm.h"
+#include "types.h"
+
+
+#define ORDER       BTREE_ORDER
+
+/* The height is at most log2 of the number of inserts */
+#define MAX_DEPTH   64
+
+/* The largest power of 2 that divides the node size */
+#define NODE_ALIGN  (BTREE_NODE_SIZE & -BTREE_NODE_SIZE)
+
+
+static long
+compareKeysDefault (const void* a, const void* b)
+{
+    return ((long)a < (long)b ? -1 : ((long)a > (long)b));
+}
+
+
+/* =============================================================================
+ * allocNode
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+static btree_node_t*
+allocNode (long level)
+{
+    btree_node_t* nodePtr;
+
+    if (posix_memalign((void**)&nodePtr, NODE_ALIGN, sizeof(btree_node_t))) {
+        return NULL;
+    }
+    nodePtr->numKey = 0;
+    nodePtr->level = level;
+
+    return nodePtr;
+}
+
+
+/* =============================================================================
+ * TMallocNode
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+static btree_node_t*
+TMallocNode (TM_ARGDECL  long level)
+{
+    btree_node_t* nodePtr = (btree_node_t*)TM_MALLOC(sizeof(btree_node_t));
+
+    if (nodePtr == NULL) {
+        return NULL;
+    }
+    nodePtr->numKey = 0;
+    nodePtr->level = level;
+
+    return nodePtr;
+}
+
+
+/* =============================================================================
+ * freeNode
+ * -- Frees the subtree
+ * =============================================================================
+ */
+static void
+freeNode (btree_node_t* nodePtr)
+{
+    if (nodePtr->level > 0) {
+        long i;
+        for (i = 0; i <= nodePtr->numKey; i++) {
+            freeNode((btree_node_t*)nodePtr->ptrs[i]);
+        }
+    }
+    free(nodePtr);
+}
+
+
+/* =============================================================================
+ * TMfreeNode
+ * -- Frees the subtree
+ * =============================================================================
+ */
+static void
+TMfreeNode (TM_ARGDECL  btree_node_t* nodePtr)
+{
+    if ((long)TM_SHARED_READ(nodePtr->level) > 0) {
+        long numKey = (long)TM_SHARED_READ(nodePtr->numKey);
+        long i;
+        for (i = 0; i <= numKey; i++) {
+            TMfreeNode(TM_ARG  (btree_node_t*)TM_SHARED_READ_P(nodePtr->ptrs[i]));
+        }
+    }
+    TM_FREE(nodePtr);
+}
+
+
+/* =============================================================================
+ * search
+ * -- Returns the first of the numKey keys of the node that is not below key,
+ *    with bound 0, or that is above key, with bound 1; numKey if none is
+ * -- With bound 1, the index of the child of an inner node that covers key
+ * =============================================================================
+ */
+static long
+search (btree_t* btreePtr, btree_node_t* nodePtr, long numKey, void* key, long bound)
+{
+    long lo = 0;
+    long hi = numKey;
+
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (btreePtr->compare(nodePtr->keys[mid], key) < bound) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/* =============================================================================
+ * TMsearch
+ * =============================================================================
+ */
+static long
+TMsearch (TM_ARGDECL
+          btree_t* btreePtr, btree_node_t* nodePtr, long numKey, void* key, long bound)
+{
+    long lo = 0;
+    long hi = numKey;
+
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        void* midKey = (void*)TM_SHARED_READ_P(nodePtr->keys[mid]);
+        if (btreePtr->compare(midKey, key) < bound) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/* =============================================================================
+ * findLeaf
+ * -- Returns the leaf that covers key
+ * -- If path is not NULL, records the inner nodes above the leaf and the
+ *    child taken at each, and their number in *depthPtr
+ * =============================================================================
+ */
+static btree_node_t*
+findLeaf (btree_t* btreePtr, void* key,
+          btree_node_t** path, long* slots, long* depthPtr)
+{
+    btree_node_t* nodePtr = btreePtr->root;
+    long depth = 0;
+
+    while (nodePtr->level > 0) {
+        long slot = search(btreePtr, nodePtr, nodePtr->numKey, key, 1);
+        if (path != NULL) {
+            assert(depth < MAX_DEPTH);
+            path[depth] = nodePtr;
+            slots[depth] = slot;
+        }
+        depth++;
+        nodePtr = (btree_node_t*)nodePtr->ptrs[slot];
+    }
+
+    if (depthPtr != NULL) {
+        *depthPtr = depth;
+    }
+
+    return nodePtr;
+}
+
+
+/* =============================================================================
+ * TMfindLeaf
+ * =============================================================================
+ */
+static btree_node_t*
+TMfindLeaf (TM_ARGDECL  btree_t* btreePtr, void* key,
+            btree_node_t** path, long* slots, long* depthPtr)
+{
+    btree_node_t* nodePtr = (btree_node_t*)TM_SHARED_READ_P(btreePtr->root);
+    long depth = 0;
+
+    while ((long)TM_SHARED_READ(nodePtr->level) > 0) {
+        long numKey = (long)TM_SHARED_READ(nodePtr->numKey);
+        long slot = TMsearch(TM_ARG  btreePtr, nodePtr, numKey, key, 1);
+        if (path != NULL) {
+            assert(depth < MAX_DEPTH);
+            path[depth] = nodePtr;
+            slots[depth] = slot;
+        }
+        depth++;
+        nodePtr = (btree_node_t*)TM_SHARED_READ_P(nodePtr->ptrs[slot]);
+    }
+
+    if (depthPtr != NULL) {
+        *depthPtr = depth;
+    }
+
+    return nodePtr;
+}
+
+
+/* =============================================================================
+ * splitLeaf
+ * -- Inserts the pair at index i of a full leaf, and moves the upper half of
+ *    the pairs to the empty leaf rightPtr
+ * -- Returns the first key of rightPtr
+ * =============================================================================
+ */
+static void*
+splitLeaf (btree_node_t* leafPtr, btree_node_t* rightPtr, long i, void* key, void* val)
+{
+    void* keys[ORDER + 1];
+    void* vals[ORDER + 1];
+    long numLeft = (ORDER + 1) / 2;
+    long j;
+
+    for (j = 0; j < ORDER; j++) {
+        keys[j + (j >= i)] = leafPtr->keys[j];
+        vals[j + (j >= i)] = leafPtr->ptrs[j];
+    }
+    keys[i] = key;
+    vals[i] = val;
+
+    for (j = i; j < numLeft; j++) {
+        leafPtr->keys[j] = keys[j];
+        leafPtr->ptrs[j] = vals[j];
+    }
+    leafPtr->numKey = numLeft;
+
+    for (j = numLeft; j <= ORDER; j++) {
+        rightPtr->keys[j - numLeft] = keys[j];
+        rightPtr->ptrs[j - numLeft] = vals[j];
+    }
+    rightPtr->numKey = ORDER + 1 - numLeft;
+
+    return keys[numLeft];
+}
+
+
+/* =============================================================================
+ * TMsplitLeaf
+ * =============================================================================
+ */
+static void*
+TMsplitLeaf (TM_ARGDECL
+             btree_node_t* leafPtr, btree_node_t* rightPtr, long i, void* key, void* val)
+{
+    void* keys[ORDER + 1];
+    void* vals[ORDER + 1];
+    long numLeft = (ORDER + 1) / 2;
+    long j;
+
+    for (j = 0; j < ORDER; j++) {
+        keys[j + (j >= i)] = (void*)TM_SHARED_READ_P(leafPtr->keys[j]);
+        vals[j + (j >= i)] = (void*)TM_SHARED_READ_P(leafPtr->ptrs[j]);
+    }
+    keys[i] = key;
+    vals[i] = val;
+
+    for (j = i; j < numLeft; j++) {
+        TM_SHARED_WRITE_P(leafPtr->keys[j], keys[j]);
+        TM_SHARED_WRITE_P(leafPtr->ptrs[j], vals[j]);
+    }
+    TM_SHARED_WRITE(leafPtr->numKey, numLeft);
+
+    for (j = numLeft; j <= ORDER; j++) {
+        rightPtr->keys[j - numLeft] = keys[j];
+        rightPtr->ptrs[j - numLeft] = vals[j];
+    }
+    rightPtr->numKey = ORDER + 1 - numLeft;
+
+    return keys[numLeft];
+}
+
+
+/* =============================================================================
+ * splitInner
+ * -- Inserts key at index slot of a full inner node, with childPtr to its
+ *    right, and moves the keys and children above the middle key to the
+ *    empty node rightPtr
+ * -- Returns the middle key, which neither node keeps
+ * =============================================================================
+ */
+static void*
+splitInner (btree_node_t* nodePtr, btree_node_t* rightPtr,
+            long slot, void* key, btree_node_t* childPtr)
+{
+    void* keys[ORDER + 1];
+    void* ptrs[ORDER + 2];
+    long numLeft = ORDER / 2;
+    long j;
+
+    for (j = 0; j < ORDER; j++) {
+        keys[j + (j >= slot)] = nodePtr->keys[j];
+    }
+    keys[slot] = key;
+    for (j = 0; j <= ORDER; j++) {
+        ptrs[j + (j > slot)] = nodePtr->ptrs[j];
+    }
+    ptrs[slot + 1] = childPtr;
+
+    for (j = slot; j < numLeft; j++) {
+        nodePtr->keys[j] = keys[j];
+        nodePtr->ptrs[j + 1] = ptrs[j + 1];
+    }
+    nodePtr->numKey = numLeft;
+
+    for (j = numLeft + 1; j <= ORDER; j++) {
+        rightPtr->keys[j - numLeft - 1] = keys[j];
+    }
+    for (j = numLeft + 1; j <= ORDER + 1; j++) {
+        rightPtr->ptrs[j - numLeft - 1] = ptrs[j];
+    }
+    rightPtr->numKey = ORDER - numLeft;
+
+    return keys[numLeft];
+}
+
+
+/* =============================================================================
+ * TMsplitInner
+ * =============================================================================
+ */
+static void*
+TMsplitInner (TM_ARGDECL
+              btree_node_t* nodePtr, btree_node_t* rightPtr,
+              long slot, void* key, btree_node_t* childPtr)
+{
+    void* keys[ORDER + 1];
+    void* ptrs[ORDER + 2];
+    long numLeft = ORDER / 2;
+    long j;
+
+    for (j = 0; j < ORDER; j++) {
+        keys[j + (j >= slot)] = (void*)TM_SHARED_READ_P(nodePtr->keys[j]);
+    }
+    keys[slot] = key;
+    for (j = 0; j <= ORDER; j++) {
+        ptrs[j + (j > slot)] = (void*)TM_SHARED_READ_P(nodePtr->ptrs[j]);
+    }
+    ptrs[slot + 1] = childPtr;
+
+    for (j = slot; j < numLeft; j++) {
+        TM_SHARED_WRITE_P(nodePtr->keys[j], keys[j]);
+        TM_SHARED_WRITE_P(nodePtr->ptrs[j + 1], ptrs[j + 1]);
+    }
+    TM_SHARED_WRITE(nodePtr->numKey, numLeft);
+
+    for (j = numLeft + 1; j <= ORDER; j++) {
+        rightPtr->keys[j - numLeft - 1] = keys[j];
+    }
+    for (j = numLeft + 1; j <= ORDER + 1; j++) {
+        rightPtr->ptrs[j - numLeft - 1] = ptrs[j];
+    }
+    rightPtr->numKey = ORDER - numLeft;
+
+    return keys[numLeft];
+}
+
+
+/* =============================================================================
+ * removeChild
+ * -- Removes the child at index slot of an inner node, and the key that
+ *    separates it from a neighbor
+ * =============================================================================
+ */
+static void
+removeChild (btree_node_t* nodePtr, long slot)
+{
+    long numKey = nodePtr->numKey;
+    long j;
+
+    for (j = (slot > 0 ? slot : 1); j < numKey; j++) {
+        nodePtr->keys[j - 1] = nodePtr->keys[j];
+    }
+    for (j = slot + 1; j <= numKey; j++) {
+        nodePtr->ptrs[j - 1] = nodePtr->ptrs[j];
+    }
+    nodePtr->numKey = numKey - 1;
+}
+
+
+/* =============================================================================
+ * TMremoveChild
+ * =============================================================================
+ */
+static void
+TMremoveChild (TM_ARGDECL  btree_node_t* nodePtr, long slot)
+{
+    long numKey = (long)TM_SHARED_READ(nodePtr->numKey);
+    long j;
+
+    for (j = (slot > 0 ? slot : 1); j < numKey; j++) {
+        TM_SHARED_WRITE_P(nodePtr->keys[j - 1],
+                          (void*)TM_SHARED_READ_P(nodePtr->keys[j]));
+    }
+    for (j = slot + 1; j <= numKey; j++) {
+        TM_SHARED_WRITE_P(nodePtr->ptrs[j - 1],
+                          (void*)TM_SHARED_READ_P(nodePtr->ptrs[j]));
+    }
+    TM_SHARED_WRITE(nodePtr->numKey, numKey - 1);
+}
+
+
+/* =============================================================================
+ * verifyNode
+ * -- Checks the subtree against the level and the bounds its parent gives it;
+ *    a NULL bound is open
+ * -- Returns the number of keys in the subtree, or -1 if it is broken
+ * =============================================================================
+ */
+static long
+verifyNode (btree_t* btreePtr, btree_node_t* nodePtr, long level,
+            void** loPtr, void** hiPtr, long verbose)
+{
+    long numKey = nodePtr->numKey;
+    long size = 0;
+    long i;
+
+    if (nodePtr->level != level || numKey < 0 || numKey > ORDER) {
+        if (verbose) {
+            printf("btree: node at level %ld has level %ld and %ld keys\n",
+                   level, nodePtr->level, numKey);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < numKey; i++) {
+        void* key = nodePtr->keys[i];
+        if ((i > 0 && btreePtr->compare(nodePtr->keys[i - 1], key) >= 0) ||
+            (loPtr != NULL && btreePtr->compare(key, *loPtr) < 0) ||
+            (hiPtr != NULL && btreePtr->compare(key, *hiPtr) >= 0))
+        {
+            if (verbose) {
+                printf("btree: key %ld of a node at level %ld is out of order\n",
+                       i, level);
+            }
+            return -1;
+        }
+    }
+
+    if (level == 0) {
+        return numKey;
+    }
+
+    for (i = 0; i <= numKey; i++) {
+        long childSize = verifyNode(btreePtr,
+                                    (btree_node_t*)nodePtr->ptrs[i],
+                                    level - 1,
+                                    (i > 0 ? &nodePtr->keys[i - 1] : loPtr),
+                                    (i < numKey ? &nodePtr->keys[i] : hiPtr),
+                                    verbose);
+        if (childSize <= 0) {
+            if (verbose && childSize == 0) {
+                printf("btree: empty subtree at level %ld\n", level - 1);
+            }
+            return -1;
+        }
+        size += childSize;
+    }
+
+    return size;
+}
+
+
+/* =============================================================================
+ * btree_verify
+ * -- Returns the number of keys, or -1 if the tree is broken
+ * =============================================================================
+ */
+long
+btree_verify (btree_t* btreePtr, long verbose)
+{
+    btree_node_t* rootPtr = btreePtr->root;
+    long size;
+
+    if (rootPtr->level > 0 && rootPtr->numKey == 0) {
+        if (verbose) {
+            puts("btree: the root has a single child");
+        }
+        return -1;
+    }
+
+    size = verifyNode(btreePtr, rootPtr, rootPtr->level, NULL, NULL, verbose);
+    if (verbose && size >= 0) {
+        printf("btree: %ld keys, height %ld\n", size, rootPtr->level + 1);
+    }
+
+    return size;
+}
+
+
+/* =============================================================================
+ * btree_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+btree_t*
+btree_alloc (long (*compare)(const void*, const void*))
+{
+    btree_t* btreePtr = (btree_t*)malloc(sizeof(btree_t));
+
+    if (btreePtr == NULL) {
+        return NULL;
+    }
+
+    btreePtr->root = allocNode(0);
+    if (btreePtr->root == NULL) {
+        free(btreePtr);
+        return NULL;
+    }
+    btreePtr->compare = (compare ? compare : compareKeysDefault);
+
+    return btreePtr;
+}
+
+
+/* =============================================================================
+ * TMbtree_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+btree_t*
+TMbtree_alloc (TM_ARGDECL  long (*compare)(const void*, const void*))
+{
+    btree_t* btreePtr = (btree_t*)TM_MALLOC(sizeof(btree_t));
+
+    if (btreePtr == NULL) {
+        return NULL;
+    }
+
+    btreePtr->root = TMallocNode(TM_ARG  0);
+    if (btreePtr->root == NULL) {
+        TM_FREE(btreePtr);
+        return NULL;
+    }
+    btreePtr->compare = (compare ? compare : compareKeysDefault);
+
+    return btreePtr;
+}
+
+
+/* =============================================================================
+ * btree_free
+ * =============================================================================
+ */
+void
+btree_free (btree_t* btreePtr)
+{
+    freeNode(btreePtr->root);
+    free(btreePtr);
+}
+
+
+/* =============================================================================
+ * TMbtree_free
+ * =============================================================================
+ */
+void
+TMbtree_free (TM_ARGDECL  btree_t* btreePtr)
+{
+    TMfreeNode(TM_ARG  (btree_node_t*)TM_SHARED_READ_P(btreePtr->root));
+    TM_FREE(btreePtr);
+}
+
+
+/* =============================================================================
+ * btree_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+btree_insert (btree_t* btreePtr, void* key, void* val)
+{
+    btree_node_t* path[MAX_DEPTH];
+    long slots[MAX_DEPTH];
+    btree_node_t* newNodes[MAX_DEPTH + 1];
+    btree_node_t* leafPtr;
+    btree_node_t* childPtr;
+    long depth;
+    long numKey;
+    long numSplit;
+    long i;
+    long l;
+
+    leafPtr = findLeaf(btreePtr, key, path, slots, &depth);
+    numKey = leafPtr->numKey;
+    i = search(btreePtr, leafPtr, numKey, key, 0);
+    if (i < numKey && btreePtr->compare(leafPtr->keys[i], key) == 0) {
+        return FALSE;
+    }
+
+    /* Room in the leaf: the common case, which writes no other node */
+    if (numKey < ORDER) {
+        long j;
+        for (j = numKey; j > i; j--) {
+            leafPtr->keys[j] = leafPtr->keys[j - 1];
+            leafPtr->ptrs[j] = leafPtr->ptrs[j - 1];
+        }
+        leafPtr->keys[i] = key;
+        leafPtr->ptrs[i] = val;
+        leafPtr->numKey = numKey + 1;
+        return TRUE;
+    }
+
+    /* Split the leaf and its full ancestors, plus a new root if they all are */
+    numSplit = 1;
+    while (numSplit <= depth && path[depth - numSplit]->numKey == ORDER) {
+        numSplit++;
+    }
+    for (l = 0; l < numSplit + (numSplit > depth); l++) {
+        newNodes[l] = allocNode(l);
+        if (newNodes[l] == NULL) {
+            while (l-- > 0) {
+                free(newNodes[l]);
+            }
+            return FALSE;
+        }
+    }
+
+    key = splitLeaf(leafPtr, newNodes[0], i, key, val);
+    childPtr = newNodes[0];
+    for (l = 1; l <= depth; l++) {
+        btree_node_t* nodePtr = path[depth - l];
+        long slot = slots[depth - l];
+        if (l == numSplit) {
+            long j;
+            numKey = nodePtr->numKey;
+            for (j = numKey; j > slot; j--) {
+                nodePtr->keys[j] = nodePtr->keys[j - 1];
+                nodePtr->ptrs[j + 1] = nodePtr->ptrs[j];
+            }
+            nodePtr->keys[slot] = key;
+            nodePtr->ptrs[slot + 1] = childPtr;
+            nodePtr->numKey = numKey + 1;
+            return TRUE;
+        }
+        key = splitInner(nodePtr, newNodes[l], slot, key, childPtr);
+        childPtr = newNodes[l];
+    }
+
+    /* The root split */
+    newNodes[l]->keys[0] = key;
+    newNodes[l]->ptrs[0] = btreePtr->root;
+    newNodes[l]->ptrs[1] = childPtr;
+    newNodes[l]->numKey = 1;
+    btreePtr->root = newNodes[l];
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * TMbtree_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+TMbtree_insert (TM_ARGDECL  btree_t* btreePtr, void* key, void* val)
+{
+    btree_node_t* path[MAX_DEPTH];
+    long slots[MAX_DEPTH];
+    btree_node_t* newNodes[MAX_DEPTH + 1];
+    btree_node_t* leafPtr;
+    btree_node_t* childPtr;
+    long depth;
+    long numKey;
+    long numSplit;
+    long i;
+    long l;
+
+    leafPtr = TMfindLeaf(TM_ARG  btreePtr, key, path, slots, &depth);
+    numKey = (long)TM_SHARED_READ(leafPtr->numKey);
+    i = TMsearch(TM_ARG  btreePtr, leafPtr, numKey, key, 0);
+    if (i < numKey &&
+        btreePtr->compare((void*)TM_SHARED_READ_P(leafPtr->keys[i]), key) == 0)
+    {
+        return FALSE;
+    }
+
+    /* Room in the leaf: the common case, which writes no other node */
+    if (numKey < ORDER) {
+        long j;
+        for (j = numKey; j > i; j--) {
+            TM_SHARED_WRITE_P(leafPtr->keys[j],
+                              (void*)TM_SHARED_READ_P(leafPtr->keys[j - 1]));
+            TM_SHARED_WRITE_P(leafPtr->ptrs[j],
+                              (void*)TM_SHARED_READ_P(leafPtr->ptrs[j - 1]));
+        }
+        TM_SHARED_WRITE_P(leafPtr->keys[i], key);
+        TM_SHARED_WRITE_P(leafPtr->ptrs[i], val);
+        TM_SHARED_WRITE(leafPtr->numKey, numKey + 1);
+        return TRUE;
+    }
+
+    /* Split the leaf and its full ancestors, plus a new root if they all are */
+    numSplit = 1;
+    while (numSplit <= depth &&
+           (long)TM_SHARED_READ(path[depth - numSplit]->numKey) == ORDER)
+    {
+        numSplit++;
+    }
+    for (l = 0; l < numSplit + (numSplit > depth); l++) {
+        newNodes[l] = TMallocNode(TM_ARG  l);
+        if (newNodes[l] == NULL) {
+            while (l-- > 0) {
+                TM_FREE(newNodes[l]);
+            }
+            return FALSE;
+        }
+    }
+
+    key = TMsplitLeaf(TM_ARG  leafPtr, newNodes[0], i, key, val);
+    childPtr = newNodes[0];
+    for (l = 1; l <= depth; l++) {
+        btree_node_t* nodePtr = path[depth - l];
+        long slot = slots[depth - l];
+        if (l == numSplit) {
+            long j;
+            numKey = (long)TM_SHARED_READ(nodePtr->numKey);
+            for (j = numKey; j > slot; j--) {
+                TM_SHARED_WRITE_P(nodePtr->keys[j],
+                                  (void*)TM_SHARED_READ_P(nodePtr->keys[j - 1]));
+                TM_SHARED_WRITE_P(nodePtr->ptrs[j + 1],
+                                  (void*)TM_SHARED_READ_P(nodePtr->ptrs[j]));
+            }
+            TM_SHARED_WRITE_P(nodePtr->keys[slot], key);
+            TM_SHARED_WRITE_P(nodePtr->ptrs[slot + 1], (void*)childPtr);
+            TM_SHARED_WRITE(nodePtr->numKey, numKey + 1);
+            return TRUE;
+        }
+        key = TMsplitInner(TM_ARG  nodePtr, newNodes[l], slot, key, childPtr);
+        childPtr = newNodes[l];
+    }
+
+    /* The root split */
+    newNodes[l]->keys[0] = key;
+    newNodes[l]->ptrs[0] = (void*)TM_SHARED_READ_P(btreePtr->root);
+    newNodes[l]->ptrs[1] = childPtr;
+    newNodes[l]->numKey = 1;
+    TM_SHARED_WRITE_P(btreePtr->root, newNodes[l]);
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * btree_delete
+ * -- Returns FALSE if the key is not present
+ * =============================================================================
+ */
+bool_t
+btree_delete (btree_t* btreePtr, void* key)
+{
+    btree_node_t* path[MAX_DEPTH];
+    long slots[MAX_DEPTH];
+    btree_node_t* nodePtr;
+    btree_node_t* parentPtr;
+    long depth;
+    long numKey;
+    long i;
+
+    nodePtr = findLeaf(btreePtr, key, path, slots, &depth);
+    numKey = nodePtr->numKey;
+    i = search(btreePtr, nodePtr, numKey, key, 0);
+    if (i == numKey || btreePtr->compare(nodePtr->keys[i], key) != 0) {
+        return FALSE;
+    }
+
+    for (i++; i < numKey; i++) {
+        nodePtr->keys[i - 1] = nodePtr->keys[i];
+        nodePtr->ptrs[i - 1] = nodePtr->ptrs[i];
+    }
+    nodePtr->numKey = numKey - 1;
+    if (numKey > 1 || depth == 0) {
+        return TRUE;
+    }
+
+    /*
+     * The leaf is empty: unlink it, and the ancestors that only had it.  The
+     * root always has two children, so one of the ancestors keeps some.
+     */
+    do {
+        depth--;
+        parentPtr = path[depth];
+        free(nodePtr);
+        nodePtr = parentPtr;
+    } while (parentPtr->numKey == 0);
+    removeChild(parentPtr, slots[depth]);
+
+    /* The root lost its second child */
+    if (depth == 0) {
+        while (parentPtr->level > 0 && parentPtr->numKey == 0) {
+            nodePtr = parentPtr;
+            parentPtr = (btree_node_t*)nodePtr->ptrs[0];
+            free(nodePtr);
+        }
+        btreePtr->root = parentPtr;
+    }
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * TMbtree_delete
+ * -- Returns FALSE if the key is not present
+ * =============================================================================
+ */
+bool_t
+TMbtree_delete (TM_ARGDECL  btree_t* btreePtr, void* key)
+{
+    btree_node_t* path[MAX_DEPTH];
+    long slots[MAX_DEPTH];
+    btree_node_t* nodePtr;
+    btree_node_t* parentPtr;
+    long depth;
+    long numKey;
+    long i;
+
+    nodePtr = TMfindLeaf(TM_ARG  btreePtr, key, path, slots, &depth);
+    numKey = (long)TM_SHARED_READ(nodePtr->numKey);
+    i = TMsearch(TM_ARG  btreePtr, nodePtr, numKey, key, 0);
+    if (i == numKey ||
+        btreePtr->compare((void*)TM_SHARED_READ_P(nodePtr->keys[i]), key) != 0)
+    {
+        return FALSE;
+    }
+
+    for (i++; i < numKey; i++) {
+        TM_SHARED_WRITE_P(nodePtr->keys[i - 1],
+                          (void*)TM_SHARED_READ_P(nodePtr->keys[i]));
+        TM_SHARED_WRITE_P(nodePtr->ptrs[i - 1],
+                          (void*)TM_SHARED_READ_P(nodePtr->ptrs[i]));
+    }
+    TM_SHARED_WRITE(nodePtr->numKey, numKey - 1);
+    if (numKey > 1 || depth == 0) {
+        return TRUE;
+    }
+
+    /*
+     * The leaf is empty: unlink it, and the ancestors that only had it.  The
+     * root always has two children, so one of the ancestors keeps some.
+     */
+    do {
+        depth--;
+        parentPtr = path[depth];
+        TM_FREE(nodePtr);
+        nodePtr = parentPtr;
+    } while ((long)TM_SHARED_READ(parentPtr->numKey) == 0);
+    TMremoveChild(TM_ARG  parentPtr, slots[depth]);
+
+    /* The root lost its second child */
+    if (depth == 0) {
+        while ((long)TM_SHARED_READ(parentPtr->level) > 0 &&
+               (long)TM_SHARED_READ(parentPtr->numKey) == 0)
+        {
+            nodePtr = parentPtr;
+            parentPtr = (btree_node_t*)TM_SHARED_READ_P(nodePtr->ptrs[0]);
+            TM_FREE(nodePtr);
+        }
+        TM_SHARED_WRITE_P(btreePtr->root, parentPtr);
+    }
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * btree_get
+ * -- Returns NULL if the key is not present
+ * =============================================================================
+ */
+void*
+btree_get (btree_t* btreePtr, void* key)
+{
+    btree_node_t* leafPtr = findLeaf(btreePtr, key, NULL, NULL, NULL);
+    long numKey = leafPtr->numKey;
+    long i = search(btreePtr, leafPtr, numKey, key, 0);
+
+    if (i < numKey && btreePtr->compare(leafPtr->keys[i], key) == 0) {
+        return leafPtr->ptrs[i];
+    }
+
+    return NULL;
+}
+
+
+/* =============================================================================
+ * TMbtree_get
+ * -- Returns NULL if the key is not present
+ * =============================================================================
+ */
+void*
+TMbtree_get (TM_ARGDECL  btree_t* btreePtr, void* key)
+{
+    btree_node_t* leafPtr = TMfindLeaf(TM_ARG  btreePtr, key, NULL, NULL, NULL);
+    long numKey = (long)TM_SHARED_READ(leafPtr->numKey);
+    long i = TMsearch(TM_ARG  btreePtr, leafPtr, numKey, key, 0);
+
+    if (i < numKey &&
+        btreePtr->compare((void*)TM_SHARED_READ_P(leafPtr->keys[i]), key) == 0)
+    {
+        return (void*)TM_SHARED_READ_P(leafPtr->ptrs[i]);
+    }
+
+    return NULL;
+}
+
+
+/* =============================================================================
+ * btree_contains
+ * =============================================================================
+ */
+bool_t
+btree_contains (btree_t* btreePtr, void* key)
+{
+    btree_node_t* leafPtr = findLeaf(btreePtr, key, NULL, NULL, NULL);
+    long numKey = leafPtr->numKey;
+    long i = search(btreePtr, leafPtr, numKey, key, 0);
+
+    return (i < numKey && btreePtr->compare(leafPtr->keys[i], key) == 0);
+}
+
+
+/* =============================================================================
+ * TMbtree_contains
+ * =============================================================================
+ */
+bool_t
+TMbtree_contains (TM_ARGDECL  btree_t* btreePtr, void* key)
+{
+    btree_node_t* leafPtr = TMfindLeaf(TM_ARG  btreePtr, key, NULL, NULL, NULL);
+    long numKey = (long)TM_SHARED_READ(leafPtr->numKey);
+    long i = TMsearch(TM_ARG  btreePtr, leafPtr, numKey, key, 0);
+
+    return (i < numKey &&
+            btreePtr->compare((void*)TM_SHARED_READ_P(leafPtr->keys[i]), key) == 0);
+}
+
+
+/* =============================================================================
+ * TEST_BTREE
+ * =============================================================================
+ */
+#ifdef TEST_BTREE
+
+
+#define NUM_KEY 20000
+
+
+static long
+compare (const void* a, const void* b)
+{
+    return (*(long*)a - *(long*)b);
+}
+
+
+static void
+testTree (btree_t* btreePtr, long* keys)
+{
+    long i;
+
+    assert(btree_verify(btreePtr, 0) == 0);
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(btree_insert(btreePtr, &keys[i], &keys[i]));
+        assert(!btree_insert(btreePtr, &keys[i], &keys[i]));
+    }
+    assert(btree_verify(btreePtr, 1) == NUM_KEY);
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(*(long*)btree_get(btreePtr, &keys[i]) == keys[i]);
+    }
+
+    /* Thin out every leaf, then empty whole ranges of them */
+    for (i = 0; i < NUM_KEY; i += 2) {
+        assert(btree_delete(btreePtr, &keys[i]));
+        assert(!btree_delete(btreePtr, &keys[i]));
+    }
+    assert(btree_verify(btreePtr, 1) == NUM_KEY / 2);
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(btree_contains(btreePtr, &keys[i]) == (i & 1));
+    }
+    for (i = 1; i < NUM_KEY / 2; i += 2) {
+        assert(btree_delete(btreePtr, &keys[i]));
+    }
+    assert(btree_verify(btreePtr, 1) == NUM_KEY / 4);
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(btree_insert(btreePtr, &keys[i], &keys[i]) ==
+               ((i & 1) == 0 || i < NUM_KEY / 2));
+    }
+    assert(btree_verify(btreePtr, 1) == NUM_KEY);
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(btree_delete(btreePtr, &keys[i]));
+        assert(btree_get(btreePtr, &keys[i]) == NULL);
+    }
+    assert(btree_verify(btreePtr, 1) == 0);
+    assert(btreePtr->root->level == 0);
+}
+
+
+int
+main ()
+{
+    btree_t* btreePtr;
+    static long keys[NUM_KEY];
+    long i;
+
+    puts("Starting...");
+    printf("%ld keys per %ld-byte node\n", (long)ORDER, (long)sizeof(btree_node_t));
+
+    /* Sorted, reversed and scattered */
+    btreePtr = btree_alloc(&compare);
+    for (i = 0; i < NUM_KEY; i++) {
+        keys[i] = i;
+    }
+    testTree(btreePtr, keys);
+    for (i = 0; i < NUM_KEY; i++) {
+        keys[i] = NUM_KEY - i;
+    }
+    testTree(btreePtr, keys);
+    for (i = 0; i < NUM_KEY; i++) {
+        keys[i] = (i * 7919) % NUM_KEY;
+    }
+    testTree(btreePtr, keys);
+    btree_free(btreePtr);
+
+    /* Default compare: the key pointers themselves */
+    btreePtr = btree_alloc(NULL);
+    for (i = 1; i <= NUM_KEY; i++) {
+        assert(btree_insert(btreePtr, (void*)i, (void*)(i * 2)));
+    }
+    for (i = 1; i <= NUM_KEY; i++) {
+        assert((long)btree_get(btreePtr, (void*)i) == i * 2);
+    }
+    assert(btree_verify(btreePtr, 0) == NUM_KEY);
+    btree_free(btreePtr);
+
+    puts("Done.");
+
+    return 0;
+}
+
+
+#endif /* TEST_BTREE */
+
+
+/* =============================================================================
+ *
+ * End of btree.c
+ *
+ * =============================================================================
+ */
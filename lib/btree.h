@@ -0,0 +1,191 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * btree.h
+ *
+ * B+-tree ordered map, see btree.c.  Same interface as rbtree.h, selected
+ * for MAP_T by MAP_USE_BTREE (map.h).
+ *
+ * =============================================================================
+ */
+
+#ifndef BTREE_H
+#define BTREE_H 1
+
+
+#include "tm.h"
+#include "types.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Bytes per node: 256 by default, 128 fits a node into one POWER line */
+#ifndef BTREE_NODE_SIZE
+#  define BTREE_NODE_SIZE 256
+#endif
+
+/* Keys per node: the node header and the last child pointer take 3 words */
+#define BTREE_ORDER ((BTREE_NODE_SIZE / 8 - 3) / 2)
+
+#if BTREE_ORDER < 3
+#  error BTREE_NODE_SIZE must be at least 72
+#endif
+
+typedef struct btree_node {
+    long numKey;
+    long level; /* 0 for a leaf */
+    void* keys[BTREE_ORDER];
+    /* The children of an inner node, the values of a leaf */
+    void* ptrs[BTREE_ORDER + 1];
+} btree_node_t;
+
+typedef struct btree {
+    btree_node_t* root;
+    long (*compare)(const void*, const void*);
+    /* compare should return <0 if before, 0 if equal, >0 if after */
+} btree_t;
+
+
+/* =============================================================================
+ * btree_verify
+ * -- Returns the number of keys, or -1 if the tree is broken
+ * =============================================================================
+ */
+long
+btree_verify (btree_t* btreePtr, long verbose);
+
+
+/* =============================================================================
+ * btree_alloc
+ * -- Returns NULL on failure
+ * -- NULL compare compares the key pointers themselves
+ * =============================================================================
+ */
+btree_t*
+btree_alloc (long (*compare)(const void*, const void*));
+
+
+/* =============================================================================
+ * TMbtree_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+btree_t*
+TMbtree_alloc (TM_ARGDECL  long (*compare)(const void*, const void*));
+
+
+/* =============================================================================
+ * btree_free
+ * =============================================================================
+ */
+void
+btree_free (btree_t* btreePtr);
+
+
+/* =============================================================================
+ * TMbtree_free
+ * =============================================================================
+ */
+void
+TMbtree_free (TM_ARGDECL  btree_t* btreePtr);
+
+
+/* =============================================================================
+ * btree_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+btree_insert (btree_t* btreePtr, void* key, void* val);
+
+
+/* =============================================================================
+ * TMbtree_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+TM_CALLABLE
+bool_t
+TMbtree_insert (TM_ARGDECL  btree_t* btreePtr, void* key, void* val);
+
+
+/* =============================================================================
+ * btree_delete
+ * -- Returns FALSE if the key is not present
+ * =============================================================================
+ */
+bool_t
+btree_delete (btree_t* btreePtr, void* key);
+
+
+/* =============================================================================
+ * TMbtree_delete
+ * -- Returns FALSE if the key is not present
+ * =============================================================================
+ */
+TM_CALLABLE
+bool_t
+TMbtree_delete (TM_ARGDECL  btree_t* btreePtr, void* key);
+
+
+/* =============================================================================
+ * btree_get
+ * -- Returns NULL if the key is not present
+ * =============================================================================
+ */
+void*
+btree_get (btree_t* btreePtr, void* key);
+
+
+/* =============================================================================
+ * TMbtree_get
+ * -- Returns NULL if the key is not present
+ * =============================================================================
+ */
+TM_CALLABLE
+void*
+TMbtree_get (TM_ARGDECL  btree_t* btreePtr, void* key);
+
+
+/* =============================================================================
+ * btree_contains
+ * =============================================================================
+ */
+bool_t
+btree_contains (btree_t* btreePtr, void* key);
+
+
+/* =============================================================================
+ * TMbtree_contains
+ * =============================================================================
+ */
+TM_CALLABLE
+bool_t
+TMbtree_contains (TM_ARGDECL  btree_t* btreePtr, void* key);
+
+
+#define TMBTREE_ALLOC(c)          TMbtree_alloc(TM_ARG  c)
+#define TMBTREE_FREE(b)           TMbtree_free(TM_ARG  b)
+#define TMBTREE_INSERT(b, k, v)   TMbtree_insert(TM_ARG  b, (void*)(k), (void*)(v))
+#define TMBTREE_DELETE(b, k)      TMbtree_delete(TM_ARG  b, (void*)(k))
+#define TMBTREE_GET(b, k)         TMbtree_get(TM_ARG  b, (void*)(k))
+#define TMBTREE_CONTAINS(b, k)    TMbtree_contains(TM_ARG  b, (void*)(k))
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* BTREE_H */
+
+
+/* =============================================================================
+ *
+ * End of btree.h
+ *
+ * =============================================================================
+ */
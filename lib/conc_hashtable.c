@@ -1,7 +1,10 @@
-/* Copyright (c) IBM Corp. 2014. */
+/* Copyright (c) IBM Corp. 2014, and others. */
+#include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "conc_hashtable.h"
+#include "thread.h"
 #include "types.h"
 
 #ifdef HAVE_CONFIG_H
@@ -20,10 +23,33 @@
 #define CACHE_LINE_SIZE 32
 #endif
 
-#define ALIGNED_HASHTABLE_SIZE ((sizeof(hashtable_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1))
+/* Segments per thread, rounded up to a power of two */
+#ifndef CONC_HASHTABLE_SEGMENTS_PER_THREAD
+#define CONC_HASHTABLE_SEGMENTS_PER_THREAD 4
+#endif
+
+/* Inserts less removes a thread counts on its own for a segment before
+   adding them to the segment's size */
+#ifndef CONC_HASHTABLE_SIZE_SLACK
+#define CONC_HASHTABLE_SIZE_SLACK 16
+#endif
+
+/* The size is the segment's count of pairs, less the counts the threads
+   still hold in sizeDeltas; it only decides when the segment grows, so
+   the hashtable_t's own size field is not used */
+typedef struct segment {
+    hashtable_t table;
+    long size;
+} segment_t;
+
+#define ALIGNED_SEGMENT_SIZE ((sizeof(segment_t) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1))
+
+#define GET_SEGMENT(seg, idx) ((segment_t *)((char *)(seg) + ALIGNED_SEGMENT_SIZE * (idx)))
 
-#define NUM_SEGMENTS 31
-#define GET_SEGMENT(seg, idx) ((hashtable_t *)((char *)(seg) + ALIGNED_HASHTABLE_SIZE * (idx)))
+/* -- Picked from the high bits of a multiplicative hash: the low bits of
+ *    the hash choose the bucket inside the segment */
+#define SEGMENT_INDEX(conc, hash) \
+    ((long)(((uint64_t)(hash) * 0x9E3779B97F4A7C15ULL) >> 32) & (conc)->segmentMask)
 
 static ulong_t
 hashKeyDefault(const void *a)
@@ -37,6 +63,134 @@ comparePairsDefault (const pair_t* a, const pair_t* b)
     return ((long)(a->firstPtr) - (long)(b->firstPtr));
 }
 
+/* -- Everything but the segments' buckets; the segments are left for the
+ *    caller to initialize
+ */
+static conc_hashtable_t*
+allocTable (ulong_t (*hash)(const void*))
+{
+    conc_hashtable_t *concHashtablePtr;
+    char *segmentsUnaligned;
+    long *sizeDeltasUnaligned;
+    long numThread = thread_getNumThread();
+    long numSegment = 1;
+    long stride;
+
+    while (numSegment < CONC_HASHTABLE_SEGMENTS_PER_THREAD * numThread) {
+	numSegment <<= 1;
+    }
+    /* A cache line (or more) of counts per thread */
+    stride = ((numSegment * sizeof(long) + CACHE_LINE_SIZE - 1) &
+	      ~(CACHE_LINE_SIZE - 1)) / sizeof(long);
+
+    /* This will be freed only by (TM)conc_hashtable_free(),
+       so it can be allocated by malloc(), not TM_MALLOC(). */
+    concHashtablePtr = (conc_hashtable_t *)malloc(sizeof(conc_hashtable_t));
+    if (concHashtablePtr == NULL) {
+	return NULL;
+    }
+
+    segmentsUnaligned = (char *)malloc(sizeof(char) * ALIGNED_SEGMENT_SIZE * numSegment + CACHE_LINE_SIZE);
+    sizeDeltasUnaligned = (long *)calloc(1, sizeof(long) * stride * numThread + CACHE_LINE_SIZE);
+    if (segmentsUnaligned == NULL || sizeDeltasUnaligned == NULL) {
+	free(segmentsUnaligned);
+	free(sizeDeltasUnaligned);
+	free(concHashtablePtr);
+	return NULL;
+    }
+
+    concHashtablePtr->hash = hash;
+    concHashtablePtr->numSegment = numSegment;
+    concHashtablePtr->segmentMask = numSegment - 1;
+    concHashtablePtr->segmentsUnaligned = segmentsUnaligned;
+    concHashtablePtr->segments =
+	(char *)(((uintptr_t)segmentsUnaligned + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+    concHashtablePtr->numSizeDelta = numThread;
+    concHashtablePtr->sizeDeltaStride = stride;
+    concHashtablePtr->sizeDeltasUnaligned = sizeDeltasUnaligned;
+    concHashtablePtr->sizeDeltas =
+	(long *)(((uintptr_t)sizeDeltasUnaligned + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+
+    return concHashtablePtr;
+}
+
+static void
+freeTable (conc_hashtable_t* concHashtablePtr)
+{
+    free(concHashtablePtr->segmentsUnaligned);
+    free(concHashtablePtr->sizeDeltasUnaligned);
+    free(concHashtablePtr);
+}
+
+/* -- Returns this thread's count for segment s, or NULL for a thread that
+ *    did not exist when the table was allocated, which counts in the
+ *    segment's size directly
+ */
+static long*
+getSizeDelta (conc_hashtable_t* concHashtablePtr, long s)
+{
+    long id = thread_getId();
+
+    if (id >= concHashtablePtr->numSizeDelta) {
+	return NULL;
+    }
+    return &concHashtablePtr->sizeDeltas[id * concHashtablePtr->sizeDeltaStride + s];
+}
+
+static void
+addSize (conc_hashtable_t* concHashtablePtr, long s, long delta)
+{
+    segment_t *segmentPtr = GET_SEGMENT(concHashtablePtr->segments, s);
+    long *deltaPtr = getSizeDelta(concHashtablePtr, s);
+
+    if (deltaPtr != NULL) {
+	delta += *deltaPtr;
+	if (delta > -CONC_HASHTABLE_SIZE_SLACK && delta < CONC_HASHTABLE_SIZE_SLACK) {
+	    *deltaPtr = delta;
+	    return;
+	}
+	*deltaPtr = 0;
+    }
+    segmentPtr->size += delta;
+}
+
+static void
+TMaddSize (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, long s, long delta)
+{
+    segment_t *segmentPtr = GET_SEGMENT(concHashtablePtr->segments, s);
+    long *deltaPtr = getSizeDelta(concHashtablePtr, s);
+
+    /* The counts of a thread share no cache line with other threads' */
+    if (deltaPtr != NULL) {
+	delta += (long)TM_SHARED_READ(*deltaPtr);
+	if (delta > -CONC_HASHTABLE_SIZE_SLACK && delta < CONC_HASHTABLE_SIZE_SLACK) {
+	    TM_SHARED_WRITE(*deltaPtr, delta);
+	    return;
+	}
+	TM_SHARED_WRITE(*deltaPtr, 0);
+    }
+    TM_SHARED_WRITE(segmentPtr->size, (long)TM_SHARED_READ(segmentPtr->size) + delta);
+}
+
+/* -- Returns the size of segment s as this thread sees it */
+static long
+getSize (conc_hashtable_t* concHashtablePtr, long s)
+{
+    long *deltaPtr = getSizeDelta(concHashtablePtr, s);
+
+    return (GET_SEGMENT(concHashtablePtr->segments, s)->size +
+	    ((deltaPtr != NULL) ? *deltaPtr : 0));
+}
+
+static long
+TMgetSize (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, long s)
+{
+    long *deltaPtr = getSizeDelta(concHashtablePtr, s);
+
+    return ((long)TM_SHARED_READ(GET_SEGMENT(concHashtablePtr->segments, s)->size) +
+	    ((deltaPtr != NULL) ? (long)TM_SHARED_READ(*deltaPtr) : 0));
+}
+
 conc_hashtable_t*
 conc_hashtable_alloc (long initNumBucket,
 		      ulong_t (*hash)(const void*),
@@ -45,9 +199,7 @@ conc_hashtable_alloc (long initNumBucket,
 		      long growthFactor)
 {
     conc_hashtable_t *concHashtablePtr;
-    char *segmentsUnaligned;
-    char *segments;
-    int s;
+    long s;
 
     if (hash == NULL) {
 	hash = hashKeyDefault;
@@ -56,26 +208,17 @@ conc_hashtable_alloc (long initNumBucket,
 	comparePairs = comparePairsDefault;
     }
 
-    concHashtablePtr = (conc_hashtable_t *)malloc(sizeof(conc_hashtable_t));
+    concHashtablePtr = allocTable(hash);
     if (concHashtablePtr == NULL) {
 	return NULL;
     }
 
-    concHashtablePtr->hash = hash;
-
-    segmentsUnaligned = (char *)malloc(sizeof(char) * ALIGNED_HASHTABLE_SIZE * NUM_SEGMENTS + CACHE_LINE_SIZE);
-    if (segmentsUnaligned == NULL) {
-	return NULL;
-    }
-    segments = (char *)(((uintptr_t)segmentsUnaligned + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
-
-    concHashtablePtr->segmentsUnaligned = segmentsUnaligned;
-    concHashtablePtr->segments = segments;
-
-    for (s = 0; s < NUM_SEGMENTS; s++) {
-	if (hashtable_init(GET_SEGMENT(segments, s),
+    for (s = 0; s < concHashtablePtr->numSegment; s++) {
+	segment_t *segmentPtr = GET_SEGMENT(concHashtablePtr->segments, s);
+	segmentPtr->size = 0;
+	if (hashtable_init(&segmentPtr->table,
 			   initNumBucket, hash, comparePairs, resizeRatio, growthFactor)) {
-	    free(concHashtablePtr);
+	    freeTable(concHashtablePtr);
 	    return NULL;
 	}
     }
@@ -86,43 +229,67 @@ conc_hashtable_alloc (long initNumBucket,
 void
 conc_hashtable_free (conc_hashtable_t* concHashtablePtr)
 {
-    int s;
+    long s;
 
-    for (s = 0; s < NUM_SEGMENTS; s++) {
-	hashtable_free_buckets(GET_SEGMENT(concHashtablePtr->segments, s));
+    for (s = 0; s < concHashtablePtr->numSegment; s++) {
+	hashtable_free_buckets(&GET_SEGMENT(concHashtablePtr->segments, s)->table);
     }
 
-    free(concHashtablePtr->segmentsUnaligned);
-    free(concHashtablePtr);
+    freeTable(concHashtablePtr);
 }
 
 bool_t
 conc_hashtable_containsKey (conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return hashtable_containsKey(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+    return hashtable_containsKey(&GET_SEGMENT(concHashtablePtr->segments, s)->table, keyPtr);
 }
 
 
 void*
 conc_hashtable_find (conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return hashtable_find(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+    return hashtable_find(&GET_SEGMENT(concHashtablePtr->segments, s)->table, keyPtr);
 }
 
 bool_t
 conc_hashtable_insert (conc_hashtable_t* concHashtablePtr, void* keyPtr, void* dataPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return hashtable_insert(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr, dataPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+
+    if (!hashtable_insertUncounted(&GET_SEGMENT(concHashtablePtr->segments, s)->table,
+				   keyPtr, dataPtr, getSize(concHashtablePtr, s))) {
+	return FALSE;
+    }
+    addSize(concHashtablePtr, s, 1);
+    return TRUE;
 }
 
 bool_t
 conc_hashtable_remove (conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return hashtable_remove(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+
+    if (!hashtable_removeUncounted(&GET_SEGMENT(concHashtablePtr->segments, s)->table,
+				   keyPtr)) {
+	return FALSE;
+    }
+    addSize(concHashtablePtr, s, -1);
+    return TRUE;
+}
+
+void
+conc_hashtable_printStats (conc_hashtable_t* concHashtablePtr)
+{
+    hashtable_t sum;
+    long s;
+
+    memset(&sum, 0, sizeof(sum));
+    for (s = 0; s < concHashtablePtr->numSegment; s++) {
+	hashtable_addStats(&sum, &GET_SEGMENT(concHashtablePtr->segments, s)->table);
+    }
+    hashtable_printStats(&sum);
 }
 
 
@@ -135,9 +302,7 @@ TMconc_hashtable_alloc (TM_ARGDECL  long initNumBucket,
 			long growthFactor)
 {
     conc_hashtable_t *concHashtablePtr;
-    char *segmentsUnaligned;
-    char *segments;
-    int s;
+    long s;
 
     if (hash == NULL) {
 	hash = hashKeyDefault;
@@ -146,30 +311,17 @@ TMconc_hashtable_alloc (TM_ARGDECL  long initNumBucket,
 	comparePairs = comparePairsDefault;
     }
 
-    /* This will be freed only by TMconc_hashtable_free(),
-       so it can be allocated by malloc(), not TM_MALLOC(). */
-    concHashtablePtr = (conc_hashtable_t *)malloc(sizeof(conc_hashtable_t));
+    concHashtablePtr = allocTable(hash);
     if (concHashtablePtr == NULL) {
 	return NULL;
     }
 
-    concHashtablePtr->hash = hash;
-
-    /* This will be freed only by TMconc_hashtable_free(),
-       so it can be allocated by malloc(), not TM_MALLOC(). */
-    segmentsUnaligned = (char *)malloc(sizeof(char) * ALIGNED_HASHTABLE_SIZE * NUM_SEGMENTS + CACHE_LINE_SIZE);
-    if (segmentsUnaligned == NULL) {
-	return NULL;
-    }
-    segments = (char *)(((uintptr_t)segmentsUnaligned + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
-
-    concHashtablePtr->segmentsUnaligned = segmentsUnaligned;
-    concHashtablePtr->segments = segments;
-
-    for (s = 0; s < NUM_SEGMENTS; s++) {
-	if (TMhashtable_init(TM_ARG  GET_SEGMENT(segments, s),
+    for (s = 0; s < concHashtablePtr->numSegment; s++) {
+	segment_t *segmentPtr = GET_SEGMENT(concHashtablePtr->segments, s);
+	segmentPtr->size = 0;
+	if (TMhashtable_init(TM_ARG  &segmentPtr->table,
 			     initNumBucket, hash, comparePairs, resizeRatio, growthFactor)) {
-	    free(concHashtablePtr);
+	    freeTable(concHashtablePtr);
 	    return NULL;
 	}
     }
@@ -180,41 +332,53 @@ TMconc_hashtable_alloc (TM_ARGDECL  long initNumBucket,
 void
 TMconc_hashtable_free (TM_ARGDECL  conc_hashtable_t* concHashtablePtr)
 {
-    int s;
+    long s;
 
-    for (s = 0; s < NUM_SEGMENTS; s++) {
-	TMhashtable_free_buckets(TM_ARG  GET_SEGMENT(concHashtablePtr->segments, s));
+    for (s = 0; s < concHashtablePtr->numSegment; s++) {
+	TMhashtable_free_buckets(TM_ARG  &GET_SEGMENT(concHashtablePtr->segments, s)->table);
     }
 
-    free(concHashtablePtr->segmentsUnaligned);
-    free(concHashtablePtr);
+    freeTable(concHashtablePtr);
 }
 
 bool_t
 TMconc_hashtable_containsKey (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return TMhashtable_containsKey(TM_ARG  GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+    return TMhashtable_containsKey(TM_ARG  &GET_SEGMENT(concHashtablePtr->segments, s)->table, keyPtr);
 }
 
 
 void*
 TMconc_hashtable_find (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return TMHASHTABLE_FIND(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+    return TMHASHTABLE_FIND(&GET_SEGMENT(concHashtablePtr->segments, s)->table, keyPtr);
 }
 
 bool_t
 TMconc_hashtable_insert (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, void* keyPtr, void* dataPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return TMHASHTABLE_INSERT(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr, dataPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+
+    if (!TMHASHTABLE_INSERTUNCOUNTED(&GET_SEGMENT(concHashtablePtr->segments, s)->table,
+				     keyPtr, dataPtr,
+				     TMgetSize(TM_ARG  concHashtablePtr, s))) {
+	return FALSE;
+    }
+    TMaddSize(TM_ARG  concHashtablePtr, s, 1);
+    return TRUE;
 }
 
 bool_t
 TMconc_hashtable_remove (TM_ARGDECL  conc_hashtable_t* concHashtablePtr, void* keyPtr)
 {
-    long i = concHashtablePtr->hash(keyPtr) % NUM_SEGMENTS;
-    return TMHASHTABLE_REMOVE(GET_SEGMENT(concHashtablePtr->segments, i), keyPtr);
+    long s = SEGMENT_INDEX(concHashtablePtr, concHashtablePtr->hash(keyPtr));
+
+    if (!TMHASHTABLE_REMOVEUNCOUNTED(&GET_SEGMENT(concHashtablePtr->segments, s)->table,
+				     keyPtr)) {
+	return FALSE;
+    }
+    TMaddSize(TM_ARG  concHashtablePtr, s, -1);
+    return TRUE;
 }
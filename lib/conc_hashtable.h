@@ -1,4 +1,4 @@
-/* Copyright (c) IBM Corp. 2014. */
+/* Copyright (c) IBM Corp. 2014, and others. */
 #ifndef CONC_HASHTABLE_H
 #define CONC_HASHTABLE_H 1
 
@@ -8,9 +8,21 @@
 extern "C" {
 #endif
 
+/* A hash table split into segments, each a hashtable_t on its own cache
+   lines.  The number of segments is a power of two sized to
+   thread_getNumThread() when the table is allocated, so allocate it after
+   thread_startup().  Each thread counts its inserts and removes per
+   segment on its own cache line, and adds them to the segment's size only
+   every CONC_HASHTABLE_SIZE_SLACK of them. */
 typedef struct conc_hashtable {
     char *segments;
     char *segmentsUnaligned;
+    long numSegment;
+    long segmentMask;
+    long *sizeDeltas;       /* sizeDeltaStride counts per thread */
+    long *sizeDeltasUnaligned;
+    long numSizeDelta;      /* threads with counts */
+    long sizeDeltaStride;
     ulong_t (*hash)(const void*);
 } conc_hashtable_t;
 
@@ -36,6 +48,10 @@ conc_hashtable_insert (conc_hashtable_t* concHashtablePtr, void* keyPtr, void* d
 bool_t
 conc_hashtable_remove (conc_hashtable_t* concHashtablePtr, void* keyPtr);
 
+/* Sum of hashtable_printStats() over the segments */
+void
+conc_hashtable_printStats (conc_hashtable_t* concHashtablePtr);
+
 
 
 conc_hashtable_t*
@@ -83,6 +83,7 @@
 
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "hashtable.h"
 #include "list.h"
@@ -98,6 +99,531 @@
 #endif
 
 
+/* =============================================================================
+ * Incremental resize
+ * -- A resize only allocates the larger bucket array.  Old bucket b feeds
+ *    the new buckets b + k * oldNumBucket, which are created when it moves,
+ *    and its slot in the old array is then cleared.  An insert moves the old
+ *    bucket of its own key, which it writes anyway, so writers of different
+ *    buckets share no cursor; removes and lookups use the old chain until it
+ *    has moved.  Once the table is due to grow again, inserts sweep the old
+ *    array for the buckets nobody touched, HASHTABLE_SWEEP_STEP slots each,
+ *    and the sweep that reaches the end frees it
+ * =============================================================================
+ */
+
+static void
+initResize (hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_RESIZABLE
+    hashtablePtr->oldBuckets = NULL;
+    hashtablePtr->oldNumBucket = 0;
+    hashtablePtr->swept = 0;
+#endif
+#ifdef HASHTABLE_STATS
+    hashtablePtr->numResize = 0;
+    hashtablePtr->numMigrateOp = 0;
+    hashtablePtr->numMigrateBucket = 0;
+    hashtablePtr->numMigratePair = 0;
+    hashtablePtr->maxMigratePair = 0;
+#endif
+}
+
+
+/* =============================================================================
+ * getChain
+ * -- Returns the chain that holds or would hold a key with this hash
+ * =============================================================================
+ */
+static list_t*
+getChain (hashtable_t* hashtablePtr, ulong_t hash)
+{
+#ifdef HASHTABLE_RESIZABLE
+    if (hashtablePtr->oldBuckets != NULL) {
+        list_t* chainPtr =
+            hashtablePtr->oldBuckets[hash % hashtablePtr->oldNumBucket];
+        if (chainPtr != NULL) {
+            return chainPtr;
+        }
+    }
+#endif
+
+    return hashtablePtr->buckets[hash % hashtablePtr->numBucket];
+}
+
+
+/* =============================================================================
+ * TMgetChain
+ * -- Returns the chain that holds or would hold a key with this hash
+ * =============================================================================
+ */
+static list_t*
+TMgetChain (TM_ARGDECL  hashtable_t* hashtablePtr, ulong_t hash)
+{
+#if defined(HASHTABLE_RESIZABLE) || defined(HASHTABLE_SIZE_FIELD)
+    list_t** buckets;
+#endif
+
+#ifdef HASHTABLE_RESIZABLE
+    list_t** oldBuckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->oldBuckets);
+    if (oldBuckets != NULL) {
+        long b = hash % (long)TM_SHARED_READ(hashtablePtr->oldNumBucket);
+        list_t* chainPtr = (list_t*)TM_SHARED_READ_P(oldBuckets[b]);
+        if (chainPtr != NULL) {
+            return chainPtr;
+        }
+    }
+#endif
+
+#if defined(HASHTABLE_RESIZABLE) || defined(HASHTABLE_SIZE_FIELD)
+    buckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->buckets);
+    return (list_t*)TM_SHARED_READ_P(buckets[hash % (long)TM_SHARED_READ(hashtablePtr->numBucket)]);
+#else
+    return hashtablePtr->buckets[hash % hashtablePtr->numBucket];
+#endif
+}
+
+
+/* =============================================================================
+ * getNumChain, getChainAt
+ * -- Chain i of the table, for 0 <= i < getNumChain(): the buckets, then
+ *    the old buckets of a resize in progress; NULL for those not in use
+ * =============================================================================
+ */
+#if defined(HASHTABLE_RESIZABLE) || !defined(HASHTABLE_SIZE_FIELD)
+static long
+getNumChain (hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_RESIZABLE
+    return (hashtablePtr->numBucket + hashtablePtr->oldNumBucket);
+#else
+    return hashtablePtr->numBucket;
+#endif
+}
+
+static list_t*
+getChainAt (hashtable_t* hashtablePtr, long i)
+{
+#ifdef HASHTABLE_RESIZABLE
+    if (hashtablePtr->oldBuckets != NULL) {
+        long numBucket = hashtablePtr->numBucket;
+        if (i >= numBucket) {
+            return hashtablePtr->oldBuckets[i - numBucket];
+        }
+        if (hashtablePtr->oldBuckets[i % hashtablePtr->oldNumBucket] != NULL) {
+            return NULL;
+        }
+    }
+#endif
+
+    return hashtablePtr->buckets[i];
+}
+#endif
+
+
+#ifndef HASHTABLE_SIZE_FIELD
+/* =============================================================================
+ * TMgetNumChain, TMgetChainAt
+ * =============================================================================
+ */
+static long
+TMgetNumChain (TM_ARGDECL  hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_RESIZABLE
+    return ((long)TM_SHARED_READ(hashtablePtr->numBucket) +
+            (long)TM_SHARED_READ(hashtablePtr->oldNumBucket));
+#else
+    return hashtablePtr->numBucket;
+#endif
+}
+
+static list_t*
+TMgetChainAt (TM_ARGDECL  hashtable_t* hashtablePtr, long i)
+{
+#ifdef HASHTABLE_RESIZABLE
+    list_t** oldBuckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->oldBuckets);
+    list_t** buckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->buckets);
+    if (oldBuckets != NULL) {
+        long numBucket = (long)TM_SHARED_READ(hashtablePtr->numBucket);
+        long oldNumBucket = (long)TM_SHARED_READ(hashtablePtr->oldNumBucket);
+        if (i >= numBucket) {
+            return (list_t*)TM_SHARED_READ_P(oldBuckets[i - numBucket]);
+        }
+        if (TM_SHARED_READ_P(oldBuckets[i % oldNumBucket]) != NULL) {
+            return NULL;
+        }
+    }
+    return (list_t*)TM_SHARED_READ_P(buckets[i]);
+#else
+    return hashtablePtr->buckets[i];
+#endif
+}
+#endif /* !HASHTABLE_SIZE_FIELD */
+
+
+#ifdef HASHTABLE_RESIZABLE
+/* =============================================================================
+ * startResize
+ * -- On failure the table keeps its size; a later insert tries again
+ * =============================================================================
+ */
+static void
+startResize (hashtable_t* hashtablePtr)
+{
+    long numBucket = hashtablePtr->numBucket;
+    long newNumBucket = hashtablePtr->growthFactor * numBucket;
+    list_t** newBuckets;
+
+    /* The chains are created by moveBucket(); the extra bucket is the dummy
+       of the iterators, see allocBuckets() */
+    newBuckets = (list_t**)malloc((newNumBucket + 1) * sizeof(list_t*));
+    if (newBuckets == NULL) {
+        return;
+    }
+    newBuckets[newNumBucket] =
+        list_alloc((long (*)(const void*, const void*))hashtablePtr->comparePairs);
+    if (newBuckets[newNumBucket] == NULL) {
+        free(newBuckets);
+        return;
+    }
+
+    hashtablePtr->oldBuckets = hashtablePtr->buckets;
+    hashtablePtr->oldNumBucket = numBucket;
+    hashtablePtr->swept = 0;
+    hashtablePtr->buckets = newBuckets;
+    hashtablePtr->numBucket = newNumBucket;
+#ifdef HASHTABLE_STATS
+    hashtablePtr->numResize++;
+#endif
+}
+
+
+/* =============================================================================
+ * TMstartResize
+ * -- On failure the table keeps its size; a later insert tries again
+ * =============================================================================
+ */
+static void
+TMstartResize (TM_ARGDECL  hashtable_t* hashtablePtr)
+{
+    long numBucket = (long)TM_SHARED_READ(hashtablePtr->numBucket);
+    long newNumBucket = hashtablePtr->growthFactor * numBucket;
+    list_t** newBuckets;
+
+    /* The chains are created by TMmoveBucket(); the extra bucket is the
+       dummy of the iterators, see allocBuckets() */
+    newBuckets = (list_t**)TM_MALLOC((newNumBucket + 1) * sizeof(list_t*));
+    if (newBuckets == NULL) {
+        return;
+    }
+    newBuckets[newNumBucket] =
+        TMLIST_ALLOC((long (*)(const void*, const void*))hashtablePtr->comparePairs);
+    if (newBuckets[newNumBucket] == NULL) {
+        TM_FREE(newBuckets);
+        return;
+    }
+
+    TM_SHARED_WRITE_P(hashtablePtr->oldBuckets,
+                      (list_t**)TM_SHARED_READ_P(hashtablePtr->buckets));
+    TM_SHARED_WRITE(hashtablePtr->oldNumBucket, numBucket);
+    TM_SHARED_WRITE(hashtablePtr->swept, 0);
+    TM_SHARED_WRITE_P(hashtablePtr->buckets, newBuckets);
+    TM_SHARED_WRITE(hashtablePtr->numBucket, newNumBucket);
+#ifdef HASHTABLE_STATS
+    TM_SHARED_WRITE(hashtablePtr->numResize,
+                    (long)TM_SHARED_READ(hashtablePtr->numResize)+1);
+#endif
+}
+
+
+/* =============================================================================
+ * moveBucket
+ * -- Moves old bucket b into the buckets and clears its slot
+ * -- Returns the number of pairs moved, or -1 if out of memory, in which
+ *    case the pairs all stay in the old chain
+ * =============================================================================
+ */
+static long
+moveBucket (hashtable_t* hashtablePtr, long b)
+{
+    list_t** oldBuckets = hashtablePtr->oldBuckets;
+    long oldNumBucket = hashtablePtr->oldNumBucket;
+    list_t** buckets = hashtablePtr->buckets;
+    long numBucket = hashtablePtr->numBucket;
+    list_t* chainPtr = oldBuckets[b];
+    list_iter_t it;
+    long numPair;
+    long j;
+
+    for (j = b; j < numBucket; j += oldNumBucket) {
+        buckets[j] =
+            list_alloc((long (*)(const void*, const void*))hashtablePtr->comparePairs);
+        if (buckets[j] == NULL) {
+            break;
+        }
+    }
+
+    if (j >= numBucket) {
+        list_iter_reset(&it, chainPtr);
+        while (list_iter_hasNext(&it, chainPtr)) {
+            pair_t* transferPtr = (pair_t*)list_iter_next(&it, chainPtr);
+            long k = hashtablePtr->hash(transferPtr->firstPtr) % numBucket;
+            if (list_insert(buckets[k], (void*)transferPtr) == FALSE) {
+                break;
+            }
+        }
+    }
+
+    if (j < numBucket || list_iter_hasNext(&it, chainPtr)) {
+        while ((j -= oldNumBucket) >= b) {
+            list_free(buckets[j]);
+        }
+        return -1;
+    }
+
+    numPair = list_getSize(chainPtr);
+    list_free(chainPtr);
+    oldBuckets[b] = NULL;
+
+    return numPair;
+}
+
+
+/* =============================================================================
+ * TMmoveBucket
+ * -- Moves old bucket b into the buckets and clears its slot
+ * -- Returns the number of pairs moved, or -1 if out of memory, in which
+ *    case the pairs all stay in the old chain
+ * =============================================================================
+ */
+static long
+TMmoveBucket (TM_ARGDECL  hashtable_t* hashtablePtr, long b)
+{
+    list_t** oldBuckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->oldBuckets);
+    long oldNumBucket = (long)TM_SHARED_READ(hashtablePtr->oldNumBucket);
+    list_t** buckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->buckets);
+    long numBucket = (long)TM_SHARED_READ(hashtablePtr->numBucket);
+    list_t* chainPtr = (list_t*)TM_SHARED_READ_P(oldBuckets[b]);
+    list_iter_t it;
+    long numPair;
+    long j;
+
+    for (j = b; j < numBucket; j += oldNumBucket) {
+        list_t* newChainPtr =
+            TMLIST_ALLOC((long (*)(const void*, const void*))hashtablePtr->comparePairs);
+        if (newChainPtr == NULL) {
+            break;
+        }
+        TM_SHARED_WRITE_P(buckets[j], newChainPtr);
+    }
+
+    if (j >= numBucket) {
+        TMLIST_ITER_RESET(&it, chainPtr);
+        while (TMLIST_ITER_HASNEXT(&it, chainPtr)) {
+            pair_t* transferPtr = (pair_t*)TMLIST_ITER_NEXT(&it, chainPtr);
+            long k = hashtablePtr->hash(TM_SHARED_READ_P(transferPtr->firstPtr)) % numBucket;
+            if (TMLIST_INSERT((list_t*)TM_SHARED_READ_P(buckets[k]),
+                              (void*)transferPtr) == FALSE) {
+                break;
+            }
+        }
+    }
+
+    if (j < numBucket || TMLIST_ITER_HASNEXT(&it, chainPtr)) {
+        while ((j -= oldNumBucket) >= b) {
+            TMLIST_FREE((list_t*)TM_SHARED_READ_P(buckets[j]));
+        }
+        return -1;
+    }
+
+    numPair = TMLIST_GETSIZE(chainPtr);
+    TMLIST_FREE(chainPtr);
+    TM_SHARED_WRITE_P(oldBuckets[b], (list_t*)NULL);
+
+    return numPair;
+}
+
+
+#ifdef HASHTABLE_STATS
+/* =============================================================================
+ * addMigrateStats, TMaddMigrateStats
+ * =============================================================================
+ */
+static void
+addMigrateStats (hashtable_t* hashtablePtr, long numMoved, long numPair)
+{
+    hashtablePtr->numMigrateOp++;
+    hashtablePtr->numMigrateBucket += numMoved;
+    hashtablePtr->numMigratePair += numPair;
+    if (numPair > hashtablePtr->maxMigratePair) {
+        hashtablePtr->maxMigratePair = numPair;
+    }
+}
+
+static void
+TMaddMigrateStats (TM_ARGDECL  hashtable_t* hashtablePtr, long numMoved, long numPair)
+{
+    TM_SHARED_WRITE(hashtablePtr->numMigrateOp,
+                    (long)TM_SHARED_READ(hashtablePtr->numMigrateOp)+1);
+    TM_SHARED_WRITE(hashtablePtr->numMigrateBucket,
+                    (long)TM_SHARED_READ(hashtablePtr->numMigrateBucket)+numMoved);
+    TM_SHARED_WRITE(hashtablePtr->numMigratePair,
+                    (long)TM_SHARED_READ(hashtablePtr->numMigratePair)+numPair);
+    if (numPair > (long)TM_SHARED_READ(hashtablePtr->maxMigratePair)) {
+        TM_SHARED_WRITE(hashtablePtr->maxMigratePair, numPair);
+    }
+}
+#endif /* HASHTABLE_STATS */
+
+
+/* =============================================================================
+ * migrate
+ * -- Moves the old bucket of this hash, if it has not moved yet
+ * =============================================================================
+ */
+static void
+migrate (hashtable_t* hashtablePtr, ulong_t hash)
+{
+    long b = hash % hashtablePtr->oldNumBucket;
+
+    if (hashtablePtr->oldBuckets[b] != NULL) {
+#ifdef HASHTABLE_STATS
+        long numPair = moveBucket(hashtablePtr, b);
+        if (numPair >= 0) {
+            addMigrateStats(hashtablePtr, 1, numPair);
+        }
+#else
+        moveBucket(hashtablePtr, b);
+#endif
+    }
+}
+
+
+/* =============================================================================
+ * TMmigrate
+ * -- Moves the old bucket of this hash, if it has not moved yet
+ * =============================================================================
+ */
+static void
+TMmigrate (TM_ARGDECL  hashtable_t* hashtablePtr, ulong_t hash)
+{
+    list_t** oldBuckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->oldBuckets);
+    long b = hash % (long)TM_SHARED_READ(hashtablePtr->oldNumBucket);
+
+    if (TM_SHARED_READ_P(oldBuckets[b]) != NULL) {
+#ifdef HASHTABLE_STATS
+        long numPair = TMmoveBucket(TM_ARG  hashtablePtr, b);
+        if (numPair >= 0) {
+            TMaddMigrateStats(TM_ARG  hashtablePtr, 1, numPair);
+        }
+#else
+        TMmoveBucket(TM_ARG  hashtablePtr, b);
+#endif
+    }
+}
+
+
+/* =============================================================================
+ * sweep
+ * -- Moves the old buckets left in the next numStep slots, and frees the
+ *    old array once they are all clear; stops early if out of memory, in
+ *    which case the next call tries again
+ * =============================================================================
+ */
+static void
+sweep (hashtable_t* hashtablePtr, long numStep)
+{
+    list_t** oldBuckets = hashtablePtr->oldBuckets;
+    long oldNumBucket = hashtablePtr->oldNumBucket;
+    long swept = hashtablePtr->swept;
+    long stop = swept + numStep;
+    long numMoved = 0;
+    long numPair = 0;
+
+    if (stop > oldNumBucket) {
+        stop = oldNumBucket;
+    }
+
+    for ( ; swept < stop; swept++) {
+        if (oldBuckets[swept] != NULL) {
+            long n = moveBucket(hashtablePtr, swept);
+            if (n < 0) {
+                break;
+            }
+            numMoved++;
+            numPair += n;
+        }
+    }
+
+#ifdef HASHTABLE_STATS
+    if (numMoved > 0) {
+        addMigrateStats(hashtablePtr, numMoved, numPair);
+    }
+#endif
+
+    if (swept == oldNumBucket) {
+        list_free(oldBuckets[oldNumBucket]); /* dummy */
+        free(oldBuckets);
+        hashtablePtr->oldBuckets = NULL;
+        hashtablePtr->oldNumBucket = 0;
+        hashtablePtr->swept = 0;
+    } else {
+        hashtablePtr->swept = swept;
+    }
+}
+
+
+/* =============================================================================
+ * TMsweep
+ * -- Moves the old buckets left in the next numStep slots, and frees the
+ *    old array once they are all clear; stops early if out of memory, in
+ *    which case the next call tries again
+ * =============================================================================
+ */
+static void
+TMsweep (TM_ARGDECL  hashtable_t* hashtablePtr, long numStep)
+{
+    list_t** oldBuckets = (list_t**)TM_SHARED_READ_P(hashtablePtr->oldBuckets);
+    long oldNumBucket = (long)TM_SHARED_READ(hashtablePtr->oldNumBucket);
+    long swept = (long)TM_SHARED_READ(hashtablePtr->swept);
+    long stop = swept + numStep;
+    long numMoved = 0;
+    long numPair = 0;
+
+    if (stop > oldNumBucket) {
+        stop = oldNumBucket;
+    }
+
+    for ( ; swept < stop; swept++) {
+        if (TM_SHARED_READ_P(oldBuckets[swept]) != NULL) {
+            long n = TMmoveBucket(TM_ARG  hashtablePtr, swept);
+            if (n < 0) {
+                break;
+            }
+            numMoved++;
+            numPair += n;
+        }
+    }
+
+#ifdef HASHTABLE_STATS
+    if (numMoved > 0) {
+        TMaddMigrateStats(TM_ARG  hashtablePtr, numMoved, numPair);
+    }
+#endif
+
+    if (swept == oldNumBucket) {
+        TMLIST_FREE((list_t*)TM_SHARED_READ_P(oldBuckets[oldNumBucket])); /* dummy */
+        TM_FREE(oldBuckets);
+        TM_SHARED_WRITE_P(hashtablePtr->oldBuckets, (list_t**)NULL);
+        TM_SHARED_WRITE(hashtablePtr->oldNumBucket, 0);
+        TM_SHARED_WRITE(hashtablePtr->swept, 0);
+    } else {
+        TM_SHARED_WRITE(hashtablePtr->swept, swept);
+    }
+}
+#endif /* HASHTABLE_RESIZABLE */
+
+
 /* =============================================================================
  * hashtable_iter_reset
  * =============================================================================
@@ -105,6 +631,13 @@
 void
 hashtable_iter_reset (hashtable_iter_t* itPtr, hashtable_t* hashtablePtr)
 {
+#ifdef HASHTABLE_RESIZABLE
+    /* Iterators only walk the buckets */
+    if (hashtablePtr->oldBuckets != NULL) {
+        sweep(hashtablePtr, hashtablePtr->oldNumBucket);
+        assert(hashtablePtr->oldBuckets == NULL);
+    }
+#endif
     itPtr->bucket = 0;
     list_iter_reset(&(itPtr->it), hashtablePtr->buckets[0]);
 }
@@ -118,6 +651,13 @@ void
 TMhashtable_iter_reset (TM_ARGDECL
                         hashtable_iter_t* itPtr, hashtable_t* hashtablePtr)
 {
+#ifdef HASHTABLE_RESIZABLE
+    /* Iterators only walk the buckets */
+    if (TM_SHARED_READ_P(hashtablePtr->oldBuckets) != NULL) {
+        TMsweep(TM_ARG  hashtablePtr, (long)TM_SHARED_READ(hashtablePtr->oldNumBucket));
+        assert(TM_SHARED_READ_P(hashtablePtr->oldBuckets) == NULL);
+    }
+#endif
     itPtr->bucket = 0;
     TMLIST_ITER_RESET(&(itPtr->it), hashtablePtr->buckets[0]);
 }
@@ -331,6 +871,7 @@ hashtable_alloc (long initNumBucket,
     }
 
     hashtablePtr->numBucket = initNumBucket;
+    initResize(hashtablePtr);
 #ifdef HASHTABLE_SIZE_FIELD
     hashtablePtr->size = 0;
 #endif
@@ -358,6 +899,7 @@ hashtable_init (hashtable_t* hashtablePtr,
     }
 
     hashtablePtr->numBucket = initNumBucket;
+    initResize(hashtablePtr);
 #ifdef HASHTABLE_SIZE_FIELD
     hashtablePtr->size = 0;
 #endif
@@ -400,6 +942,7 @@ TMhashtable_alloc (TM_ARGDECL
     }
 
     hashtablePtr->numBucket = initNumBucket;
+    initResize(hashtablePtr);
 #ifdef HASHTABLE_SIZE_FIELD
     hashtablePtr->size = 0;
 #endif
@@ -428,6 +971,7 @@ TMhashtable_init (TM_ARGDECL
     }
 
     hashtablePtr->numBucket = initNumBucket;
+    initResize(hashtablePtr);
 #ifdef HASHTABLE_SIZE_FIELD
     hashtablePtr->size = 0;
 #endif
@@ -483,13 +1027,29 @@ TMfreeBuckets (TM_ARGDECL  list_t** buckets, long numBucket)
 void
 hashtable_free (hashtable_t* hashtablePtr)
 {
-    freeBuckets(hashtablePtr->buckets, hashtablePtr->numBucket);
+    hashtable_free_buckets(hashtablePtr);
     free(hashtablePtr);
 }
 
 void
 hashtable_free_buckets (hashtable_t* hashtablePtr)
 {
+#ifdef HASHTABLE_RESIZABLE
+    if (hashtablePtr->oldBuckets != NULL) {
+        /* Resize in progress: each array holds only part of the chains */
+        long numChain = getNumChain(hashtablePtr);
+        long i;
+        for (i = 0; i < numChain; i++) {
+            list_t* chainPtr = getChainAt(hashtablePtr, i);
+            if (chainPtr != NULL) {
+                list_free(chainPtr);
+            }
+        }
+        free(hashtablePtr->oldBuckets);
+        free(hashtablePtr->buckets);
+        return;
+    }
+#endif
     freeBuckets(hashtablePtr->buckets, hashtablePtr->numBucket);
 }
 
@@ -501,7 +1061,7 @@ hashtable_free_buckets (hashtable_t* hashtablePtr)
 void
 TMhashtable_free (TM_ARGDECL  hashtable_t* hashtablePtr)
 {
-    TMfreeBuckets(TM_ARG  hashtablePtr->buckets, hashtablePtr->numBucket);
+    TMhashtable_free_buckets(TM_ARG  hashtablePtr);
     TM_FREE(hashtablePtr);
 }
 
@@ -509,6 +1069,22 @@ void
 TMhashtable_free_buckets (TM_ARGDECL  hashtable_t* hashtablePtr)
 {
     /*printf("numBucket %ld  size %ld\n", hashtablePtr->numBucket, hashtablePtr->size);*/
+#ifdef HASHTABLE_RESIZABLE
+    if (hashtablePtr->oldBuckets != NULL) {
+        /* Resize in progress: each array holds only part of the chains */
+        long numChain = getNumChain(hashtablePtr);
+        long i;
+        for (i = 0; i < numChain; i++) {
+            list_t* chainPtr = getChainAt(hashtablePtr, i);
+            if (chainPtr != NULL) {
+                TMLIST_FREE(chainPtr);
+            }
+        }
+        TM_FREE(hashtablePtr->oldBuckets);
+        TM_FREE(hashtablePtr->buckets);
+        return;
+    }
+#endif
     TMfreeBuckets(TM_ARG  hashtablePtr->buckets, hashtablePtr->numBucket);
 }
 
@@ -523,10 +1099,12 @@ hashtable_isEmpty (hashtable_t* hashtablePtr)
 #ifdef HASHTABLE_SIZE_FIELD
     return ((hashtablePtr->size == 0) ? TRUE : FALSE);
 #else
+    long numChain = getNumChain(hashtablePtr);
     long i;
 
-    for (i = 0; i < hashtablePtr->numBucket; i++) {
-        if (!list_isEmpty(hashtablePtr->buckets[i])) {
+    for (i = 0; i < numChain; i++) {
+        list_t* chainPtr = getChainAt(hashtablePtr, i);
+        if (chainPtr != NULL && !list_isEmpty(chainPtr)) {
             return FALSE;
         }
     }
@@ -546,10 +1124,12 @@ TMhashtable_isEmpty (TM_ARGDECL  hashtable_t* hashtablePtr)
 #ifdef HASHTABLE_SIZE_FIELD
     return ((TM_SHARED_READ(hashtablePtr->size) == 0) ? TRUE : FALSE);
 #else
+    long numChain = TMgetNumChain(TM_ARG  hashtablePtr);
     long i;
 
-    for (i = 0; i < hashtablePtr->numBucket; i++) {
-        if (!TMLIST_ISEMPTY(hashtablePtr->buckets[i])) {
+    for (i = 0; i < numChain; i++) {
+        list_t* chainPtr = TMgetChainAt(TM_ARG  hashtablePtr, i);
+        if (chainPtr != NULL && !TMLIST_ISEMPTY(chainPtr)) {
             return FALSE;
         }
     }
@@ -570,11 +1150,15 @@ hashtable_getSize (hashtable_t* hashtablePtr)
 #ifdef HASHTABLE_SIZE_FIELD
     return hashtablePtr->size;
 #else
+    long numChain = getNumChain(hashtablePtr);
     long i;
     long size = 0;
 
-    for (i = 0; i < hashtablePtr->numBucket; i++) {
-        size += list_getSize(hashtablePtr->buckets[i]);
+    for (i = 0; i < numChain; i++) {
+        list_t* chainPtr = getChainAt(hashtablePtr, i);
+        if (chainPtr != NULL) {
+            size += list_getSize(chainPtr);
+        }
     }
 
     return size;
@@ -593,11 +1177,15 @@ TMhashtable_getSize (TM_ARGDECL  hashtable_t* hashtablePtr)
 #ifdef HASHTABLE_SIZE_FIELD
     return (long)TM_SHARED_READ(hashtablePtr->size);
 #else
+    long numChain = TMgetNumChain(TM_ARG  hashtablePtr);
     long i;
     long size = 0;
 
-    for (i = 0; i < hashtablePtr->numBucket; i++) {
-        size += TMLIST_GETSIZE(hashtablePtr->buckets[i]);
+    for (i = 0; i < numChain; i++) {
+        list_t* chainPtr = TMgetChainAt(TM_ARG  hashtablePtr, i);
+        if (chainPtr != NULL) {
+            size += TMLIST_GETSIZE(chainPtr);
+        }
     }
 
     return size;
@@ -612,12 +1200,12 @@ TMhashtable_getSize (TM_ARGDECL  hashtable_t* hashtablePtr)
 bool_t
 hashtable_containsKey (hashtable_t* hashtablePtr, void* keyPtr)
 {
-    long i = hashtablePtr->hash(keyPtr) % hashtablePtr->numBucket;
     pair_t* pairPtr;
     pair_t findPair;
 
     findPair.firstPtr = keyPtr;
-    pairPtr = (pair_t*)list_find(hashtablePtr->buckets[i], &findPair);
+    pairPtr = (pair_t*)list_find(getChain(hashtablePtr, hashtablePtr->hash(keyPtr)),
+                                 &findPair);
 
     return ((pairPtr != NULL) ? TRUE : FALSE);
 }
@@ -630,12 +1218,13 @@ hashtable_containsKey (hashtable_t* hashtablePtr, void* keyPtr)
 bool_t
 TMhashtable_containsKey (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
 {
-    long i = hashtablePtr->hash(keyPtr) % hashtablePtr->numBucket;
     pair_t* pairPtr;
     pair_t findPair;
 
     findPair.firstPtr = keyPtr;
-    pairPtr = (pair_t*)TMLIST_FIND(hashtablePtr->buckets[i], &findPair);
+    pairPtr = (pair_t*)TMLIST_FIND(TMgetChain(TM_ARG  hashtablePtr,
+                                              hashtablePtr->hash(keyPtr)),
+                                   &findPair);
 
     return ((pairPtr != NULL) ? TRUE : FALSE);
 }
@@ -649,12 +1238,12 @@ TMhashtable_containsKey (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
 void*
 hashtable_find (hashtable_t* hashtablePtr, void* keyPtr)
 {
-    long i = hashtablePtr->hash(keyPtr) % hashtablePtr->numBucket;
     pair_t* pairPtr;
     pair_t findPair;
 
     findPair.firstPtr = keyPtr;
-    pairPtr = (pair_t*)list_find(hashtablePtr->buckets[i], &findPair);
+    pairPtr = (pair_t*)list_find(getChain(hashtablePtr, hashtablePtr->hash(keyPtr)),
+                                 &findPair);
     if (pairPtr == NULL) {
         return NULL;
     }
@@ -671,12 +1260,13 @@ hashtable_find (hashtable_t* hashtablePtr, void* keyPtr)
 void*
 TMhashtable_find (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
 {
-    long i = hashtablePtr->hash(keyPtr) % hashtablePtr->numBucket;
     pair_t* pairPtr;
     pair_t findPair;
 
     findPair.firstPtr = keyPtr;
-    pairPtr = (pair_t*)TMLIST_FIND(hashtablePtr->buckets[i], &findPair);
+    pairPtr = (pair_t*)TMLIST_FIND(TMgetChain(TM_ARG  hashtablePtr,
+                                              hashtablePtr->hash(keyPtr)),
+                                   &findPair);
     if (pairPtr == NULL) {
         return NULL;
     }
@@ -685,98 +1275,30 @@ TMhashtable_find (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
 }
 
 
-/* Modified by Odaira begin */
-#if defined(HASHTABLE_RESIZABLE)
-/*#if defined(HASHTABLE_RESIZABLE) && !(defined(HTM) || defined(STM) || defined(HTM_IBM) || defined(HLE_INTEL))*/
-/* Modified by Odaira end */
 /* =============================================================================
- * rehash
+ * insertEntry
+ * -- With counted FALSE, the caller keeps the count of pairs: size is its
+ *    count before the insert, and the size field is left alone
  * =============================================================================
  */
-static list_t**
-rehash (hashtable_t* hashtablePtr)
+static bool_t
+insertEntry (hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr,
+             bool_t counted, long size)
 {
-    list_t** oldBuckets = hashtablePtr->buckets;
-    long oldNumBucket = hashtablePtr->numBucket;
-    long newNumBucket = hashtablePtr->growthFactor * oldNumBucket;
-    list_t** newBuckets;
-    long i;
-
-    newBuckets = allocBuckets(newNumBucket, hashtablePtr->comparePairs);
-    if (newBuckets == NULL) {
-        return NULL;
-    }
-
-    for (i = 0; i < oldNumBucket; i++) {
-        list_t* chainPtr = oldBuckets[i];
-        list_iter_t it;
-        list_iter_reset(&it, chainPtr);
-        while (list_iter_hasNext(&it, chainPtr)) {
-            pair_t* transferPtr = (pair_t*)list_iter_next(&it, chainPtr);
-            long j = hashtablePtr->hash(transferPtr->firstPtr) % newNumBucket;
-            if (list_insert(newBuckets[j], (void*)transferPtr) == FALSE) {
-                return NULL;
-            }
-        }
-    }
-
-    return newBuckets;
-}
-#endif /* HASHTABLE_RESIZABLE */
-
-#if defined(HASHTABLE_RESIZABLE)
-/* =============================================================================
- * TMrehash
- * =============================================================================
- */
-static list_t**
-TMrehash (TM_ARGDECL  hashtable_t* hashtablePtr)
-{
-    list_t** oldBuckets = TM_SHARED_READ(hashtablePtr->buckets);
-    long oldNumBucket = TM_SHARED_READ(hashtablePtr->numBucket);
-    long newNumBucket = hashtablePtr->growthFactor * oldNumBucket;
-    list_t** newBuckets;
-    long i;
-
-    newBuckets = TMallocBuckets(TM_ARG  newNumBucket, hashtablePtr->comparePairs);
-    if (newBuckets == NULL) {
-        return NULL;
-    }
+    ulong_t hash = hashtablePtr->hash(keyPtr);
+#if defined(HASHTABLE_SIZE_FIELD) || defined(HASHTABLE_RESIZABLE)
+    long newSize = size + 1;
+#endif
 
-    for (i = 0; i < oldNumBucket; i++) {
-        list_t* chainPtr = TM_SHARED_READ(oldBuckets[i]);
-        list_iter_t it;
-        TMLIST_ITER_RESET(&it, chainPtr);
-        while (TMLIST_ITER_HASNEXT(&it, chainPtr)) {
-            pair_t* transferPtr = (pair_t*)TMLIST_ITER_NEXT(&it, chainPtr);
-            long j = hashtablePtr->hash(transferPtr->firstPtr) % newNumBucket;
-            if (TMLIST_INSERT(newBuckets[j], (void*)transferPtr) == FALSE) {
-                return NULL;
-            }
-        }
+#ifdef HASHTABLE_RESIZABLE
+    if (hashtablePtr->oldBuckets != NULL) {
+        migrate(hashtablePtr, hash);
     }
-
-    return newBuckets;
-}
-#endif /* HASHTABLE_RESIZABLE */
-
-
-/* =============================================================================
- * hashtable_insert
- * =============================================================================
- */
-bool_t
-hashtable_insert (hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
-{
-    long numBucket = hashtablePtr->numBucket;
-    long i = hashtablePtr->hash(keyPtr) % numBucket;
-#if defined(HASHTABLE_SIZE_FIELD) || defined(HASHTABLE_RESIZABLE)
-    long newSize;
 #endif
 
     pair_t findPair;
     findPair.firstPtr = keyPtr;
-    pair_t* pairPtr = (pair_t*)list_find(hashtablePtr->buckets[i], &findPair);
+    pair_t* pairPtr = (pair_t*)list_find(getChain(hashtablePtr, hash), &findPair);
     if (pairPtr != NULL) {
         return FALSE;
     }
@@ -786,37 +1308,38 @@ hashtable_insert (hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
         return FALSE;
     }
 
+    if (counted) {
 #ifdef HASHTABLE_SIZE_FIELD
-    newSize = hashtablePtr->size + 1;
-    assert(newSize > 0);
+        newSize = hashtablePtr->size + 1;
+        assert(newSize > 0);
 #elif defined(HASHTABLE_RESIZABLE)
-    newSize = hashtable_getSize(hashtablePtr) + 1;
-    assert(newSize > 0);
+        newSize = hashtable_getSize(hashtablePtr) + 1;
+        assert(newSize > 0);
 #endif
+    }
 
 #ifdef HASHTABLE_RESIZABLE
-    /* Increase number of buckets to maintain size ratio */
-    if (newSize >= (numBucket * hashtablePtr->resizeRatio)) {
-        list_t** newBuckets = rehash(hashtablePtr);
-        if (newBuckets == NULL) {
-            return FALSE;
+    /* Increase number of buckets to maintain size ratio, once the previous
+       resize is swept */
+    if (newSize >= (hashtablePtr->numBucket * hashtablePtr->resizeRatio)) {
+        if (hashtablePtr->oldBuckets != NULL) {
+            sweep(hashtablePtr, HASHTABLE_SWEEP_STEP);
+        }
+        if (hashtablePtr->oldBuckets == NULL) {
+            startResize(hashtablePtr);
         }
-        freeBuckets(hashtablePtr->buckets, numBucket);
-        numBucket *= hashtablePtr->growthFactor;
-        hashtablePtr->buckets = newBuckets;
-        hashtablePtr->numBucket = numBucket;
-        i = hashtablePtr->hash(keyPtr) % numBucket;
-
     }
 #endif
 
     /* Add new entry  */
-    if (list_insert(hashtablePtr->buckets[i], insertPtr) == FALSE) {
+    if (list_insert(getChain(hashtablePtr, hash), insertPtr) == FALSE) {
         pair_free(insertPtr);
         return FALSE;
     }
 #ifdef HASHTABLE_SIZE_FIELD
-    hashtablePtr->size = newSize;
+    if (counted) {
+        hashtablePtr->size = newSize;
+    }
 #endif
 
     return TRUE;
@@ -824,31 +1347,31 @@ hashtable_insert (hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
 
 
 /* =============================================================================
- * TMhashtable_insert
+ * TMinsertEntry
+ * -- With counted FALSE, the caller keeps the count of pairs: size is its
+ *    count before the insert, and the size field is left alone
  * =============================================================================
  */
-bool_t
-TMhashtable_insert (TM_ARGDECL
-                    hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
+static bool_t
+TMinsertEntry (TM_ARGDECL
+               hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr,
+               bool_t counted, long size)
 {
-#ifdef HASHTABLE_SIZE_FIELD
-    long numBucket = TM_SHARED_READ(hashtablePtr->numBucket);
-#else
-    long numBucket = hashtablePtr->numBucket;
-#endif
-    long i = hashtablePtr->hash(keyPtr) % numBucket;
+    ulong_t hash = hashtablePtr->hash(keyPtr);
 #if defined(HASHTABLE_SIZE_FIELD) || defined(HASHTABLE_RESIZABLE)
-    long newSize;
+    long newSize = size + 1;
+#endif
+
+#ifdef HASHTABLE_RESIZABLE
+    if (TM_SHARED_READ_P(hashtablePtr->oldBuckets) != NULL) {
+        TMmigrate(TM_ARG  hashtablePtr, hash);
+    }
 #endif
 
     pair_t findPair;
     findPair.firstPtr = keyPtr;
-#ifdef HASHTABLE_SIZE_FIELD
-    list_t **buckets = TM_SHARED_READ(hashtablePtr->buckets);
-    pair_t* pairPtr = (pair_t*)TMLIST_FIND(TM_SHARED_READ(buckets[i]), &findPair);
-#else
-    pair_t* pairPtr = (pair_t*)TMLIST_FIND(hashtablePtr->buckets[i], &findPair);
-#endif
+    pair_t* pairPtr =
+        (pair_t*)TMLIST_FIND(TMgetChain(TM_ARG  hashtablePtr, hash), &findPair);
     if (pairPtr != NULL) {
         return FALSE;
     }
@@ -858,48 +1381,40 @@ TMhashtable_insert (TM_ARGDECL
         return FALSE;
     }
 
+    if (counted) {
 #ifdef HASHTABLE_SIZE_FIELD
-    newSize = TM_SHARED_READ(hashtablePtr->size) + 1;
-    assert(newSize > 0);
+        newSize = TM_SHARED_READ(hashtablePtr->size) + 1;
+        assert(newSize > 0);
 #elif defined(HASHTABLE_RESIZABLE)
-    newSize = TMHASHTABLE_GETSIZE(hashtablePtr) + 1;
-    assert(newSize > 0);
+        newSize = TMHASHTABLE_GETSIZE(hashtablePtr) + 1;
+        assert(newSize > 0);
 #endif
+    }
 
 #ifdef HASHTABLE_RESIZABLE
-    /* Increase number of buckets to maintain size ratio */
-    if (newSize >= (numBucket * hashtablePtr->resizeRatio)) {
-        list_t** newBuckets = TMrehash(TM_ARG  hashtablePtr);
-        if (newBuckets == NULL) {
-            return FALSE;
+    /* Increase number of buckets to maintain size ratio, once the previous
+       resize is swept */
+    if (newSize >= ((long)TM_SHARED_READ(hashtablePtr->numBucket) *
+                    hashtablePtr->resizeRatio)) {
+        if (TM_SHARED_READ_P(hashtablePtr->oldBuckets) != NULL) {
+            TMsweep(TM_ARG  hashtablePtr, HASHTABLE_SWEEP_STEP);
+        }
+        if (TM_SHARED_READ_P(hashtablePtr->oldBuckets) == NULL) {
+            TMstartResize(TM_ARG  hashtablePtr);
         }
-        TMfreeBuckets(TM_ARG  hashtablePtr->buckets, numBucket);
-        numBucket *= hashtablePtr->growthFactor;
-	TM_SHARED_WRITE(hashtablePtr->buckets, newBuckets);
-        TM_SHARED_WRITE(hashtablePtr->numBucket, numBucket);
-        i = hashtablePtr->hash(keyPtr) % numBucket;
-
     }
 #endif
 
     /* Add new entry  */
-#ifdef HASHTABLE_SIZE_FIELD
-    buckets = TM_SHARED_READ(hashtablePtr->buckets);
-    if (TMLIST_INSERT(TM_SHARED_READ(buckets[i]), insertPtr) == FALSE) {
+    if (TMLIST_INSERT(TMgetChain(TM_ARG  hashtablePtr, hash), insertPtr) == FALSE) {
         TMPAIR_FREE(insertPtr);
         return FALSE;
     }
-#else
-    if (TMLIST_INSERT(hashtablePtr->buckets[i], insertPtr) == FALSE) {
-        TMPAIR_FREE(insertPtr);
-        return FALSE;
-    }
-#endif
 
 #ifdef HASHTABLE_SIZE_FIELD
-    /*long newSize = TM_SHARED_READ(hashtablePtr->size) + 1;
-    assert(newSize > 0);*/
-    TM_SHARED_WRITE(hashtablePtr->size, newSize);
+    if (counted) {
+        TM_SHARED_WRITE(hashtablePtr->size, newSize);
+    }
 #endif
 
     return TRUE;
@@ -907,19 +1422,65 @@ TMhashtable_insert (TM_ARGDECL
 
 
 /* =============================================================================
- * hashtable_remove
- * -- Returns TRUE if successful, else FALSE
+ * hashtable_insert
  * =============================================================================
  */
 bool_t
-hashtable_remove (hashtable_t* hashtablePtr, void* keyPtr)
+hashtable_insert (hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
 {
-    long numBucket = hashtablePtr->numBucket;
-    long i = hashtablePtr->hash(keyPtr) % numBucket;
-    list_t* chainPtr = hashtablePtr->buckets[i];
+    return insertEntry(hashtablePtr, keyPtr, dataPtr, TRUE, 0);
+}
+
+
+/* =============================================================================
+ * TMhashtable_insert
+ * =============================================================================
+ */
+bool_t
+TMhashtable_insert (TM_ARGDECL
+                    hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
+{
+    return TMinsertEntry(TM_ARG  hashtablePtr, keyPtr, dataPtr, TRUE, 0);
+}
+
+
+/* =============================================================================
+ * hashtable_insertUncounted
+ * =============================================================================
+ */
+bool_t
+hashtable_insertUncounted (hashtable_t* hashtablePtr,
+                           void* keyPtr, void* dataPtr, long size)
+{
+    return insertEntry(hashtablePtr, keyPtr, dataPtr, FALSE, size);
+}
+
+
+/* =============================================================================
+ * TMhashtable_insertUncounted
+ * =============================================================================
+ */
+bool_t
+TMhashtable_insertUncounted (TM_ARGDECL  hashtable_t* hashtablePtr,
+                             void* keyPtr, void* dataPtr, long size)
+{
+    return TMinsertEntry(TM_ARG  hashtablePtr, keyPtr, dataPtr, FALSE, size);
+}
+
+
+/* =============================================================================
+ * removeEntry
+ * -- With counted FALSE, the size field is left alone
+ * =============================================================================
+ */
+static bool_t
+removeEntry (hashtable_t* hashtablePtr, void* keyPtr, bool_t counted)
+{
+    list_t* chainPtr;
     pair_t* pairPtr;
     pair_t removePair;
 
+    chainPtr = getChain(hashtablePtr, hashtablePtr->hash(keyPtr));
     removePair.firstPtr = keyPtr;
     pairPtr = (pair_t*)list_find(chainPtr, &removePair);
     if (pairPtr == NULL) {
@@ -931,8 +1492,10 @@ hashtable_remove (hashtable_t* hashtablePtr, void* keyPtr)
     pair_free(pairPtr);
 
 #ifdef HASHTABLE_SIZE_FIELD
-    hashtablePtr->size--;
-    assert(hashtablePtr->size >= 0);
+    if (counted) {
+        hashtablePtr->size--;
+        assert(hashtablePtr->size >= 0);
+    }
 #endif
 
     return TRUE;
@@ -940,19 +1503,18 @@ hashtable_remove (hashtable_t* hashtablePtr, void* keyPtr)
 
 
 /* =============================================================================
- * TMhashtable_remove
- * -- Returns TRUE if successful, else FALSE
+ * TMremoveEntry
+ * -- With counted FALSE, the size field is left alone
  * =============================================================================
  */
-bool_t
-TMhashtable_remove (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
+static bool_t
+TMremoveEntry (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr, bool_t counted)
 {
-    long numBucket = hashtablePtr->numBucket;
-    long i = hashtablePtr->hash(keyPtr) % numBucket;
-    list_t* chainPtr = hashtablePtr->buckets[i];
+    list_t* chainPtr;
     pair_t* pairPtr;
     pair_t removePair;
 
+    chainPtr = TMgetChain(TM_ARG  hashtablePtr, hashtablePtr->hash(keyPtr));
     removePair.firstPtr = keyPtr;
     pairPtr = (pair_t*)TMLIST_FIND(chainPtr, &removePair);
     if (pairPtr == NULL) {
@@ -964,15 +1526,104 @@ TMhashtable_remove (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
     TMPAIR_FREE(pairPtr);
 
 #ifdef HASHTABLE_SIZE_FIELD
-    TM_SHARED_WRITE(hashtablePtr->size,
-                    (long)TM_SHARED_READ(hashtablePtr->size)-1);
-    assert(hashtablePtr->size >= 0);
+    if (counted) {
+        TM_SHARED_WRITE(hashtablePtr->size,
+                        (long)TM_SHARED_READ(hashtablePtr->size)-1);
+        assert(hashtablePtr->size >= 0);
+    }
 #endif
 
     return TRUE;
 }
 
 
+/* =============================================================================
+ * hashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+hashtable_remove (hashtable_t* hashtablePtr, void* keyPtr)
+{
+    return removeEntry(hashtablePtr, keyPtr, TRUE);
+}
+
+
+/* =============================================================================
+ * TMhashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+TMhashtable_remove (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
+{
+    return TMremoveEntry(TM_ARG  hashtablePtr, keyPtr, TRUE);
+}
+
+
+/* =============================================================================
+ * hashtable_removeUncounted
+ * =============================================================================
+ */
+bool_t
+hashtable_removeUncounted (hashtable_t* hashtablePtr, void* keyPtr)
+{
+    return removeEntry(hashtablePtr, keyPtr, FALSE);
+}
+
+
+/* =============================================================================
+ * TMhashtable_removeUncounted
+ * =============================================================================
+ */
+bool_t
+TMhashtable_removeUncounted (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr)
+{
+    return TMremoveEntry(TM_ARG  hashtablePtr, keyPtr, FALSE);
+}
+
+
+/* =============================================================================
+ * hashtable_printStats
+ * -- Without HASHTABLE_STATS, prints nothing
+ * =============================================================================
+ */
+void
+hashtable_printStats (hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_STATS
+    long numMigrateOp = hashtablePtr->numMigrateOp;
+
+    printf("#HASHTABLE_STATS %15ld resize\n", hashtablePtr->numResize);
+    printf("#HASHTABLE_STATS %15ld migrate_op\n", numMigrateOp);
+    printf("#HASHTABLE_STATS %15ld migrate_bucket\n", hashtablePtr->numMigrateBucket);
+    printf("#HASHTABLE_STATS %15ld migrate_pair\n", hashtablePtr->numMigratePair);
+    printf("#HASHTABLE_STATS %15.2f migrate_pair_per_op\n",
+           (numMigrateOp ? (double)hashtablePtr->numMigratePair / numMigrateOp : 0.0));
+    printf("#HASHTABLE_STATS %15ld max_migrate_pair_per_op\n", hashtablePtr->maxMigratePair);
+#endif
+}
+
+
+/* =============================================================================
+ * hashtable_addStats
+ * =============================================================================
+ */
+void
+hashtable_addStats (hashtable_t* sumPtr, hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_STATS
+    sumPtr->numResize += hashtablePtr->numResize;
+    sumPtr->numMigrateOp += hashtablePtr->numMigrateOp;
+    sumPtr->numMigrateBucket += hashtablePtr->numMigrateBucket;
+    sumPtr->numMigratePair += hashtablePtr->numMigratePair;
+    if (hashtablePtr->maxMigratePair > sumPtr->maxMigratePair) {
+        sumPtr->maxMigratePair = hashtablePtr->maxMigratePair;
+    }
+#endif
+}
+
+
 /* =============================================================================
  * TEST_HASHTABLE
  * =============================================================================
@@ -1011,12 +1662,16 @@ printHashtable (hashtable_t* hashtablePtr)
     puts("]");
 
     /* Low-level to see structure */
-    for (i = 0; i < hashtablePtr->numBucket; i++) {
+    for (i = 0; i < getNumChain(hashtablePtr); i++) {
+        list_t* chainPtr = getChainAt(hashtablePtr, i);
         list_iter_t it;
+        if (chainPtr == NULL) {
+            continue;
+        }
         printf("%2li: [", i);
-        list_iter_reset(&it, hashtablePtr->buckets[i]);
-        while (list_iter_hasNext(&it, hashtablePtr->buckets[i])) {
-            void* pairPtr = list_iter_next(&it, hashtablePtr->buckets[i]);
+        list_iter_reset(&it, chainPtr);
+        while (list_iter_hasNext(&it, chainPtr)) {
+            void* pairPtr = list_iter_next(&it, chainPtr);
             printf("%li ", *(long*)(((pair_t*)pairPtr)->secondPtr));
         }
         puts("]");
@@ -1049,7 +1704,10 @@ main ()
 {
     hashtable_t* hashtablePtr;
     long data[] = {3, 1, 4, 1, 5, 9, 2, 6, 8, 7, -1};
+    long* keys;
+    long numKey = 1000;
     long i;
+    long j;
 
     puts("Starting...");
 
@@ -1067,6 +1725,31 @@ main ()
 
     hashtable_free(hashtablePtr);
 
+    /* Lookups, inserts and removes while the buckets migrate */
+    keys = (long*)malloc(numKey * sizeof(long));
+    assert(keys);
+    hashtablePtr = hashtable_alloc(1, &hash, &comparePairs, -1, -1);
+    for (i = 0; i < numKey; i++) {
+        keys[i] = i * 7;
+        assert(hashtable_insert(hashtablePtr, &keys[i], &keys[i]));
+        assert(!hashtable_insert(hashtablePtr, &keys[i], &keys[i]));
+        for (j = 0; j <= i; j++) {
+            assert(hashtable_find(hashtablePtr, &keys[j]) == &keys[j]);
+        }
+        assert(hashtable_getSize(hashtablePtr) == (i + 1));
+    }
+    for (i = 0; i < numKey; i += 2) {
+        assert(hashtable_remove(hashtablePtr, &keys[i]));
+        assert(!hashtable_containsKey(hashtablePtr, &keys[i]));
+    }
+    for (i = 1; i < numKey; i += 2) {
+        assert(hashtable_find(hashtablePtr, &keys[i]) == &keys[i]);
+    }
+    assert(hashtable_getSize(hashtablePtr) == (numKey / 2));
+    hashtable_printStats(hashtablePtr);
+    hashtable_free(hashtablePtr);
+    free(keys);
+
     puts("Done.");
 
     return 0;
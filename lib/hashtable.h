@@ -14,6 +14,12 @@
  * LIST_NO_DUPLICATES (default: allow duplicates)
  *
  * HASHTABLE_RESIZABLE (enable dynamically increasing number of buckets)
+ *     The pairs move to the larger bucket array one bucket at a time,
+ *     by the inserts into it; HASHTABLE_SWEEP_STEP sets how many slots of
+ *     the old array an insert sweeps once the table is due to grow again
+ *
+ * HASHTABLE_STATS (count the resizes and the migration work done by
+ *     inserts, see hashtable_printStats())
  *
  * HASHTABLE_SIZE_FIELD (size is explicitely stored in
  *     hashtable and not implicitly defined by the sizes of
@@ -102,9 +108,27 @@ enum hashtable_config {
     HASHTABLE_DEFAULT_GROWTH_FACTOR = 3
 };
 
+#ifndef HASHTABLE_SWEEP_STEP
+#  define HASHTABLE_SWEEP_STEP 16 /* old bucket slots swept per insert */
+#endif
+
 typedef struct hashtable {
     list_t** buckets;
     long numBucket;
+#ifdef HASHTABLE_RESIZABLE
+    /* While a resize is in progress: the previous bucket array, whose
+       moved buckets are NULL, all of them in [0, swept) */
+    list_t** oldBuckets;
+    long oldNumBucket;
+    long swept;
+#endif
+#ifdef HASHTABLE_STATS
+    long numResize;
+    long numMigrateOp;     /* inserts that moved buckets */
+    long numMigrateBucket;
+    long numMigratePair;
+    long maxMigratePair;   /* moved by a single operation */
+#endif
 #ifdef HASHTABLE_SIZE_FIELD
     long size;
 #endif
@@ -343,6 +367,42 @@ bool_t
 TMhashtable_remove (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr);
 
 
+/* =============================================================================
+ * hashtable_insertUncounted, hashtable_removeUncounted
+ * -- As hashtable_insert and hashtable_remove, for callers that keep the
+ *    count of pairs themselves (see conc_hashtable.c): the size field is
+ *    left alone, and size is the caller's count before the insert, which
+ *    decides when HASHTABLE_RESIZABLE grows the table
+ * =============================================================================
+ */
+bool_t
+hashtable_insertUncounted (hashtable_t* hashtablePtr,
+                           void* keyPtr, void* dataPtr, long size);
+
+bool_t
+TMhashtable_insertUncounted (TM_ARGDECL  hashtable_t* hashtablePtr,
+                             void* keyPtr, void* dataPtr, long size);
+
+bool_t
+hashtable_removeUncounted (hashtable_t* hashtablePtr, void* keyPtr);
+
+bool_t
+TMhashtable_removeUncounted (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * hashtable_printStats
+ * -- Without HASHTABLE_STATS, prints nothing
+ * =============================================================================
+ */
+void
+hashtable_printStats (hashtable_t* hashtablePtr);
+
+/* Adds the counters of hashtablePtr to those of sumPtr */
+void
+hashtable_addStats (hashtable_t* sumPtr, hashtable_t* hashtablePtr);
+
+
 #define TMHASHTABLE_ITER_RESET(it, ht)    TMhashtable_iter_reset(TM_ARG  it, ht)
 #define TMHASHTABLE_ITER_HASNEXT(it, ht)  TMhashtable_iter_hasNext(TM_ARG  it, ht)
 #define TMHASHTABLE_ITER_NEXT(it, ht)     TMhashtable_iter_next(TM_ARG  it, ht)
@@ -353,6 +413,9 @@ TMhashtable_remove (TM_ARGDECL  hashtable_t* hashtablePtr, void* keyPtr);
 #define TMHASHTABLE_FIND(ht, k)           TMhashtable_find(TM_ARG  ht, k)
 #define TMHASHTABLE_INSERT(ht, k, d)      TMhashtable_insert(TM_ARG  ht, k, d)
 #define TMHASHTABLE_REMOVE(ht, k)         TMhashtable_remove(TM_ARG  ht, k)
+#define TMHASHTABLE_INSERTUNCOUNTED(ht, k, d, n) \
+    TMhashtable_insertUncounted(TM_ARG  ht, k, d, n)
+#define TMHASHTABLE_REMOVEUNCOUNTED(ht, k) TMhashtable_removeUncounted(TM_ARG  ht, k)
 
 
 #ifdef __cplusplus
@@ -1,100 +1,44 @@
-/* Copyright (c) IBM Corp. 2014. */
-/* Code that uses Intel Hardware Lock Elision: derived from htm_ibm.c */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <inttypes.h>
-#include <unistd.h>
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* Intel TSX support of htm_ibm.c.  HLE_INTEL builds run the retry engine
+   of htm_ibm.c on RTM (xbegin/xend/xabort, see htm_util.h), with its
+   statistics and fallback locks; with HTM_HLE set, regions instead elide
+   the fallback lock with the XACQUIRE/XRELEASE primitives below. */
+#include <cpuid.h>
 #include <immintrin.h>
 #include "hle_intel.h"
-#include "thread.h"
 
-#define NUM_ATOMIC_REGIONS 20
+/* xtest raises #UD on processors with neither HLE nor RTM */
+static int xtest_supported = 0;
 
-int global_lock;
-static THREAD_KEY_T global_tls_key;
-typedef struct event_counters_struct {
-	unsigned long long event_tx_enter;
-	unsigned long long event_tx;
-} event_counters_t;
-typedef struct tls_struct {
-	event_counters_t event_counters[NUM_ATOMIC_REGIONS];
-} tls_t;
-static event_counters_t global_event_counters;
-static event_counters_t global_ctr_per_region[NUM_ATOMIC_REGIONS];
-static int global_evt_ctrs_lock = 0;
+int hle_supported(void) {
+	unsigned int eax, ebx, ecx, edx;
 
-void tm_startup_hle() {
-	__atomic_store_n(&global_lock,0,__ATOMIC_RELEASE);
-	THREAD_KEY_INIT(global_tls_key);
-	
-	memset(&global_event_counters,0,sizeof(global_event_counters));
-	memset(&global_ctr_per_region,0,sizeof(global_ctr_per_region));
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	xtest_supported = (ebx >> 4) & 1 || (ebx >> 11) & 1;
+	return (ebx >> 4) & 1;
 }
 
-static void print_stats_hle(event_counters_t *stats) {
-	fprintf(stderr, "#HTM_STATS %15llu           tx_enter\n", stats->event_tx_enter);
-	fprintf(stderr, "#HTM_STATS %15llu %6.2f %%  tx\n", stats->event_tx, 100 * stats->event_tx / (double)stats->event_tx_enter);
-}
-
-void tm_shutdown_hle() {
-	int region;
-	for(region=0; region<NUM_ATOMIC_REGIONS; region++) {
-		global_event_counters.event_tx_enter+=global_ctr_per_region[region].event_tx_enter;
-		global_event_counters.event_tx+=global_ctr_per_region[region].event_tx;
-	}
-	print_stats_hle(&global_event_counters);
-	for(region=0; region<NUM_ATOMIC_REGIONS; region++) {
-		if(global_ctr_per_region[region].event_tx_enter) {
-			fprintf(stderr, "--- region %d ------------------------------\n", region);
-			print_stats_hle(&global_ctr_per_region[region]);
-		}
+/* An elided region that aborts is re-executed from here, this time
+   taking the lock; _mm_pause() aborts an elision that finds it held */
+void hle_acquire(volatile int *lock) {
+	while(__atomic_exchange_n(lock,1,__ATOMIC_ACQUIRE|__ATOMIC_HLE_ACQUIRE)) {
+		while(*lock)
+			_mm_pause();
 	}
 }
 
-void tm_thread_enter_hle() {
-	tls_t *tls;
-	if(!(tls=malloc(sizeof(tls_t)))) {
-		perror("malloc tls");
-		exit(1);
-	}
-	memset(tls,0,sizeof(tls_t));
-	THREAD_KEY_SET(global_tls_key,tls);
+void hle_release(volatile int *lock) {
+	__atomic_store_n(lock,0,__ATOMIC_RELEASE|__ATOMIC_HLE_RELEASE);
 }
 
-void tm_thread_exit_hle() {
-	tls_t *tls;
-	tls=THREAD_KEY_GET(global_tls_key);
-	int region;
-	/* Lock Global counters */
-	while(__atomic_exchange_n(&global_evt_ctrs_lock,1,__ATOMIC_ACQUIRE|__ATOMIC_HLE_ACQUIRE))
-		_mm_pause();
-	for(region=0; region<NUM_ATOMIC_REGIONS; region++) {
-		global_ctr_per_region[region].event_tx_enter += tls->event_counters[region].event_tx_enter;
-		global_ctr_per_region[region].event_tx += tls->event_counters[region].event_tx;
-	}
-	/* unlock global counters */
-	__atomic_store_n(&global_evt_ctrs_lock,0,__ATOMIC_RELEASE|__ATOMIC_HLE_RELEASE);
-	free(tls);
-}
-
-void tbegin_hle(int region_id) {
-	tls_t *tls;
-	tls=THREAD_KEY_GET(global_tls_key);
-	tls->event_counters[region_id].event_tx_enter++;
-	while(__atomic_exchange_n(&global_lock,1,__ATOMIC_ACQUIRE|__ATOMIC_HLE_ACQUIRE))
-		_mm_pause();
-	if(!_xtest()) {
-		tls->event_counters[region_id].event_tx++;
-	}
-	return;
-}
-
-void tend_hle() {
-	__atomic_store_n(&global_lock,0,__ATOMIC_RELEASE|__ATOMIC_HLE_RELEASE);
-}
+int hle_elided(void) {
+	unsigned char in_tx;
 
-void tabort_hle() {
-  asm volatile(".byte 0xc6; .byte 0xf8; .byte 0xff" :: );
-  /*__builtin_ia32_xabort(0xff);*/
+	if (!xtest_supported)
+		return 0;
+	asm volatile(".byte 0x0f; .byte 0x01; .byte 0xd6;" /* xtest */
+		     "setnz %0" : "=r"(in_tx) :: "cc");
+	return in_tx;
 }
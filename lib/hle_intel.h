@@ -1,15 +1,19 @@
-/* Copyright (c) IBM Corp. 2014. */
+/* Copyright (c) IBM Corp. 2014, and others. */
 #ifndef HLE_INTEL_H
 #define HLE_INTEL_H 1
 
-extern void tm_startup_hle();
-extern void tm_shutdown_hle();
+/* Hardware Lock Elision for the HTM_HLE mode of htm_ibm.c, see
+   hle_intel.c */
 
-extern void tm_thread_enter_hle();
-extern void tm_thread_exit_hle();
+/* Nonzero if the processor elides XACQUIRE/XRELEASE locks; without HLE
+   the prefixes are ignored and the lock is simply taken.  Call it once
+   before hle_elided() */
+extern int hle_supported(void);
 
-extern void tbegin_hle(int region_id);
-extern void tend_hle();
-extern void tabort_hle();
+extern void hle_acquire(volatile int *lock);
+extern void hle_release(volatile int *lock);
+
+/* Nonzero while the caller runs an elided (or RTM) transaction */
+extern int hle_elided(void);
 
 #endif
@@ -0,0 +1,458 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/*
+ * Software emulation of a best-effort HTM, for hosts without usable
+ * TSX/POWER HTM.  Transactions buffer their writes (redo log) and
+ * validate their reads by value against a global sequence lock, in the
+ * style of NOrec.  The distinct cache lines read and written are counted
+ * to model the hardware footprint: exceeding HTM_EMU_RCAP read lines or
+ * HTM_EMU_WCAP written lines aborts the transaction with a capacity abort,
+ * just like an L1 (write) or L2/bloom-filter (read) overflow would.
+ *
+ * Abort codes follow the IA32 RTM encoding, so the htm_ia32_stat.h
+ * counters and the retry policy of htm_ibm.c apply unchanged:
+ *   conflict  -> XABORT_CONFLICT | XABORT_RETRY   (transient)
+ *   capacity  -> XABORT_CAPACITY                  (persistent)
+ *   tabort()  -> XABORT_EXPLICIT | code << 24      (persistent)
+ *
+ * An abort also reports where it was seen, as the POWER TFIAR would: the
+ * return address of the tload()/tstore() (or tend()) that detected it,
+ * and the address of the data involved.  After htm_emu_record_sites(1),
+ * a conflict found when revalidating reports the site of the stale read
+ * instead.
+ */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "htm_util.h"
+#include "txlog.h"
+
+#if defined(__PPC__) || defined(_ARCH_PPC)
+#define HTM_EMU_LINE_SHIFT 7
+#else
+#define HTM_EMU_LINE_SHIFT 6
+#endif
+
+#define HTM_EMU_DEFAULT_READ_CAPACITY  4096  /* lines tracked for reads */
+#define HTM_EMU_DEFAULT_WRITE_CAPACITY 512   /* 32KB L1D of 64B lines */
+#define HTM_EMU_LIMBO_BATCH 64
+
+typedef struct htm_emu_tx {
+  int active;
+  int pending;
+  int nontx;                    /* owns the sequence lock (nontx_begin) */
+  uint64_t abort_code;
+  void *site;                   /* return address of the current access */
+  uint64_t abort_site;
+  uint64_t abort_addr;
+  uintptr_t snapshot;
+  unsigned long gen;
+  sigjmp_buf *checkpoint;
+  txepoch_t epoch;              /* start = snapshot, or pin time */
+  txlog_t reads;
+  txlog_t read_sites;           /* addr = site of reads[i] */
+  txlog_t writes;
+  txset_t write_index;
+  txset_t read_lines;
+  txset_t write_lines;
+  txlog_t frees;
+  txlog_t limbo;                /* addr = block, value = freeing time */
+} htm_emu_tx_t;
+
+static union {
+  char two_cache_lines[512];
+  struct {
+    char one_cache_line[256];
+    volatile uintptr_t seq;
+    char another_cache_line[248];
+  } a;
+} emu_clock;
+
+static long read_capacity = HTM_EMU_DEFAULT_READ_CAPACITY;
+static long write_capacity = HTM_EMU_DEFAULT_WRITE_CAPACITY;
+static int record_sites = 0;
+
+static __thread htm_emu_tx_t htm_emu_tx;
+static txepoch_registry_t emu_threads;
+
+void
+htm_emu_startup(void)
+{
+  const char *env_read_capacity;
+  const char *env_write_capacity;
+
+  emu_clock.a.seq = 0;
+
+  env_read_capacity = getenv("HTM_EMU_RCAP");
+  if (env_read_capacity) {
+    read_capacity = atol(env_read_capacity);
+    printf("<HTM_EMU_RCAP=%ld>\n", read_capacity);
+  }
+
+  env_write_capacity = getenv("HTM_EMU_WCAP");
+  if (env_write_capacity) {
+    write_capacity = atol(env_write_capacity);
+    printf("<HTM_EMU_WCAP=%ld>\n", write_capacity);
+  }
+}
+
+void
+htm_emu_thread_enter(sigjmp_buf *checkpoint)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+
+  memset(tx, 0, sizeof(*tx));
+  tx->checkpoint = checkpoint;
+  txlog_alloc(&tx->reads);
+  txlog_alloc(&tx->read_sites);
+  txlog_alloc(&tx->writes);
+  txset_alloc(&tx->write_index, TXLOG_INIT_SIZE);
+  txset_alloc(&tx->read_lines, TXLOG_INIT_SIZE);
+  txset_alloc(&tx->write_lines, TXLOG_INIT_SIZE);
+  txlog_alloc(&tx->frees);
+  txlog_alloc(&tx->limbo);
+  txepoch_register(&emu_threads, &tx->epoch);
+}
+
+void
+htm_emu_thread_exit(void)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+
+  while (tx->limbo.size != 0) {
+    txlog_reclaim(&tx->limbo, txepoch_oldest(&emu_threads));
+    txlog_relax();
+  }
+  txepoch_unregister(&emu_threads, &tx->epoch);
+  txlog_free(&tx->frees);
+  txlog_free(&tx->limbo);
+  txlog_free(&tx->reads);
+  txlog_free(&tx->read_sites);
+  txlog_free(&tx->writes);
+  txset_free(&tx->write_index);
+  txset_free(&tx->read_lines);
+  txset_free(&tx->write_lines);
+  memset(tx, 0, sizeof(*tx));
+}
+
+/* Publishes an even clock value no later than any state the caller is
+   about to read, so that blocks freed from then on outlive its reads. */
+static uintptr_t
+pin(htm_emu_tx_t *tx)
+{
+  uintptr_t seq;
+
+  do {
+    while ((seq = emu_clock.a.seq) & 1) {
+      txlog_relax();
+    }
+    tx->epoch.start = seq;
+    __sync_synchronize();
+  } while (seq != emu_clock.a.seq);
+  return seq;
+}
+
+static void
+htm_emu_abort(htm_emu_tx_t *tx, uint64_t code, void *site, const volatile void *addr)
+{
+  tx->active = 0;
+  tx->epoch.start = TXEPOCH_INACTIVE;
+  tx->pending = 1;
+  tx->abort_code = code;
+  tx->abort_site = (uint64_t)(uintptr_t)site;
+  tx->abort_addr = (uint64_t)(uintptr_t)addr;
+  siglongjmp(*tx->checkpoint, 1);
+}
+
+/* Waits for a stable even sequence number and re-checks every logged read
+   against memory.  Returns the sequence number the read set is consistent
+   with; aborts on a mismatch. */
+static uintptr_t
+validate(htm_emu_tx_t *tx)
+{
+  for ( ; ; ) {
+    uintptr_t seq = emu_clock.a.seq;
+    long i;
+
+    if (seq & 1) {
+      txlog_relax();
+      continue;
+    }
+    __sync_synchronize();
+    for (i = 0; i < tx->reads.size; i++) {
+      txlog_entry_t *e = &tx->reads.entries[i];
+      if (txlog_load_word(e->addr, e->size) != e->value) {
+	void *site = record_sites ? (void *)tx->read_sites.entries[i].addr : tx->site;
+	htm_emu_abort(tx, XABORT_CONFLICT | XABORT_RETRY, site, e->addr);
+      }
+    }
+    __sync_synchronize();
+    if (seq == emu_clock.a.seq) {
+      return seq;
+    }
+  }
+}
+
+static inline void
+track_line(htm_emu_tx_t *tx, txset_t *lines, long capacity, const volatile void *addr)
+{
+  long *seen = txset_lookup(lines, (uintptr_t)addr >> HTM_EMU_LINE_SHIFT, tx->gen, 1);
+
+  if (*seen < 0) {
+    *seen = 0;
+    if (lines->count > capacity) {
+      htm_emu_abort(tx, XABORT_CAPACITY, tx->site, addr);
+    }
+  }
+}
+
+/* Frees ptr once no transaction, and no pinned reader, that could still
+   see it is running.  The tag is the first even clock value after the
+   commit (or non-transactional section) that unlinked it. */
+static void
+retire(htm_emu_tx_t *tx, void *ptr)
+{
+  txlog_entry_t *e = txlog_append(&tx->limbo);
+
+  e->addr = ptr;
+  e->value = (emu_clock.a.seq | 1) + 1;
+  if (tx->limbo.size >= HTM_EMU_LIMBO_BATCH) {
+    txlog_reclaim(&tx->limbo, txepoch_oldest(&emu_threads));
+  }
+}
+
+int
+tbegin(int rot, TransactionDiagnosticInfo *diag)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+
+  if (tx->pending) {
+    tx->pending = 0;
+    diag->transactionAbortCode = tx->abort_code;
+    diag->abortedTransactionInstructionAddress = tx->abort_site;
+    diag->conflictAddress = tx->abort_addr;
+    return (tx->abort_code & XABORT_RETRY) ? 2 : 3;
+  }
+
+  assert(!tx->active);
+  tx->gen++;
+  tx->reads.size = 0;
+  tx->read_sites.size = 0;
+  tx->writes.size = 0;
+  tx->write_index.count = 0;
+  tx->read_lines.count = 0;
+  tx->write_lines.count = 0;
+  tx->frees.size = 0;
+  tx->snapshot = pin(tx);
+  tx->active = 1;
+
+  return 0;
+}
+
+void
+tend(void)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+  long i;
+
+  if (!tx->active) {
+    return;
+  }
+
+  tx->site = __builtin_return_address(0);
+  if (tx->writes.size != 0) {
+    while (!__sync_bool_compare_and_swap(&emu_clock.a.seq, tx->snapshot, tx->snapshot + 1)) {
+      tx->snapshot = validate(tx);
+    }
+    for (i = 0; i < tx->writes.size; i++) {
+      txlog_entry_t *e = &tx->writes.entries[i];
+      txlog_store_word(e->addr, e->value, e->size);
+    }
+    __sync_synchronize();
+    emu_clock.a.seq = tx->snapshot + 2;
+  }
+
+  tx->active = 0;
+  tx->epoch.start = TXEPOCH_INACTIVE;
+  for (i = 0; i < tx->frees.size; i++) {
+    retire(tx, (void *)tx->frees.entries[i].addr);
+  }
+}
+
+void
+tabort(uint64_t code)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+
+  /* Like XABORT, a no-op outside of a transaction */
+  if (tx->active) {
+    htm_emu_abort(tx, XABORT_EXPLICIT | ((code & 0xff) << 24), __builtin_return_address(0), NULL);
+  }
+}
+
+int
+tpending(void)
+{
+  return htm_emu_tx.pending;
+}
+
+int
+ttest(void)
+{
+  return htm_emu_tx.active;
+}
+
+void
+htm_emu_load(const volatile void *addr, void *buf, size_t size)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+  txlog_entry_t *e;
+  uint64_t value;
+  long *idx;
+
+  if (!tx->active) {
+    /* Never observe half of an emulated commit, which a hardware commit
+       would not expose either.  The owner of the sequence lock reads
+       plainly. */
+    if (tx->nontx) {
+      value = txlog_load_word(addr, size);
+    } else {
+      uintptr_t seq;
+      do {
+	while ((seq = emu_clock.a.seq) & 1) {
+	  txlog_relax();
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	value = txlog_load_word(addr, size);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+      } while (seq != emu_clock.a.seq);
+    }
+    txlog_store_word(buf, value, size);
+    return;
+  }
+
+  idx = txset_lookup(&tx->write_index, (uintptr_t)addr, tx->gen, 0);
+  if (idx != NULL) {
+    e = &tx->writes.entries[*idx];
+    assert(e->size == size);
+    txlog_store_word(buf, e->value, size);
+    return;
+  }
+
+  tx->site = __builtin_return_address(0);
+  track_line(tx, &tx->read_lines, read_capacity, addr);
+
+  value = txlog_load_word(addr, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  while (tx->snapshot != emu_clock.a.seq) {
+    tx->snapshot = validate(tx);
+    value = txlog_load_word(addr, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+
+  e = txlog_append(&tx->reads);
+  e->addr = (volatile void *)addr;
+  e->value = value;
+  e->size = size;
+  if (record_sites) {
+    txlog_append(&tx->read_sites)->addr = tx->site;
+  }
+  txlog_store_word(buf, value, size);
+}
+
+void
+htm_emu_store(volatile void *addr, const void *buf, size_t size)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+  txlog_entry_t *e;
+  uint64_t value = txlog_load_word(buf, size);
+  long *idx;
+
+  if (!tx->active) {
+    txlog_store_word(addr, value, size);
+    return;
+  }
+
+  tx->site = __builtin_return_address(0);
+  track_line(tx, &tx->write_lines, write_capacity, addr);
+
+  idx = txset_lookup(&tx->write_index, (uintptr_t)addr, tx->gen, 1);
+  if (*idx < 0) {
+    *idx = tx->writes.size;
+    e = txlog_append(&tx->writes);
+    e->addr = addr;
+    e->size = size;
+  } else {
+    e = &tx->writes.entries[*idx];
+    assert(e->size == size);
+  }
+  e->value = value;
+}
+
+/* The hardware would roll back a free() made inside an aborted
+   transaction, and concurrent transactions may still read the block while
+   they validate: defer it to commit, then until they are done. */
+void
+htm_emu_free(void *ptr)
+{
+  htm_emu_tx_t *tx = &htm_emu_tx;
+
+  if (tx->active) {
+    txlog_append(&tx->frees)->addr = ptr;
+  } else if (tx->limbo.entries != NULL) {
+    retire(tx, ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+/* Non-transactional readers that may race with commits (the software path
+   of HTM_HYBRID) pin the clock so that the blocks they reach stay mapped */
+void
+htm_emu_pin(void)
+{
+  pin(&htm_emu_tx);
+}
+
+void
+htm_emu_unpin(void)
+{
+  htm_emu_tx.epoch.start = TXEPOCH_INACTIVE;
+}
+
+/* Keeps the site of every transactional read, so that a conflict points
+   at the read that went stale (HTM_PROFILE in htm_ibm.c) */
+void
+htm_emu_record_sites(int on)
+{
+  record_sites = on;
+}
+
+/* Stores made while holding the fallback lock are not transactional.
+   Owning the sequence lock for that period makes concurrent emulated
+   transactions wait and then revalidate, which is what the cache
+   coherence protocol achieves for a real HTM. */
+void
+htm_emu_nontx_begin(void)
+{
+  for ( ; ; ) {
+    uintptr_t seq = emu_clock.a.seq;
+    if (!(seq & 1) && __sync_bool_compare_and_swap(&emu_clock.a.seq, seq, seq + 1)) {
+      htm_emu_tx.nontx = 1;
+      return;
+    }
+    txlog_relax();
+  }
+}
+
+void
+htm_emu_nontx_end(void)
+{
+  htm_emu_tx.nontx = 0;
+  __sync_synchronize();
+  emu_clock.a.seq++;
+}
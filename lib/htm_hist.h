@@ -0,0 +1,127 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * htm_hist.h
+ *
+ * Log-linear latency histograms for the statistics of htm_ibm.c.
+ *
+ * Values below 2^HTM_HIST_SUB_BITS get a bucket each; above that, every
+ * power of two is split into 2^HTM_HIST_SUB_BITS equal buckets, so a
+ * bucket is never wider than 1/8 of its lower bound.  Values of 2^40 and
+ * more share the last bucket.  Recording is a couple of shifts and an
+ * increment, cheap enough to run on every attempt of every region.
+ *
+ * =============================================================================
+ */
+
+#ifndef HTM_HIST_H
+#define HTM_HIST_H 1
+
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTM_HIST_SUB_BITS 3
+#define HTM_HIST_SUB      (1 << HTM_HIST_SUB_BITS)
+#define HTM_HIST_MAX_BITS 40
+#define HTM_HIST_BUCKETS  ((HTM_HIST_MAX_BITS - HTM_HIST_SUB_BITS + 1) * HTM_HIST_SUB)
+
+typedef struct htm_hist {
+  unsigned long long count;
+  unsigned long long max;
+  unsigned long long bucket[HTM_HIST_BUCKETS];
+} htm_hist_t;
+
+static inline int
+htm_hist_index (unsigned long long value)
+{
+  int e;
+
+  if (value < HTM_HIST_SUB) {
+    return (int)value;
+  }
+  e = 63 - __builtin_clzll(value);
+  if (e >= HTM_HIST_MAX_BITS) {
+    return HTM_HIST_BUCKETS - 1;
+  }
+  return (e - HTM_HIST_SUB_BITS + 1) * HTM_HIST_SUB
+    + (int)((value >> (e - HTM_HIST_SUB_BITS)) & (HTM_HIST_SUB - 1));
+}
+
+/* Smallest value that falls into bucket i */
+static inline unsigned long long
+htm_hist_lower (int i)
+{
+  int e;
+
+  if (i < HTM_HIST_SUB) {
+    return i;
+  }
+  e = i / HTM_HIST_SUB + HTM_HIST_SUB_BITS - 1;
+  return (unsigned long long)(HTM_HIST_SUB + i % HTM_HIST_SUB) << (e - HTM_HIST_SUB_BITS);
+}
+
+static inline void
+htm_hist_record (htm_hist_t *h, unsigned long long value)
+{
+  h->count++;
+  h->bucket[htm_hist_index(value)]++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+static inline void
+htm_hist_merge (htm_hist_t *to, const htm_hist_t *from)
+{
+  int i;
+
+  if (from->count == 0) {
+    return;
+  }
+  to->count += from->count;
+  for (i = 0; i < HTM_HIST_BUCKETS; i++) {
+    to->bucket[i] += from->bucket[i];
+  }
+  if (from->max > to->max) {
+    to->max = from->max;
+  }
+}
+
+/* Upper bound of the bucket holding the value at the given fraction
+   (0.99 for p99), never above the largest value recorded */
+static inline unsigned long long
+htm_hist_percentile (const htm_hist_t *h, double fraction)
+{
+  unsigned long long rank = (unsigned long long)(fraction * h->count + 0.5);
+  unsigned long long seen = 0;
+  int i;
+
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (i = 0; i < HTM_HIST_BUCKETS - 1; i++) {
+    seen += h->bucket[i];
+    if (seen >= rank) {
+      unsigned long long upper = htm_hist_lower(i + 1) - 1;
+      return upper < h->max ? upper : h->max;
+    }
+  }
+  return h->max;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTM_HIST_H */
+
+
+/* =============================================================================
+ *
+ * End of htm_hist.h
+ *
+ * =============================================================================
+ */
@@ -5,29 +5,49 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 #include <unistd.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "htm_ibm.h"
 #include "htm_util.h"
 #include "thread.h"
 #include "mfence.h"
 #include "tm.h"
 #include "timer.h"
+#include "htm_lock.h"
+#include "htm_hist.h"
+#include "tmalloc.h"
+#ifdef HLE_INTEL
+#include "hle_intel.h"
+#endif
+#if defined(__PPC__) || defined(_ARCH_PPC)
 #include <htmxlintrin.h>
+#endif
 
 #ifdef __bgq__
 #include <speculation.h>
 #endif
 
 #include <pthread.h>
+#if defined(__PPC__) || defined(_ARCH_PPC)
 #include <sys/platform/ppc.h>
+#endif
 
-#define NUM_HTM_STATS_EVENTS 14
+#define NUM_HTM_STATS_EVENTS 46
 #define NUM_HTM_ABORT_REASON_CODES 19
 #define NUM_HTM_TBEGIN_RETURNS 3
 #define NUM_ATOMIC_REGIONS 20
 #ifndef DETECT_DELINQUENTS
 #define DETECT_DELINQUENTS 0
 #endif
+#define ADAPTIVE_DEFAULT_EPOCH 128
+#define ADAPTIVE_MAX_RETRY 32
+#define ADAPTIVE_NUM_ARMS 3
 
 enum {
   event_tx = 0,
@@ -43,14 +63,171 @@ enum {
   event_global_lock_persistent_abort,
   event_transient_abort_retry,
   event_global_lock_transient_abort,
-  event_detected_delinquent
+  event_detected_delinquent,
+  event_software_tx,
+  event_software_abort,
+  event_adaptive_epoch,
+  event_adaptive_budget_up,
+  event_adaptive_budget_down,
+  event_adaptive_giveup,
+  event_adaptive_halve,
+  event_adaptive_stubborn,
+  event_adaptive_budget,       /* sum of the final budgets ... */
+  event_adaptive_threads,      /* ... of that many threads */
+  event_aux_lock_acquired,
+  event_global_lock_read_acquired,
+  event_lazy_subscription_tx,
+  event_lazy_subscription_abort,
+  event_lazy_subscription_saved,
+  event_rot_tx,
+  event_rot_abort,
+  event_rot_upgrade,
+  event_rot_fallback,
+  event_prefetch_tx,
+  event_prefetch_warmed,
+  event_irrevocable_tx,
+  event_irrevocable_auto,
+  event_irrevocable_become,
+  event_irrevocable_marked,
+  event_no_htm,
+  event_hle_tx,
+  event_hle_acquired,
+  event_batch_tx,
+  event_batch_executions,
+  event_batch_abort,
+  event_batch_split
+};
+
+/* Names of the events in HTM_STATS_FORMAT documents */
+static const char *event_names[NUM_HTM_STATS_EVENTS] = {
+  [event_tx] = "tx",
+  [event_tx_enter] = "tx_enter",
+  [event_abort] = "abort",
+  [event_first_abort] = "first_abort",
+  [event_global_lock_wait_before_tx_spin] = "global_lock_wait_before_tx_spin",
+  [event_global_lock_wait_before_tx_sleep] = "global_lock_wait_before_tx_sleep",
+  [event_global_lock_wait_and_retry_spin] = "global_lock_wait_and_retry_spin",
+  [event_global_lock_wait_and_retry_sleep] = "global_lock_wait_and_retry_sleep",
+  [event_global_lock_acquired] = "global_lock_acquired",
+  [event_persistent_abort_retry] = "persistent_abort_retry",
+  [event_global_lock_persistent_abort] = "global_lock_persistent_abort",
+  [event_transient_abort_retry] = "transient_abort_retry",
+  [event_global_lock_transient_abort] = "global_lock_transient_abort",
+  [event_detected_delinquent] = "detected_delinquent",
+  [event_software_tx] = "software_tx",
+  [event_software_abort] = "software_abort",
+  [event_adaptive_epoch] = "adaptive_epoch",
+  [event_adaptive_budget_up] = "adaptive_budget_up",
+  [event_adaptive_budget_down] = "adaptive_budget_down",
+  [event_adaptive_giveup] = "adaptive_giveup",
+  [event_adaptive_halve] = "adaptive_halve",
+  [event_adaptive_stubborn] = "adaptive_stubborn",
+  [event_adaptive_budget] = "adaptive_budget",
+  [event_adaptive_threads] = "adaptive_threads",
+  [event_aux_lock_acquired] = "aux_lock_acquired",
+  [event_global_lock_read_acquired] = "global_lock_read_acquired",
+  [event_lazy_subscription_tx] = "lazy_subscription_tx",
+  [event_lazy_subscription_abort] = "lazy_subscription_abort",
+  [event_lazy_subscription_saved] = "lazy_subscription_saved",
+  [event_rot_tx] = "rot_tx",
+  [event_rot_abort] = "rot_abort",
+  [event_rot_upgrade] = "rot_upgrade",
+  [event_rot_fallback] = "rot_fallback",
+  [event_prefetch_tx] = "prefetch_tx",
+  [event_prefetch_warmed] = "prefetch_warmed",
+  [event_irrevocable_tx] = "irrevocable_tx",
+  [event_irrevocable_auto] = "irrevocable_auto",
+  [event_irrevocable_become] = "irrevocable_become",
+  [event_irrevocable_marked] = "irrevocable_marked",
+  [event_no_htm] = "no_htm",
+  [event_hle_tx] = "hle_tx",
+  [event_hle_acquired] = "hle_acquired",
+  [event_batch_tx] = "batch_tx",
+  [event_batch_executions] = "batch_executions",
+  [event_batch_abort] = "batch_abort",
+  [event_batch_split] = "batch_split"
+};
+
+/* What the thread holds while it runs a region outside of HTM */
+enum {
+  fallback_none = 0,
+  fallback_write,
+  fallback_read,
+  fallback_serial,              /* HTM_HYBRID: holds sw_seq, see software_serialize() */
+  fallback_hle                  /* HTM_HLE: elides (or holds) gl.a.global_lock */
+};
+
+/* What a region does on a persistent (e.g. capacity) abort, see policy_t */
+enum {
+  arm_giveup = 0,
+  arm_halve,
+  arm_stubborn
+};
+
+/* Per-thread, per-region retry policy of HTM_ADAPTIVE.  Every epoch runs
+   of the region, the mean latency of a run (fallbacks included) is fed
+   to two learners:
+     - a hill climber on transient_retry_max, the number of hardware
+       attempts (0 skips HTM, like a delinquent region): keep moving while
+       the latency drops, turn around when it grows, and jump to a random
+       budget now and then to leave local minima;
+     - a UCB1 bandit choosing how many persistent aborts to retry: none
+       (give up), half or all of the transient budget.  It only learns
+       from epochs that saw persistent aborts. */
+typedef struct policy_struct {
+  int transient_retry_max;
+  int direction;
+  int arm;
+  long runs;
+  long persistent_aborts;
+  double time;
+  double last_cost;
+  double best_cost;
+  long arm_pulls[ADAPTIVE_NUM_ARMS];
+  double arm_reward[ADAPTIVE_NUM_ARMS];
+  long total_pulls;
+} policy_t;
+
+/* Per-thread, per-region counts behind HTM_IRREVOCABLE */
+typedef struct irrevocable_profile_struct {
+  unsigned long long attempts;
+  unsigned long long capacity_aborts;
+  unsigned long long fallbacks;       /* runs that exhausted their retries */
+  unsigned long long retry_time;      /* ticks those runs spent before */
+} irrevocable_profile_t;
+
+/* Per-thread, per-region batch size of HTM_BATCH, see batch_max */
+typedef struct batch_struct {
+  int size;                     /* executions per batch, 1 once split */
+  int failures;                 /* batch aborts since the last full batch */
+  int cooldown;                 /* unbatched commits left after a split */
+} batch_t;
+
+/* Latency histograms of a region, in ticks (see TICKS_READ() in timer.h):
+   one per committed hardware or rollback-only attempt, one per aborted
+   attempt, and one per execution on the fallback path, from the decision
+   to fall back to the release at tend_ibm() */
+enum {
+  latency_commit = 0,
+  latency_abort,
+  latency_fallback,
+  NUM_HTM_LATENCIES
+};
+
+static const char *latency_names[NUM_HTM_LATENCIES] = {
+  "commit",
+  "abort",
+  "fallback"
 };
 
 typedef struct htm_stats_struct {
   unsigned long long event_counter[NUM_HTM_STATS_EVENTS];
+  htm_hist_t latency[NUM_HTM_LATENCIES];
+  unsigned long long fallback_hold_time; /* ticks the fallback lock was held */
+  unsigned long long irrevocable_saved_time; /* retry ticks HTM_IRREVOCABLE skipped */
 #if defined(__370__)
   unsigned long long abort_reason_code[NUM_HTM_ABORT_REASON_CODES][NUM_HTM_TBEGIN_RETURNS];
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
 #define HTM_IA32_STAT(nam) long long unsigned int nam;
   struct{
 #include "htm_ia32_stat.h"
@@ -73,9 +250,47 @@ typedef struct tls_struct {
   unsigned long long normal_time;
   unsigned long long abort_time;
   int first_retry;
-  TIMER_T start, stop;
+  int transient_retry_count;
+  int persistent_retry_count;
+  int global_lock_retry_count;
+  TICKS_T start, stop;
+  TICKS_T fallback_start;
+  TICKS_T fallback_acquired;
+  struct profile_site *profile;   /* HTM_PROFILE samples */
+  long profile_countdown;
+  unsigned long long profile_dropped;
   long tid;
+  long master;
   int isMaster;
+  tm_prefetch_producer_t producer;
+  void *producer_arg;
+  int prefetch_hit;
+  long prefetch_op;
+  unsigned long long prefetch_ops;
+  unsigned long long prefetch_hits;
+  unsigned long long prefetch_skipped;
+  unsigned long long hit_abort_time;
+  unsigned long long miss_abort_time;
+  int region_id;
+  int software_restart;
+  TICKS_T region_start;
+  unsigned long seed;
+  int read_only;
+  int rot;
+  int fallback;
+  int aux_held;
+  int lazy;
+  int lazy_off;
+  uintptr_t lazy_epoch;
+  htm_lock_node_t fallback_node;
+  htm_lock_node_t aux_node;
+  policy_t policy[NUM_ATOMIC_REGIONS];
+  int irrevocable;
+  irrevocable_profile_t irrevocable_profile[NUM_ATOMIC_REGIONS];
+  int batch_open;               /* region id + 1 of the batch left open by tend_ibm() */
+  int batch_target;             /* executions the current attempt may batch */
+  int batch_count;              /* executions it has finished */
+  batch_t batch[NUM_ATOMIC_REGIONS];
 } tls_t;
 
 /*#define USE_MUTEX*/
@@ -89,21 +304,348 @@ static union {
   } a;
 } gl;
 
-static struct {
-  int completed_txs;
-  char one_cache_line[252];
-} ctxs[256];
-
 #ifdef USE_MUTEX
 static THREAD_MUTEX_T global_lock_mutex;
 static THREAD_COND_T global_lock_cond;
 #endif
-static THREAD_KEY_T global_tls_key;
+/* The tls_t of the calling thread, set by tm_thread_enter_ibm() */
+static THREAD_LOCAL tls_t *global_tls;
+
+/* The tls_t of every thread lives in one slab, sized at TM_STARTUP and
+   indexed by thread id.  Each entry starts on a page of its own and is
+   first touched by its thread once pinned, so its counters never share
+   a cache line with another thread's, and sit on the thread's NUMA node
+   under the default first-touch policy.  Threads beyond the slab get an
+   entry of their own, aligned the same way. */
+static char *tls_slab = NULL;
+static long tls_slab_threads = 0;
+static size_t tls_slab_stride = 0;
+
+#ifndef __bgq__
+__thread sigjmp_buf tm_checkpoint_ibm;
+#endif
+
+#ifdef HTM_EMULATED
+/* The lock word joins the emulated read set, like the cache line a
+   hardware transaction subscribes to. */
+#define READ_GLOBAL_LOCK() tload(gl.a.global_lock)
+#define HW_LOAD(var) tload(var)
+#define HW_STORE(var, val) tstore(var, val)
+#define NONTX_BEGIN() htm_emu_nontx_begin()
+#define NONTX_END() htm_emu_nontx_end()
+#define PIN() htm_emu_pin()
+#define UNPIN() htm_emu_unpin()
+#define RELEASE(ptr) htm_emu_free(ptr)
+#else
+#define READ_GLOBAL_LOCK() (gl.a.global_lock)
+#define HW_LOAD(var) (var)
+#define HW_STORE(var, val) ((var) = (val))
+#define NONTX_BEGIN()
+#define NONTX_END()
+#define PIN()
+#define UNPIN()
+#define RELEASE(ptr) free(ptr)
+#endif
+
+#if defined(HTM_HYBRID) && !defined(USE_TLH)
+/* Software transactions log their own allocations, see tm_malloc_ibm() */
+#define TMALLOC_ATTEMPT()
+#define TMALLOC_COMMIT()
+#define TMALLOC_ABORT()
+#else
+/* TM_MALLOC is tmalloc_alloc(), see tm.h */
+#define USE_TMALLOC 1
+#define TMALLOC_ATTEMPT() tmalloc_attempt()
+#define TMALLOC_COMMIT() tmalloc_commit()
+#define TMALLOC_ABORT() tmalloc_abort()
+#endif
+
+typedef union {
+  char two_cache_lines[512];
+  struct {
+    char one_cache_line[256];
+    volatile uintptr_t value;
+    char another_cache_line[248];
+  } a;
+} padded_word_t;
+
+/* The lock behind gl.a.global_lock (HTM_FBLOCK), the lock aborted threads
+   queue on before retrying (HTM_AUXLOCK), and the fallback readers of
+   TM_BEGIN_RO regions (HTM_FBLOCK_RW) */
+static htm_lock_t fallback_lock;
+static htm_lock_t aux_lock;
+static int aux_locking = 0;
+static int rw_fallback = 0;
+static padded_word_t fallback_readers;
+
+/* The explicit abort of a region that found, right before tend, that it
+   has to run again (lazy subscription, rollback-only validation) or must
+   not commit (a prefetching helper) */
+#define RETRY_ABORT_CODE 0xfe
+
+/* The explicit abort of TM_BECOME_IRREVOCABLE() in a hardware transaction */
+#define IRREVOCABLE_ABORT_CODE 0xfd
+
+/*
+ * Lazy subscription (HTM_LAZY_SUB=all or a comma-separated list of region
+ * ids).  A hardware transaction of an opted-in region does not read the
+ * fallback lock after tbegin but just before tend, so a holder that comes
+ * and goes while it runs only aborts it if they touch the same data.
+ *
+ * Until that check the transaction may run on state the holder is half way
+ * through updating.  The hardware contains most of what such a zombie can
+ * do (faults, system calls and endless loops abort it), and these keep
+ * the rest out:
+ *   - tend_ibm() is the only place a lazy transaction commits, and it
+ *     checks the lock first;
+ *   - rollback-only transactions (the PREFETCHING helpers) do not track
+ *     their reads and always subscribe early;
+ *   - HTM_CONSERVE_RWBUF runs regions suspended between shared accesses,
+ *     where nothing is rolled back, so it ignores HTM_LAZY_SUB;
+ *   - once the check has failed (it aborts with RETRY_ABORT_CODE), the
+ *     run subscribes early on every retry.
+ *
+ * fallback_epochs counts the acquisitions of the fallback lock; a lazy
+ * commit that saw it move would have been aborted by early subscription.
+ */
+static char lazy_regions[NUM_ATOMIC_REGIONS];
+static int lazy_subscription = 0;
+static padded_word_t fallback_epochs;
+
+/*
+ * Irrevocable regions.  A region begun with TM_BEGIN_IRREVOCABLE(id) skips
+ * HTM and runs on the fallback path: under the fallback lock, or with
+ * HTM_HYBRID holding sw_seq like a software commit does, so that nothing
+ * runs beside it.  TM_BECOME_IRREVOCABLE() gets there from inside a
+ * region: a hardware attempt aborts with IRREVOCABLE_ABORT_CODE and a
+ * software one restarts from its checkpoint, and either way the region
+ * reruns irrevocably; on the fallback path it does nothing.
+ *
+ * HTM_IRREVOCABLE=<percent> does the same for regions that cannot fit
+ * the hardware.  Once capacity aborts make up that share of the attempts
+ * of a region in some thread (after IRREVOCABLE_MIN_ATTEMPTS of them),
+ * the region is irrevocable for every thread from then on.
+ * irrevocable_cost is what a run of the region spent retrying before it
+ * fell back, as that thread measured it; every irrevocable run it causes
+ * is credited with that much (irrevocable_saved_us of HTM_STATS).
+ */
+#define IRREVOCABLE_MIN_ATTEMPTS 64
+
+static int irrevocable_threshold = 0;
+static volatile char irrevocable_regions[NUM_ATOMIC_REGIONS];
+static unsigned long long irrevocable_cost[NUM_ATOMIC_REGIONS];
+
+/*
+ * Batching (HTM_BATCH=<max>).  Small regions issued back to back pay for
+ * a tbegin/tend pair, a TLS lookup and a subscription to the fallback
+ * lock each time.  With HTM_BATCH, tend_ibm() of a master leaves the
+ * hardware transaction open, and the next executions of the same region
+ * join it, until batch_t.size of them have run; tbegin_ibm() of any other
+ * region (or of a rollback-only or irrevocable one) commits the batch in
+ * progress first.
+ *
+ * An abort rolls the thread back to the first execution of the batch,
+ * which reruns as a batch half the size on the same retry budgets.
+ * After BATCH_SPLIT_FAILURES batch aborts without a full batch the
+ * region runs unbatched for BATCH_COOLDOWN commits; every full batch
+ * lets the next one grow by an execution, up to max.
+ *
+ * Whatever the thread does between two executions runs inside the
+ * transaction as well, and a system call there aborts the batch, which
+ * shrinks it.  This relies on the hardware rolling back the stack and
+ * registers, so HTM_EMULATED and HTM_CONSERVE_RWBUF ignore HTM_BATCH.
+ */
+#define BATCH_DEFAULT_MAX 8
+#define BATCH_SPLIT_FAILURES 4
+#define BATCH_COOLDOWN 1024
+
+static int batch_max = 0;
+
+static void tend_region(tls_t *tls, int close_batch);
+
+#ifdef HTM_HYBRID
+/*
+ * Hybrid NOrec (Dalessandro et al., ASPLOS'11).  Once its retries are
+ * exhausted a region runs as a NOrec software transaction instead of
+ * taking the global lock, so hardware transactions keep running beside it.
+ *
+ * Software transactions serialize their commits on sw_seq and validate
+ * by value whenever sw_seq or hw_commits moves.  A hardware transaction
+ * reads sw_seq right after tbegin and aborts if a software commit is
+ * writing back; the read also subscribes it, so a later software commit
+ * aborts it as well.  At tend it bumps hw_commits if any software
+ * transaction is running (reading sw_active subscribes to that too),
+ * which is how software readers learn about hardware commits.
+ */
+static padded_word_t sw_seq;
+static padded_word_t sw_active;
+static padded_word_t hw_commits;
+
+#define SW_LIMBO_BATCH 64
+
+typedef struct sw_tx_struct {
+  txepoch_t epoch;              /* start = snapshot at begin */
+  uintptr_t snapshot;
+  uintptr_t hw_snapshot;
+  unsigned long gen;
+  txlog_t reads;
+  txlog_t writes;
+  txset_t write_index;
+  txlog_t allocs;
+  txlog_t frees;
+  txlog_t limbo;                /* addr = block, value = freeing commit */
+} sw_tx_t;
+
+__thread int tm_software_ibm = 0;
+static __thread sw_tx_t sw_tx;
+static txepoch_registry_t sw_threads;
+
+#define FALLBACK_WRITING() (HW_LOAD(sw_seq.a.value) & 1)
+#define FALLBACK_BUSY(tls) FALLBACK_WRITING()
+#define FALLBACK_EPOCH() (sw_seq.a.value)
+#else
+/* Writers of a region also conflict with fallback readers */
+#define FALLBACK_WRITING() READ_GLOBAL_LOCK()
+#define FALLBACK_BUSY(tls) \
+  (FALLBACK_WRITING() || (rw_fallback && !(tls)->read_only && HW_LOAD(fallback_readers.a.value)))
+#define FALLBACK_EPOCH() (fallback_epochs.a.value)
+#endif
+
+/*
+ * Rollback-only regions (HTM_ROT; TM_BEGIN_ROT and TM_BEGIN_RO).  The
+ * loads of a read-mostly region stay out of the hardware read set:
+ * TM_SHARED_READ logs the version of the stripe it reads from, and a
+ * hardware transaction bumps the version of the stripes it writes to, in
+ * the same commit as the data.  The region is consistent as long as none
+ * of the logged versions moved and the fallback path has not run
+ * (FALLBACK_EPOCH) since it began; the fallback path itself does not
+ * version its writes.
+ *
+ * Writers only version while some region is counted in rot_readers.  A
+ * region counts itself before its first attempt and until it ends; the
+ * writer reads the counter inside its transaction, so a region that
+ * counts itself later aborts it.
+ *
+ * On POWER the region is a rollback-only transaction, which validates
+ * its log right before tend; its own stores stay transactional.  x86 has
+ * no ROTs (and the emulator has no sandbox), so there the region runs in
+ * software: it revalidates after every read, so it never acts on an
+ * inconsistent snapshot, and its first store reruns it as an ordinary
+ * region.  The log holds each stripe once (read_index), and a read from
+ * a stripe already in it only checks that stripe: its data is still that
+ * of the snapshot validated last.  A new stripe validates the whole log.
+ *
+ * HTM_ROT=<n> uses n stripes, rounded up to a power of two; 1 is a single
+ * global version, which also makes all writers conflict on it.
+ */
+#define ROT_DEFAULT_STRIPES 1024
+#define ROT_STRIPE_SHIFT 6      /* one version per 64-byte block */
+
+enum {
+  rot_none = 0,
+  rot_hardware,
+  rot_software
+};
+
+typedef union {
+  char cache_line[128];
+  volatile uintptr_t value;
+} rot_version_t;
+
+typedef struct rot_tx_struct {
+  uintptr_t epoch;              /* FALLBACK_EPOCH() at begin */
+  int restart;                  /* a software attempt failed validation */
+  int upgrade;                  /* rerun as an ordinary region */
+  int retry_count;
+  int counted;                  /* in rot_readers */
+  txlog_t reads;                /* addr = version, value = version seen */
+  txset_t read_index;           /* version -> its entry in reads */
+  unsigned long gen;
+} rot_tx_t;
+
+int tm_rot_enabled_ibm = 0;
+__thread int tm_rot_ibm = rot_none;
+static __thread rot_tx_t rot_tx;
+static rot_version_t *rot_versions;
+static uintptr_t rot_mask;
+static padded_word_t rot_readers;
+
+#define ROT_VERSION(addr) \
+  (&rot_versions[((uintptr_t)(addr) >> ROT_STRIPE_SHIFT) & rot_mask].value)
+
+#if (defined(__PPC__) || defined(_ARCH_PPC)) && !defined(HTM_EMULATED)
+#define ROT_MODE rot_hardware
+#else
+#define ROT_MODE rot_software
+#endif
+
+/*
+ * Helper-thread prefetching (PREFETCHING=<helpers per master>).  Thread
+ * ids come in groups of one master followed by its helpers.  A master
+ * registers the producer of its operations (TM_PREFETCH_REGISTER), which
+ * fills a ring of the next HTM_PREFETCH_LEAD of them ahead of the master.
+ * Helpers claim operations from that ring and run their regions as
+ * rollback-only transactions that tend_ibm() always aborts, so they only
+ * bring the master's footprint into the shared caches.  A helper that
+ * falls behind skips to the operation its master takes next; it never
+ * retries and never falls back.
+ *
+ * A slot holds its operation number while its operation is valid, so a
+ * helper that copied it while the master was refilling it notices.  A
+ * master operation is a hit if a helper ran its region to the end before
+ * the master took it; abort time is kept apart for hits and misses.
+ *
+ * Helpers only help from the master's core; THREAD_PLACEMENT=smt-pairs
+ * (or compact on cores with as many siblings as a group has threads)
+ * places them there, see thread.c.
+ */
+#define PREFETCH_DEFAULT_LEAD 5
+#define PREFETCH_MAX_MASTERS 256
+#define PREFETCH_SLOT_ALIGN 128
+
+typedef struct prefetch_slot {
+  volatile long seq;            /* operation held, -1 while refilled */
+  volatile long warmed;         /* operation a helper ran to the end */
+} prefetch_slot_t;              /* followed by the operation */
+
+typedef struct prefetch_master {
+  size_t size;                  /* of an operation */
+  size_t stride;                /* of a slot */
+  char *ring;                   /* prefetch_lead + 1 slots */
+  volatile int registered;
+  volatile int ended;
+  volatile long taken;          /* operations the master took */
+  volatile long produced;       /* operations put in the ring */
+  char one_cache_line[256];
+  volatile long claimed;        /* next operation for a helper */
+  char another_cache_line[256 - sizeof(long)];
+} prefetch_master_t;
+
+#define PREFETCH_SLOT(m, n) \
+  ((prefetch_slot_t *)((m)->ring + ((n) % (prefetch_lead + 1)) * (m)->stride))
+
+__thread int tm_prefetch_helper_ibm = 0;
+static int prefetch_helpers = 0;
+static long prefetch_lead = PREFETCH_DEFAULT_LEAD;
+static prefetch_master_t prefetch_masters[PREFETCH_MAX_MASTERS];
 
 static int transient_retry_max = 16;
 static int persistent_retry_max = 1;
 static int global_lock_retry_max = 16;
+static int adaptive = 0;
 static int collect_stats = 0;
+/* HTM_STATS_PER_REGION and LOOP_AT_END, read with the rest of the
+   environment by tm_startup_ibm() */
+static int stats_per_region = 0;
+static int loop_at_end = 0;
+/* Zero when the processor lacks HTM (see htm_supported()): every region
+   then goes straight to its fallback path */
+static int htm_usable = 1;
+#ifdef HLE_INTEL
+/* HTM_HLE: regions elide gl.a.global_lock instead of running the retry
+   loop on RTM, see hle_intel.c */
+static int hle_elision = 0;
+#endif
 static htm_stats_t global_htm_stats_per_region[NUM_ATOMIC_REGIONS];
 static htm_stats_t global_htm_stats;
 static THREAD_MUTEX_T global_htm_stats_lock;
@@ -111,34 +653,444 @@ static int prefetching = 0;
 static unsigned long long global_prefetch_time = 0;
 static unsigned long long global_normal_time = 0;
 static unsigned long long global_abort_time = 0;
+static unsigned long long global_prefetch_ops = 0;
+static unsigned long long global_prefetch_hits = 0;
+static unsigned long long global_prefetch_skipped = 0;
+static unsigned long long global_hit_abort_time = 0;
+static unsigned long long global_miss_abort_time = 0;
+
+/* HTM_STATS_FORMAT: the text lines below, or one JSON or CSV document
+   written to HTM_STATS_FILE (stdout by default) at shutdown */
+enum {
+  stats_text = 0,
+  stats_json,
+  stats_csv
+};
 
-/*#define ABORTED_INSN_ADDRESS_STATS*/
-#ifdef ABORTED_INSN_ADDRESS_STATS
-#define ABORTED_INSN_ADDRESS_STATS_MAP_SIZE (15 * 1024 * 1024 / 2)
-#define ABORTED_INSN_ADDRESS_STATS_START_ADDRESS 0x13b08000
-/*#define ABORTED_INSN_ADDRESS_STATS_START_ADDRESS 0x25c08000*/
-uint64_t aborted_insn_address_stats[ABORTED_INSN_ADDRESS_STATS_MAP_SIZE];
-uint64_t aborted_insn_address_reason_code;
+/* Totals of a thread, kept for the per-thread part of the document */
+typedef struct thread_stats_struct {
+  long tid;
+  htm_stats_t stats;
+  unsigned long long prefetch_time;
+  unsigned long long normal_time;
+  unsigned long long abort_time;
+  struct thread_stats_struct *next;
+} thread_stats_t;
+
+static int stats_format = stats_text;
+static const char *stats_file = NULL;
+static thread_stats_t *thread_stats_list = NULL;
+
+/*
+ * Abort profiling (HTM_PROFILE=<period>).  Every period-th abort of a
+ * thread is sampled with its region and the address of the instruction
+ * that saw it: TFIAR on POWER, the tload()/tstore() site under
+ * HTM_EMULATED (which also gives the data address), and on x86, whose RTM
+ * reports no address, the call site of the region's TM_BEGIN.  Threads
+ * count samples per (region, address) and merge them at exit.  At
+ * shutdown the sites are symbolized with dladdr() and addr2line, the
+ * HTM_PROFILE_TOP (10) hottest of each region are printed, and all of
+ * them are written as folded stacks, "region N;function;file:line count"
+ * for flamegraph.pl, to HTM_PROFILE_FILE (htm_profile.folded).
+ */
+#define PROFILE_THREAD_SITES 1024       /* per thread, a power of two */
+#define PROFILE_SITES 16384             /* merged, a power of two */
+
+#if defined(HTM_EMULATED)
+#define ABORT_SITE(diag) ((uintptr_t)(diag).abortedTransactionInstructionAddress)
+#define ABORT_DATA(diag) ((uintptr_t)(diag).conflictAddress)
+#define PROFILE_SITE_IS_RETURN 1
+#define REGION_SITE()
+#elif defined(__370__) || defined(__PPC__) || defined(_ARCH_PPC)
+#define ABORT_SITE(diag) ((uintptr_t)(diag).abortedTransactionInstructionAddress)
+#define ABORT_DATA(diag) ((uintptr_t)0)
+#define PROFILE_SITE_IS_RETURN 0
+#define REGION_SITE()
+#else
+static __thread uintptr_t region_site;
+#define ABORT_SITE(diag) region_site
+#define ABORT_DATA(diag) ((uintptr_t)0)
+#define PROFILE_SITE_IS_RETURN 1
+#define REGION_SITE() (region_site = (uintptr_t)__builtin_return_address(0))
 #endif
 
+typedef struct profile_site {
+  uintptr_t pc;
+  uintptr_t addr;               /* last data address seen, 0 if unknown */
+  int region;
+  unsigned long long count;     /* 0 while the slot is free */
+} profile_site_t;
+
+static long profile_period = 0;
+static int profile_top = 10;
+static const char *profile_file = "htm_profile.folded";
+static profile_site_t *profile_sites = NULL;
+static unsigned long long profile_dropped = 0;
+
+/* The slot of (region, pc) in a table of size slots, claimed if new;
+   NULL once the table is full */
+static profile_site_t *
+profile_lookup(profile_site_t *sites, long size, int region, uintptr_t pc)
+{
+  uint64_t hash = ((uint64_t)pc ^ ((uint64_t)region << 48)) * 0x9e3779b97f4a7c15ULL;
+  long i = (long)(hash >> 32) & (size - 1);
+  long n;
+
+  for (n = 0; n < size; n++, i = (i + 1) & (size - 1)) {
+    profile_site_t *site = &sites[i];
+
+    if (site->count == 0) {
+      site->pc = pc;
+      site->region = region;
+      site->addr = 0;
+      return site;
+    }
+    if (site->pc == pc && site->region == region) {
+      return site;
+    }
+  }
+  return NULL;
+}
+
+static void
+profile_record(tls_t *tls, int region_id, uintptr_t pc, uintptr_t addr)
+{
+  profile_site_t *site = profile_lookup(tls->profile, PROFILE_THREAD_SITES, region_id, pc);
+
+  if (site == NULL) {
+    tls->profile_dropped++;
+    return;
+  }
+  site->count++;
+  if (addr) {
+    site->addr = addr;
+  }
+}
+
+static void
+profile_merge(tls_t *tls)
+{
+  long i;
+
+  for (i = 0; i < PROFILE_THREAD_SITES; i++) {
+    profile_site_t *from = &tls->profile[i];
+    profile_site_t *to;
+
+    if (from->count == 0) {
+      continue;
+    }
+    to = profile_lookup(profile_sites, PROFILE_SITES, from->region, from->pc);
+    if (to == NULL) {
+      profile_dropped += from->count;
+      continue;
+    }
+    to->count += from->count;
+    if (from->addr) {
+      to->addr = from->addr;
+    }
+  }
+  profile_dropped += tls->profile_dropped;
+}
+
+/* Function and file:line of a site */
+typedef struct profile_symbol {
+  char function[512];
+  char line[512];
+} profile_symbol_t;
+
+#define PROFILE_ADDR2LINE_BATCH 512     /* addresses per addr2line run */
+
+extern char **environ;
+
+/* Runs addr2line once on n offsets into object, for syms[index[i]].  No
+   shell is involved, so the path of the object is taken as it is */
+static void
+profile_addr2line(const char *object, const uintptr_t *offsets, const long *index, long n, profile_symbol_t *syms)
+{
+  char *argv[5 + PROFILE_ADDR2LINE_BATCH + 1];
+  char hex[PROFILE_ADDR2LINE_BATCH][2 + 2 * sizeof(uintptr_t) + 1];
+  posix_spawn_file_actions_t actions;
+  int fds[2];
+  pid_t pid = -1;
+  FILE *out;
+  long i;
+
+  argv[0] = (char *)"addr2line";
+  argv[1] = (char *)"-f";
+  argv[2] = (char *)"-C";
+  argv[3] = (char *)"-e";
+  argv[4] = (char *)object;
+  for (i = 0; i < n; i++) {
+    snprintf(hex[i], sizeof(hex[i]), "0x%lx", (unsigned long)offsets[i]);
+    argv[5 + i] = hex[i];
+  }
+  argv[5 + n] = NULL;
+
+  if (pipe(fds) != 0) {
+    return;
+  }
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  if (posix_spawnp(&pid, "addr2line", &actions, NULL, argv, environ) != 0) {
+    pid = -1;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
+
+  /* Two lines per address, in order; without addr2line there are none */
+  out = fdopen(fds[0], "r");
+  if (out == NULL) {
+    close(fds[0]);
+  } else {
+    for (i = 0; i < n; i++) {
+      profile_symbol_t *sym = &syms[index[i]];
+      char f[1024];
+      char l[1024];
+
+      if (!fgets(f, sizeof(f), out) || !fgets(l, sizeof(l), out)) {
+	break;
+      }
+      f[strcspn(f, "\n")] = '\0';
+      l[strcspn(l, "\n")] = '\0';
+      l[strcspn(l, " ")] = '\0';       /* drops " (discriminator n)" */
+      if (strcmp(f, "??") != 0) {
+	snprintf(sym->function, sizeof(sym->function), "%s", f);
+      }
+      if (l[0] != '?') {
+	snprintf(sym->line, sizeof(sym->line), "%s", l);
+      }
+    }
+    fclose(out);
+  }
+  if (pid > 0) {
+    waitpid(pid, NULL, 0);
+  }
+}
+
+/* Function and file:line of the sites with need[i], through the dynamic
+   symbol table and then the debug information, as far as they go */
+static void
+profile_symbolize(const profile_site_t *sites, const char *need, long n, profile_symbol_t *syms)
+{
+  const char **objects = (const char **)calloc(n, sizeof(const char *));
+  uintptr_t *offsets = (uintptr_t *)calloc(n, sizeof(uintptr_t));
+  uintptr_t batch[PROFILE_ADDR2LINE_BATCH];
+  long index[PROFILE_ADDR2LINE_BATCH];
+  long i;
+  long j;
+
+  if (objects == NULL || offsets == NULL) {
+    printf( "malloc error\n");
+    exit(1);
+  }
+  for (i = 0; i < n; i++) {
+    uintptr_t pc = sites[i].pc;
+    uintptr_t insn = pc - PROFILE_SITE_IS_RETURN;
+    profile_symbol_t *sym = &syms[i];
+    Dl_info info;
+
+    snprintf(sym->function, sizeof(sym->function), "%s", pc ? "??" : "<unknown>");
+    snprintf(sym->line, sizeof(sym->line), "??");
+    if (!need[i] || pc == 0 || !dladdr((void *)insn, &info)) {
+      continue;
+    }
+    if (info.dli_sname) {
+      snprintf(sym->function, sizeof(sym->function), "%s+0x%lx", info.dli_sname, (unsigned long)(insn - (uintptr_t)info.dli_saddr));
+    } else {
+      snprintf(sym->function, sizeof(sym->function), "0x%lx", (unsigned long)pc);
+    }
+    if (info.dli_fname && info.dli_fname[0]) {
+      const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)info.dli_fbase;
+
+      /* Position-independent objects are looked up by offset */
+      offsets[i] = insn;
+      if (ehdr && ehdr->e_type == ET_DYN) {
+	offsets[i] -= (uintptr_t)info.dli_fbase;
+      }
+      objects[i] = info.dli_fname;
+    }
+  }
+
+  /* All the sites of an object in one run */
+  for (i = 0; i < n; i++) {
+    const char *object = objects[i];
+    long count = 0;
+
+    if (object == NULL) {
+      continue;
+    }
+    for (j = i; j < n; j++) {
+      if (objects[j] == NULL || strcmp(objects[j], object) != 0) {
+	continue;
+      }
+      objects[j] = NULL;
+      batch[count] = offsets[j];
+      index[count] = j;
+      if (++count == PROFILE_ADDR2LINE_BATCH) {
+	profile_addr2line(object, batch, index, count, syms);
+	count = 0;
+      }
+    }
+    if (count) {
+      profile_addr2line(object, batch, index, count, syms);
+    }
+  }
+  free(objects);
+  free(offsets);
+}
+
+/* By region, then hottest first */
+static int
+profile_compare(const void *a, const void *b)
+{
+  const profile_site_t *x = (const profile_site_t *)a;
+  const profile_site_t *y = (const profile_site_t *)b;
+
+  if (x->region != y->region) {
+    return x->region < y->region ? -1 : 1;
+  }
+  if (x->count != y->count) {
+    return x->count > y->count ? -1 : 1;
+  }
+  return 0;
+}
+
+static void
+profile_report(void)
+{
+  long n = 0;
+  long i;
+  long first;
+  FILE *folded;
+  char *need;
+  profile_symbol_t *syms;
+
+  for (i = 0; i < PROFILE_SITES; i++) {
+    if (profile_sites[i].count != 0) {
+      profile_sites[n++] = profile_sites[i];
+    }
+  }
+  qsort(profile_sites, n, sizeof(profile_site_t), profile_compare);
+
+  folded = fopen(profile_file, "w");
+  if (folded == NULL) {
+    printf( "<HTM_PROFILE_FILE=%s cannot be opened>\n", profile_file);
+  }
+
+  /* The sites printed, or all of them for the folded stacks */
+  need = (char *)calloc(n + 1, 1);
+  syms = (profile_symbol_t *)calloc(n + 1, sizeof(profile_symbol_t));
+  if (need == NULL || syms == NULL) {
+    printf( "malloc error\n");
+    exit(1);
+  }
+  for (first = 0; first < n; first = i) {
+    for (i = first; i < n && profile_sites[i].region == profile_sites[first].region; i++) {
+      need[i] = (i - first < profile_top || folded != NULL);
+    }
+  }
+  profile_symbolize(profile_sites, need, n, syms);
+
+  printf( "#HTM_PROFILE region         samples        %%  site\n");
+  for (first = 0; first < n; first = i) {
+    unsigned long long total = 0;
+
+    for (i = first; i < n && profile_sites[i].region == profile_sites[first].region; i++) {
+      total += profile_sites[i].count;
+    }
+    for (i = first; i < n && profile_sites[i].region == profile_sites[first].region; i++) {
+      profile_site_t *site = &profile_sites[i];
+      const char *function = syms[i].function;
+      const char *line = syms[i].line;
+
+      if (!need[i]) {
+	continue;
+      }
+      if (i - first < profile_top) {
+	printf( "#HTM_PROFILE %6d %15llu %7.2f %%  %s %s", site->region, site->count, 100.0 * site->count / total, function, line);
+	if (site->addr) {
+	  printf( " data 0x%lx", (unsigned long)site->addr);
+	}
+	printf( "\n");
+      }
+      if (folded) {
+	fprintf(folded, "region %d;%s;%s %llu\n", site->region, function, line, site->count);
+      }
+    }
+  }
+  if (profile_dropped) {
+    printf( "#HTM_PROFILE %llu samples dropped, the site tables were full\n", profile_dropped);
+  }
+  if (folded) {
+    fclose(folded);
+  }
+  free(need);
+  free(syms);
+}
+
+/* "all" or a comma-separated list of region ids */
+static void
+parse_lazy_regions(const char *list)
+{
+  const char *p = list;
+  int region;
+
+  lazy_subscription = 1;
+  if (strcmp(list, "all") == 0) {
+    for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+      lazy_regions[region] = 1;
+    }
+    return;
+  }
+  while (*p) {
+    char *end;
+    long id = strtol(p, &end, 10);
+    if (end == p || id < 0 || id >= NUM_ATOMIC_REGIONS || (*end != ',' && *end != '\0')) {
+      printf( "<HTM_LAZY_SUB=%s invalid, use all or region ids below %d>\n", list, NUM_ATOMIC_REGIONS);
+      exit(1);
+    }
+    lazy_regions[id] = 1;
+    p = (*end == ',') ? end + 1 : end;
+  }
+}
+
 void
-tm_startup_ibm()
+tm_startup_ibm(long numThread)
 {
   const char *env_transient_retry_max;
   const char *env_persistent_retry_max;
   const char *env_global_lock_retry_max;
+  const char *env_fallback_lock;
+  const char *env_adaptive;
+  const char *env_lazy_subscription;
+  const char *env_irrevocable;
+  const char *env_batch;
+  const char *env_rot;
   const char *env_collect_stats;
+  const char *env_stats_format;
   const char *env_prefetching;
-#ifdef ABORTED_INSN_ADDRESS_STATS
-  const char *env_aborted_insn_address_reason_code;
-#endif
+  const char *env_profile;
 
   gl.a.global_lock = 0;
+#ifdef HTM_HYBRID
+  sw_seq.a.value = 0;
+  sw_active.a.value = 0;
+  hw_commits.a.value = 0;
+#endif
 #ifdef USE_MUTEX
   THREAD_MUTEX_INIT(global_lock_mutex);
   THREAD_COND_INIT(global_lock_cond);
 #endif
-  THREAD_KEY_INIT(global_tls_key);
+#ifdef HTM_EMULATED
+  htm_emu_startup();
+#endif
+  if (!htm_supported()) {
+    htm_usable = 0;
+    printf( "<no HTM on this processor: regions run on the fallback path>\n");
+  }
 
   env_transient_retry_max = getenv("HTM_TRETRY");
   if (env_transient_retry_max) {
@@ -170,21 +1122,211 @@ tm_startup_ibm()
 #endif
   }
 
+  htm_lock_init(&fallback_lock, HTM_LOCK_TTAS);
+  env_fallback_lock = getenv("HTM_FBLOCK");
+  if (env_fallback_lock) {
+#ifdef USE_MUTEX
+    printf( "<HTM_FBLOCK has no meaning with USE_MUTEX>\n");
+#else
+    int kind = htm_lock_parse(env_fallback_lock);
+    if (kind < 0) {
+      printf( "<HTM_FBLOCK=%s unknown, use ttas, ticket or mcs>\n", env_fallback_lock);
+      exit(1);
+    }
+    htm_lock_init(&fallback_lock, (htm_lock_kind_t)kind);
+    printf( "<HTM_FBLOCK=%s>\n", htm_lock_name(fallback_lock.kind));
+#endif
+  }
+
+  if (getenv("HTM_FBLOCK_RW")) {
+    rw_fallback = 1;
+    printf( "<HTM_FBLOCK_RW>\n");
+  }
+  fallback_readers.a.value = 0;
+
+  htm_lock_init(&aux_lock, fallback_lock.kind);
+  if (getenv("HTM_AUXLOCK")) {
+    aux_locking = 1;
+    printf( "<HTM_AUXLOCK>\n");
+  }
+
+  env_adaptive = getenv("HTM_ADAPTIVE");
+  if (env_adaptive) {
+#ifdef __bgq__
+    printf( "<HTM_ADAPTIVE has no meaning on Blue Gene/Q>");
+#else
+    adaptive = atoi(env_adaptive);
+    if (adaptive <= 1) {
+      adaptive = ADAPTIVE_DEFAULT_EPOCH;
+    }
+    printf( "<HTM_ADAPTIVE=%d>\n", adaptive);
+#endif
+  }
+
+  fallback_epochs.a.value = 0;
+  env_lazy_subscription = getenv("HTM_LAZY_SUB");
+  if (env_lazy_subscription) {
+#if defined(__bgq__) || defined(HTM_CONSERVE_RWBUF)
+    printf( "<HTM_LAZY_SUB has no meaning with this configuration>\n");
+#else
+    parse_lazy_regions(env_lazy_subscription);
+    printf( "<HTM_LAZY_SUB=%s>\n", env_lazy_subscription);
+#endif
+  }
+
+  memset((void *)irrevocable_regions, 0, sizeof(irrevocable_regions));
+  env_irrevocable = getenv("HTM_IRREVOCABLE");
+  if (env_irrevocable) {
+#ifdef __bgq__
+    printf( "<HTM_IRREVOCABLE has no meaning on Blue Gene/Q>\n");
+#else
+    irrevocable_threshold = atoi(env_irrevocable);
+    if (irrevocable_threshold < 1 || irrevocable_threshold > 100) {
+      printf( "<HTM_IRREVOCABLE=%s invalid, use a percentage from 1 to 100>\n", env_irrevocable);
+      exit(1);
+    }
+    printf( "<HTM_IRREVOCABLE=%d>\n", irrevocable_threshold);
+#endif
+  }
+
+  env_batch = getenv("HTM_BATCH");
+  if (env_batch) {
+#if defined(__bgq__) || defined(HTM_EMULATED) || defined(HTM_CONSERVE_RWBUF)
+    printf( "<HTM_BATCH has no meaning with this configuration>\n");
+#else
+    batch_max = atoi(env_batch);
+    if (batch_max <= 1) {
+      batch_max = BATCH_DEFAULT_MAX;
+    }
+    printf( "<HTM_BATCH=%d>\n", batch_max);
+#endif
+  }
+
+#ifdef HLE_INTEL
+  if (getenv("HTM_HLE")) {
+#if defined(USE_MUTEX) || defined(HTM_HYBRID)
+    /* Their fallback paths do not only raise gl.a.global_lock */
+    printf( "<HTM_HLE has no meaning with this configuration>\n");
+#else
+    hle_elision = 1;
+    printf( "<HTM_HLE%s>\n", hle_supported() ? "" : ": no HLE on this processor, regions take the lock");
+#endif
+  }
+#endif
+
+  env_rot = getenv("HTM_ROT");
+  if (env_rot) {
+#ifdef __bgq__
+    printf( "<HTM_ROT has no meaning on Blue Gene/Q>");
+#else
+    long stripes = atol(env_rot);
+    long n;
+
+    if (stripes <= 0) {
+      stripes = ROT_DEFAULT_STRIPES;
+    }
+    for (n = 1; n < stripes; n <<= 1)
+      ;
+    if (posix_memalign((void **)&rot_versions, sizeof(rot_version_t), n * sizeof(rot_version_t))) {
+      printf( "malloc error\n");
+      exit(1);
+    }
+    memset(rot_versions, 0, n * sizeof(rot_version_t));
+    rot_mask = n - 1;
+    tm_rot_enabled_ibm = 1;
+    printf( "<HTM_ROT=%ld%s>\n", n, ROT_MODE == rot_hardware ? "" : " software");
+#endif
+  }
+
   env_collect_stats = getenv("HTM_STATS");
   if (DETECT_DELINQUENTS || env_collect_stats) {
     collect_stats = 1;
   }
 
+  stats_per_region = getenv("HTM_STATS_PER_REGION") != NULL;
+  loop_at_end = getenv("LOOP_AT_END") != NULL;
+
+  env_stats_format = getenv("HTM_STATS_FORMAT");
+  stats_file = getenv("HTM_STATS_FILE");
+  if (env_stats_format || stats_file) {
+#ifdef __bgq__
+    printf( "<HTM_STATS_FORMAT is not supported on Blue Gene/Q>\n");
+#else
+    if (!env_stats_format || !strcmp(env_stats_format, "json")) {
+      stats_format = stats_json;
+    } else if (!strcmp(env_stats_format, "csv")) {
+      stats_format = stats_csv;
+    } else if (!strcmp(env_stats_format, "text")) {
+      stats_format = stats_text;
+    } else {
+      printf( "<HTM_STATS_FORMAT=%s invalid, use json, csv or text>\n", env_stats_format);
+      exit(1);
+    }
+    collect_stats = 1;
+    printf( "<HTM_STATS_FORMAT=%s HTM_STATS_FILE=%s>\n", stats_format == stats_json ? "json" : stats_format == stats_csv ? "csv" : "text", stats_file ? stats_file : "stdout");
+#endif
+  }
+
   env_prefetching = getenv("PREFETCHING");
   if(env_prefetching){
-    printf("prefetching enabled\n");
+#ifndef __bgq__
+    const char *env_prefetch_lead = getenv("HTM_PREFETCH_LEAD");
+
     prefetching = 1;
+    prefetch_helpers = atoi(env_prefetching);
+    if (prefetch_helpers < 1) {
+      prefetch_helpers = 1;
+    }
+    if (env_prefetch_lead) {
+      prefetch_lead = atol(env_prefetch_lead);
+      if (prefetch_lead < 1) {
+	prefetch_lead = 1;
+      }
+    }
+    memset(prefetch_masters, 0, sizeof(prefetch_masters));
+    printf( "<PREFETCHING=%d HTM_PREFETCH_LEAD=%ld>\n", prefetch_helpers, prefetch_lead);
+#else
+    printf( "<PREFETCHING has no meaning on bgq>\n");
+#endif
+  }
+
+  env_profile = getenv("HTM_PROFILE");
+  if (env_profile) {
+#ifdef __bgq__
+    printf( "<HTM_PROFILE is not supported on Blue Gene/Q>\n");
+#else
+    profile_period = atol(env_profile);
+    if (profile_period < 1) {
+      profile_period = 1;
+    }
+    if (getenv("HTM_PROFILE_TOP")) {
+      profile_top = atoi(getenv("HTM_PROFILE_TOP"));
+    }
+    if (getenv("HTM_PROFILE_FILE")) {
+      profile_file = getenv("HTM_PROFILE_FILE");
+    }
+    profile_sites = calloc(PROFILE_SITES, sizeof(profile_site_t));
+    if (profile_sites == NULL) {
+      printf( "malloc error\n");
+      exit(1);
+    }
+#ifdef HTM_EMULATED
+    htm_emu_record_sites(1);
+#endif
+    printf( "<HTM_PROFILE=%ld HTM_PROFILE_TOP=%d HTM_PROFILE_FILE=%s>\n", profile_period, profile_top, profile_file);
+#endif
   }
 
-#ifdef ABORTED_INSN_ADDRESS_STATS
-  env_aborted_insn_address_reason_code = getenv("HTM_AIACODE");
-  if (env_aborted_insn_address_reason_code) {
-    aborted_insn_address_reason_code = (uint64_t)atoi(env_aborted_insn_address_reason_code);
+  /* Calibrates the ticks before any thread times a transaction */
+  ticks_per_microsec();
+
+#ifndef __bgq__
+  tls_slab_stride = (sizeof(tls_t) + getpagesize() - 1) / getpagesize() * getpagesize();
+  tls_slab_threads = tm_prefetch_threads_ibm(numThread);
+  tls_slab = mmap(NULL, tls_slab_threads * tls_slab_stride, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (tls_slab == MAP_FAILED) {
+    tls_slab = NULL;
+    tls_slab_threads = 0;
   }
 #endif
 
@@ -192,49 +1334,86 @@ tm_startup_ibm()
   if (collect_stats) {
     memset(&global_htm_stats_per_region, 0, sizeof(global_htm_stats_per_region));
     memset(&global_htm_stats, 0, sizeof(global_htm_stats));
+  }
+  if (collect_stats || profile_period) {
     THREAD_MUTEX_INIT(global_htm_stats_lock);
   }
 #endif
 
-  memset(&ctxs, 0, sizeof(ctxs));
 }
 
-static void
-print_stats(htm_stats_t *stats)
-{
-#if defined(__bgq__)
-  TmReport_t bgq_htm_stats;
-
-  tm_get_all_stats(&bgq_htm_stats);
-  printf("#HTM_STATS %15lu totalTransactions\n", bgq_htm_stats.totalTransactions);
-  printf("#HTM_STATS %15lu totalRollbacks\n", bgq_htm_stats.totalRollbacks);
-  printf("#HTM_STATS %15lu totalSerializedJMV\n", bgq_htm_stats.totalSerializedJMV);
-  printf("#HTM_STATS %15lu totalSerializedMAXRB\n", bgq_htm_stats.totalSerializedMAXRB);
-  printf("#HTM_STATS %15lu totalSerializedOTHER\n", bgq_htm_stats.totalSerializedOTHER);
-#else /* ! __bgq__ */
 #if defined(__370__)
-  int i;
-  const char *reason_string[] = {
-    "TDB_not_set",
-    "Restart_interruption",
-    "External_interruption",
-    NULL,
-    "Program_interruption",
-    "Machine-check_interruption",
-    "I/O_interruption",
-    "Fetch_overflow",
-    "Store_overflow",
-    "Fetch_conflict",
-    "Store_conflict",
-    "Restricted_instruction",
-    "Program-interruption_condition",
-    "Nesting_depth_exceeded",
-    "Cache_fetch-related",
-    "Cache_store-related",
-    "Cache_other",
-    "Undetermined_condition",
-    "TABORT_instruction"
-  };
+static const char *reason_string[] = {
+  "TDB_not_set",
+  "Restart_interruption",
+  "External_interruption",
+  NULL,
+  "Program_interruption",
+  "Machine-check_interruption",
+  "I/O_interruption",
+  "Fetch_overflow",
+  "Store_overflow",
+  "Fetch_conflict",
+  "Store_conflict",
+  "Restricted_instruction",
+  "Program-interruption_condition",
+  "Nesting_depth_exceeded",
+  "Cache_fetch-related",
+  "Cache_store-related",
+  "Cache_other",
+  "Undetermined_condition",
+  "TABORT_instruction"
+};
+#endif
+
+#ifndef __bgq__
+static void
+stats_add(htm_stats_t *to, const htm_stats_t *from)
+{
+  int i;
+
+  for (i = 0; i < NUM_HTM_STATS_EVENTS; i++) {
+    to->event_counter[i] += from->event_counter[i];
+  }
+  for (i = 0; i < NUM_HTM_LATENCIES; i++) {
+    htm_hist_merge(&to->latency[i], &from->latency[i]);
+  }
+  to->fallback_hold_time += from->fallback_hold_time;
+  to->irrevocable_saved_time += from->irrevocable_saved_time;
+#if defined(__370__)
+  for (i = 0; i < NUM_HTM_ABORT_REASON_CODES; i++) {
+    int j;
+    for (j = 0; j < NUM_HTM_TBEGIN_RETURNS; j++) {
+      to->abort_reason_code[i][j] += from->abort_reason_code[i][j];
+    }
+  }
+#elif defined(HTM_IA32_ABORT_CODES)
+#define HTM_IA32_STAT(nam) to->abort_reason_counters.nam += from->abort_reason_counters.nam;
+#include "htm_ia32_stat.h"
+#undef HTM_IA32_STAT
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+#define HTM_PPC_STAT(nam) to->abort_reason_counters.nam += from->abort_reason_counters.nam;
+#include "htm_ppc_stat.h"
+#undef HTM_PPC_STAT
+#endif
+}
+#endif /* ! __bgq__ */
+
+static void
+print_stats(htm_stats_t *stats)
+{
+#if defined(__bgq__)
+  TmReport_t bgq_htm_stats;
+
+  tm_get_all_stats(&bgq_htm_stats);
+  printf("#HTM_STATS %15lu totalTransactions\n", bgq_htm_stats.totalTransactions);
+  printf("#HTM_STATS %15lu totalRollbacks\n", bgq_htm_stats.totalRollbacks);
+  printf("#HTM_STATS %15lu totalSerializedJMV\n", bgq_htm_stats.totalSerializedJMV);
+  printf("#HTM_STATS %15lu totalSerializedMAXRB\n", bgq_htm_stats.totalSerializedMAXRB);
+  printf("#HTM_STATS %15lu totalSerializedOTHER\n", bgq_htm_stats.totalSerializedOTHER);
+#else /* ! __bgq__ */
+#if defined(__370__)
+  int i;
 #endif
 
   printf( "#HTM_STATS %15llu           tx_enter\n", stats->event_counter[event_tx_enter]);
@@ -251,9 +1430,75 @@ print_stats(htm_stats_t *stats)
   printf( "#HTM_STATS %15llu %6.2f %%  transient_abort_retry\n", stats->event_counter[event_transient_abort_retry], 100 * stats->event_counter[event_transient_abort_retry] / (double)stats->event_counter[event_abort]);
   printf( "#HTM_STATS %15llu %6.2f %%  global_lock_transient_abort\n", stats->event_counter[event_global_lock_transient_abort], 100 * stats->event_counter[event_global_lock_transient_abort] / (double)stats->event_counter[event_abort]);
   printf( "#HTM_STATS %15llu %6.2f %%  detected_delinquent\n", stats->event_counter[event_detected_delinquent], 100 * stats->event_counter[event_detected_delinquent] / (double)stats->event_counter[event_tx_enter]);
-  printf( "#HTM_STATS global_prefetch_time %15llu\n", global_prefetch_time);
-  printf( "#HTM_STATS global_normal_time %15llu\n", global_normal_time);
-  printf( "#HTM_STATS global_abort_time %15llu\n", global_abort_time);
+#ifdef HTM_HYBRID
+  printf( "#HTM_STATS %15llu %6.2f %%  software_tx\n", stats->event_counter[event_software_tx], 100 * stats->event_counter[event_software_tx] / (double)stats->event_counter[event_tx_enter]);
+  printf( "#HTM_STATS %15llu %6.2f %%  software_abort\n", stats->event_counter[event_software_abort], 100 * stats->event_counter[event_software_abort] / (double)stats->event_counter[event_software_tx]);
+#endif
+  if (adaptive) {
+    printf( "#HTM_STATS %15llu           adaptive_epoch\n", stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15llu %6.2f %%  adaptive_budget_up\n", stats->event_counter[event_adaptive_budget_up], 100 * stats->event_counter[event_adaptive_budget_up] / (double)stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15llu %6.2f %%  adaptive_budget_down\n", stats->event_counter[event_adaptive_budget_down], 100 * stats->event_counter[event_adaptive_budget_down] / (double)stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15llu %6.2f %%  adaptive_giveup\n", stats->event_counter[event_adaptive_giveup], 100 * stats->event_counter[event_adaptive_giveup] / (double)stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15llu %6.2f %%  adaptive_halve\n", stats->event_counter[event_adaptive_halve], 100 * stats->event_counter[event_adaptive_halve] / (double)stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15llu %6.2f %%  adaptive_stubborn\n", stats->event_counter[event_adaptive_stubborn], 100 * stats->event_counter[event_adaptive_stubborn] / (double)stats->event_counter[event_adaptive_epoch]);
+    printf( "#HTM_STATS %15.2f           adaptive_transient_retry_max\n", stats->event_counter[event_adaptive_budget] / (double)stats->event_counter[event_adaptive_threads]);
+  }
+  if (aux_locking) {
+    printf( "#HTM_STATS %15llu %6.2f %%  aux_lock_acquired\n", stats->event_counter[event_aux_lock_acquired], 100 * stats->event_counter[event_aux_lock_acquired] / (double)stats->event_counter[event_tx_enter]);
+  }
+  if (rw_fallback) {
+    printf( "#HTM_STATS %15llu %6.2f %%  global_lock_read_acquired\n", stats->event_counter[event_global_lock_read_acquired], 100 * stats->event_counter[event_global_lock_read_acquired] / (double)stats->event_counter[event_tx_enter]);
+  }
+  if (lazy_subscription) {
+    printf( "#HTM_STATS %15llu %6.2f %%  lazy_subscription_tx\n", stats->event_counter[event_lazy_subscription_tx], 100 * stats->event_counter[event_lazy_subscription_tx] / (double)stats->event_counter[event_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  lazy_subscription_abort\n", stats->event_counter[event_lazy_subscription_abort], 100 * stats->event_counter[event_lazy_subscription_abort] / (double)stats->event_counter[event_abort]);
+    printf( "#HTM_STATS %15llu %6.2f %%  lazy_subscription_saved\n", stats->event_counter[event_lazy_subscription_saved], 100 * stats->event_counter[event_lazy_subscription_saved] / (double)stats->event_counter[event_lazy_subscription_tx]);
+  }
+  if (tm_rot_enabled_ibm) {
+    printf( "#HTM_STATS %15llu           rot_tx\n", stats->event_counter[event_rot_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  rot_abort\n", stats->event_counter[event_rot_abort], 100 * stats->event_counter[event_rot_abort] / (double)stats->event_counter[event_rot_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  rot_upgrade\n", stats->event_counter[event_rot_upgrade], 100 * stats->event_counter[event_rot_upgrade] / (double)stats->event_counter[event_rot_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  rot_fallback\n", stats->event_counter[event_rot_fallback], 100 * stats->event_counter[event_rot_fallback] / (double)stats->event_counter[event_rot_tx]);
+  }
+  if (prefetching) {
+    printf( "#HTM_STATS %15llu           prefetch_tx\n", stats->event_counter[event_prefetch_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  prefetch_warmed\n", stats->event_counter[event_prefetch_warmed], 100 * stats->event_counter[event_prefetch_warmed] / (double)stats->event_counter[event_prefetch_tx]);
+  }
+  if (irrevocable_threshold || stats->event_counter[event_irrevocable_tx]) {
+    printf( "#HTM_STATS %15llu %6.2f %%  irrevocable_tx\n", stats->event_counter[event_irrevocable_tx], 100 * stats->event_counter[event_irrevocable_tx] / (double)stats->event_counter[event_tx_enter]);
+    printf( "#HTM_STATS %15llu %6.2f %%  irrevocable_auto\n", stats->event_counter[event_irrevocable_auto], 100 * stats->event_counter[event_irrevocable_auto] / (double)stats->event_counter[event_irrevocable_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  irrevocable_become\n", stats->event_counter[event_irrevocable_become], 100 * stats->event_counter[event_irrevocable_become] / (double)stats->event_counter[event_irrevocable_tx]);
+    printf( "#HTM_STATS %15llu           irrevocable_marked\n", stats->event_counter[event_irrevocable_marked]);
+    printf( "#HTM_STATS %15.0f           irrevocable_saved_us\n", TICKS_TO_MICROSEC(stats->irrevocable_saved_time));
+  }
+  if (batch_max) {
+    printf( "#HTM_STATS %15llu           batch_tx\n", stats->event_counter[event_batch_tx]);
+    printf( "#HTM_STATS %15.2f           batch_executions_per_tx\n", stats->event_counter[event_batch_executions] / (double)stats->event_counter[event_batch_tx]);
+    printf( "#HTM_STATS %15llu %6.2f %%  batch_abort\n", stats->event_counter[event_batch_abort], 100 * stats->event_counter[event_batch_abort] / (double)stats->event_counter[event_abort]);
+    printf( "#HTM_STATS %15llu           batch_split\n", stats->event_counter[event_batch_split]);
+  }
+  if (!htm_usable) {
+    printf( "#HTM_STATS %15llu %6.2f %%  no_htm\n", stats->event_counter[event_no_htm], 100 * stats->event_counter[event_no_htm] / (double)stats->event_counter[event_tx_enter]);
+  }
+#ifdef HLE_INTEL
+  if (hle_elision) {
+    printf( "#HTM_STATS %15llu %6.2f %%  hle_tx\n", stats->event_counter[event_hle_tx], 100 * stats->event_counter[event_hle_tx] / (double)stats->event_counter[event_tx_enter]);
+    printf( "#HTM_STATS %15llu %6.2f %%  hle_acquired\n", stats->event_counter[event_hle_acquired], 100 * stats->event_counter[event_hle_acquired] / (double)stats->event_counter[event_hle_tx]);
+  }
+#endif
+  printf( "#HTM_STATS %15.0f           fallback_hold_us\n", TICKS_TO_MICROSEC(stats->fallback_hold_time));
+  printf( "#HTM_STATS global_prefetch_time %15.0f\n", TICKS_TO_MICROSEC(global_prefetch_time));
+  printf( "#HTM_STATS global_normal_time %15.0f\n", TICKS_TO_MICROSEC(global_normal_time));
+  printf( "#HTM_STATS global_abort_time %15.0f\n", TICKS_TO_MICROSEC(global_abort_time));
+  if (prefetching) {
+    unsigned long long misses = global_prefetch_ops - global_prefetch_hits;
+
+    printf( "#HTM_STATS global_prefetch_ops %15llu\n", global_prefetch_ops);
+    printf( "#HTM_STATS global_prefetch_hit_ops %15llu\n", global_prefetch_hits);
+    printf( "#HTM_STATS global_prefetch_skipped_ops %15llu\n", global_prefetch_skipped);
+    printf( "#HTM_STATS global_abort_time_per_hit_op %15.3f\n", TICKS_TO_MICROSEC(global_hit_abort_time) / global_prefetch_hits);
+    printf( "#HTM_STATS global_abort_time_per_miss_op %15.3f\n", TICKS_TO_MICROSEC(global_miss_abort_time) / misses);
+  }
 #if defined(__370__)
   for (i = 0; i < NUM_HTM_ABORT_REASON_CODES; i++) {
     if (reason_string[i]) {
@@ -261,7 +1506,7 @@ print_stats(htm_stats_t *stats)
       printf( "#HTM_STATS %15llu %s\n", total, reason_string[i]);
     }
   }
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
 #define HTM_IA32_STAT(nam) printf( "#HTM_STATS %15llu " #nam "\n", stats->abort_reason_counters.nam );
 #include "htm_ia32_stat.h"
 #undef HTM_IA32_STAT
@@ -273,64 +1518,367 @@ print_stats(htm_stats_t *stats)
 #endif /* ! __bgq__ */
 }
 
-void
-tm_shutdown_ibm()
-{
-  if (collect_stats) {
 #ifndef __bgq__
-    int i;
-    int region;
+/* One line per kind of latency of a region, in microseconds */
+static void
+print_latency(const char *region, htm_stats_t *stats)
+{
+  int kind;
 
-    for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
-      for (i = 0; i < NUM_HTM_STATS_EVENTS; i++) {
-	global_htm_stats.event_counter[i] += global_htm_stats_per_region[region].event_counter[i];
-      }
+  for (kind = 0; kind < NUM_HTM_LATENCIES; kind++) {
+    htm_hist_t *h = &stats->latency[kind];
+
+    if (h->count == 0) {
+      continue;
+    }
+    printf( "#HTM_LATENCY %6s %-8s %15llu %10.3f %10.3f %10.3f %10.3f\n", region, latency_names[kind], h->count,
+	    TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.5)),
+	    TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.99)),
+	    TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.999)),
+	    TICKS_TO_MICROSEC(h->max));
+  }
+}
+
+/* =============================================================================
+ * HTM_STATS_FORMAT documents
+ *
+ * The same walk writes both formats: JSON nests the groups as objects,
+ * CSV writes one "scope,id,name,value" row per value, with the scope
+ * (run, region or thread) and the groups folded into the row.
+ * =============================================================================
+ */
+
+#define STATS_WRITER_DEPTH 8
+
+typedef struct stats_writer {
+  FILE *out;
+  int format;
+  const char *scope;            /* CSV only */
+  long id;                      /* CSV only */
+  const char *group;            /* CSV only */
+  int depth;                    /* JSON only */
+  int first[STATS_WRITER_DEPTH];
+  char close[STATS_WRITER_DEPTH];
+} stats_writer_t;
+
+static void
+stats_key(stats_writer_t *w, const char *name)
+{
+  if (!w->first[w->depth]) {
+    fputc(',', w->out);
+  }
+  w->first[w->depth] = 0;
+  fprintf(w->out, "\n%*s", 2 * w->depth, "");
+  if (name) {
+    fprintf(w->out, "\"%s\": ", name);
+  }
+}
+
+/* A JSON object ('{') or array ('['); a CSV group when named */
+static void
+stats_begin(stats_writer_t *w, const char *name, char open)
+{
+  if (w->format == stats_csv) {
+    w->group = name;
+    return;
+  }
+  if (w->depth > 0) {
+    stats_key(w, name);
+  }
+  fputc(open, w->out);
+  w->depth++;
+  assert(w->depth < STATS_WRITER_DEPTH);
+  w->first[w->depth] = 1;
+  w->close[w->depth] = (open == '{') ? '}' : ']';
+}
+
+static void
+stats_end(stats_writer_t *w)
+{
+  if (w->format == stats_csv) {
+    w->group = NULL;
+    return;
+  }
+  fprintf(w->out, "\n%*s%c", 2 * (w->depth - 1), "", w->close[w->depth]);
+  w->depth--;
+}
+
+static void
+stats_ull(stats_writer_t *w, const char *name, unsigned long long value)
+{
+  if (w->format == stats_csv) {
+    fprintf(w->out, "%s,%ld,%s%s%s,%llu\n", w->scope, w->id, w->group ? w->group : "", w->group ? "." : "", name, value);
+    return;
+  }
+  stats_key(w, name);
+  fprintf(w->out, "%llu", value);
+}
+
+static void
+stats_double(stats_writer_t *w, const char *name, double value)
+{
+  if (w->format == stats_csv) {
+    fprintf(w->out, "%s,%ld,%s%s%s,%.3f\n", w->scope, w->id, w->group ? w->group : "", w->group ? "." : "", name, value);
+    return;
+  }
+  stats_key(w, name);
+  fprintf(w->out, "%.3f", value);
+}
+
+/* The counters, abort causes, fallback lock hold time and latencies of
+   the run, a region or a thread */
+static void
+export_htm_stats(stats_writer_t *w, htm_stats_t *stats)
+{
+  int i;
+  char name[64];
+
+  stats_begin(w, "events", '{');
+  for (i = 0; i < NUM_HTM_STATS_EVENTS; i++) {
+    stats_ull(w, event_names[i], stats->event_counter[i]);
+  }
+  stats_end(w);
+
+  stats_begin(w, "abort_causes", '{');
 #if defined(__370__)
-      for (i = 0; i < NUM_HTM_ABORT_REASON_CODES; i++) {
-	int j;
-	for (j = 0; j < NUM_HTM_TBEGIN_RETURNS; j++) {
-	  global_htm_stats.abort_reason_code[i][j] += global_htm_stats_per_region[region].abort_reason_code[i][j];
-	}
-      }
-#elif defined(__x86_64__)
-#define HTM_IA32_STAT(nam) global_htm_stats.abort_reason_counters.nam += global_htm_stats_per_region[region].abort_reason_counters.nam;
+  for (i = 0; i < NUM_HTM_ABORT_REASON_CODES; i++) {
+    if (reason_string[i]) {
+      stats_ull(w, reason_string[i], stats->abort_reason_code[i][0] + stats->abort_reason_code[i][1] + stats->abort_reason_code[i][2]);
+    }
+  }
+#elif defined(HTM_IA32_ABORT_CODES)
+#define HTM_IA32_STAT(nam) stats_ull(w, #nam, stats->abort_reason_counters.nam);
 #include "htm_ia32_stat.h"
 #undef HTM_IA32_STAT
 #elif defined(__PPC__) || defined(_ARCH_PPC)
-#define HTM_PPC_STAT(nam) global_htm_stats.abort_reason_counters.nam += global_htm_stats_per_region[region].abort_reason_counters.nam;
+#define HTM_PPC_STAT(nam) stats_ull(w, #nam, stats->abort_reason_counters.nam);
 #include "htm_ppc_stat.h"
 #undef HTM_PPC_STAT
 #endif
+  stats_end(w);
+
+  stats_begin(w, "fallback", '{');
+  stats_ull(w, "executions", stats->latency[latency_fallback].count);
+  stats_double(w, "hold_us", TICKS_TO_MICROSEC(stats->fallback_hold_time));
+  stats_end(w);
+
+  stats_begin(w, "irrevocable", '{');
+  stats_ull(w, "executions", stats->event_counter[event_irrevocable_tx]);
+  stats_double(w, "saved_us", TICKS_TO_MICROSEC(stats->irrevocable_saved_time));
+  stats_end(w);
+
+  stats_begin(w, "latency_us", '{');
+  for (i = 0; i < NUM_HTM_LATENCIES; i++) {
+    htm_hist_t *h = &stats->latency[i];
+
+    snprintf(name, sizeof(name), "%s_count", latency_names[i]);
+    stats_ull(w, name, h->count);
+    if (h->count == 0) {
+      continue;
+    }
+    snprintf(name, sizeof(name), "%s_p50", latency_names[i]);
+    stats_double(w, name, TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.5)));
+    snprintf(name, sizeof(name), "%s_p99", latency_names[i]);
+    stats_double(w, name, TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.99)));
+    snprintf(name, sizeof(name), "%s_p999", latency_names[i]);
+    stats_double(w, name, TICKS_TO_MICROSEC(htm_hist_percentile(h, 0.999)));
+    snprintf(name, sizeof(name), "%s_max", latency_names[i]);
+    stats_double(w, name, TICKS_TO_MICROSEC(h->max));
+  }
+  stats_end(w);
+}
+
+static void
+export_times(stats_writer_t *w, unsigned long long prefetch_time, unsigned long long normal_time, unsigned long long abort_time)
+{
+  stats_begin(w, "time_us", '{');
+  stats_double(w, "prefetch", TICKS_TO_MICROSEC(prefetch_time));
+  stats_double(w, "normal", TICKS_TO_MICROSEC(normal_time));
+  stats_double(w, "abort", TICKS_TO_MICROSEC(abort_time));
+  stats_end(w);
+}
+
+static void
+export_stats(void)
+{
+  stats_writer_t w;
+  thread_stats_t *ts;
+  long threads = 0;
+  int region;
+
+  memset(&w, 0, sizeof(w));
+  w.format = stats_format;
+  w.out = stdout;
+  if (stats_file) {
+    w.out = fopen(stats_file, "w");
+    if (!w.out) {
+      printf( "<HTM_STATS_FILE=%s cannot be opened, writing to stdout>\n", stats_file);
+      w.out = stdout;
+    }
+  }
+  for (ts = thread_stats_list; ts; ts = ts->next) {
+    threads++;
+  }
+
+  if (w.format == stats_csv) {
+    fprintf(w.out, "scope,id,name,value\n");
+  }
+  w.scope = "run";
+  w.id = 0;
+  stats_begin(&w, NULL, '{');
+  stats_begin(&w, "config", '{');
+  stats_ull(&w, "threads", threads);
+  stats_ull(&w, "transient_retry_max", transient_retry_max);
+  stats_ull(&w, "persistent_retry_max", persistent_retry_max);
+  stats_ull(&w, "global_lock_retry_max", global_lock_retry_max);
+  stats_ull(&w, "fallback_lock", fallback_lock.kind);
+  stats_ull(&w, "rw_fallback", rw_fallback);
+  stats_ull(&w, "adaptive", adaptive);
+  stats_ull(&w, "rot", tm_rot_enabled_ibm);
+  stats_ull(&w, "irrevocable_threshold", irrevocable_threshold);
+  stats_ull(&w, "prefetching", prefetching);
+  stats_ull(&w, "batch_max", batch_max);
+  stats_ull(&w, "htm", htm_usable);
+#ifdef HLE_INTEL
+  stats_ull(&w, "hle_elision", hle_elision);
+#endif
+  stats_double(&w, "ticks_per_us", ticks_per_microsec());
+  stats_end(&w);
+  export_times(&w, global_prefetch_time, global_normal_time, global_abort_time);
+  if (prefetching) {
+    stats_begin(&w, "prefetch", '{');
+    stats_ull(&w, "ops", global_prefetch_ops);
+    stats_ull(&w, "hit_ops", global_prefetch_hits);
+    stats_ull(&w, "skipped_ops", global_prefetch_skipped);
+    stats_double(&w, "hit_abort_us", TICKS_TO_MICROSEC(global_hit_abort_time));
+    stats_double(&w, "miss_abort_us", TICKS_TO_MICROSEC(global_miss_abort_time));
+    stats_end(&w);
+  }
+  stats_begin(&w, "totals", '{');
+  export_htm_stats(&w, &global_htm_stats);
+  stats_end(&w);
+
+  w.scope = "region";
+  stats_begin(&w, "regions", '[');
+  for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+    htm_stats_t *stats = &global_htm_stats_per_region[region];
+
+    if (stats->event_counter[event_tx_enter] == 0 && stats->event_counter[event_rot_tx] == 0) {
+      continue;
     }
+    w.id = region;
+    stats_begin(&w, NULL, '{');
+    stats_ull(&w, "region", region);
+    export_htm_stats(&w, stats);
+    stats_end(&w);
+  }
+  stats_end(&w);
+
+  w.scope = "thread";
+  stats_begin(&w, "threads", '[');
+  for (ts = thread_stats_list; ts; ts = ts->next) {
+    w.id = ts->tid;
+    stats_begin(&w, NULL, '{');
+    stats_ull(&w, "thread", ts->tid);
+    export_times(&w, ts->prefetch_time, ts->normal_time, ts->abort_time);
+    export_htm_stats(&w, &ts->stats);
+    stats_end(&w);
+  }
+  stats_end(&w);
+  stats_end(&w);
+  if (w.format == stats_json) {
+    fputc('\n', w.out);
+  }
+
+  if (w.out != stdout) {
+    fclose(w.out);
+  } else {
+    fflush(stdout);
+  }
+}
 #endif /* ! __bgq__ */
 
-    print_stats(&global_htm_stats);
-    if (getenv("HTM_STATS_PER_REGION")) {
+void
+tm_shutdown_ibm()
+{
+  if (collect_stats) {
+#ifndef __bgq__
+    int region;
+
+    for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+      stats_add(&global_htm_stats, &global_htm_stats_per_region[region]);
+    }
+
+    if (stats_format != stats_text) {
+      export_stats();
+      while (thread_stats_list) {
+	thread_stats_t *next = thread_stats_list->next;
+	free(thread_stats_list);
+	thread_stats_list = next;
+      }
+    } else
+#endif /* ! __bgq__ */
+    {
+      print_stats(&global_htm_stats);
+#ifndef __bgq__
+      printf( "#HTM_LATENCY region kind               count     p50 us     p99 us    p999 us     max us\n");
+      for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+	char name[16];
+
+	snprintf(name, sizeof(name), "%d", region);
+	print_latency(name, &global_htm_stats_per_region[region]);
+      }
+      print_latency("all", &global_htm_stats);
+#endif
+      if (stats_per_region) {
 #ifdef __bgq__
-      printf( "<HTM_STATS_PER_REGION is not supported on Blue Gene/Q>\n");
+	printf( "<HTM_STATS_PER_REGION is not supported on Blue Gene/Q>\n");
 #else
-      for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
-	if (global_htm_stats_per_region[region].event_counter[event_tx] != 0) {
-	  printf( "--- region %d ------------------------------\n", region);
-	  print_stats(&global_htm_stats_per_region[region]);
+	for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+	  if (global_htm_stats_per_region[region].event_counter[event_tx] != 0
+	      || global_htm_stats_per_region[region].event_counter[event_rot_tx] != 0) {
+	    printf( "--- region %d ------------------------------\n", region);
+	    print_stats(&global_htm_stats_per_region[region]);
+	  }
 	}
-      }
 #endif
+      }
     }
   }
 
-#ifdef ABORTED_INSN_ADDRESS_STATS
-  {
-    int insn_addr;
-    for (insn_addr = 0; insn_addr < ABORTED_INSN_ADDRESS_STATS_MAP_SIZE; insn_addr++) {
-      if (aborted_insn_address_stats[insn_addr] != 0) {
-	printf( "ABORTED_INSN_ADDRESS %" PRIx64 " %x %" PRIu64 "\n", (uint64_t)(ABORTED_INSN_ADDRESS_STATS_START_ADDRESS + insn_addr * 2), insn_addr * 2, aborted_insn_address_stats[insn_addr]);
+#ifndef __bgq__
+  if (profile_period) {
+    profile_report();
+    free(profile_sites);
+    profile_sites = NULL;
+  }
+  if (irrevocable_threshold) {
+    int region;
+
+    printf( "<HTM_IRREVOCABLE regions:");
+    for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+      if (irrevocable_regions[region]) {
+	printf( " %d", region);
       }
     }
+    printf( ">\n");
+  }
+  if (prefetching) {
+    int master;
+
+    for (master = 0; master < PREFETCH_MAX_MASTERS; master++) {
+      free(prefetch_masters[master].ring);
+    }
+    memset(prefetch_masters, 0, sizeof(prefetch_masters));
+  }
+  if (tls_slab) {
+    munmap(tls_slab, tls_slab_threads * tls_slab_stride);
+    tls_slab = NULL;
+    tls_slab_threads = 0;
   }
 #endif
 
-  if (getenv("LOOP_AT_END")) {
+  if (loop_at_end) {
     for ( ; ; ) {
       sleep(3600);
     }
@@ -342,35 +1890,67 @@ tm_thread_enter_ibm()
 {
 #ifndef __bgq__
   tls_t *tls;
+  long tid = thread_getId();
+  long master = tid / (prefetch_helpers + 1);
 
-  tls = malloc(sizeof(tls_t));
-  if (tls == NULL) {
+  if (prefetching && master >= PREFETCH_MAX_MASTERS) {
+    printf( "<PREFETCHING supports up to %d masters>\n", PREFETCH_MAX_MASTERS);
+    exit(1);
+  }
+
+  /* thread.c has placed this thread already (THREAD_PLACEMENT), so the
+     first touch below is made from its node */
+  if (tid < tls_slab_threads) {
+    tls = (tls_t *)(tls_slab + tid * tls_slab_stride);
+  } else if (posix_memalign((void **)&tls, getpagesize(), tls_slab_stride) != 0) {
     printf( "malloc error\n");
     exit(1);
   }
+  /* Also clears what an earlier parallel phase of this thread left */
   memset(tls, 0, sizeof(tls_t));
 
-  tls->tid = thread_getId();
-  tls->isMaster = (!prefetching || tls->tid % 2 == 0);
-
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  //for(int i = 0; i < 8; i++){
-    if(prefetching){
-        CPU_SET( tls->tid/2*8+tls->tid%2, &cpuset);
-    //	CPU_SET( tls->tid/2*8+i, &cpuset);
-    }else
-        //CPU_SET( tls->tid*8%80+tls->tid/5*80, &cpuset);
-        CPU_SET( tls->tid*8, &cpuset);
-  //}
-
-  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  tls->tid = tid;
+  tls->seed = (unsigned long)tls->tid * 2654435761UL + 1;
+  tls->master = master;
+  tls->isMaster = (tls->tid % (prefetch_helpers + 1) == 0);
+  tls->prefetch_op = -1;
+  tm_prefetch_helper_ibm = !tls->isMaster;
+  if (profile_period) {
+    tls->profile = calloc(PROFILE_THREAD_SITES, sizeof(profile_site_t));
+    if (tls->profile == NULL) {
+      printf( "malloc error\n");
+      exit(1);
+    }
+    tls->profile_countdown = profile_period;
+  }
 
+#if defined(__PPC__) || defined(_ARCH_PPC)
   if(!tls->isMaster)
     __ppc_set_ppr_low();
+#endif
+#ifdef HTM_EMULATED
+  htm_emu_thread_enter(&tm_checkpoint_ibm);
+#endif
+#ifdef HTM_HYBRID
+  txlog_alloc(&sw_tx.reads);
+  txlog_alloc(&sw_tx.writes);
+  txset_alloc(&sw_tx.write_index, TXLOG_INIT_SIZE);
+  txlog_alloc(&sw_tx.allocs);
+  txlog_alloc(&sw_tx.frees);
+  txlog_alloc(&sw_tx.limbo);
+  txepoch_register(&sw_threads, &sw_tx.epoch);
+#endif
+  if (tm_rot_enabled_ibm) {
+    txlog_alloc(&rot_tx.reads);
+    txset_alloc(&rot_tx.read_index, TXLOG_INIT_SIZE);
+  }
+
+#ifdef USE_TMALLOC
+  tmalloc_thread_enter();
+#endif
 
-  TIMER_READ(tls->start);
-  THREAD_KEY_SET(global_tls_key, tls);
+  tls->start = TICKS_READ();
+  global_tls = tls;
 #endif /* ! __bgq__ */
 }
 
@@ -378,64 +1958,133 @@ void
 tm_thread_exit_ibm()
 {
 #ifndef __bgq__
+  if (batch_max) {
+    tls_t *tls = global_tls;
+
+    if (tls->batch_open) {
+      tend_region(tls, 1);
+    }
+  }
+  if (prefetching) {
+    tls_t *tls = global_tls;
+
+    /* Lets the helpers go, even if the master stopped before the end of
+       its operations or never registered them */
+    if (tls->isMaster) {
+      prefetch_masters[tls->master].ended = 1;
+    }
+  }
+  if (profile_period) {
+    tls_t *tls = global_tls;
+
+    THREAD_MUTEX_LOCK(global_htm_stats_lock);
+    profile_merge(tls);
+    THREAD_MUTEX_UNLOCK(global_htm_stats_lock);
+    free(tls->profile);
+    tls->profile = NULL;
+  }
   if (collect_stats) {
     tls_t *tls;
-    int i;
     int region;
+    int aborts = 0;
+    thread_stats_t *ts = NULL;
 #if defined(__PPC__) || defined(_ARCH_PPC)
 #define HTM_PPC_STAT(NAM) long long unsigned int NAM;
     struct {
 #include "htm_ppc_stat.h"
     } thread_abort_reason_counters;
-    int aborts = 0;
 
     memset(&thread_abort_reason_counters, 0, sizeof(thread_abort_reason_counters));
 #undef HTM_PPC_STAT
 #endif
 
-    tls = THREAD_KEY_GET(global_tls_key);
+    tls = global_tls;
 
-    THREAD_MUTEX_LOCK(global_htm_stats_lock);
     for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
-      for (i = 0; i < NUM_HTM_STATS_EVENTS; i++) {
-	global_htm_stats_per_region[region].event_counter[i] += tls->htm_stats[region].event_counter[i];
+      if (tls->policy[region].direction != 0) {
+	tls->htm_stats[region].event_counter[event_adaptive_budget] += tls->policy[region].transient_retry_max;
+	tls->htm_stats[region].event_counter[event_adaptive_threads]++;
       }
-      aborts += tls->htm_stats[region].event_counter[2];
+    }
 
-#if defined(__370__)
-      for (i = 0; i < NUM_HTM_ABORT_REASON_CODES; i++) {
-	int j;
-	for (j = 0; j < NUM_HTM_TBEGIN_RETURNS; j++) {
-	  global_htm_stats_per_region[region].abort_reason_code[i][j] += tls->htm_stats[region].abort_reason_code[i][j];
-	}
+    if (stats_format != stats_text) {
+      ts = (thread_stats_t *)calloc(1, sizeof(thread_stats_t));
+      assert(ts);
+      ts->tid = tls->tid;
+      ts->prefetch_time = tls->prefetch_time;
+      ts->normal_time = tls->normal_time;
+      ts->abort_time = tls->abort_time;
+    }
+
+    THREAD_MUTEX_LOCK(global_htm_stats_lock);
+    for (region = 0; region < NUM_ATOMIC_REGIONS; region++) {
+      stats_add(&global_htm_stats_per_region[region], &tls->htm_stats[region]);
+      if (ts) {
+	stats_add(&ts->stats, &tls->htm_stats[region]);
       }
-#elif defined(__x86_64__)
-#define HTM_IA32_STAT(nam) global_htm_stats_per_region[region].abort_reason_counters.nam += tls->htm_stats[region].abort_reason_counters.nam;
-#include "htm_ia32_stat.h"
-#undef HTM_IA32_STAT
-#elif defined(__PPC__) || defined(_ARCH_PPC)
-#define HTM_PPC_STAT(nam) global_htm_stats_per_region[region].abort_reason_counters.nam += tls->htm_stats[region].abort_reason_counters.nam; thread_abort_reason_counters.nam += tls->htm_stats[region].abort_reason_counters.nam;
+      aborts += tls->htm_stats[region].event_counter[2];
+#if defined(__PPC__) || defined(_ARCH_PPC)
+#define HTM_PPC_STAT(nam) thread_abort_reason_counters.nam += tls->htm_stats[region].abort_reason_counters.nam;
 #include "htm_ppc_stat.h"
 #undef HTM_PPC_STAT
 #endif
     }
-
-    printf("thread id: %lu , %d aborts\n", thread_getId(), aborts);
+    if (ts) {
+      ts->next = thread_stats_list;
+      thread_stats_list = ts;
+    } else {
+      printf("thread id: %lu , %d aborts\n", thread_getId(), aborts);
 #if defined(__PPC__) || defined(_ARCH_PPC)
 #define HTM_PPC_STAT(nam) printf("thread %lu: %15llu %s\n", thread_getId(), thread_abort_reason_counters.nam, #nam);
 #include "htm_ppc_stat.h"
 #undef HTM_PPC_STAT
 #endif
+    }
 
     global_prefetch_time += tls->prefetch_time;
     global_normal_time += tls->normal_time;
     global_abort_time += tls->abort_time;
-    //printf("thread %llu : completed txs %llu\n", thread_getId(), completed_txs[thread_getId()]);
+    global_prefetch_ops += tls->prefetch_ops;
+    global_prefetch_hits += tls->prefetch_hits;
+    global_prefetch_skipped += tls->prefetch_skipped;
+    global_hit_abort_time += tls->hit_abort_time;
+    global_miss_abort_time += tls->miss_abort_time;
     THREAD_MUTEX_UNLOCK(global_htm_stats_lock);
   }
+#ifdef HTM_HYBRID
+  while (sw_tx.limbo.size != 0) {
+    txlog_reclaim(&sw_tx.limbo, txepoch_oldest(&sw_threads));
+    txlog_relax();
+  }
+  txepoch_unregister(&sw_threads, &sw_tx.epoch);
+  txlog_free(&sw_tx.reads);
+  txlog_free(&sw_tx.writes);
+  txset_free(&sw_tx.write_index);
+  txlog_free(&sw_tx.allocs);
+  txlog_free(&sw_tx.frees);
+  txlog_free(&sw_tx.limbo);
+#endif
+  if (tm_rot_enabled_ibm) {
+    txlog_free(&rot_tx.reads);
+    txset_free(&rot_tx.read_index);
+  }
+#ifdef HTM_EMULATED
+  htm_emu_thread_exit();
+#endif
+#ifdef USE_TMALLOC
+  tmalloc_thread_exit();
+#endif
+  if (global_tls->tid >= tls_slab_threads) {
+    /* Not in the slab: posix_memalign()ed by tm_thread_enter_ibm() */
+    free(global_tls);
+  }
+  global_tls = NULL;
 #endif /* ! __bgq__ */
 }
 
+/* Only outside hardware transactions: before tbegin(), on the abort path
+   or after tend().  A counter written inside one would join its footprint,
+   and its abort would roll the count back */
 #define INCREMENT_STAT(field)                           \
   do {                                                  \
     if (collect_stats) {                                \
@@ -443,9 +2092,29 @@ tm_thread_exit_ibm()
     }                                                   \
   } while (0)
 
+#define RECORD_LATENCY(kind, ticks)                     \
+  do {                                                  \
+    if (collect_stats) {                                \
+      htm_hist_record(&tls->htm_stats[region_id].latency[latency_ ## kind], (ticks)); \
+    }                                                   \
+  } while (0)
+
+/* Called with gl.a.global_lock raised: the fallback readers that got in
+   first must leave before the holder may write */
+static void
+wait_for_fallback_readers(void)
+{
+  if (rw_fallback) {
+    __sync_synchronize();
+    while (fallback_readers.a.value)
+      ;
+  }
+}
+
 static int
-fall_back_global_lock(int acquire)
+fall_back_global_lock(tls_t *tls, int acquire)
 {
+  tls->fallback_start = TICKS_READ();
 #ifdef USE_MUTEX
   const int spin_max = 2000000000;
   int spin_count = spin_max;
@@ -460,7 +2129,14 @@ fall_back_global_lock(int acquire)
     THREAD_COND_WAIT(global_lock_cond, global_lock_mutex);
   }
   gl.a.global_lock = 1;
+  fallback_epochs.a.value++;
   THREAD_MUTEX_UNLOCK(global_lock_mutex);
+  wait_for_fallback_readers();
+#ifdef HTM_EMULATED
+  htm_emu_nontx_begin();
+#endif
+  tls->fallback = fallback_write;
+  tls->fallback_acquired = TICKS_READ();
 
   return 1;
 #else /* !USE_MUTEX */
@@ -474,6 +2150,12 @@ fall_back_global_lock(int acquire)
   if (! acquire)
     return 0;
 
+  if (fallback_lock.kind != HTM_LOCK_TTAS) {
+    /* Queue on the HTM_FBLOCK lock; only its owner raises the flag
+       that transactions subscribe to */
+    htm_lock_acquire(&fallback_lock, &tls->fallback_node);
+    gl.a.global_lock = 1;
+  } else {
 #if defined(__370__)
   while (cs(&local_value, (cs_t *)&gl.a.global_lock, new_value)) {
     while (local_value = gl.a.global_lock)
@@ -491,17 +2173,457 @@ fall_back_global_lock(int acquire)
 #else
 #error
 #endif
+  }
+  fallback_epochs.a.value++;
+  wait_for_fallback_readers();
+#ifdef HTM_EMULATED
+  htm_emu_nontx_begin();
+#endif
+  tls->fallback = fallback_write;
+  tls->fallback_acquired = TICKS_READ();
 
   return 1;
 #endif /* USE_MUTEX */
 }
 
+/* A load that never sees half of a commit; an emulated hardware commit
+   is not atomic to plain loads. */
+static inline uint64_t
+sw_load_word(const volatile void *addr, size_t size)
+{
+#ifdef HTM_EMULATED
+  char buf[8] __attribute__((aligned(8)));
+
+  htm_emu_load(addr, (void *)buf, size);
+  return txlog_load_word(buf, size);
+#else
+  return txlog_load_word(addr, size);
+#endif
+}
+
+#ifdef HTM_HYBRID
+
+static void
+software_begin(tls_t *tls)
+{
+  sw_tx_t *tx = &sw_tx;
+
+  tx->gen++;
+  tx->reads.size = 0;
+  tx->writes.size = 0;
+  tx->write_index.count = 0;
+  tx->allocs.size = 0;
+  tx->frees.size = 0;
+
+  /* Running hardware transactions read sw_active at tend: they abort
+     here, or have committed and will be seen through hw_commits */
+  NONTX_BEGIN();
+  __sync_fetch_and_add(&sw_active.a.value, 1);
+  NONTX_END();
+
+  do {
+    tx->snapshot = sw_seq.a.value;
+  } while (tx->snapshot & 1);
+  tx->hw_snapshot = hw_commits.a.value;
+  tx->epoch.start = tx->snapshot;
+  PIN();
+  __sync_synchronize();
+  tm_software_ibm = 1;
+}
+
+static void
+software_finish(sw_tx_t *tx)
+{
+  tm_software_ibm = 0;
+  tx->epoch.start = TXEPOCH_INACTIVE;
+  UNPIN();
+  NONTX_BEGIN();
+  __sync_fetch_and_sub(&sw_active.a.value, 1);
+  NONTX_END();
+}
+
+static void
+software_abort(void)
+{
+  tls_t *tls = global_tls;
+  int region_id = tls->region_id;
+  sw_tx_t *tx = &sw_tx;
+  long i;
+
+  software_finish(tx);
+  for (i = 0; i < tx->allocs.size; i++) {
+    free((void *)tx->allocs.entries[i].addr);
+  }
+  INCREMENT_STAT(software_abort);
+  tls->software_restart = 1;
+  siglongjmp(tm_checkpoint_ibm, 1);
+}
+
+/* Waits until neither counter moves and re-checks every logged read
+   against memory.  Returns the sequence number the read set is
+   consistent with; aborts on a mismatch. */
+static uintptr_t
+software_validate(sw_tx_t *tx)
+{
+  for ( ; ; ) {
+    uintptr_t seq = sw_seq.a.value;
+    uintptr_t hw = hw_commits.a.value;
+    long i;
+
+    if (seq & 1) {
+      txlog_relax();
+      continue;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for (i = 0; i < tx->reads.size; i++) {
+      txlog_entry_t *e = &tx->reads.entries[i];
+      if (sw_load_word(e->addr, e->size) != e->value) {
+	software_abort();
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq == sw_seq.a.value && hw == hw_commits.a.value) {
+      tx->hw_snapshot = hw;
+      return seq;
+    }
+  }
+}
+
+static void
+software_commit(void)
+{
+  sw_tx_t *tx = &sw_tx;
+  long i;
+
+  if (tx->writes.size != 0) {
+    NONTX_BEGIN();
+    while (!__sync_bool_compare_and_swap(&sw_seq.a.value, tx->snapshot, tx->snapshot + 1)) {
+      NONTX_END();
+      tx->snapshot = software_validate(tx);
+      NONTX_BEGIN();
+    }
+    /* Hardware transactions started from now on see sw_seq odd, and
+       those still running are subscribed to it; only commits that
+       happened before the CAS can have been missed. */
+    if (hw_commits.a.value != tx->hw_snapshot) {
+      for (i = 0; i < tx->reads.size; i++) {
+	txlog_entry_t *e = &tx->reads.entries[i];
+	if (txlog_load_word(e->addr, e->size) != e->value) {
+	  sw_seq.a.value = tx->snapshot + 2;
+	  NONTX_END();
+	  software_abort();
+	}
+      }
+    }
+    for (i = 0; i < tx->writes.size; i++) {
+      txlog_entry_t *e = &tx->writes.entries[i];
+      txlog_store_word(e->addr, e->value, e->size);
+    }
+    __sync_synchronize();
+    sw_seq.a.value = tx->snapshot + 2;
+    NONTX_END();
+  }
+
+  software_finish(tx);
+#ifdef HTM_EMULATED
+  /* Emulated hardware transactions may be validating against them too */
+  for (i = 0; i < tx->frees.size; i++) {
+    RELEASE((void *)tx->frees.entries[i].addr);
+  }
+#else
+  for (i = 0; i < tx->frees.size; i++) {
+    txlog_entry_t *e = txlog_append(&tx->limbo);
+    e->addr = tx->frees.entries[i].addr;
+    e->value = tx->snapshot + 2;
+  }
+  if (tx->limbo.size >= SW_LIMBO_BATCH) {
+    txlog_reclaim(&tx->limbo, txepoch_oldest(&sw_threads));
+  }
+#endif
+}
+
+/* An irrevocable run: takes sw_seq like a commit about to write back,
+   and keeps it until tend_ibm(), so that software transactions wait and
+   hardware ones abort.  The region runs uninstrumented meanwhile. */
+static void
+software_serialize(tls_t *tls)
+{
+  for ( ; ; ) {
+    uintptr_t seq = sw_seq.a.value;
+
+    if (!(seq & 1)) {
+      NONTX_BEGIN();
+      if (__sync_bool_compare_and_swap(&sw_seq.a.value, seq, seq + 1)) {
+	break;
+      }
+      NONTX_END();
+    }
+    txlog_relax();
+  }
+  /* The emulator's sequence lock stays held too, like after
+     fall_back_global_lock() */
+  tls->fallback = fallback_serial;
+  tls->fallback_acquired = TICKS_READ();
+}
+
+void
+tm_sw_load_ibm(const volatile void *addr, void *buf, size_t size)
+{
+  sw_tx_t *tx = &sw_tx;
+  txlog_entry_t *e;
+  uint64_t value;
+  long *idx;
+
+  if (tx->writes.size != 0) {
+    idx = txset_lookup(&tx->write_index, (uintptr_t)addr, tx->gen, 0);
+    if (idx != NULL) {
+      e = &tx->writes.entries[*idx];
+      assert(e->size == size);
+      txlog_store_word(buf, e->value, size);
+      return;
+    }
+  }
+
+  value = sw_load_word(addr, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  while (tx->snapshot != sw_seq.a.value || tx->hw_snapshot != hw_commits.a.value) {
+    tx->snapshot = software_validate(tx);
+    value = sw_load_word(addr, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+
+  e = txlog_append(&tx->reads);
+  e->addr = (volatile void *)addr;
+  e->value = value;
+  e->size = size;
+  txlog_store_word(buf, value, size);
+}
+
+void
+tm_sw_store_ibm(volatile void *addr, const void *buf, size_t size)
+{
+  sw_tx_t *tx = &sw_tx;
+  txlog_entry_t *e;
+  long *idx;
+
+  idx = txset_lookup(&tx->write_index, (uintptr_t)addr, tx->gen, 1);
+  if (*idx < 0) {
+    *idx = tx->writes.size;
+    e = txlog_append(&tx->writes);
+    e->addr = addr;
+    e->size = size;
+  } else {
+    e = &tx->writes.entries[*idx];
+    assert(e->size == size);
+  }
+  e->value = txlog_load_word(buf, size);
+}
+
+void *
+tm_malloc_ibm(size_t size)
+{
+  void *ptr = malloc(size);
+
+  if (tm_software_ibm && ptr != NULL) {
+    txlog_append(&sw_tx.allocs)->addr = ptr;
+  }
+  return ptr;
+}
+
+/* A software transaction may abort after TM_FREE, and concurrent ones may
+   still validate against the block: defer it like norec.c does. */
+void
+tm_free_ibm(void *ptr)
+{
+  if (tm_software_ibm) {
+    txlog_append(&sw_tx.frees)->addr = ptr;
+  } else {
+    RELEASE(ptr);
+  }
+}
+#endif /* HTM_HYBRID */
+
+#ifndef HTM_HYBRID
+/* TM_BEGIN_RO regions share the fallback path with HTM_FBLOCK_RW.
+   Readers announce themselves, then back out if a writer got the lock. */
+static void
+fall_back_read_lock(tls_t *tls)
+{
+  for ( ; ; ) {
+    while (gl.a.global_lock)
+      ;
+    NONTX_BEGIN();
+    __sync_fetch_and_add(&fallback_readers.a.value, 1);
+    NONTX_END();
+    if (!gl.a.global_lock) {
+      break;
+    }
+    NONTX_BEGIN();
+    __sync_fetch_and_sub(&fallback_readers.a.value, 1);
+    NONTX_END();
+  }
+  tls->fallback = fallback_read;
+  tls->fallback_acquired = TICKS_READ();
+}
+#endif
+
+/* Makes writers version their stripes until rot_uncount() */
+static void
+rot_count(void)
+{
+  if (!rot_tx.counted) {
+    rot_tx.counted = 1;
+    NONTX_BEGIN();
+    __sync_fetch_and_add(&rot_readers.a.value, 1);
+    NONTX_END();
+  }
+}
+
+static void
+rot_uncount(void)
+{
+  if (rot_tx.counted) {
+    rot_tx.counted = 0;
+    __sync_fetch_and_sub(&rot_readers.a.value, 1);
+  }
+}
+
+/* Empties the read log of a new rollback-only attempt */
+static void
+rot_reset(void)
+{
+  rot_tx.reads.size = 0;
+  rot_tx.gen++;
+  rot_tx.read_index.count = 0;
+}
+
+/* Nothing the rollback-only region has read has changed (only the stripe
+   of e if not NULL), and the fallback path has not run, since the region
+   began */
+static int
+rot_validate(txlog_entry_t *e)
+{
+  long i;
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (FALLBACK_WRITING() || FALLBACK_EPOCH() != rot_tx.epoch) {
+    return 0;
+  }
+  if (e != NULL) {
+    return HW_LOAD(*(volatile uintptr_t *)e->addr) == e->value;
+  }
+  for (i = 0; i < rot_tx.reads.size; i++) {
+    e = &rot_tx.reads.entries[i];
+    if (HW_LOAD(*(volatile uintptr_t *)e->addr) != e->value) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void
+tm_rot_load_ibm(const volatile void *addr, void *buf, size_t size)
+{
+  volatile uintptr_t *version = ROT_VERSION(addr);
+  uintptr_t seen = HW_LOAD(*version);
+  uint64_t value;
+  txlog_entry_t *e;
+  long *idx;
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  value = sw_load_word(addr, size);
+  idx = txset_lookup(&rot_tx.read_index, (uintptr_t)version, rot_tx.gen, 1);
+  if (*idx < 0) {
+    *idx = rot_tx.reads.size;
+    e = txlog_append(&rot_tx.reads);
+    e->addr = version;
+    e->value = seen;
+    e = NULL;
+  } else {
+    e = &rot_tx.reads.entries[*idx];
+  }
+  if (tm_rot_ibm == rot_software && !rot_validate(e)) {
+    tm_rot_ibm = rot_none;
+    rot_tx.restart = 1;
+    siglongjmp(tm_checkpoint_ibm, 1);
+  }
+  txlog_store_word(buf, value, size);
+}
+
+void
+tm_rot_store_ibm(volatile void *addr)
+{
+  volatile uintptr_t *version;
+
+  if (tm_rot_ibm == rot_software) {
+    /* Nothing to buffer the store in: rerun as an ordinary region */
+    tls_t *tls = global_tls;
+    int region_id = tls->region_id;
+
+    INCREMENT_STAT(rot_upgrade);
+    tm_rot_ibm = rot_none;
+    rot_tx.upgrade = 1;
+    siglongjmp(tm_checkpoint_ibm, 1);
+  }
+  if (HW_LOAD(rot_readers.a.value) == 0) {
+    return;
+  }
+  version = ROT_VERSION(addr);
+#ifdef HTM_EMULATED
+  HW_STORE(*version, HW_LOAD(*version) + 1);
+#else
+  __sync_fetch_and_add(version, 1);
+#endif
+}
+
+/* Where a region goes once HTM has failed it */
+static void
+fall_back(tls_t *tls, int region_id)
+{
+  tm_rot_ibm = rot_none;
+  tls->fallback_start = TICKS_READ();
+  if (irrevocable_threshold) {
+    irrevocable_profile_t *p = &tls->irrevocable_profile[region_id];
+
+    p->fallbacks++;
+    p->retry_time += tls->fallback_start - tls->region_start;
+  }
+#ifdef HTM_HYBRID
+  INCREMENT_STAT(software_tx);
+  software_begin(tls);
+#else
+  if (rw_fallback && tls->read_only) {
+    fall_back_read_lock(tls);
+    INCREMENT_STAT(global_lock_read_acquired);
+  } else {
+    fall_back_global_lock(tls, 1);
+  }
+#endif
+}
+
+/* An irrevocable run of the region, see irrevocable_regions */
+static void
+fall_back_irrevocable(tls_t *tls, int region_id)
+{
+  tls->irrevocable = 0;
+  tm_rot_ibm = rot_none;
+  INCREMENT_STAT(irrevocable_tx);
+  INCREMENT_STAT(tx);
+  tls->start = TICKS_READ();
+#ifdef HTM_HYBRID
+  tls->fallback_start = tls->start;
+  software_serialize(tls);
+#else
+  fall_back_global_lock(tls, 1);
+#endif
+}
+
 static int isAbortPersistent(int tbegin_result,TransactionDiagnosticInfo *diag) {
 #if defined(__370__)
   uint64_t reason=diag->transactionAbortCode;
   return (tbegin_result != 4 &&
 	  (diag->format != 1 || reason == 7 || reason == 8 || (11 <= reason && reason <= 13)));
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
   return ( (tbegin_result != 4) && !(diag->transactionAbortCode&XABORT_RETRY));
 #elif defined(__PPC__) || defined(_ARCH_PPC)
   return (tbegin_result != 4) && (diag->transactionAbortCode&0x0100000000000000ULL);
@@ -510,6 +2632,156 @@ static int isAbortPersistent(int tbegin_result,TransactionDiagnosticInfo *diag)
 #endif
 }
 
+/* The hardware ran out of room for the footprint */
+static int isCapacityAbort(int tbegin_result,TransactionDiagnosticInfo *diag) {
+  uint64_t reason=diag->transactionAbortCode;
+#if defined(__370__)
+  return tbegin_result != 4 && diag->format == 1 && (reason == 7 || reason == 8);
+#elif defined(HTM_IA32_ABORT_CODES)
+  return tbegin_result != 4 && (reason & XABORT_CAPACITY);
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+  /* TEXASR: footprint overflow (bit 10) */
+  return tbegin_result != 4 && (reason & 0x0020000000000000ULL);
+#else
+  return 0;
+#endif
+}
+
+static int isAbortWithCode(uint64_t reason, uint64_t code) {
+#if defined(HTM_IA32_ABORT_CODES)
+  return (reason & XABORT_EXPLICIT) && ((reason >> 24) & 0xff) == code;
+#elif defined(__370__)
+  return reason == code + 256;
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+  /* TEXASR: explicit abort (bit 31) with our failure code in bits 0-7 */
+  return (reason & 0x0000000100000000ULL) && (reason >> 56) == code;
+#else
+  return 0;
+#endif
+}
+
+static int isRetryAbort(uint64_t reason) {
+  return isAbortWithCode(reason, RETRY_ABORT_CODE);
+}
+
+static int isIrrevocableAbort(uint64_t reason) {
+  return isAbortWithCode(reason, IRREVOCABLE_ABORT_CODE);
+}
+
+/* Aborts with RETRY_ABORT_CODE; the tabort() of htm_util.h does not pass
+   its code through on x86 and POWER */
+static inline void
+tabort_retry(void)
+{
+#if defined(HTM_EMULATED)
+  tabort(RETRY_ABORT_CODE);
+#elif defined(__370__)
+  tabort(RETRY_ABORT_CODE + 256);        /* codes below 256 are reserved */
+#elif defined(__x86_64)
+  asm volatile(".byte 0xc6; .byte 0xf8; .byte 0xfe" :: ); /* xabort $0xfe */
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+  asm volatile("mr 3,%0;"
+	       ".long 0x7c03071d": : "r" ((uint64_t)RETRY_ABORT_CODE) : "r3", "cr0"); // tabort. 3
+#else
+  tabort(RETRY_ABORT_CODE);
+#endif
+}
+
+/* The same with IRREVOCABLE_ABORT_CODE */
+static inline void
+tabort_irrevocable(void)
+{
+#if defined(HTM_EMULATED)
+  tabort(IRREVOCABLE_ABORT_CODE);
+#elif defined(__370__)
+  tabort(IRREVOCABLE_ABORT_CODE + 256);
+#elif defined(__x86_64)
+  asm volatile(".byte 0xc6; .byte 0xf8; .byte 0xfd" :: ); /* xabort $0xfd */
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+  asm volatile("mr 3,%0;"
+	       ".long 0x7c03071d": : "r" ((uint64_t)IRREVOCABLE_ABORT_CODE) : "r3", "cr0"); // tabort. 3
+#else
+  tabort(IRREVOCABLE_ABORT_CODE);
+#endif
+}
+
+/* HTM_IRREVOCABLE: counts a capacity abort of the region, and makes the
+   region irrevocable once they are frequent enough */
+static void
+irrevocable_profile(tls_t *tls, int region_id)
+{
+  irrevocable_profile_t *p = &tls->irrevocable_profile[region_id];
+
+  p->capacity_aborts++;
+  if (p->attempts < IRREVOCABLE_MIN_ATTEMPTS || irrevocable_regions[region_id] ||
+      p->capacity_aborts * 100 < p->attempts * irrevocable_threshold) {
+    return;
+  }
+  /* The run in progress has retried this long already, and counts as one
+     that falls back */
+  irrevocable_cost[region_id] = (p->retry_time + (TICKS_READ() - tls->region_start)) / (p->fallbacks + 1);
+  __sync_synchronize();
+  irrevocable_regions[region_id] = 1;
+  INCREMENT_STAT(irrevocable_marked);
+}
+
+static batch_t *
+batch_get(tls_t *tls, int region_id)
+{
+  batch_t *b = &tls->batch[region_id];
+
+  if (b->size == 0) {
+    b->size = 2;
+  }
+  return b;
+}
+
+/* HTM_BATCH: a batch of tls->batch_target executions aborted */
+static void
+batch_abort(tls_t *tls, int region_id)
+{
+  batch_t *b = batch_get(tls, region_id);
+
+  INCREMENT_STAT(batch_abort);
+  b->size = tls->batch_target / 2;
+  if (++b->failures >= BATCH_SPLIT_FAILURES) {
+    INCREMENT_STAT(batch_split);
+    b->size = 1;
+    b->failures = 0;
+    b->cooldown = BATCH_COOLDOWN;
+  }
+}
+
+/* HTM_BATCH: a hardware transaction of the region committed, after
+   tls->batch_count executions */
+static void
+batch_commit(tls_t *tls, int region_id)
+{
+  batch_t *b = batch_get(tls, region_id);
+
+  if (tls->batch_target > 1) {
+    INCREMENT_STAT(batch_tx);
+    if (collect_stats) {
+      /* tbegin_ibm() counted the first execution only */
+      tls->htm_stats[region_id].event_counter[event_tx_enter] += tls->batch_count - 1;
+      tls->htm_stats[region_id].event_counter[event_batch_executions] += tls->batch_count;
+    }
+    if (tls->batch_count == tls->batch_target) {
+      b->failures = 0;
+      if (b->size < batch_max) {
+	b->size++;
+      }
+    } else if (tls->batch_count == 1) {
+      /* Another region came first: the region is not issued back to
+	 back, and an open batch only holds the transaction longer */
+      b->size = 1;
+      b->cooldown = BATCH_COOLDOWN;
+    }
+  } else if (b->size == 1 && --b->cooldown <= 0) {
+    b->size = 2;
+  }
+}
+
 static int isTransactionDelinquent(htm_stats_t* stats) {
   static const long long min_tx_before_detection=1000;
   static const long long delinquent_abort_threshold=80;
@@ -524,15 +2796,177 @@ static int isTransactionDelinquent(htm_stats_t* stats) {
   return res;
 }
 
+static inline unsigned long
+next_random(tls_t *tls)
+{
+  tls->seed = tls->seed * 6364136223846793005UL + 1442695040888963407UL;
+  return tls->seed >> 33;
+}
+
+static int
+persistent_budget(policy_t *p)
+{
+  switch (p->arm) {
+  case arm_halve:
+    return p->transient_retry_max / 2 > 1 ? p->transient_retry_max / 2 : 1;
+  case arm_stubborn:
+    return p->transient_retry_max > 1 ? p->transient_retry_max : 1;
+  default:
+    return 1;
+  }
+}
+
+static policy_t *
+policy_get(tls_t *tls, int region_id)
+{
+  policy_t *p = &tls->policy[region_id];
+
+  if (p->direction == 0) {
+    p->transient_retry_max = transient_retry_max < ADAPTIVE_MAX_RETRY ? transient_retry_max : ADAPTIVE_MAX_RETRY;
+    p->direction = -1;
+    p->arm = persistent_retry_max > 1 ? arm_stubborn : arm_giveup;
+  }
+  return p;
+}
+
+static int
+choose_arm(policy_t *p)
+{
+  double best = -1;
+  int arm = 0;
+  int i;
+
+  for (i = 0; i < ADAPTIVE_NUM_ARMS; i++) {
+    double score;
+
+    if (p->arm_pulls[i] == 0) {
+      return i;
+    }
+    score = p->arm_reward[i] / p->arm_pulls[i]
+      + sqrt(2 * log((double)p->total_pulls) / p->arm_pulls[i]);
+    if (score > best) {
+      best = score;
+      arm = i;
+    }
+  }
+  return arm;
+}
+
+/* Accounts one run of the region; ends the epoch every "adaptive" runs */
+static void
+policy_update(tls_t *tls, int region_id, double elapsed)
+{
+  policy_t *p = &tls->policy[region_id];
+  double cost;
+
+  p->time += elapsed;
+  if (++p->runs < adaptive) {
+    return;
+  }
+
+  cost = p->time / p->runs + 1e-3;
+  if (p->best_cost == 0 || cost < p->best_cost) {
+    p->best_cost = cost;
+  }
+  INCREMENT_STAT(adaptive_epoch);
+
+  if (p->persistent_aborts != 0) {
+    p->arm_pulls[p->arm]++;
+    p->arm_reward[p->arm] += p->best_cost / cost;
+    p->total_pulls++;
+    p->arm = choose_arm(p);
+  }
+  switch (p->arm) {
+  case arm_giveup:   INCREMENT_STAT(adaptive_giveup);   break;
+  case arm_halve:    INCREMENT_STAT(adaptive_halve);    break;
+  case arm_stubborn: INCREMENT_STAT(adaptive_stubborn); break;
+  }
+
+  if (p->last_cost != 0 && cost > p->last_cost) {
+    p->direction = -p->direction;
+  }
+  p->last_cost = cost;
+  if (next_random(tls) % 16 == 0) {
+    int budget = next_random(tls) % (ADAPTIVE_MAX_RETRY + 1);
+    p->direction = budget > p->transient_retry_max ? 1 : -1;
+    p->transient_retry_max = budget;
+    p->last_cost = 0;
+  } else {
+    if (p->transient_retry_max + p->direction < 0 ||
+	p->transient_retry_max + p->direction > ADAPTIVE_MAX_RETRY) {
+      p->direction = -p->direction;
+    }
+    p->transient_retry_max += p->direction;
+  }
+  if (p->direction > 0) {
+    INCREMENT_STAT(adaptive_budget_up);
+  } else {
+    INCREMENT_STAT(adaptive_budget_down);
+  }
+
+  p->runs = 0;
+  p->time = 0;
+  p->persistent_aborts = 0;
+}
+
 /*#define ABORT_CC_AND_RETRY_STATS*/
 
-int tbegin_ibm(int region_id)
+/* A helper runs each region of its master's operation as a rollback-only
+   transaction, which tend_ibm() aborts once the body is done; the body is
+   then skipped.  Any other abort gives up on the region. */
+static int
+tbegin_helper(tls_t *tls, int region_id)
+{
+  TransactionDiagnosticInfo diag = {};
+
+  if (!htm_usable) {
+    /* Nothing to warm the footprint with */
+    TMALLOC_ABORT();
+    return CONTINUE;
+  }
+#ifdef HTM_EMULATED
+  /* Re-entered from the checkpoint: tbegin() returns the abort */
+  if (tpending()) {
+    goto tx_resume;
+  }
+#endif
+  INCREMENT_STAT(prefetch_tx);
+  tls->start = TICKS_READ();
+#ifdef HTM_EMULATED
+ tx_resume:
+#endif
+  tls->lazy = 0;
+
+  if (tbegin(1, &diag) == 0) {
+    if (!FALLBACK_BUSY(tls)) {
+#ifdef HTM_CONSERVE_RWBUF
+      suspend_tx();
+#endif
+      return 0;
+    }
+    tend();
+  } else if (isRetryAbort(diag.transactionAbortCode)) {
+    INCREMENT_STAT(prefetch_warmed);
+    if (tls->prefetch_op >= 0) {
+      prefetch_slot_t *slot = PREFETCH_SLOT(&prefetch_masters[tls->master], tls->prefetch_op);
+      if (slot->seq == tls->prefetch_op) {
+	slot->warmed = tls->prefetch_op;
+      }
+    }
+  }
+  /* Helpers never commit: leave the allocator's epoch */
+  TMALLOC_ABORT();
+
+  tls->stop = TICKS_READ();
+  tls->prefetch_time += (tls->stop - tls->start);
+  return CONTINUE;
+}
+
+static int
+tbegin_region(int region_id, int read_only, int rot)
 {
   int tbegin_result;
   TransactionDiagnosticInfo diag = {};
-  int transient_retry_count;
-  int persistent_retry_count;
-  int global_lock_retry_count;
   tls_t *tls = NULL;
 #if defined(__370__)
   uint64_t saved_fprs[8];  /* FPR8 - FPR15 */
@@ -541,45 +2975,163 @@ int tbegin_ibm(int region_id)
   uint64_t saved_reason = 0; uint8_t saved_LSUAbortCode = 0; int saved_tbegin_result = 0;
 #endif
 
-  tls = THREAD_KEY_GET(global_tls_key);
+  tls = global_tls;
+
+#ifdef HTM_HYBRID
+  /* Re-entered from the checkpoint after a software abort: the region
+     stays on the software path */
+  if (tls->software_restart) {
+    tls->software_restart = 0;
+    /* Forgets the frees of the aborted attempt, retires its blocks */
+    TMALLOC_ATTEMPT();
+    if (tls->irrevocable) {
+      fall_back_irrevocable(tls, region_id);
+    } else {
+      software_begin(tls);
+    }
+    return 0;
+  }
+#endif
+  if (tls->batch_open) {
+    /* Inside the hardware transaction of a batch: the execution joins
+       it, or a different kind of region commits it first */
+    if (tls->batch_open == region_id + 1 && tls->read_only == read_only &&
+	!rot && !tls->irrevocable) {
+      return 0;
+    }
+    tend_region(tls, 1);
+  }
+  tls->batch_target = 1;
+  tls->region_id = region_id;
+  tls->read_only = read_only;
+  tls->rot = rot;
+  /* Also forgets the frees of an emulated attempt that aborted */
+  TMALLOC_ATTEMPT();
+
+  if (!tls->isMaster) {
+    return tbegin_helper(tls, region_id);
+  }
+
+#ifdef HTM_EMULATED
+  /* Re-entered from the checkpoint after an emulated abort: continue the
+     retry loop of the attempt that aborted. */
+  if (tpending()) {
+    goto tx_resume;
+  }
+#endif
 
   INCREMENT_STAT(tx_enter);
+  if (rot) {
+    INCREMENT_STAT(rot_tx);
+  }
+  if (adaptive || irrevocable_threshold) {
+    tls->region_start = TICKS_READ();
+  }
+
+  if (tls->irrevocable || irrevocable_regions[region_id]) {
+    if (!tls->irrevocable) {
+      INCREMENT_STAT(irrevocable_auto);
+      if (collect_stats) {
+	tls->htm_stats[region_id].irrevocable_saved_time += irrevocable_cost[region_id];
+      }
+    }
+    fall_back_irrevocable(tls, region_id);
+    return 0;
+  }
+
+#ifdef HLE_INTEL
+  if (hle_elision) {
+    INCREMENT_STAT(hle_tx);
+    INCREMENT_STAT(tx);
+    tls->start = TICKS_READ();
+    tls->fallback_start = tls->start;
+    hle_acquire(&gl.a.global_lock);
+    /* An aborted elision re-executes the acquire and gets here holding
+       the lock, outside of any transaction */
+    if (!hle_elided()) {
+      INCREMENT_STAT(hle_acquired);
+      tls->fallback_acquired = TICKS_READ();
+    }
+    tls->fallback = fallback_hle;
+    return 0;
+  }
+#endif
+
+  if (!htm_usable) {
+    fall_back(tls, region_id);
+    INCREMENT_STAT(no_htm);
+    INCREMENT_STAT(tx);
+    tls->start = TICKS_READ();
+    return 0;
+  }
 
   /* Do not use HTM for delinquent transactions */
   if(DETECT_DELINQUENTS && isTransactionDelinquent(&(tls->htm_stats[region_id]))) {
-    fall_back_global_lock(1);
+    fall_back(tls, region_id);
     INCREMENT_STAT(detected_delinquent);
     return 0;
   }
 
   if (gl.a.global_lock) {
-    if (fall_back_global_lock(0)) {
+    if (fall_back_global_lock(tls, 0)) {
       INCREMENT_STAT(global_lock_wait_before_tx_sleep);
       return 0;
     }
     INCREMENT_STAT(global_lock_wait_before_tx_spin);
   }
 
-  transient_retry_count = transient_retry_max;
-  persistent_retry_count = persistent_retry_max;
-  global_lock_retry_count = global_lock_retry_max;
+  tls->transient_retry_count = transient_retry_max;
+  tls->persistent_retry_count = persistent_retry_max;
+  tls->global_lock_retry_count = global_lock_retry_max;
   tls->first_retry = 1;
+  tls->lazy_off = 0;
+
+  if (adaptive) {
+    policy_t *p = policy_get(tls, region_id);
+
+    if (p->transient_retry_max == 0) {
+      fall_back(tls, region_id);
+      INCREMENT_STAT(detected_delinquent);
+      return 0;
+    }
+    tls->transient_retry_count = p->transient_retry_max;
+    tls->persistent_retry_count = persistent_budget(p);
+    tls->global_lock_retry_count = p->transient_retry_max;
+  }
 
 #if defined(__370__)
   save_preserved_fpr(saved_fprs);
 #endif
  tx_retry:
   INCREMENT_STAT(tx);
-  TIMER_READ(tls->start);
+  tls->start = TICKS_READ();
+  TMALLOC_ATTEMPT();
+  if (irrevocable_threshold) {
+    tls->irrevocable_profile[region_id].attempts++;
+  }
+#ifdef HTM_EMULATED
+ tx_resume:
+#endif
+  tls->lazy = lazy_regions[region_id] && !tls->lazy_off && !tls->rot;
+  if (tls->lazy) {
+    tls->lazy_epoch = FALLBACK_EPOCH();
+  }
+  if (tls->rot) {
+    /* The read log of a rollback-only transaction is rolled back too */
+    rot_reset();
+    rot_tx.epoch = FALLBACK_EPOCH();
+    tm_rot_ibm = rot_hardware;
+  }
+  if (batch_max && !tls->lazy && !tls->rot) {
+    tls->batch_target = batch_get(tls, region_id)->size;
+    tls->batch_count = 0;
+  }
 
-  if(tls->isMaster)
-    tbegin_result = tbegin(0, &diag);
-  else
-    tbegin_result = tbegin(1, &diag);
+  tbegin_result = tbegin(tls->rot, &diag);
 
   if (tbegin_result == 0) {
     /* Transaction */
-    if (gl.a.global_lock) {
+    if (!tls->lazy && FALLBACK_BUSY(tls)) {
       tend();
       tbegin_result = 4;
     }
@@ -588,21 +3140,14 @@ int tbegin_ibm(int region_id)
       suspend_tx();
     }
 #endif
-    else {
-        if(prefetching && !tls->isMaster){
-            if(ctxs[tls->tid].completed_txs - ctxs[tls->tid - 1].completed_txs < 5){
-              tabort_ibm();
-            }
-//		while(1)
-//            ctxs[tls->tid-1].completed_txs = 0;
-        }
-    }
   }
   if (tbegin_result != 0) {
     /* Abort */
     uint64_t reason = diag.transactionAbortCode;
     /*int saved_first_retry;*/
 
+    tm_rot_ibm = rot_none;
+
     if (tbegin_result != 4) {
 #if defined(__370__)
       restore_preserved_fpr(saved_fprs);
@@ -610,18 +3155,58 @@ int tbegin_ibm(int region_id)
     }
 
 #ifdef ABORT_CC_AND_RETRY_STATS
-    if (global_lock_retry_count == global_lock_retry_max
+    if (tls->global_lock_retry_count == global_lock_retry_max
 	&& reason == saved_reason && diag.LSUAbortCode == saved_LSUAbortCode && tbegin_result == saved_tbegin_result) {
-      printf("AbortCcAndRetryStats r %d %llu %u %d\n", transient_retry_count, saved_reason, saved_LSUAbortCode, saved_tbegin_result);
+      printf("AbortCcAndRetryStats r %d %llu %u %d\n", tls->transient_retry_count, saved_reason, saved_LSUAbortCode, saved_tbegin_result);
     }
 #endif
 
     INCREMENT_STAT(abort);
     /*saved_first_retry = first_retry;*/
 
+    if (tls->batch_target > 1 && tbegin_result != 4) {
+      /* Back at the first execution of the batch, whatever the cause:
+         rerun it as a smaller batch */
+      batch_abort(tls, region_id);
+      tls->stop = TICKS_READ();
+      RECORD_LATENCY(abort, tls->stop - tls->start);
+      tls->abort_time += (tls->stop - tls->start);
+      goto tx_retry;
+    }
+
+    if (isIrrevocableAbort(reason)) {
+      /* TM_BECOME_IRREVOCABLE() */
+      INCREMENT_STAT(irrevocable_become);
+      tls->stop = TICKS_READ();
+      RECORD_LATENCY(abort, tls->stop - tls->start);
+      tls->abort_time += (tls->stop - tls->start);
+      fall_back_irrevocable(tls, region_id);
+      return 0;
+    }
+
+    /* The check in tend_ibm() failed: retry like after an early
+       subscription abort.  A lazy region subscribes early from now on. */
+    if ((tls->lazy || tls->rot) && isRetryAbort(reason)) {
+      tbegin_result = 4;
+      if (tls->lazy) {
+	tls->lazy_off = 1;
+	INCREMENT_STAT(lazy_subscription_abort);
+      } else {
+	INCREMENT_STAT(rot_abort);
+      }
+    }
+
+    /* Aborted threads serialize among themselves before retrying, so
+       that they do not all end up on the fallback lock */
+    if (aux_locking && !tls->aux_held) {
+      htm_lock_acquire(&aux_lock, &tls->aux_node);
+      tls->aux_held = 1;
+      INCREMENT_STAT(aux_lock_acquired);
+    }
+
     if (gl.a.global_lock) {
-      if (--global_lock_retry_count > 0) {
-	if (fall_back_global_lock(0)) {
+      if (--tls->global_lock_retry_count > 0) {
+	if (fall_back_global_lock(tls, 0)) {
 	  INCREMENT_STAT(global_lock_wait_and_retry_sleep);
 	  return 0;
 	}
@@ -629,7 +3214,7 @@ int tbegin_ibm(int region_id)
 	goto tx_retry;
       }
       INCREMENT_STAT(global_lock_acquired);
-      fall_back_global_lock(1);
+      fall_back(tls, region_id);
     } else {
       if (collect_stats /*&& saved_first_retry*/) {
 #if defined(__370__)
@@ -644,7 +3229,7 @@ int tbegin_ibm(int region_id)
 	} else {
 	  tls->htm_stats[region_id].abort_reason_code[18][tbegin_result - 1]++;
 	}
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
 #define TLSCTR tls->htm_stats[region_id].abort_reason_counters
 	if(tbegin_result==4) {
 	  TLSCTR.GLOBAL_LOCK_ACQUIRED ++;
@@ -678,42 +3263,36 @@ int tbegin_ibm(int region_id)
 #endif
       }
 
-      TIMER_READ(tls->stop);
+      tls->stop = TICKS_READ();
+      RECORD_LATENCY(abort, tls->stop - tls->start);
 
       if (tls->first_retry) {
-        if(prefetching && !tls->isMaster){
-          tls->prefetch_time += TIMER_DIFF_MICROSEC(tls->start, tls->stop);
-          ctxs[tls->tid].completed_txs++;
-          return CONTINUE;
-        }
-
         tls->first_retry = 0;
         INCREMENT_STAT(first_abort);
       }
 
-      tls->abort_time += TIMER_DIFF_MICROSEC(tls->start, tls->stop);
+      tls->abort_time += (tls->stop - tls->start);
+      if (tls->prefetch_hit) {
+	tls->hit_abort_time += (tls->stop - tls->start);
+      } else {
+	tls->miss_abort_time += (tls->stop - tls->start);
+      }
 //printf("abort: %lu\n", tls->start.tv_usec);
 
-#ifdef ABORTED_INSN_ADDRESS_STATS
-      if (reason == aborted_insn_address_reason_code) {
-	int idx;
+      if (profile_period && tbegin_result != 4 && --tls->profile_countdown == 0) {
+	tls->profile_countdown = profile_period;
+	profile_record(tls, region_id, ABORT_SITE(diag), ABORT_DATA(diag));
+      }
 
-	if (diag.abortedTransactionInstructionAddress < ABORTED_INSN_ADDRESS_STATS_START_ADDRESS) {
-	  idx = 0;
-	} else {
-	  idx = (diag.abortedTransactionInstructionAddress - ABORTED_INSN_ADDRESS_STATS_START_ADDRESS) / 2;
-	  if (idx >= ABORTED_INSN_ADDRESS_STATS_MAP_SIZE)
-	    idx = ABORTED_INSN_ADDRESS_STATS_MAP_SIZE - 1;
-	}
-	aborted_insn_address_stats[idx]++;
+      if (irrevocable_threshold && isCapacityAbort(tbegin_result, &diag)) {
+	irrevocable_profile(tls, region_id);
       }
-#endif
 
 #ifdef ABORT_CC_AND_RETRY_STATS
-      if (global_lock_retry_count == global_lock_retry_max
-	  && (transient_retry_count == transient_retry_max ||
+      if (tls->global_lock_retry_count == global_lock_retry_max
+	  && (tls->transient_retry_count == transient_retry_max ||
 	      reason == saved_reason && diag.LSUAbortCode == saved_LSUAbortCode && tbegin_result == saved_tbegin_result)) {
-	printf("AbortCcAndRetryStats f %d %llu %u %d\n", transient_retry_count, reason, diag.LSUAbortCode, tbegin_result);
+	printf("AbortCcAndRetryStats f %d %llu %u %d\n", tls->transient_retry_count, reason, diag.LSUAbortCode, tbegin_result);
 	saved_reason = reason; saved_LSUAbortCode = diag.LSUAbortCode; saved_tbegin_result = tbegin_result;
       } else {
 	saved_reason = 0; saved_LSUAbortCode = 0; saved_tbegin_result = 0;
@@ -721,27 +3300,30 @@ int tbegin_ibm(int region_id)
 #else /* ABORT_CC_AND_RETRY_STATS */
       if (isAbortPersistent(tbegin_result,&diag)) {
 	/* Persistent abort */
-	if (--persistent_retry_count > 0) {
+	if (adaptive) {
+	  tls->policy[region_id].persistent_aborts++;
+	}
+	if (--tls->persistent_retry_count > 0) {
 	  INCREMENT_STAT(persistent_abort_retry);
 	  goto tx_retry;
 	}
 
 	INCREMENT_STAT(global_lock_persistent_abort);
-	fall_back_global_lock(1);
+	fall_back(tls, region_id);
         INCREMENT_STAT(tx);
-        TIMER_READ(tls->start);
+        tls->start = TICKS_READ();
       } else
 #endif /* ! ABORT_CC_AND_RETRY_STATS */
       {
 	/* Transient abort */
-	if (--transient_retry_count > 0) {
+	if (--tls->transient_retry_count > 0) {
 	  INCREMENT_STAT(transient_abort_retry);
 	  goto tx_retry;
 	}
 	INCREMENT_STAT(global_lock_transient_abort);
-	fall_back_global_lock(1);
+	fall_back(tls, region_id);
         INCREMENT_STAT(tx);
-        TIMER_READ(tls->start);
+        tls->start = TICKS_READ();
       }
     }
   }
@@ -750,15 +3332,58 @@ int tbegin_ibm(int region_id)
 }
 
 
-void
-tend_ibm()
+/* Ends the region of tls->region_id; close_batch commits an HTM_BATCH
+   batch before it is full */
+static void
+tend_region(tls_t *tls, int close_batch)
 {
-  tls_t *tls = THREAD_KEY_GET(global_tls_key);
+  int region_id = tls->region_id;
+  int fallback = tls->fallback != fallback_none;
 
 #ifdef HTM_CONSERVE_RWBUF
   resume_tx();
 #endif
-  if (gl.a.global_lock) { //printf("thread %d on gl\n", tls->tid);
+  if (tm_rot_ibm == rot_software) {
+    /* Every read was validated as it was made */
+    tm_rot_ibm = rot_none;
+    rot_uncount();
+    TMALLOC_COMMIT();
+    RECORD_LATENCY(commit, TICKS_READ() - tls->start);
+    return;
+  }
+#ifdef HLE_INTEL
+  if (tls->fallback == fallback_hle) {
+    /* An elided run commits at the release, like a hardware one */
+    fallback = !hle_elided();
+    if (fallback && collect_stats) {
+      tls->htm_stats[region_id].fallback_hold_time += TICKS_READ() - tls->fallback_acquired;
+    }
+    tls->fallback = fallback_none;
+    hle_release(&gl.a.global_lock);
+  } else
+#endif
+#ifdef HTM_HYBRID
+  if (tm_software_ibm) {
+    fallback = 1;
+    software_commit();
+  } else if (tls->fallback == fallback_serial) {
+    if (collect_stats) {
+      tls->htm_stats[region_id].fallback_hold_time += TICKS_READ() - tls->fallback_acquired;
+    }
+    tls->fallback = fallback_none;
+    __sync_synchronize();
+    sw_seq.a.value++;
+    NONTX_END();
+  } else
+#endif
+  if (tls->fallback == fallback_write) { //printf("thread %d on gl\n", tls->tid);
+    if (collect_stats) {
+      tls->htm_stats[region_id].fallback_hold_time += TICKS_READ() - tls->fallback_acquired;
+    }
+    tls->fallback = fallback_none;
+#ifdef HTM_EMULATED
+    htm_emu_nontx_end();
+#endif
 #ifdef USE_MUTEX
     THREAD_MUTEX_LOCK(global_lock_mutex);
     gl.a.global_lock = 0;
@@ -771,30 +3396,365 @@ tend_ibm()
 #else
     gl.a.global_lock = 0;
 #endif /* __IBMC__ */
+    if (fallback_lock.kind != HTM_LOCK_TTAS) {
+      htm_lock_release(&fallback_lock, &tls->fallback_node);
+    }
 #endif
     /*memory_fence();*/
+  } else if (tls->fallback == fallback_read) {
+    if (collect_stats) {
+      tls->htm_stats[region_id].fallback_hold_time += TICKS_READ() - tls->fallback_acquired;
+    }
+    tls->fallback = fallback_none;
+    NONTX_BEGIN();
+    __sync_fetch_and_sub(&fallback_readers.a.value, 1);
+    NONTX_END();
   } else {
+    if (tls->batch_target > 1 && !close_batch) {
+      if (++tls->batch_count < tls->batch_target) {
+	/* The next execution of the region joins the transaction */
+	tls->batch_open = region_id + 1;
+	return;
+      }
+    }
+    tls->batch_open = 0;
+    if (!tls->isMaster) {
+      /* A helper has warmed the footprint, and never commits */
+      tabort_retry();
+    }
+    if (tls->lazy && FALLBACK_BUSY(tls)) {
+      tabort_retry();
+    }
+    if (tm_rot_ibm == rot_hardware && !rot_validate(NULL)) {
+      tabort_retry();
+    }
+#ifdef HTM_HYBRID
+    if (HW_LOAD(sw_active.a.value)) {
+      HW_STORE(hw_commits.a.value, HW_LOAD(hw_commits.a.value) + 1);
+    }
+#endif
+    tend();
+    tm_rot_ibm = rot_none;
+    if (batch_max) {
+      batch_commit(tls, region_id);
+    }
 
-    if(prefetching){
-      if(!tls->isMaster){
-        tabort_ibm();
+    if (tls->lazy) {
+      INCREMENT_STAT(lazy_subscription_tx);
+      /* Read after the commit, so an acquisition right after it counts too */
+      if (FALLBACK_EPOCH() != tls->lazy_epoch) {
+	INCREMENT_STAT(lazy_subscription_saved);
       }
-//      ctxs[tls->tid].completed_txs++;
     }
+  }
 
-    tend();
+  if (tls->aux_held) {
+    tls->aux_held = 0;
+    htm_lock_release(&aux_lock, &tls->aux_node);
+  }
+  rot_tx.upgrade = 0;
+  rot_uncount();
+  TMALLOC_COMMIT();
+
+  tls->stop = TICKS_READ();
+  tls->normal_time += (tls->stop - tls->start);
+  if (fallback) {
+    RECORD_LATENCY(fallback, tls->stop - tls->fallback_start);
+  } else {
+    RECORD_LATENCY(commit, tls->stop - tls->start);
+  }
+  if (adaptive) {
+    policy_update(tls, region_id, TICKS_TO_MICROSEC(tls->stop - tls->region_start));
+  }
+//printf("end: %lu\n", tls->start.tv_usec);
+}
+
+void
+tend_ibm()
+{
+  tend_region(global_tls, 0);
+}
+
+/* A rollback-only region, see rot_tx_t */
+static int
+tbegin_rot(int region_id, int read_only)
+{
+  tls_t *tls = global_tls;
+
+  if (tls->batch_open) {
+    tend_region(tls, 1);
+  }
+  if (!tm_rot_enabled_ibm || rot_tx.upgrade || tm_prefetch_helper_ibm ||
+      tls->irrevocable || irrevocable_regions[region_id]) {
+    return tbegin_region(region_id, read_only, 0);
+  }
+#ifdef HLE_INTEL
+  if (hle_elision) {
+    /* Holders of the elided lock do not move the fallback epoch */
+    return tbegin_region(region_id, read_only, 0);
+  }
+#endif
+  rot_count();
+  if (ROT_MODE == rot_hardware) {
+    return tbegin_region(region_id, read_only, 1);
   }
 
-//  ctxs[tls->tid].completed_txs++;
+  tls->region_id = region_id;
+  tls->read_only = read_only;
+  if (rot_tx.restart) {
+    /* Re-entered from the checkpoint after a failed validation */
+    rot_tx.restart = 0;
+    INCREMENT_STAT(rot_abort);
+    RECORD_LATENCY(abort, TICKS_READ() - tls->start);
+    if (--rot_tx.retry_count <= 0) {
+      INCREMENT_STAT(rot_fallback);
+      rot_tx.upgrade = 1;
+      return tbegin_region(region_id, read_only, 0);
+    }
+  } else {
+    INCREMENT_STAT(rot_tx);
+    rot_tx.retry_count = transient_retry_max;
+  }
 
+  TMALLOC_ATTEMPT();
 
-  TIMER_READ(tls->stop);
-  tls->normal_time += TIMER_DIFF_MICROSEC(tls->start, tls->stop);
-//printf("end: %lu\n", tls->start.tv_usec);
+  /* Sample the epoch before checking the lock: a holder that gets in
+     afterwards moves it */
+  rot_reset();
+  for ( ; ; ) {
+    rot_tx.epoch = FALLBACK_EPOCH();
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!FALLBACK_WRITING()) {
+      break;
+    }
+    while (FALLBACK_WRITING()) {
+      txlog_relax();
+    }
+  }
+  tm_rot_ibm = rot_software;
+  tls->start = TICKS_READ();
+  return 0;
+}
+
+int
+tbegin_ibm(int region_id)
+{
+  REGION_SITE();
+  return tbegin_region(region_id, 0, 0);
+}
+
+/* A region that does not write shared data; with HTM_FBLOCK_RW it takes
+   the fallback lock in shared mode */
+int
+tbegin_ibm_ro(int region_id)
+{
+  REGION_SITE();
+  return tbegin_rot(region_id, 1);
+}
+
+int
+tbegin_ibm_rot(int region_id)
+{
+  REGION_SITE();
+  return tbegin_rot(region_id, 0);
+}
+
+/* A region that cannot run in hardware (I/O, a footprint no HTM holds) */
+int
+tbegin_ibm_irrevocable(int region_id)
+{
+  tls_t *tls = global_tls;
+
+  REGION_SITE();
+  /* A helper only warms the footprint, and must not write */
+  if (tls->isMaster) {
+    tls->irrevocable = 1;
+  }
+  return tbegin_region(region_id, 0, 0);
+}
+
+void
+tm_become_irrevocable_ibm()
+{
+  tls_t *tls = global_tls;
+  int region_id = tls->region_id;
+
+#ifdef HLE_INTEL
+  if (tls->fallback == fallback_hle) {
+    /* The abort re-executes the acquire, which then takes the lock */
+    if (hle_elided()) {
+      tabort_irrevocable();
+    }
+    return;
+  }
+#endif
+  if (tls->fallback != fallback_none) {
+    /* Nothing can abort the region any more */
+    return;
+  }
+#ifdef HTM_HYBRID
+  if (tm_software_ibm) {
+    INCREMENT_STAT(irrevocable_become);
+    tls->irrevocable = 1;
+    software_abort();
+  }
+#endif
+  if (tm_rot_ibm == rot_software) {
+    INCREMENT_STAT(irrevocable_become);
+    tm_rot_ibm = rot_none;
+    tls->irrevocable = 1;
+    siglongjmp(tm_checkpoint_ibm, 1);
+  }
+  /* A hardware attempt, which the abort path reruns */
+  tabort_irrevocable();
 }
 
 void
 tabort_ibm()
 {
+#ifdef HTM_HYBRID
+  if (tm_software_ibm) {
+    software_abort();
+  }
+#endif
   tabort(300);
 }
+
+/* Threads to start for the given number of masters */
+long
+tm_prefetch_threads_ibm(long masters)
+{
+  return masters * (prefetch_helpers + 1);
+}
+
+long
+tm_prefetch_master_ibm()
+{
+  tls_t *tls = global_tls;
+
+  return tls->master;
+}
+
+/* Called by every thread of a group; only the master's call counts */
+void
+tm_prefetch_register_ibm(tm_prefetch_producer_t next, void *arg, size_t size)
+{
+  tls_t *tls = global_tls;
+  prefetch_master_t *m;
+  long n;
+
+  if (!tls->isMaster) {
+    return;
+  }
+  tls->producer = next;
+  tls->producer_arg = arg;
+  if (!prefetching) {
+    return;
+  }
+  m = &prefetch_masters[tls->master];
+  m->size = size;
+  m->stride = (sizeof(prefetch_slot_t) + size + PREFETCH_SLOT_ALIGN - 1) & ~(size_t)(PREFETCH_SLOT_ALIGN - 1);
+  if (posix_memalign((void **)&m->ring, PREFETCH_SLOT_ALIGN, (prefetch_lead + 1) * m->stride)) {
+    printf( "malloc error\n");
+    exit(1);
+  }
+  for (n = 0; n <= prefetch_lead; n++) {
+    PREFETCH_SLOT(m, n)->seq = -1;
+    PREFETCH_SLOT(m, n)->warmed = -1;
+  }
+  m->taken = 0;
+  m->produced = 0;
+  m->claimed = 0;
+  memory_fence();
+  m->registered = 1;
+}
+
+/* The next operation the master has not taken yet that no other helper
+   has claimed, once it is in the ring */
+static int
+prefetch_claim(tls_t *tls, prefetch_master_t *m, void *op)
+{
+  while (!m->registered) {
+    if (m->ended) {
+      return 0;
+    }
+    txlog_relax();
+  }
+
+  for ( ; ; ) {
+    long claimed = m->claimed;
+    long taken = m->taken;
+    long n = claimed < taken ? taken : claimed;
+    prefetch_slot_t *slot;
+
+    if (n >= m->produced) {
+      if (m->ended) {
+	return 0;
+      }
+      txlog_relax();
+      continue;
+    }
+    if (!__sync_bool_compare_and_swap(&m->claimed, claimed, n + 1)) {
+      continue;
+    }
+    tls->prefetch_skipped += n - claimed;
+
+    slot = PREFETCH_SLOT(m, n);
+    if (slot->seq != n) {
+      continue;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    memcpy(op, slot + 1, m->size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (slot->seq != n) {
+      continue;
+    }
+    tls->prefetch_op = n;
+    return 1;
+  }
+}
+
+/* A master takes its next operation, after topping up the ring for its
+   helpers; a helper claims one of those.  Returns 0 at the end. */
+int
+tm_prefetch_next_ibm(void *op)
+{
+  tls_t *tls = global_tls;
+  prefetch_master_t *m;
+  prefetch_slot_t *slot;
+  long n;
+
+  if (!prefetching) {
+    return tls->producer(tls->producer_arg, op);
+  }
+  m = &prefetch_masters[tls->master];
+  if (!tls->isMaster) {
+    return prefetch_claim(tls, m, op);
+  }
+
+  n = m->taken;
+  while (!m->ended && m->produced <= n + prefetch_lead) {
+    slot = PREFETCH_SLOT(m, m->produced);
+    slot->seq = -1;
+    memory_fence();
+    if (!tls->producer(tls->producer_arg, slot + 1)) {
+      m->ended = 1;
+      break;
+    }
+    memory_fence();
+    slot->seq = m->produced;
+    m->produced++;
+  }
+  if (n >= m->produced) {
+    tls->prefetch_hit = 0;
+    return 0;
+  }
+
+  slot = PREFETCH_SLOT(m, n);
+  memcpy(op, slot + 1, m->size);
+  tls->prefetch_hit = (slot->warmed == n);
+  tls->prefetch_ops++;
+  tls->prefetch_hits += tls->prefetch_hit;
+  m->taken = n + 1;
+  return 1;
+}
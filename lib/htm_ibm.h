@@ -2,13 +2,62 @@
 #ifndef HTM_IBM_H
 #define HTM_IBM_H 1
 
-extern void tm_startup_ibm();
+#include <stddef.h>
+
+#ifndef __bgq__
+#include <setjmp.h>
+
+/* Restart point of the current atomic region; see TM_BEGIN() in tm.h */
+extern __thread sigjmp_buf tm_checkpoint_ibm;
+
+/* Rollback-only regions (HTM_ROT): nonzero tm_rot_enabled_ibm makes
+   TM_SHARED_WRITE version what it writes while such a region runs,
+   nonzero tm_rot_ibm makes TM_SHARED_READ log and validate what it reads */
+extern int tm_rot_enabled_ibm;
+extern __thread int tm_rot_ibm;
+
+extern void tm_rot_load_ibm(const volatile void *addr, void *buf, size_t size);
+extern void tm_rot_store_ibm(volatile void *addr);
+extern int tbegin_ibm_rot(int region_id);
+#endif
+
+#if defined(HTM_EMULATED) || defined(HTM_HYBRID)
+#include "htm_util.h"
+#endif
+
+#ifdef HTM_HYBRID
+/* Nonzero while the calling thread runs its region on the software
+   (NOrec) path; TM_SHARED_READ/WRITE then go through the barriers below */
+extern __thread int tm_software_ibm;
+
+extern void tm_sw_load_ibm(const volatile void *addr, void *buf, size_t size);
+extern void tm_sw_store_ibm(volatile void *addr, const void *buf, size_t size);
+extern void *tm_malloc_ibm(size_t size);
+extern void tm_free_ibm(void *ptr);
+#endif
+
+/* Helper-thread prefetching (PREFETCHING); see TM_PREFETCH_REGISTER() in
+   tm.h.  Nonzero tm_prefetch_helper_ibm keeps a helper's writes and frees
+   from taking effect */
+typedef int (*tm_prefetch_producer_t)(void *arg, void *op);
+
+extern __thread int tm_prefetch_helper_ibm;
+
+extern long tm_prefetch_threads_ibm(long masters);
+extern long tm_prefetch_master_ibm();
+extern void tm_prefetch_register_ibm(tm_prefetch_producer_t next, void *arg, size_t size);
+extern int tm_prefetch_next_ibm(void *op);
+
+extern void tm_startup_ibm(long numThread);
 extern void tm_shutdown_ibm();
 
 extern void tm_thread_enter_ibm();
 extern void tm_thread_exit_ibm();
 
 extern int tbegin_ibm(int region_id);
+extern int tbegin_ibm_ro(int region_id);
+extern int tbegin_ibm_irrevocable(int region_id);
+extern void tm_become_irrevocable_ibm();
 extern void tend_ibm();
 extern void tabort_ibm();
 
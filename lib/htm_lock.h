@@ -0,0 +1,170 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * htm_lock.h
+ *
+ * Locks for the fallback path of htm_ibm.c, selected with HTM_FBLOCK:
+ *
+ *   ttas    test-and-test-and-set on a single word (the default)
+ *   ticket  FIFO ticket lock; waiters back off in proportion to their
+ *           distance from the head of the queue
+ *   mcs     MCS queue lock; every waiter spins on its own node
+ *
+ * Hardware transactions never subscribe to these words, only to the flag
+ * the holder raises once it owns the lock, so the queue traffic of the
+ * waiters does not abort them.  The same locks serve as the auxiliary
+ * lock (HTM_AUXLOCK) that aborted threads take before they retry.
+ *
+ * =============================================================================
+ */
+
+#ifndef HTM_LOCK_H
+#define HTM_LOCK_H 1
+
+#include <string.h>
+#include "txlog.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HTM_LOCK_BACKOFF 64     /* pauses per waiter ahead of us */
+
+typedef enum htm_lock_kind {
+  HTM_LOCK_TTAS = 0,
+  HTM_LOCK_TICKET,
+  HTM_LOCK_MCS
+} htm_lock_kind_t;
+
+typedef struct htm_lock_node {
+  struct htm_lock_node *volatile next;
+  volatile int locked;
+  char pad[256 - sizeof(void *) - sizeof(int)];
+} htm_lock_node_t;
+
+typedef struct htm_lock {
+  htm_lock_kind_t kind;
+  char pad0[256 - sizeof(htm_lock_kind_t)];
+  volatile int word;                            /* ttas */
+  char pad1[256 - sizeof(int)];
+  volatile unsigned long next_ticket;           /* ticket */
+  char pad2[256 - sizeof(unsigned long)];
+  volatile unsigned long now_serving;
+  char pad3[256 - sizeof(unsigned long)];
+  htm_lock_node_t *volatile tail;               /* mcs */
+  char pad4[256 - sizeof(void *)];
+} htm_lock_t;
+
+/* Returns -1 for an unknown name */
+static inline int
+htm_lock_parse (const char *name)
+{
+  if (strcmp(name, "ttas") == 0) {
+    return HTM_LOCK_TTAS;
+  }
+  if (strcmp(name, "ticket") == 0) {
+    return HTM_LOCK_TICKET;
+  }
+  if (strcmp(name, "mcs") == 0) {
+    return HTM_LOCK_MCS;
+  }
+  return -1;
+}
+
+static inline const char *
+htm_lock_name (htm_lock_kind_t kind)
+{
+  switch (kind) {
+  case HTM_LOCK_TICKET: return "ticket";
+  case HTM_LOCK_MCS:    return "mcs";
+  default:              return "ttas";
+  }
+}
+
+static inline void
+htm_lock_init (htm_lock_t *lock, htm_lock_kind_t kind)
+{
+  memset(lock, 0, sizeof(*lock));
+  lock->kind = kind;
+}
+
+static inline void
+htm_lock_acquire (htm_lock_t *lock, htm_lock_node_t *me)
+{
+  switch (lock->kind) {
+  case HTM_LOCK_TICKET: {
+    unsigned long ticket = __sync_fetch_and_add(&lock->next_ticket, 1);
+    for ( ; ; ) {
+      unsigned long ahead = ticket - lock->now_serving;
+      unsigned long spins;
+      if (ahead == 0) {
+	break;
+      }
+      for (spins = ahead * HTM_LOCK_BACKOFF; spins > 0; spins--) {
+	txlog_relax();
+      }
+    }
+    break;
+  }
+  case HTM_LOCK_MCS: {
+    htm_lock_node_t *pred;
+    me->next = NULL;
+    me->locked = 1;
+    pred = __atomic_exchange_n(&lock->tail, me, __ATOMIC_ACQ_REL);
+    if (pred != NULL) {
+      pred->next = me;
+      while (me->locked) {
+	txlog_relax();
+      }
+    }
+    break;
+  }
+  default:
+    while (__sync_lock_test_and_set(&lock->word, 1)) {
+      while (lock->word) {
+	txlog_relax();
+      }
+    }
+    break;
+  }
+  __sync_synchronize();
+}
+
+static inline void
+htm_lock_release (htm_lock_t *lock, htm_lock_node_t *me)
+{
+  __sync_synchronize();
+  switch (lock->kind) {
+  case HTM_LOCK_TICKET:
+    lock->now_serving++;
+    break;
+  case HTM_LOCK_MCS:
+    if (me->next == NULL) {
+      if (__sync_bool_compare_and_swap(&lock->tail, me, NULL)) {
+	break;
+      }
+      while (me->next == NULL) {
+	txlog_relax();
+      }
+    }
+    me->next->locked = 0;
+    break;
+  default:
+    __sync_lock_release(&lock->word);
+    break;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTM_LOCK_H */
+
+
+/* =============================================================================
+ *
+ * End of htm_lock.h
+ *
+ * =============================================================================
+ */
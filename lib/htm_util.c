@@ -3,8 +3,15 @@
 #include <stdint.h>
 #include <assert.h>
 #include "htm_util.h"
+#if defined(__x86_64) && !defined(HTM_EMULATED)
+#include <cpuid.h>
+#endif
 
-#if defined(__370__)
+#if defined(HTM_EMULATED)
+
+/* Everything is in htm_emu.c */
+
+#elif defined(__370__)
 
 static int tbegin_impl(void *diag);
 #if 1
@@ -153,7 +160,7 @@ countHTMFailures(TransactionDiagnosticInfo *diag, uint64_t *counters)
   } else {
     counters[18]++;
   }
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
   uint64_t abortCode = diag->transactionAbortCode;
   counters[0] += (abortCode & XABORT_EXPLICIT) ? 1 : 0;
   counters[1] += (abortCode & XABORT_RETRY) ? 1 : 0;
@@ -206,7 +213,7 @@ getHTMFailureName(int id)
     "CTEND_abort",
     "Miscellaneous_condition",
     "TABORT_instruction"
-#elif defined(__x86_64__)
+#elif defined(HTM_IA32_ABORT_CODES)
     "XABORT",
     "TRANSIENT",
     "MEMADDR_CONFLICT",
@@ -237,3 +244,19 @@ getHTMFailureName(int id)
   }
   return reason_strings[id];
 }
+
+int
+htm_supported(void)
+{
+#if defined(__x86_64) && !defined(HTM_EMULATED)
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid_max(0, NULL) < 7) {
+    return 0;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx >> 11) & 1;       /* RTM */
+#else
+  return 1;
+#endif
+}
@@ -12,7 +12,11 @@ extern "C" {
 #endif
 
 typedef struct {
-#if defined(__370__)
+#if defined(HTM_EMULATED)
+  uint64_t transactionAbortCode;
+  uint64_t abortedTransactionInstructionAddress; /* access that saw the abort */
+  uint64_t conflictAddress;     /* data whose change or overflow aborted */
+#elif defined(__370__)
   uint8_t format;
   uint8_t flags;
   uint16_t reserved0;
@@ -51,7 +55,77 @@ typedef struct {
 	  3 for persistent abort
  */
 
-#if defined(__370__)
+#if defined(HTM_EMULATED)
+
+/*
+  Software-emulated HTM (see htm_emu.c).  Transactions keep a software
+  read/write set of bounded capacity and report IA32 (RTM) abort codes.
+  Since software cannot roll back the stack, the caller must place a
+  sigsetjmp() checkpoint before entering the code that calls tbegin(), and
+  register it with htm_emu_thread_enter().  An abort long-jumps to that
+  checkpoint; the next tbegin() then returns the pending abort status
+  instead of starting a new transaction (tpending() tells whether one is
+  waiting).  As with any siglongjmp(), a local of the checkpointing frame
+  that the transaction changes is indeterminate after the abort unless it
+  is volatile; the region should set such locals again before reading
+  them, or declare them volatile.
+
+  Only accesses made through tload()/tstore() are tracked.  Code that
+  writes shared data outside of a transaction while others may run
+  speculatively (the fallback-lock holder) must be bracketed by
+  htm_emu_nontx_begin()/htm_emu_nontx_end().  TM_FREE goes through
+  htm_emu_free(), which holds the block back until no transaction can
+  still read it.
+ */
+
+#include <setjmp.h>
+#include <stddef.h>
+
+#define XABORT_EXPLICIT	0x01
+#define XABORT_RETRY	0x02
+#define XABORT_CONFLICT	0x04
+#define XABORT_CAPACITY	0x08
+#define XABORT_DEBUG	0x10
+#define XABORT_NESTED	0x20
+
+#define HTM_IA32_ABORT_CODES 1
+
+void htm_emu_startup(void);
+void htm_emu_thread_enter(sigjmp_buf *checkpoint);
+void htm_emu_thread_exit(void);
+
+int tbegin(int rot, TransactionDiagnosticInfo *diag);
+void tend(void);
+void tabort(uint64_t code);
+int tpending(void);
+int ttest(void);
+
+void htm_emu_load(const volatile void *addr, void *buf, size_t size);
+void htm_emu_store(volatile void *addr, const void *buf, size_t size);
+void htm_emu_nontx_begin(void);
+void htm_emu_nontx_end(void);
+void htm_emu_free(void *ptr);
+void htm_emu_pin(void);
+void htm_emu_unpin(void);
+void htm_emu_record_sites(int on);
+
+/* The buffer sidesteps const-qualified operands, which C++ will not
+   let us declare uninitialised. */
+#define tload(var) ({							\
+      char __tl_buf[sizeof(var)] __attribute__((aligned(8)));		\
+      htm_emu_load(&(var), (void *)__tl_buf, sizeof(var));		\
+      *(__typeof__(var) *)__tl_buf;					\
+    })
+
+#define tstore(var, val) ({						\
+      __typeof__(var) __ts_val = (val);					\
+      htm_emu_store(&(var), (const void *)&__ts_val, sizeof(var));	\
+      __ts_val;								\
+    })
+
+#define NUM_HTM_FAILURE_REASONS 7
+
+#elif defined(__370__)
 
 int tbegin(int rot, TransactionDiagnosticInfo *diag);
 #if __COMPILER_VER__ >= 0x410d0000
@@ -80,6 +154,8 @@ void restore_preserved_fpr(uint64_t *addr);
 
 #elif defined(__x86_64)
 
+#define HTM_IA32_ABORT_CODES 1
+
 #define XABORT_EXPLICIT	0x01
 #define XABORT_RETRY	0x02
 #define XABORT_CONFLICT	0x04
@@ -195,6 +271,10 @@ static inline void tabort(uint64_t code)
 void countHTMFailures(TransactionDiagnosticInfo *diag, uint64_t *counters);
 const char *getHTMFailureName(int id);
 
+/* Nonzero if the processor can run tbegin(): x86 parts may ship (or be
+   microcoded) without RTM, and xbegin then raises #UD */
+int htm_supported(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -91,6 +91,27 @@
 #  define MAP_FIND(map, key)          hashtable_find(map, (void*)(key))
 #  define MAP_INSERT(map, key, data)  hashtable_insert(map, (void*)(key), (void*)(data))
 #  define MAP_REMOVE(map, key)        hashtable_remove(map, (void*)(key))
+#  define MAP_PRINT_STATS(map)        hashtable_printStats(map)
+
+#elif defined(MAP_USE_OPEN_HASHTABLE)
+
+#  include "open_hashtable.h"
+
+#  define MAP_T                       open_hashtable_t
+#  define MAP_ALLOC(hash, cmp)        open_hashtable_alloc(1, hash, cmp)
+#  define MAP_FREE(map)               open_hashtable_free(map)
+#  define MAP_CONTAINS(map, key)      open_hashtable_containsKey(map, (void*)(key))
+#  define MAP_FIND(map, key)          open_hashtable_find(map, (void*)(key))
+#  define MAP_INSERT(map, key, data)  open_hashtable_insert(map, (void*)(key), (void*)(data))
+#  define MAP_REMOVE(map, key)        open_hashtable_remove(map, (void*)(key))
+
+#  define TMMAP_ALLOC(hash, cmp)      TMOPEN_HASHTABLE_ALLOC(1, hash, cmp)
+#  define TMMAP_FREE(map)             TMOPEN_HASHTABLE_FREE(map)
+#  define TMMAP_CONTAINS(map, key)    TMOPEN_HASHTABLE_CONTAINSKEY(map, (void*)(key))
+#  define TMMAP_FIND(map, key)        TMOPEN_HASHTABLE_FIND(map, (void*)(key))
+#  define TMMAP_INSERT(map, key, data) \
+    TMOPEN_HASHTABLE_INSERT(map, (void*)(key), (void*)(data))
+#  define TMMAP_REMOVE(map, key)      TMOPEN_HASHTABLE_REMOVE(map, (void*)(key))
 
 #elif defined(MAP_USE_CONCUREENT_HASHTABLE)
 
@@ -103,6 +124,7 @@
 #  define MAP_FIND(map, key)          conc_hashtable_find(map, (void*)(key))
 #  define MAP_INSERT(map, key, data)  conc_hashtable_insert(map, (void*)(key), (void*)(data))
 #  define MAP_REMOVE(map, key)        conc_hashtable_remove(map, (void*)(key))
+#  define MAP_PRINT_STATS(map)        conc_hashtable_printStats(map)
 
 #  define TMMAP_ALLOC(hash, cmp)      TMCONC_HASHTABLE_ALLOC(1, hash, cmp, 2, 2)
 #  define TMMAP_FREE(map)             TMCONC_HASHTABLE_FREE(map)
@@ -268,6 +290,29 @@
 #  define TMMAP_REMOVE(map, key)      TMRBTREE_DELETE(map, (void*)(key))
 
 
+#elif defined(MAP_USE_BTREE)
+
+#  include "btree.h"
+
+#  define MAP_T                       btree_t
+#  define MAP_ALLOC(hash, cmp)        btree_alloc(cmp)
+#  define MAP_FREE(map)               btree_free(map)
+
+#  define MAP_CONTAINS(map, key)      btree_contains(map, (void*)(key))
+#  define MAP_FIND(map, key)          btree_get(map, (void*)(key))
+#  define MAP_INSERT(map, key, data) \
+    btree_insert(map, (void*)(key), (void*)(data))
+#  define MAP_REMOVE(map, key)        btree_delete(map, (void*)(key))
+
+#  define TMMAP_ALLOC(hash, cmp)      TMBTREE_ALLOC(cmp)
+#  define TMMAP_FREE(map)             TMBTREE_FREE(map)
+#  define TMMAP_CONTAINS(map, key)    TMBTREE_CONTAINS(map, (void*)(key))
+#  define TMMAP_FIND(map, key)        TMBTREE_GET(map, (void*)(key))
+#  define TMMAP_INSERT(map, key, data) \
+    TMBTREE_INSERT(map, (void*)(key), (void*)(data))
+#  define TMMAP_REMOVE(map, key)      TMBTREE_DELETE(map, (void*)(key))
+
+
 #elif defined(MAP_USE_SKIPLIST)
 
 #  include "skiplist.h"
@@ -329,6 +374,11 @@
 
 #endif
 
+/* HASHTABLE_STATS counters of the hash table maps */
+#ifndef MAP_PRINT_STATS
+#  define MAP_PRINT_STATS(map)        /* nothing */
+#endif
+
 
 #endif /* MAP_H */
 
@@ -2,6 +2,11 @@
  *
  * memory.c
  * -- Very simple pseudo thread-local memory allocator
+ * -- Objects are carved from the blocks of the thread's pool in power-of-two
+ *    size classes and recycled through per-thread free lists; an object
+ *    freed by another thread is queued on its owner's pool, which takes the
+ *    whole queue when a free list of its runs dry
+ * -- Objects larger than the largest class get a block of their own
  *
  * =============================================================================
  *
@@ -74,6 +79,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/mman.h>
 #include "memory.h"
 #include "types.h"
 
@@ -106,19 +112,44 @@ typedef struct block {
     uint64_t padding2[PADDING_SIZE];
 } block_t;
 
+/* Precedes every object; the first word of a free object links it to the
+   next free object of its list */
+typedef struct header {
+    uint32_t owner;     /* thread whose pool holds the object */
+    uint16_t sizeClass; /* LARGE_SIZE_CLASS: a block of its own */
+    uint16_t tag;       /* HEADER_TAG */
+} header_t;
+
+/* Bit 3 is set: malloc()'s size word before its blocks is a multiple of 16
+   below 2^48, so neither of its ends matches, whatever the byte order */
+#define HEADER_TAG 0xA11A
+
+#define MIN_SIZE_CLASS 4  /* 16 bytes, header included */
+#define NUM_SIZE_CLASS 17 /* up to 64KB */
+#define LARGE_SIZE_CLASS NUM_SIZE_CLASS
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
 typedef struct pool {
     block_t* blocksPtr;
     size_t nextCapacity;
     size_t initBlockCapacity;
     long blockGrowthFactor;
+    void* freeLists[NUM_SIZE_CLASS];
+    uint64_t padding[PADDING_SIZE];
+    void* volatile remoteFrees; /* pushed by other threads */
+    uint64_t padding2[PADDING_SIZE];
 } pool_t;
 
 struct memory {
     pool_t** pools;
     long numThread;
+    size_t initBlockCapacity;
+    long blockGrowthFactor;
 };
 
 memory_t* global_memoryPtr = 0;
+static bool_t global_hugePages = FALSE;
 
 
 /* =============================================================================
@@ -140,9 +171,24 @@ allocBlock (size_t capacity)
 
     blockPtr->size = 0;
     blockPtr->capacity = capacity;
-    blockPtr->contents = (char*)malloc(capacity / sizeof(char) + 1);
-    if (blockPtr->contents == NULL) {
-        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (global_hugePages && capacity >= HUGE_PAGE_SIZE) {
+        /* Whole huge pages, so that a transaction's footprint spans few
+           TLB entries */
+        blockPtr->capacity = (capacity + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        if (posix_memalign((void**)&blockPtr->contents,
+                           HUGE_PAGE_SIZE,
+                           blockPtr->capacity) != 0) {
+            return NULL;
+        }
+        madvise(blockPtr->contents, blockPtr->capacity, MADV_HUGEPAGE);
+    } else
+#endif
+    {
+        blockPtr->contents = (char*)malloc(capacity / sizeof(char) + 1);
+        if (blockPtr->contents == NULL) {
+            return NULL;
+        }
     }
     blockPtr->nextPtr = NULL;
 
@@ -172,7 +218,7 @@ allocPool (size_t initBlockCapacity, long blockGrowthFactor)
 {
     pool_t* poolPtr;
 
-    poolPtr = (pool_t*)malloc(sizeof(pool_t));
+    poolPtr = (pool_t*)calloc(1, sizeof(pool_t));
     if (poolPtr == NULL) {
         return NULL;
     }
@@ -223,15 +269,25 @@ freePool (pool_t* poolPtr)
 /* =============================================================================
  * memory_init
  * -- Returns FALSE on failure
+ * -- With THREAD_FIRST_TOUCH=1 in the environment, a pool is only created by
+ *    the first memory_get() of its thread, so that its blocks come from that
+ *    thread's malloc arena and are first touched from the NUMA node the
+ *    thread was placed on (see THREAD_PLACEMENT in thread.c)
+ * -- With MEMORY_HUGEPAGES=1, blocks of 2MB and more are backed by
+ *    transparent huge pages
  * =============================================================================
  */
 bool_t
 memory_init (long numThread, size_t initBlockCapacity, long blockGrowthFactor)
 {
     long i;
+    const char* firstTouch = getenv("THREAD_FIRST_TOUCH");
+    const char* hugePages = getenv("MEMORY_HUGEPAGES");
 
     assert(numThread > 0);
 
+    global_hugePages = (hugePages != NULL && atoi(hugePages) != 0);
+
     global_memoryPtr = (memory_t*)malloc(sizeof(memory_t));
     if (global_memoryPtr == NULL) {
         return FALSE;
@@ -243,6 +299,10 @@ memory_init (long numThread, size_t initBlockCapacity, long blockGrowthFactor)
     }
 
     for (i = 0; i < numThread; i++) {
+        if (firstTouch != NULL && atoi(firstTouch) != 0) {
+            global_memoryPtr->pools[i] = NULL; /* see memory_get */
+            continue;
+        }
         global_memoryPtr->pools[i] = allocPool(initBlockCapacity, blockGrowthFactor);
         if (global_memoryPtr->pools[i] == NULL) {
             return FALSE;
@@ -250,6 +310,8 @@ memory_init (long numThread, size_t initBlockCapacity, long blockGrowthFactor)
     }
 
     global_memoryPtr->numThread = numThread;
+    global_memoryPtr->initBlockCapacity = initBlockCapacity;
+    global_memoryPtr->blockGrowthFactor = blockGrowthFactor;
 
     return TRUE;
 }
@@ -266,7 +328,9 @@ memory_destroy (void)
     long numThread = global_memoryPtr->numThread;
 
     for (i = 0; i < numThread; i++) {
-        freePool(global_memoryPtr->pools[i]);
+        if (global_memoryPtr->pools[i] != NULL) {
+            freePool(global_memoryPtr->pools[i]);
+        }
     }
     free(global_memoryPtr->pools);
     free(global_memoryPtr);
@@ -344,6 +408,72 @@ getMemoryFromPool (pool_t* poolPtr, size_t numByte)
 }
 
 
+/* =============================================================================
+ * getSizeClass
+ * -- Smallest power of two that holds numByte and a header
+ * -- LARGE_SIZE_CLASS if no class does
+ * =============================================================================
+ */
+static uint32_t
+getSizeClass (size_t numByte)
+{
+    uint32_t sizeClass = MIN_SIZE_CLASS;
+
+    while (((size_t)1 << sizeClass) < numByte + sizeof(header_t)) {
+        sizeClass++;
+        if (sizeClass == LARGE_SIZE_CLASS) {
+            break;
+        }
+    }
+
+    return sizeClass;
+}
+
+
+/* =============================================================================
+ * getLarge
+ * -- Returns NULL on failure
+ * -- The block is sized to the object and its pointer precedes the header,
+ *    so that any thread can free it at once
+ * =============================================================================
+ */
+static header_t*
+getLarge (size_t numByte)
+{
+    block_t* blockPtr;
+    block_t** linkPtr;
+
+    blockPtr = allocBlock(sizeof(block_t*) + sizeof(header_t) + numByte);
+    if (blockPtr == NULL) {
+        return NULL;
+    }
+    linkPtr = (block_t**)getMemoryFromBlock(blockPtr, blockPtr->capacity);
+    *linkPtr = blockPtr;
+
+    return (header_t*)(linkPtr + 1);
+}
+
+
+/* =============================================================================
+ * drainRemoteFrees
+ * -- Moves the objects other threads freed to the owner's free lists
+ * =============================================================================
+ */
+static void
+drainRemoteFrees (pool_t* poolPtr)
+{
+    void* objPtr = __sync_lock_test_and_set(&poolPtr->remoteFrees, NULL);
+
+    while (objPtr != NULL) {
+        void* nextPtr = *(void**)objPtr;
+        header_t* headerPtr = (header_t*)objPtr - 1;
+        *(void**)objPtr = poolPtr->freeLists[headerPtr->sizeClass];
+        poolPtr->freeLists[headerPtr->sizeClass] = objPtr;
+        objPtr = nextPtr;
+    }
+}
+
+
 /* =============================================================================
  * memory_get
  * -- Reserves memory
@@ -353,22 +483,87 @@ void*
 memory_get (long threadId, size_t numByte)
 {
     pool_t* poolPtr;
+    header_t* headerPtr;
     void* dataPtr;
-    size_t addr;
-    size_t misalignment;
+    uint32_t sizeClass;
 
     poolPtr = global_memoryPtr->pools[threadId];
-    dataPtr = getMemoryFromPool(poolPtr, (numByte + 7)); /* +7 for alignment */
-
-    /* Fix alignment for 64 bit */
-    addr = (size_t)dataPtr;
-    misalignment = addr % 8;
-    if (misalignment) {
-        addr += (8 - misalignment);
-        dataPtr = (void*)addr;
+    if (poolPtr == NULL) {
+        /* THREAD_FIRST_TOUCH: created by its own thread */
+        poolPtr = allocPool(global_memoryPtr->initBlockCapacity,
+                            global_memoryPtr->blockGrowthFactor);
+        if (poolPtr == NULL) {
+            return NULL;
+        }
+        global_memoryPtr->pools[threadId] = poolPtr;
     }
 
-    return dataPtr;
+    sizeClass = getSizeClass(numByte);
+    if (sizeClass == LARGE_SIZE_CLASS) {
+        headerPtr = getLarge(numByte);
+    } else {
+        if (poolPtr->freeLists[sizeClass] == NULL && poolPtr->remoteFrees != NULL) {
+            drainRemoteFrees(poolPtr);
+        }
+        dataPtr = poolPtr->freeLists[sizeClass];
+        if (dataPtr != NULL) {
+            poolPtr->freeLists[sizeClass] = *(void**)dataPtr;
+            return dataPtr;
+        }
+        /* Sizes are multiples of 16, so objects stay 8-byte aligned */
+        headerPtr = (header_t*)getMemoryFromPool(poolPtr, (size_t)1 << sizeClass);
+    }
+    if (headerPtr == NULL) {
+        return NULL;
+    }
+    headerPtr->owner = (uint32_t)threadId;
+    headerPtr->sizeClass = (uint16_t)sizeClass;
+    headerPtr->tag = HEADER_TAG;
+
+    return (void*)(headerPtr + 1);
+}
+
+
+/* =============================================================================
+ * memory_free
+ * -- Returns memory from memory_get() of any thread
+ * -- Memory from malloc() goes back to free(): programs mix the two, and
+ *    the word before a malloc()ed block is its size, without the tag
+ * =============================================================================
+ */
+void
+memory_free (long threadId, void* dataPtr)
+{
+    header_t* headerPtr;
+    pool_t* poolPtr;
+
+    if (dataPtr == NULL) {
+        return;
+    }
+
+    headerPtr = (header_t*)dataPtr - 1;
+    if (headerPtr->tag != HEADER_TAG) {
+        free(dataPtr);
+        return;
+    }
+    if (headerPtr->sizeClass == LARGE_SIZE_CLASS) {
+        freeBlock(*((block_t**)headerPtr - 1));
+        return;
+    }
+
+    poolPtr = global_memoryPtr->pools[headerPtr->owner];
+    if ((long)headerPtr->owner == threadId) {
+        *(void**)dataPtr = poolPtr->freeLists[headerPtr->sizeClass];
+        poolPtr->freeLists[headerPtr->sizeClass] = dataPtr;
+    } else {
+        void* headPtr;
+        do {
+            headPtr = poolPtr->remoteFrees;
+            *(void**)dataPtr = headPtr;
+        } while (!__sync_bool_compare_and_swap(&poolPtr->remoteFrees,
+                                               headPtr,
+                                               dataPtr));
+    }
 }
 
 
@@ -395,6 +590,9 @@ printMemory (memory_t* memoryPtr)
         pool_t* poolPtr = memoryPtr->pools[i];
         block_t* blockPtr;
         long j = 0;
+        if (poolPtr == NULL) {
+            continue;
+        }
         for (blockPtr = poolPtr->blocksPtr;
              blockPtr != NULL;
              blockPtr = blockPtr->nextPtr)
@@ -421,7 +619,7 @@ main ()
 
     puts("Starting tests...");
 
-    assert(memory_init(1, 32, 2));
+    assert(memory_init(2, 32, 2));
     memoryPtr = global_memoryPtr;
 
     size = 1;
@@ -451,6 +649,51 @@ main ()
         }
     }
 
+    /* Freed memory comes back for sizes of the same class */
+    puts("Checking reuse...");
+    for (i = 0; i < NUM_ALLOC; i++) {
+        memory_free(0, mem0Array[i]);
+    }
+    size = 1;
+    for (i = 0; i < NUM_ALLOC; i++) {
+        char* dataPtr = (char*)memory_get(0, size);
+        long j;
+        for (j = 0; j < NUM_ALLOC; j++) {
+            if (dataPtr == mem0Array[j]) {
+                break;
+            }
+        }
+        assert(j < NUM_ALLOC);
+        assert(((size_t)dataPtr % 8) == 0);
+        if (i % 2) {
+            size = size * (i + 1);
+        }
+    }
+
+    /* Another thread's frees wait until a free list of the owner runs dry */
+    puts("Checking remote frees...");
+    {
+        char* dataPtr = (char*)memory_get(1, 100);
+        memory_free(0, dataPtr); /* queued on the pool of thread 1 */
+        assert(memory_get(1, 100) == dataPtr);
+        assert(memory_get(1, 100) != dataPtr);
+        memory_free(1, malloc(100)); /* not ours: goes to free() */
+    }
+
+    /* Past the largest class: a block of its own, freed by any thread */
+    puts("Checking large objects...");
+    {
+        size_t used = memoryPtr->pools[0]->blocksPtr->size;
+        size_t numByte = ((size_t)1 << NUM_SIZE_CLASS) + 3;
+        char* dataPtr = (char*)memory_get(0, numByte);
+        assert(dataPtr != NULL);
+        assert(((size_t)dataPtr % 8) == 0);
+        dataPtr[numByte - 1] = 'z';
+        assert(memoryPtr->pools[0]->blocksPtr->size == used);
+        memory_free(1, dataPtr);
+    }
+    printMemory(memoryPtr);
+
     memory_destroy();
 
     puts("All tests passed.");
@@ -115,6 +115,17 @@ void*
 memory_get (long threadId, size_t numByte);
 
 
+/* =============================================================================
+ * memory_free
+ * -- Returns memory from memory_get() of any thread
+ * -- Memory of another thread is queued until that thread allocates again
+ * -- Constant time: the object's header names its owner and size class
+ * =============================================================================
+ */
+void
+memory_free (long threadId, void* dataPtr);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,357 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * norec.c
+ *
+ * NOrec STM: one global sequence lock, value-based validation, lazy
+ * write-back through a per-thread redo log.
+ *
+ * A transaction takes an even snapshot of the sequence lock at begin.
+ * Every read first checks the redo log, then loads from memory and, if
+ * the sequence lock has moved since the snapshot, revalidates the whole
+ * read log by value and retries the load; a read-only transaction thus
+ * commits without any global write.  A writer commits by CASing the lock
+ * from its snapshot to snapshot+1, writing back its redo log and
+ * releasing the lock at snapshot+2.
+ *
+ * Memory obtained with TM_MALLOC inside an aborted transaction is freed.
+ * TM_FREE is deferred: a concurrent transaction may still be validating
+ * against the block, so it is only released once every thread has begun
+ * a transaction after the one that freed it (epoch-based reclamation
+ * over the sequence lock).
+ *
+ * =============================================================================
+ */
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "norec.h"
+#include "txlog.h"
+
+#define NOREC_BACKOFF_MIN 4
+#define NOREC_BACKOFF_MAX 4096
+#define NOREC_LIMBO_BATCH 64
+
+struct norec_thread {
+  long id;
+  txepoch_t epoch;              /* start = snapshot at begin */
+  int active;
+  int readOnly;
+  uintptr_t snapshot;
+  unsigned long gen;
+  unsigned long backoff;
+  unsigned long seed;
+  sigjmp_buf checkpoint;
+  txlog_t reads;
+  txlog_t writes;
+  txset_t write_index;
+  txlog_t allocs;
+  txlog_t frees;
+  txlog_t limbo;                /* addr = block, value = freeing commit */
+  long starts;
+  long aborts;
+};
+
+static union {
+  char two_cache_lines[512];
+  struct {
+    char one_cache_line[256];
+    volatile uintptr_t seq;
+    char another_cache_line[248];
+  } a;
+} norec_clock;
+
+static volatile long global_starts = 0;
+static volatile long global_aborts = 0;
+
+static txepoch_registry_t global_threads;
+
+
+void
+norec_startup (void)
+{
+  norec_clock.a.seq = 0;
+  global_starts = 0;
+  global_aborts = 0;
+}
+
+
+void
+norec_shutdown (void)
+{
+  printf("NOrec system shutdown:\n"
+         "  CLOCK=%lu Starts=%li Aborts=%li\n",
+         (unsigned long)norec_clock.a.seq, global_starts, global_aborts);
+}
+
+
+norec_thread_t*
+norec_new_thread (void)
+{
+  norec_thread_t* self = (norec_thread_t*)malloc(sizeof(norec_thread_t));
+  if (self == NULL) {
+    printf("malloc error\n");
+    exit(1);
+  }
+  memset(self, 0, sizeof(*self));
+  return self;
+}
+
+
+void
+norec_init_thread (norec_thread_t* self, long id)
+{
+  self->id = id;
+  self->seed = (unsigned long)id * 2654435761UL + 1;
+  txlog_alloc(&self->reads);
+  txlog_alloc(&self->writes);
+  txset_alloc(&self->write_index, TXLOG_INIT_SIZE);
+  txlog_alloc(&self->allocs);
+  txlog_alloc(&self->frees);
+  txlog_alloc(&self->limbo);
+  txepoch_register(&global_threads, &self->epoch);
+}
+
+
+void
+norec_free_thread (norec_thread_t* self)
+{
+  __sync_fetch_and_add(&global_starts, self->starts);
+  __sync_fetch_and_add(&global_aborts, self->aborts);
+
+  while (self->limbo.size != 0) {
+    txlog_reclaim(&self->limbo, txepoch_oldest(&global_threads));
+    txlog_relax();
+  }
+  txepoch_unregister(&global_threads, &self->epoch);
+
+  txlog_free(&self->reads);
+  txlog_free(&self->writes);
+  txset_free(&self->write_index);
+  txlog_free(&self->allocs);
+  txlog_free(&self->frees);
+  txlog_free(&self->limbo);
+  free(self);
+}
+
+
+sigjmp_buf*
+norec_checkpoint (norec_thread_t* self)
+{
+  return &self->checkpoint;
+}
+
+
+void
+norec_begin (norec_thread_t* self, int readOnly)
+{
+  assert(!self->active);
+  self->gen++;
+  self->reads.size = 0;
+  self->writes.size = 0;
+  self->write_index.count = 0;
+  self->allocs.size = 0;
+  self->frees.size = 0;
+  self->readOnly = readOnly;
+  self->starts++;
+  do {
+    self->snapshot = norec_clock.a.seq;
+  } while (self->snapshot & 1);
+  self->epoch.start = self->snapshot;
+  __sync_synchronize();
+  self->active = 1;
+}
+
+
+/* Randomized exponential backoff, so that writers which keep invalidating
+   each other do not restart in lockstep. */
+static void
+backoff (norec_thread_t* self)
+{
+  unsigned long spins;
+
+  if (self->backoff < NOREC_BACKOFF_MAX) {
+    self->backoff = self->backoff ? 2 * self->backoff : NOREC_BACKOFF_MIN;
+  }
+  self->seed = self->seed * 6364136223846793005UL + 1442695040888963407UL;
+  spins = (self->seed >> 33) % self->backoff;
+  while (spins--) {
+    txlog_relax();
+  }
+}
+
+
+void
+norec_abort (norec_thread_t* self)
+{
+  long i;
+
+  assert(self->active);
+  self->active = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  self->aborts++;
+  for (i = 0; i < self->allocs.size; i++) {
+    free((void*)self->allocs.entries[i].addr);
+  }
+  backoff(self);
+  siglongjmp(self->checkpoint, 1);
+}
+
+
+/* Waits for a stable even sequence number and re-checks every logged read
+   against memory.  Returns the sequence number the read set is consistent
+   with; aborts on a mismatch. */
+static uintptr_t
+validate (norec_thread_t* self)
+{
+  for ( ; ; ) {
+    uintptr_t seq = norec_clock.a.seq;
+    long i;
+
+    if (seq & 1) {
+      txlog_relax();
+      continue;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for (i = 0; i < self->reads.size; i++) {
+      txlog_entry_t* e = &self->reads.entries[i];
+      if (txlog_load_word(e->addr, e->size) != e->value) {
+        norec_abort(self);
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq == norec_clock.a.seq) {
+      return seq;
+    }
+  }
+}
+
+
+void
+norec_commit (norec_thread_t* self)
+{
+  long i;
+
+  if (self->writes.size != 0) {
+    while (!__sync_bool_compare_and_swap(&norec_clock.a.seq, self->snapshot, self->snapshot + 1)) {
+      self->snapshot = validate(self);
+    }
+    for (i = 0; i < self->writes.size; i++) {
+      txlog_entry_t* e = &self->writes.entries[i];
+      txlog_store_word(e->addr, e->value, e->size);
+    }
+    __sync_synchronize();
+    norec_clock.a.seq = self->snapshot + 2;
+  }
+
+  self->active = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  self->backoff = 0;
+  for (i = 0; i < self->frees.size; i++) {
+    txlog_entry_t* e = txlog_append(&self->limbo);
+    e->addr = self->frees.entries[i].addr;
+    e->value = self->snapshot + 2;
+  }
+  if (self->limbo.size >= NOREC_LIMBO_BATCH) {
+    txlog_reclaim(&self->limbo, txepoch_oldest(&global_threads));
+  }
+}
+
+
+void
+norec_load (norec_thread_t* self, const volatile void* addr, void* buf, size_t size)
+{
+  txlog_entry_t* e;
+  uint64_t value;
+  long* idx;
+
+  if (!self->active) {
+    txlog_store_word(buf, txlog_load_word(addr, size), size);
+    return;
+  }
+
+  if (self->writes.size != 0) {
+    idx = txset_lookup(&self->write_index, (uintptr_t)addr, self->gen, 0);
+    if (idx != NULL) {
+      e = &self->writes.entries[*idx];
+      assert(e->size == size);
+      txlog_store_word(buf, e->value, size);
+      return;
+    }
+  }
+
+  value = txlog_load_word(addr, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  while (self->snapshot != norec_clock.a.seq) {
+    self->snapshot = validate(self);
+    value = txlog_load_word(addr, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }
+
+  e = txlog_append(&self->reads);
+  e->addr = (volatile void*)addr;
+  e->value = value;
+  e->size = size;
+  txlog_store_word(buf, value, size);
+}
+
+
+void
+norec_store (norec_thread_t* self, volatile void* addr, const void* buf, size_t size)
+{
+  txlog_entry_t* e;
+  uint64_t value = txlog_load_word(buf, size);
+  long* idx;
+
+  if (!self->active) {
+    txlog_store_word(addr, value, size);
+    return;
+  }
+
+  idx = txset_lookup(&self->write_index, (uintptr_t)addr, self->gen, 1);
+  if (*idx < 0) {
+    *idx = self->writes.size;
+    e = txlog_append(&self->writes);
+    e->addr = addr;
+    e->size = size;
+  } else {
+    e = &self->writes.entries[*idx];
+    assert(e->size == size);
+  }
+  e->value = value;
+}
+
+
+void*
+norec_malloc (norec_thread_t* self, size_t size)
+{
+  void* ptr = malloc(size);
+
+  if (self->active && ptr != NULL) {
+    txlog_append(&self->allocs)->addr = ptr;
+  }
+  return ptr;
+}
+
+
+void
+norec_free (norec_thread_t* self, void* ptr)
+{
+  if (self->active) {
+    txlog_append(&self->frees)->addr = ptr;
+  } else {
+    free(ptr);
+  }
+}
+
+
+/* =============================================================================
+ *
+ * End of norec.c
+ *
+ * =============================================================================
+ */
@@ -0,0 +1,80 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * norec.h
+ *
+ * NOrec software transactional memory (Dalessandro, Spear and Scott,
+ * PPoPP'10).  A single global sequence lock serializes commits; reads are
+ * validated by value whenever the sequence number moves; writes are
+ * buffered in a redo log and written back while holding the lock.
+ *
+ * Exposes the STM_* interface that lib/tm.h expects from <stm.h>.
+ *
+ * =============================================================================
+ */
+
+#ifndef NOREC_H
+#define NOREC_H 1
+
+#include <setjmp.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct norec_thread norec_thread_t;
+
+void norec_startup (void);
+void norec_shutdown (void);
+norec_thread_t* norec_new_thread (void);
+void norec_init_thread (norec_thread_t* self, long id);
+void norec_free_thread (norec_thread_t* self);
+sigjmp_buf* norec_checkpoint (norec_thread_t* self);
+void norec_begin (norec_thread_t* self, int readOnly);
+void norec_commit (norec_thread_t* self);
+void norec_abort (norec_thread_t* self);
+void norec_load (norec_thread_t* self, const volatile void* addr, void* buf, size_t size);
+void norec_store (norec_thread_t* self, volatile void* addr, const void* buf, size_t size);
+void* norec_malloc (norec_thread_t* self, size_t size);
+void norec_free (norec_thread_t* self, void* ptr);
+
+#define STM_THREAD_T                    norec_thread_t
+#define STM_SELF                        Self
+
+#define STM_STARTUP()                   norec_startup()
+#define STM_SHUTDOWN()                  norec_shutdown()
+#define STM_NEW_THREAD()                norec_new_thread()
+#define STM_INIT_THREAD(t, id)          norec_init_thread(t, id)
+#define STM_FREE_THREAD(t)              norec_free_thread(t)
+
+/* The checkpoint must be taken in the frame of the transaction body,
+   so it cannot live inside norec_begin(). */
+#define STM_BEGIN(isReadOnly)           do { \
+                                            sigsetjmp(*norec_checkpoint(STM_SELF), 0); \
+                                            norec_begin(STM_SELF, isReadOnly); \
+                                        } while (0) /* enforce comma */
+#define STM_BEGIN_RD()                  STM_BEGIN(1)
+#define STM_BEGIN_WR()                  STM_BEGIN(0)
+#define STM_END()                       norec_commit(STM_SELF)
+#define STM_RESTART()                   norec_abort(STM_SELF)
+
+#define STM_LOAD(addr, buf, size)       norec_load(STM_SELF, addr, buf, size)
+#define STM_STORE(addr, buf, size)      norec_store(STM_SELF, addr, buf, size)
+
+#define STM_MALLOC(size)                norec_malloc(STM_SELF, size)
+#define STM_FREE(ptr)                   norec_free(STM_SELF, ptr)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NOREC_H */
+
+
+/* =============================================================================
+ *
+ * End of norec.h
+ *
+ * =============================================================================
+ */
@@ -0,0 +1,1010 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * open_hashtable.c
+ *
+ * Open-addressing hash table.  hashtable.c reaches a pair through the
+ * bucket array, a list node and the pair itself, and each of those loads
+ * adds a line to the read set of the transaction.  Here the pairs sit
+ * inline in one array, and a lookup usually reads one tag word and one
+ * pair.
+ *
+ * Slots come in groups of OPEN_HASHTABLE_GROUP, each with one 64-bit tag
+ * word: byte j is 0x80 if slot j of the group is empty, 0xFE if its pair
+ * was removed, and otherwise seven bits of the hash of its key.  A lookup
+ * matches all eight tags of a group at once with word arithmetic, and only
+ * compares the keys of the slots whose tag matches.  Groups are probed
+ * linearly from the home group of the hash, so that the tag words of a
+ * probe share cache lines; a lookup stops at the first group with an
+ * empty slot, and after maxProbe groups, as insert never places a key
+ * further away.  An insert that finds no free slot within maxProbe groups
+ * doubles the table, or only maxProbe when the table is less than half
+ * full.  Removing a pair only rewrites its tag.
+ *
+ * The TM variants read and write the tag words and pairs through
+ * TM_SHARED_READ/WRITE, so they work under the software TMs as well as in
+ * hardware transactions; the arrays of a table that grows are filled
+ * before it is published and need no instrumentation.
+ *
+ * =============================================================================
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include "open_hashtable.h"
+#include "pair.h"
+#include "tm.h"
+#include "types.h"
+
+#ifdef HAVE_CONFIG_H
+# include "STAMP_config.h"
+#endif
+
+
+#define GROUP              OPEN_HASHTABLE_GROUP
+#define LSBS               0x0101010101010101ULL
+#define MSBS               0x8080808080808080ULL
+#define TAG_EMPTY          0x80ULL
+#define TAG_DELETED        0xFEULL
+#define EMPTY_GROUP        (LSBS * TAG_EMPTY)
+
+/* The pairs follow the tag words */
+#define SLOTS(tags, numGroup)  ((pair_t*)((tags) + (numGroup)))
+
+
+static ulong_t
+hashKeyDefault (const void* a)
+{
+    return (ulong_t)a;
+}
+
+static long
+comparePairsDefault (const pair_t* a, const pair_t* b)
+{
+    return ((long)(a->firstPtr) - (long)(b->firstPtr));
+}
+
+
+/* =============================================================================
+ * Tag words
+ * -- The match functions set the top bit of the bytes that qualify.
+ *    matchTag() may also flag a full slot just above a match; the key
+ *    comparison weeds it out
+ * =============================================================================
+ */
+static inline uint64_t
+matchTag (uint64_t word, uint64_t tag)
+{
+    uint64_t x = word ^ (LSBS * tag);
+    return ((x - LSBS) & ~x & MSBS);
+}
+
+static inline uint64_t
+matchEmpty (uint64_t word)
+{
+    return (word & ~(word << 6) & MSBS);
+}
+
+/* Empty or removed */
+static inline uint64_t
+matchFree (uint64_t word)
+{
+    return (word & MSBS);
+}
+
+static inline uint64_t
+matchFull (uint64_t word)
+{
+    return (~word & MSBS);
+}
+
+static inline long
+firstMatch (uint64_t match)
+{
+    return (__builtin_ctzll(match) >> 3);
+}
+
+static inline uint64_t
+setTag (uint64_t word, long j, uint64_t tag)
+{
+    return ((word & ~(0xFFULL << (8 * j))) | (tag << (8 * j)));
+}
+
+
+/* =============================================================================
+ * mixHash
+ * -- The home group comes from the low bits, the tag from the top seven;
+ *    mixing keeps sequential ids and aligned pointers apart in both
+ * =============================================================================
+ */
+static inline uint64_t
+mixHash (ulong_t hash)
+{
+    uint64_t x = (uint64_t)hash;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+#define HASH_TAG(h)  ((h) >> 57)
+
+
+/* =============================================================================
+ * allocTags
+ * -- Returns NULL on error
+ * =============================================================================
+ */
+static uint64_t*
+allocTags (long numGroup)
+{
+    uint64_t* tags;
+    long g;
+
+    tags = (uint64_t*)malloc(numGroup * (sizeof(uint64_t) + GROUP * sizeof(pair_t)));
+    if (tags == NULL) {
+        return NULL;
+    }
+    for (g = 0; g < numGroup; g++) {
+        tags[g] = EMPTY_GROUP;
+    }
+
+    return tags;
+}
+
+
+/* =============================================================================
+ * TMallocTags
+ * -- Returns NULL on error
+ * =============================================================================
+ */
+static uint64_t*
+TMallocTags (TM_ARGDECL  long numGroup)
+{
+    uint64_t* tags;
+    long g;
+
+    tags = (uint64_t*)TM_MALLOC(numGroup * (sizeof(uint64_t) + GROUP * sizeof(pair_t)));
+    if (tags == NULL) {
+        return NULL;
+    }
+    /* Not yet reachable by other threads */
+    for (g = 0; g < numGroup; g++) {
+        tags[g] = EMPTY_GROUP;
+    }
+
+    return tags;
+}
+
+
+/* =============================================================================
+ * place
+ * -- Puts a pair into arrays that no other thread sees yet, without a
+ *    probe limit
+ * -- Returns the number of groups probed
+ * =============================================================================
+ */
+static long
+place (uint64_t* tags, long numGroup, uint64_t h, void* keyPtr, void* dataPtr)
+{
+    long mask = numGroup - 1;
+    long g = h & mask;
+    long i;
+
+    for (i = 0; /* linear probing visits every group */; i++) {
+        uint64_t match = matchFree(tags[g]);
+        if (match) {
+            long j = firstMatch(match);
+            pair_t* slotPtr = &SLOTS(tags, numGroup)[g * GROUP + j];
+            slotPtr->firstPtr = keyPtr;
+            slotPtr->secondPtr = dataPtr;
+            tags[g] = setTag(tags[g], j, HASH_TAG(h));
+            return i + 1;
+        }
+        g = (g + 1) & mask;
+    }
+}
+
+
+/* =============================================================================
+ * open_hashtable_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+open_hashtable_t*
+open_hashtable_alloc (long initNumSlot,
+                      ulong_t (*hash)(const void*),
+                      long (*comparePairs)(const pair_t*, const pair_t*))
+{
+    open_hashtable_t* hashtablePtr;
+    long numGroup = 1;
+
+    while (numGroup * GROUP < initNumSlot) {
+        numGroup *= 2;
+    }
+
+    hashtablePtr = (open_hashtable_t*)malloc(sizeof(open_hashtable_t));
+    if (hashtablePtr == NULL) {
+        return NULL;
+    }
+
+    hashtablePtr->tags = allocTags(numGroup);
+    if (hashtablePtr->tags == NULL) {
+        free(hashtablePtr);
+        return NULL;
+    }
+
+    hashtablePtr->numGroup = numGroup;
+    hashtablePtr->maxProbe = OPEN_HASHTABLE_MAX_PROBE;
+#ifdef HASHTABLE_SIZE_FIELD
+    hashtablePtr->size = 0;
+#endif
+    hashtablePtr->hash = (hash ? hash : hashKeyDefault);
+    hashtablePtr->comparePairs = (comparePairs ? comparePairs : comparePairsDefault);
+
+    return hashtablePtr;
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+open_hashtable_t*
+TMopen_hashtable_alloc (TM_ARGDECL
+                        long initNumSlot,
+                        ulong_t (*hash)(const void*),
+                        long (*comparePairs)(const pair_t*, const pair_t*))
+{
+    open_hashtable_t* hashtablePtr;
+    long numGroup = 1;
+
+    while (numGroup * GROUP < initNumSlot) {
+        numGroup *= 2;
+    }
+
+    hashtablePtr = (open_hashtable_t*)TM_MALLOC(sizeof(open_hashtable_t));
+    if (hashtablePtr == NULL) {
+        return NULL;
+    }
+
+    hashtablePtr->tags = TMallocTags(TM_ARG  numGroup);
+    if (hashtablePtr->tags == NULL) {
+        TM_FREE(hashtablePtr);
+        return NULL;
+    }
+
+    hashtablePtr->numGroup = numGroup;
+    hashtablePtr->maxProbe = OPEN_HASHTABLE_MAX_PROBE;
+#ifdef HASHTABLE_SIZE_FIELD
+    hashtablePtr->size = 0;
+#endif
+    hashtablePtr->hash = (hash ? hash : hashKeyDefault);
+    hashtablePtr->comparePairs = (comparePairs ? comparePairs : comparePairsDefault);
+
+    return hashtablePtr;
+}
+
+
+/* =============================================================================
+ * open_hashtable_free
+ * =============================================================================
+ */
+void
+open_hashtable_free (open_hashtable_t* hashtablePtr)
+{
+    free(hashtablePtr->tags);
+    free(hashtablePtr);
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_free
+ * =============================================================================
+ */
+void
+TMopen_hashtable_free (TM_ARGDECL  open_hashtable_t* hashtablePtr)
+{
+    TM_FREE(hashtablePtr->tags);
+    TM_FREE(hashtablePtr);
+}
+
+
+/* =============================================================================
+ * open_hashtable_getSize
+ * -- Returns number of elements in hash table
+ * =============================================================================
+ */
+long
+open_hashtable_getSize (open_hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_SIZE_FIELD
+    return hashtablePtr->size;
+#else
+    uint64_t* tags = hashtablePtr->tags;
+    long numGroup = hashtablePtr->numGroup;
+    long size = 0;
+    long g;
+
+    for (g = 0; g < numGroup; g++) {
+        size += __builtin_popcountll(matchFull(tags[g]));
+    }
+
+    return size;
+#endif
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_getSize
+ * -- Returns number of elements in hash table
+ * =============================================================================
+ */
+long
+TMopen_hashtable_getSize (TM_ARGDECL  open_hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_SIZE_FIELD
+    return (long)TM_SHARED_READ(hashtablePtr->size);
+#else
+    uint64_t* tags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+    long numGroup = (long)TM_SHARED_READ(hashtablePtr->numGroup);
+    long size = 0;
+    long g;
+
+    for (g = 0; g < numGroup; g++) {
+        size += __builtin_popcountll(matchFull((uint64_t)TM_SHARED_READ(tags[g])));
+    }
+
+    return size;
+#endif
+}
+
+
+/* =============================================================================
+ * open_hashtable_isEmpty
+ * =============================================================================
+ */
+bool_t
+open_hashtable_isEmpty (open_hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_SIZE_FIELD
+    return ((hashtablePtr->size == 0) ? TRUE : FALSE);
+#else
+    uint64_t* tags = hashtablePtr->tags;
+    long numGroup = hashtablePtr->numGroup;
+    long g;
+
+    for (g = 0; g < numGroup; g++) {
+        if (matchFull(tags[g])) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+#endif
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_isEmpty
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_isEmpty (TM_ARGDECL  open_hashtable_t* hashtablePtr)
+{
+#ifdef HASHTABLE_SIZE_FIELD
+    return ((TM_SHARED_READ(hashtablePtr->size) == 0) ? TRUE : FALSE);
+#else
+    uint64_t* tags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+    long numGroup = (long)TM_SHARED_READ(hashtablePtr->numGroup);
+    long g;
+
+    for (g = 0; g < numGroup; g++) {
+        if (matchFull((uint64_t)TM_SHARED_READ(tags[g]))) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+#endif
+}
+
+
+/* =============================================================================
+ * findSlot
+ * -- Returns the index of the slot that holds the key, or -1
+ * =============================================================================
+ */
+static long
+findSlot (open_hashtable_t* hashtablePtr, uint64_t h, void* keyPtr)
+{
+    uint64_t* tags = hashtablePtr->tags;
+    long numGroup = hashtablePtr->numGroup;
+    long numProbe = hashtablePtr->maxProbe;
+    pair_t* slots = SLOTS(tags, numGroup);
+    long mask = numGroup - 1;
+    long g = h & mask;
+    pair_t findPair;
+    long i;
+
+    findPair.firstPtr = keyPtr;
+    if (numProbe > numGroup) {
+        numProbe = numGroup;
+    }
+
+    for (i = 0; i < numProbe; i++) {
+        uint64_t word = tags[g];
+        uint64_t match;
+        for (match = matchTag(word, HASH_TAG(h)); match; match &= match - 1) {
+            long s = g * GROUP + firstMatch(match);
+            if (hashtablePtr->comparePairs(&findPair, &slots[s]) == 0) {
+                return s;
+            }
+        }
+        if (matchEmpty(word)) {
+            break;
+        }
+        g = (g + 1) & mask;
+    }
+
+    return -1;
+}
+
+
+/* =============================================================================
+ * TMfindSlot
+ * -- Returns the index of the slot that holds the key, or -1
+ * =============================================================================
+ */
+static long
+TMfindSlot (TM_ARGDECL  open_hashtable_t* hashtablePtr, uint64_t h, void* keyPtr)
+{
+    uint64_t* tags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+    long numGroup = (long)TM_SHARED_READ(hashtablePtr->numGroup);
+    long numProbe = (long)TM_SHARED_READ(hashtablePtr->maxProbe);
+    pair_t* slots = SLOTS(tags, numGroup);
+    long mask = numGroup - 1;
+    long g = h & mask;
+    pair_t findPair;
+    long i;
+
+    findPair.firstPtr = keyPtr;
+    if (numProbe > numGroup) {
+        numProbe = numGroup;
+    }
+
+    for (i = 0; i < numProbe; i++) {
+        uint64_t word = (uint64_t)TM_SHARED_READ(tags[g]);
+        uint64_t match;
+        for (match = matchTag(word, HASH_TAG(h)); match; match &= match - 1) {
+            long s = g * GROUP + firstMatch(match);
+            pair_t slotPair;
+            slotPair.firstPtr = TM_SHARED_READ_P(slots[s].firstPtr);
+            if (hashtablePtr->comparePairs(&findPair, &slotPair) == 0) {
+                return s;
+            }
+        }
+        if (matchEmpty(word)) {
+            break;
+        }
+        g = (g + 1) & mask;
+    }
+
+    return -1;
+}
+
+
+/* =============================================================================
+ * open_hashtable_containsKey
+ * =============================================================================
+ */
+bool_t
+open_hashtable_containsKey (open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+
+    return ((findSlot(hashtablePtr, h, keyPtr) >= 0) ? TRUE : FALSE);
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_containsKey
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_containsKey (TM_ARGDECL
+                              open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+
+    return ((TMfindSlot(TM_ARG  hashtablePtr, h, keyPtr) >= 0) ? TRUE : FALSE);
+}
+
+
+/* =============================================================================
+ * open_hashtable_find
+ * -- Returns NULL on failure, else pointer to data associated with key
+ * =============================================================================
+ */
+void*
+open_hashtable_find (open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    long s = findSlot(hashtablePtr, h, keyPtr);
+
+    if (s < 0) {
+        return NULL;
+    }
+
+    return SLOTS(hashtablePtr->tags, hashtablePtr->numGroup)[s].secondPtr;
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_find
+ * -- Returns NULL on failure, else pointer to data associated with key
+ * =============================================================================
+ */
+void*
+TMopen_hashtable_find (TM_ARGDECL  open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    long s = TMfindSlot(TM_ARG  hashtablePtr, h, keyPtr);
+    pair_t* slots;
+
+    if (s < 0) {
+        return NULL;
+    }
+
+    slots = SLOTS((uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags),
+                  (long)TM_SHARED_READ(hashtablePtr->numGroup));
+
+    return TM_SHARED_READ_P(slots[s].secondPtr);
+}
+
+
+/* =============================================================================
+ * grow
+ * -- Called when an insert found no free slot within maxProbe groups
+ * -- Returns FALSE if out of memory
+ * =============================================================================
+ */
+static bool_t
+grow (open_hashtable_t* hashtablePtr)
+{
+    uint64_t* oldTags = hashtablePtr->tags;
+    long oldNumGroup = hashtablePtr->numGroup;
+    long maxProbe = hashtablePtr->maxProbe;
+    pair_t* oldSlots = SLOTS(oldTags, oldNumGroup);
+    long newNumGroup = oldNumGroup * 2;
+    uint64_t* newTags;
+    long numFull = 0;
+    long g;
+
+    for (g = 0; g < oldNumGroup; g++) {
+        numFull += __builtin_popcountll(matchFull(oldTags[g]));
+    }
+
+    /* Less than half full: the keys cluster, look further instead */
+    if (2 * numFull < oldNumGroup * GROUP && maxProbe < oldNumGroup) {
+        hashtablePtr->maxProbe = maxProbe * 2;
+        return TRUE;
+    }
+
+    newTags = allocTags(newNumGroup);
+    if (newTags == NULL) {
+        return FALSE;
+    }
+
+    for (g = 0; g < oldNumGroup; g++) {
+        uint64_t match;
+        for (match = matchFull(oldTags[g]); match; match &= match - 1) {
+            pair_t* pairPtr = &oldSlots[g * GROUP + firstMatch(match)];
+            uint64_t h = mixHash(hashtablePtr->hash(pairPtr->firstPtr));
+            long numProbe = place(newTags, newNumGroup, h,
+                                  pairPtr->firstPtr, pairPtr->secondPtr);
+            if (numProbe > maxProbe) {
+                maxProbe = numProbe;
+            }
+        }
+    }
+
+    hashtablePtr->tags = newTags;
+    hashtablePtr->numGroup = newNumGroup;
+    hashtablePtr->maxProbe = maxProbe;
+    free(oldTags);
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * TMgrow
+ * -- Called when an insert found no free slot within maxProbe groups
+ * -- Returns FALSE if out of memory
+ * =============================================================================
+ */
+static bool_t
+TMgrow (TM_ARGDECL  open_hashtable_t* hashtablePtr)
+{
+    uint64_t* oldTags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+    long oldNumGroup = (long)TM_SHARED_READ(hashtablePtr->numGroup);
+    long maxProbe = (long)TM_SHARED_READ(hashtablePtr->maxProbe);
+    pair_t* oldSlots = SLOTS(oldTags, oldNumGroup);
+    long newNumGroup = oldNumGroup * 2;
+    uint64_t* newTags;
+    long numFull = 0;
+    long g;
+
+    for (g = 0; g < oldNumGroup; g++) {
+        numFull += __builtin_popcountll(matchFull((uint64_t)TM_SHARED_READ(oldTags[g])));
+    }
+
+    /* Less than half full: the keys cluster, look further instead */
+    if (2 * numFull < oldNumGroup * GROUP && maxProbe < oldNumGroup) {
+        TM_SHARED_WRITE(hashtablePtr->maxProbe, maxProbe * 2);
+        return TRUE;
+    }
+
+    newTags = TMallocTags(TM_ARG  newNumGroup);
+    if (newTags == NULL) {
+        return FALSE;
+    }
+
+    for (g = 0; g < oldNumGroup; g++) {
+        uint64_t match;
+        for (match = matchFull((uint64_t)TM_SHARED_READ(oldTags[g]));
+             match;
+             match &= match - 1) {
+            pair_t* pairPtr = &oldSlots[g * GROUP + firstMatch(match)];
+            void* keyPtr = TM_SHARED_READ_P(pairPtr->firstPtr);
+            uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+            long numProbe = place(newTags, newNumGroup, h,
+                                  keyPtr, TM_SHARED_READ_P(pairPtr->secondPtr));
+            if (numProbe > maxProbe) {
+                maxProbe = numProbe;
+            }
+        }
+    }
+
+    TM_SHARED_WRITE_P(hashtablePtr->tags, newTags);
+    TM_SHARED_WRITE(hashtablePtr->numGroup, newNumGroup);
+    TM_SHARED_WRITE(hashtablePtr->maxProbe, maxProbe);
+    TM_FREE(oldTags);
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * open_hashtable_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+open_hashtable_insert (open_hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    pair_t findPair;
+
+    findPair.firstPtr = keyPtr;
+
+    while (1) {
+        uint64_t* tags = hashtablePtr->tags;
+        long numGroup = hashtablePtr->numGroup;
+        long numProbe = hashtablePtr->maxProbe;
+        pair_t* slots = SLOTS(tags, numGroup);
+        long mask = numGroup - 1;
+        long g = h & mask;
+        long freeSlot = -1;
+        long i;
+
+        if (numProbe > numGroup) {
+            numProbe = numGroup;
+        }
+
+        /* Look for the key up to the first group with an empty slot,
+           remembering the first free slot on the way */
+        for (i = 0; i < numProbe; i++) {
+            uint64_t word = tags[g];
+            uint64_t match;
+            for (match = matchTag(word, HASH_TAG(h)); match; match &= match - 1) {
+                long s = g * GROUP + firstMatch(match);
+                if (hashtablePtr->comparePairs(&findPair, &slots[s]) == 0) {
+                    return FALSE;
+                }
+            }
+            if (freeSlot < 0 && (match = matchFree(word))) {
+                freeSlot = g * GROUP + firstMatch(match);
+            }
+            if (matchEmpty(word)) {
+                break;
+            }
+            g = (g + 1) & mask;
+        }
+
+        if (freeSlot >= 0) {
+            g = freeSlot / GROUP;
+            slots[freeSlot].firstPtr = keyPtr;
+            slots[freeSlot].secondPtr = dataPtr;
+            tags[g] = setTag(tags[g], freeSlot % GROUP, HASH_TAG(h));
+#ifdef HASHTABLE_SIZE_FIELD
+            hashtablePtr->size++;
+#endif
+            return TRUE;
+        }
+
+        if (!grow(hashtablePtr)) {
+            return FALSE;
+        }
+    }
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_insert (TM_ARGDECL
+                         open_hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    pair_t findPair;
+
+    findPair.firstPtr = keyPtr;
+
+    while (1) {
+        uint64_t* tags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+        long numGroup = (long)TM_SHARED_READ(hashtablePtr->numGroup);
+        long numProbe = (long)TM_SHARED_READ(hashtablePtr->maxProbe);
+        pair_t* slots = SLOTS(tags, numGroup);
+        long mask = numGroup - 1;
+        long g = h & mask;
+        long freeSlot = -1;
+        uint64_t freeWord = 0;
+        long i;
+
+        if (numProbe > numGroup) {
+            numProbe = numGroup;
+        }
+
+        /* Look for the key up to the first group with an empty slot,
+           remembering the first free slot on the way */
+        for (i = 0; i < numProbe; i++) {
+            uint64_t word = (uint64_t)TM_SHARED_READ(tags[g]);
+            uint64_t match;
+            for (match = matchTag(word, HASH_TAG(h)); match; match &= match - 1) {
+                long s = g * GROUP + firstMatch(match);
+                pair_t slotPair;
+                slotPair.firstPtr = TM_SHARED_READ_P(slots[s].firstPtr);
+                if (hashtablePtr->comparePairs(&findPair, &slotPair) == 0) {
+                    return FALSE;
+                }
+            }
+            if (freeSlot < 0 && (match = matchFree(word))) {
+                freeSlot = g * GROUP + firstMatch(match);
+                freeWord = word;
+            }
+            if (matchEmpty(word)) {
+                break;
+            }
+            g = (g + 1) & mask;
+        }
+
+        if (freeSlot >= 0) {
+            g = freeSlot / GROUP;
+            TM_SHARED_WRITE_P(slots[freeSlot].firstPtr, keyPtr);
+            TM_SHARED_WRITE_P(slots[freeSlot].secondPtr, dataPtr);
+            TM_SHARED_WRITE(tags[g], setTag(freeWord, freeSlot % GROUP, HASH_TAG(h)));
+#ifdef HASHTABLE_SIZE_FIELD
+            TM_SHARED_WRITE(hashtablePtr->size,
+                            (long)TM_SHARED_READ(hashtablePtr->size)+1);
+#endif
+            return TRUE;
+        }
+
+        if (!TMgrow(TM_ARG  hashtablePtr)) {
+            return FALSE;
+        }
+    }
+}
+
+
+/* =============================================================================
+ * open_hashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+open_hashtable_remove (open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    long s = findSlot(hashtablePtr, h, keyPtr);
+    uint64_t* tags = hashtablePtr->tags;
+    uint64_t word;
+    long g;
+
+    if (s < 0) {
+        return FALSE;
+    }
+
+    /* A group with an empty slot was never full, so no lookup went past
+       it and the slot can be empty again */
+    g = s / GROUP;
+    word = tags[g];
+    tags[g] = setTag(word, s % GROUP, (matchEmpty(word) ? TAG_EMPTY : TAG_DELETED));
+
+#ifdef HASHTABLE_SIZE_FIELD
+    hashtablePtr->size--;
+    assert(hashtablePtr->size >= 0);
+#endif
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * TMopen_hashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_remove (TM_ARGDECL  open_hashtable_t* hashtablePtr, void* keyPtr)
+{
+    uint64_t h = mixHash(hashtablePtr->hash(keyPtr));
+    long s = TMfindSlot(TM_ARG  hashtablePtr, h, keyPtr);
+    uint64_t* tags;
+    uint64_t word;
+    long g;
+
+    if (s < 0) {
+        return FALSE;
+    }
+
+    /* A group with an empty slot was never full, so no lookup went past
+       it and the slot can be empty again */
+    tags = (uint64_t*)TM_SHARED_READ_P(hashtablePtr->tags);
+    g = s / GROUP;
+    word = (uint64_t)TM_SHARED_READ(tags[g]);
+    TM_SHARED_WRITE(tags[g],
+                    setTag(word, s % GROUP, (matchEmpty(word) ? TAG_EMPTY : TAG_DELETED)));
+
+#ifdef HASHTABLE_SIZE_FIELD
+    TM_SHARED_WRITE(hashtablePtr->size,
+                    (long)TM_SHARED_READ(hashtablePtr->size)-1);
+#endif
+
+    return TRUE;
+}
+
+
+/* =============================================================================
+ * TEST_OPEN_HASHTABLE
+ * =============================================================================
+ */
+#ifdef TEST_OPEN_HASHTABLE
+
+
+#include <stdio.h>
+
+
+#define NUM_KEY 4096
+
+
+static ulong_t
+hash (const void* keyPtr)
+{
+    return ((ulong_t)(*(long*)keyPtr));
+}
+
+
+/* Every key lands in one of four home groups */
+static ulong_t
+hashCollide (const void* keyPtr)
+{
+    return ((ulong_t)(*(long*)keyPtr) & 3);
+}
+
+
+static long
+comparePairs (const pair_t* a, const pair_t* b)
+{
+    return (*(long*)(a->firstPtr) - *(long*)(b->firstPtr));
+}
+
+
+static void
+testTable (open_hashtable_t* hashtablePtr, long* keys)
+{
+    long i;
+
+    assert(open_hashtable_isEmpty(hashtablePtr));
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(open_hashtable_insert(hashtablePtr, &keys[i], &keys[i]));
+        assert(!open_hashtable_insert(hashtablePtr, &keys[i], &keys[i]));
+    }
+    assert(open_hashtable_getSize(hashtablePtr) == NUM_KEY);
+    printf("%li keys: %li groups, maxProbe %li\n",
+           (long)NUM_KEY, hashtablePtr->numGroup, hashtablePtr->maxProbe);
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(*(long*)open_hashtable_find(hashtablePtr, &keys[i]) == keys[i]);
+    }
+
+    /* Leave holes, then refill them */
+    for (i = 0; i < NUM_KEY; i += 2) {
+        assert(open_hashtable_remove(hashtablePtr, &keys[i]));
+        assert(!open_hashtable_remove(hashtablePtr, &keys[i]));
+    }
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(open_hashtable_containsKey(hashtablePtr, &keys[i]) == (i & 1));
+    }
+    assert(open_hashtable_getSize(hashtablePtr) == NUM_KEY / 2);
+    for (i = 0; i < NUM_KEY; i += 2) {
+        assert(open_hashtable_insert(hashtablePtr, &keys[i], &keys[i]));
+    }
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(*(long*)open_hashtable_find(hashtablePtr, &keys[i]) == keys[i]);
+    }
+
+    for (i = 0; i < NUM_KEY; i++) {
+        assert(open_hashtable_remove(hashtablePtr, &keys[i]));
+        assert(open_hashtable_find(hashtablePtr, &keys[i]) == NULL);
+    }
+    assert(open_hashtable_isEmpty(hashtablePtr));
+}
+
+
+int
+main ()
+{
+    open_hashtable_t* hashtablePtr;
+    static long keys[NUM_KEY];
+    long i;
+
+    puts("Starting...");
+
+    for (i = 0; i < NUM_KEY; i++) {
+        keys[i] = i * 7919;
+    }
+
+    hashtablePtr = open_hashtable_alloc(1, &hash, &comparePairs);
+    testTable(hashtablePtr, keys);
+    open_hashtable_free(hashtablePtr);
+
+    hashtablePtr = open_hashtable_alloc(1, &hashCollide, &comparePairs);
+    testTable(hashtablePtr, keys);
+    open_hashtable_free(hashtablePtr);
+
+    /* Default hash and compare: the key pointers themselves */
+    hashtablePtr = open_hashtable_alloc(NUM_KEY, NULL, NULL);
+    for (i = 1; i <= NUM_KEY; i++) {
+        assert(open_hashtable_insert(hashtablePtr, (void*)i, (void*)(i * 2)));
+    }
+    for (i = 1; i <= NUM_KEY; i++) {
+        assert((long)open_hashtable_find(hashtablePtr, (void*)i) == i * 2);
+    }
+    open_hashtable_free(hashtablePtr);
+
+    puts("Done.");
+
+    return 0;
+}
+
+
+#endif /* TEST_OPEN_HASHTABLE */
+
+
+/* =============================================================================
+ *
+ * End of open_hashtable.c
+ *
+ * =============================================================================
+ */
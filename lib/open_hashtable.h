@@ -0,0 +1,218 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * open_hashtable.h
+ *
+ * Open-addressing hash table with the pairs stored inline, see
+ * open_hashtable.c.  Same interface as hashtable.h, selected for MAP_T by
+ * MAP_USE_OPEN_HASHTABLE (map.h).
+ *
+ * =============================================================================
+ */
+
+#ifndef OPEN_HASHTABLE_H
+#define OPEN_HASHTABLE_H 1
+
+
+#include <stdint.h>
+#include "pair.h"
+#include "tm.h"
+#include "types.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+enum open_hashtable_config {
+    OPEN_HASHTABLE_GROUP     = 8, /* slots per tag word */
+    OPEN_HASHTABLE_MAX_PROBE = 8  /* groups a key may be from its home group */
+};
+
+typedef struct open_hashtable {
+    /* numGroup tag words, followed by numGroup * OPEN_HASHTABLE_GROUP
+       pairs; replaced as a whole when the table grows */
+    uint64_t* tags;
+    long numGroup;
+    long maxProbe;
+#ifdef HASHTABLE_SIZE_FIELD
+    long size;
+#endif
+    ulong_t (*hash)(const void*);
+    long (*comparePairs)(const pair_t*, const pair_t*);
+    /* comparePairs should return <0 if before, 0 if equal, >0 if after */
+} open_hashtable_t;
+
+
+/* =============================================================================
+ * open_hashtable_alloc
+ * -- Returns NULL on failure
+ * -- Room for initNumSlot pairs before the first resize; NULL hash or
+ *    comparePairs hash and compare the key pointers themselves
+ * =============================================================================
+ */
+open_hashtable_t*
+open_hashtable_alloc (long initNumSlot,
+                      ulong_t (*hash)(const void*),
+                      long (*comparePairs)(const pair_t*, const pair_t*));
+
+
+/* =============================================================================
+ * TMopen_hashtable_alloc
+ * -- Returns NULL on failure
+ * =============================================================================
+ */
+open_hashtable_t*
+TMopen_hashtable_alloc (TM_ARGDECL
+                        long initNumSlot,
+                        ulong_t (*hash)(const void*),
+                        long (*comparePairs)(const pair_t*, const pair_t*));
+
+
+/* =============================================================================
+ * open_hashtable_free
+ * =============================================================================
+ */
+void
+open_hashtable_free (open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_free
+ * =============================================================================
+ */
+void
+TMopen_hashtable_free (TM_ARGDECL  open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * open_hashtable_isEmpty
+ * =============================================================================
+ */
+bool_t
+open_hashtable_isEmpty (open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_isEmpty
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_isEmpty (TM_ARGDECL  open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * open_hashtable_getSize
+ * -- Returns number of elements in hash table
+ * =============================================================================
+ */
+long
+open_hashtable_getSize (open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_getSize
+ * -- Returns number of elements in hash table
+ * =============================================================================
+ */
+long
+TMopen_hashtable_getSize (TM_ARGDECL  open_hashtable_t* hashtablePtr);
+
+
+/* =============================================================================
+ * open_hashtable_containsKey
+ * =============================================================================
+ */
+bool_t
+open_hashtable_containsKey (open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_containsKey
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_containsKey (TM_ARGDECL
+                              open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * open_hashtable_find
+ * -- Returns NULL on failure, else pointer to data associated with key
+ * =============================================================================
+ */
+void*
+open_hashtable_find (open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_find
+ * -- Returns NULL on failure, else pointer to data associated with key
+ * =============================================================================
+ */
+void*
+TMopen_hashtable_find (TM_ARGDECL  open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * open_hashtable_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+open_hashtable_insert (open_hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_insert
+ * -- Returns FALSE if the key is already present or memory runs out
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_insert (TM_ARGDECL
+                         open_hashtable_t* hashtablePtr, void* keyPtr, void* dataPtr);
+
+
+/* =============================================================================
+ * open_hashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+open_hashtable_remove (open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+/* =============================================================================
+ * TMopen_hashtable_remove
+ * -- Returns TRUE if successful, else FALSE
+ * =============================================================================
+ */
+bool_t
+TMopen_hashtable_remove (TM_ARGDECL  open_hashtable_t* hashtablePtr, void* keyPtr);
+
+
+#define TMOPEN_HASHTABLE_ALLOC(i, h, c)      TMopen_hashtable_alloc(TM_ARG  i, h, c)
+#define TMOPEN_HASHTABLE_FREE(ht)            TMopen_hashtable_free(TM_ARG  ht)
+#define TMOPEN_HASHTABLE_ISEMPTY(ht)         TMopen_hashtable_isEmpty(TM_ARG  ht)
+#define TMOPEN_HASHTABLE_GETSIZE(ht)         TMopen_hashtable_getSize(TM_ARG  ht)
+#define TMOPEN_HASHTABLE_CONTAINSKEY(ht, k)  TMopen_hashtable_containsKey(TM_ARG  ht, k)
+#define TMOPEN_HASHTABLE_FIND(ht, k)         TMopen_hashtable_find(TM_ARG  ht, k)
+#define TMOPEN_HASHTABLE_INSERT(ht, k, d)    TMopen_hashtable_insert(TM_ARG  ht, k, d)
+#define TMOPEN_HASHTABLE_REMOVE(ht, k)       TMopen_hashtable_remove(TM_ARG  ht, k)
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* OPEN_HASHTABLE_H */
+
+
+/* =============================================================================
+ *
+ * End of open_hashtable.h
+ *
+ * =============================================================================
+ */
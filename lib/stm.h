@@ -0,0 +1,52 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * stm.h
+ *
+ * In-tree STM backends for the STM branch of tm.h, selected at build time:
+ * STM_TL2 (tl2.c) or STM_NOREC (norec.c, the default).  The backend header
+ * provides the thread/transaction macros (STM_BEGIN_WR, STM_END, ...) and
+ * STM_LOAD/STM_STORE on (address, buffer, size); the typed accessors below
+ * are shared, so any field of 1, 2, 4 or 8 bytes can be accessed.
+ *
+ * =============================================================================
+ */
+
+#ifndef STM_H
+#define STM_H 1
+
+#if defined(STM_TL2)
+#  include "tl2.h"
+#else
+#  include "norec.h"
+#endif
+
+#define STM_READ(var)                   ({ \
+                                            char __stm_buf[sizeof(var)] __attribute__((aligned(8))); \
+                                            STM_LOAD(&(var), (void*)__stm_buf, sizeof(var)); \
+                                            *(__typeof__(var)*)__stm_buf; \
+                                        })
+#define STM_READ_P(var)                 STM_READ(var)
+#define STM_READ_F(var)                 STM_READ(var)
+
+#define STM_WRITE(var, val)             ({ \
+                                            __typeof__(var) __stm_val = (val); \
+                                            STM_STORE(&(var), (const void*)&__stm_val, sizeof(var)); \
+                                            __stm_val; \
+                                        })
+#define STM_WRITE_P(var, val)           STM_WRITE(var, val)
+#define STM_WRITE_F(var, val)           STM_WRITE(var, val)
+
+#define STM_LOCAL_WRITE(var, val)       ({var = val; var;})
+#define STM_LOCAL_WRITE_P(var, val)     ({var = val; var;})
+#define STM_LOCAL_WRITE_F(var, val)     ({var = val; var;})
+
+#endif /* STM_H */
+
+
+/* =============================================================================
+ *
+ * End of stm.h
+ *
+ * =============================================================================
+ */
@@ -69,12 +69,23 @@
  */
 
 
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "thread.h"
 #include "types.h"
 
-static THREAD_KEY_T    global_threadId;
+#if defined(__linux__) && !defined(__bgq__) && !defined(SIMULATOR)
+#  define THREAD_PLACEMENT
+#  include <dirent.h>
+#  include <sched.h>
+#endif
+
+static THREAD_LOCAL long global_threadId = 0;
 static long              global_numThread       = 1;
 static THREAD_BARRIER_T* global_barrierPtr      = NULL;
 static long*             global_threadIds       = NULL;
@@ -82,6 +93,7 @@ static THREAD_T*         global_threads         = NULL;
 static void            (*global_funcPtr)(void*) = NULL;
 static void*             global_argPtr          = NULL;
 static volatile bool_t   global_doShutdown      = FALSE;
+static int*              global_threadCpus      = NULL; /* NULL: OS places */
 #ifdef GLOBAL_LOCK
 #ifdef USE_MUTEX
 THREAD_MUTEX_T global_lock;
@@ -90,6 +102,306 @@ volatile int global_lock;
 #endif
 #endif
 
+/* =============================================================================
+ * Thread placement
+ *
+ * THREAD_PLACEMENT pins thread i to the i-th cpu of an order built from the
+ * topology in /sys/devices/system/cpu, restricted to the cpus the process
+ * may run on, and wraps around when there are more threads than cpus:
+ *
+ *   compact    every SMT sibling of a core before the next core, every core
+ *              of a socket before the next socket
+ *   scatter    one thread per core, alternating sockets, before any core
+ *              gets a second thread
+ *   smt-pairs  two siblings of each core in compact order, then the next two
+ *              siblings of each core (with PREFETCHING=1 a master and its
+ *              helper share a core)
+ *   0,2,8-11   an explicit list of cpus
+ *
+ * Unset or none leaves placement to the OS.  Threads pin themselves before
+ * they run anything, so what TM_THREAD_ENTER() and the memory pools touch
+ * first (see THREAD_FIRST_TOUCH in memory.c) lands on their NUMA node.
+ * =============================================================================
+ */
+#ifdef THREAD_PLACEMENT
+
+typedef struct cpu_place {
+    int cpu;
+    int package;
+    int core;       /* core_id, only unique within a package */
+    int coreRank;   /* position of the core within its package */
+    int smt;        /* position of the cpu among the siblings of its core */
+} cpu_place_t;
+
+
+/* =============================================================================
+ * readCpuInt
+ * -- Returns -1 if the topology file cannot be read
+ * =============================================================================
+ */
+static int
+readCpuInt (int cpu, const char* file)
+{
+    char path[128];
+    FILE* fp;
+    int value = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    fp = fopen(path, "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%d", &value) != 1) {
+            value = -1;
+        }
+        fclose(fp);
+    }
+
+    return value;
+}
+
+
+/* =============================================================================
+ * readCpuNode
+ * -- Returns the NUMA node of cpu, 0 without NUMA support
+ * =============================================================================
+ */
+static int
+readCpuNode (int cpu)
+{
+    char path[64];
+    DIR* dir;
+    struct dirent* entry;
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+    }
+    closedir(dir);
+
+    return node;
+}
+
+
+/* =============================================================================
+ * parseCpuList
+ * -- Accepts "0,2,8-11"; returns number of cpus, or -1 if malformed
+ * =============================================================================
+ */
+static long
+parseCpuList (const char* str, int* cpus, long maxCpu)
+{
+    long numCpu = 0;
+
+    while (*str != '\0') {
+        char* end;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if (end == str || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE || numCpu + (last - first + 1) > maxCpu) {
+            return -1;
+        }
+        for (; first <= last; first++) {
+            cpus[numCpu++] = (int)first;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        str = end;
+    }
+
+    return numCpu;
+}
+
+
+static int
+compareCompact (const void* a, const void* b)
+{
+    const cpu_place_t* p = (const cpu_place_t*)a;
+    const cpu_place_t* q = (const cpu_place_t*)b;
+
+    if (p->package != q->package) return p->package - q->package;
+    if (p->core != q->core) return p->core - q->core;
+    return p->cpu - q->cpu;
+}
+
+static int
+compareScatter (const void* a, const void* b)
+{
+    const cpu_place_t* p = (const cpu_place_t*)a;
+    const cpu_place_t* q = (const cpu_place_t*)b;
+
+    if (p->smt != q->smt) return p->smt - q->smt;
+    if (p->coreRank != q->coreRank) return p->coreRank - q->coreRank;
+    if (p->package != q->package) return p->package - q->package;
+    return p->cpu - q->cpu;
+}
+
+static int
+compareSmtPairs (const void* a, const void* b)
+{
+    const cpu_place_t* p = (const cpu_place_t*)a;
+    const cpu_place_t* q = (const cpu_place_t*)b;
+
+    if (p->smt / 2 != q->smt / 2) return p->smt / 2 - q->smt / 2;
+    return compareCompact(a, b);
+}
+
+
+/* =============================================================================
+ * placementInit
+ * -- Chooses a cpu for each of numThread threads and logs the mapping
+ * =============================================================================
+ */
+static void
+placementInit (long numThread)
+{
+    const char* policy = getenv("THREAD_PLACEMENT");
+    cpu_set_t allowed;
+    cpu_place_t* places;
+    int* cpus;
+    long numCpu = 0;
+    long i;
+
+    if (policy == NULL || strcmp(policy, "none") == 0) {
+        return;
+    }
+
+    places = (cpu_place_t*)malloc(CPU_SETSIZE * sizeof(cpu_place_t));
+    cpus = (int*)malloc(CPU_SETSIZE * sizeof(int));
+    assert(places && cpus);
+
+    if (policy[0] >= '0' && policy[0] <= '9') {
+        numCpu = parseCpuList(policy, cpus, CPU_SETSIZE);
+        if (numCpu <= 0) {
+            printf("<THREAD_PLACEMENT=%s invalid, use compact, scatter, "
+                   "smt-pairs, none or a cpu list such as 0,2,8-11>\n", policy);
+            exit(1);
+        }
+    } else {
+        int (*compare)(const void*, const void*);
+        int cpu;
+        if (strcmp(policy, "compact") == 0) {
+            compare = &compareCompact;
+        } else if (strcmp(policy, "scatter") == 0) {
+            compare = &compareScatter;
+        } else if (strcmp(policy, "smt-pairs") == 0) {
+            compare = &compareSmtPairs;
+        } else {
+            printf("<THREAD_PLACEMENT=%s invalid, use compact, scatter, "
+                   "smt-pairs, none or a cpu list such as 0,2,8-11>\n", policy);
+            exit(1);
+        }
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            perror("sched_getaffinity");
+            exit(1);
+        }
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            cpu_place_t* place;
+            if (!CPU_ISSET(cpu, &allowed)) {
+                continue;
+            }
+            place = &places[numCpu++];
+            place->cpu = cpu;
+            place->package = readCpuInt(cpu, "topology/physical_package_id");
+            place->core = readCpuInt(cpu, "topology/core_id");
+            if (place->package < 0 || place->core < 0) {
+                /* No topology: every cpu is a core of its own */
+                place->package = 0;
+                place->core = cpu;
+            }
+        }
+        /* Rank cores within packages and siblings within cores */
+        qsort(places, numCpu, sizeof(cpu_place_t), &compareCompact);
+        for (i = 0; i < numCpu; i++) {
+            cpu_place_t* place = &places[i];
+            cpu_place_t* prev = (i > 0) ? &places[i - 1] : NULL;
+            if (prev == NULL || prev->package != place->package) {
+                place->coreRank = 0;
+                place->smt = 0;
+            } else if (prev->core != place->core) {
+                place->coreRank = prev->coreRank + 1;
+                place->smt = 0;
+            } else {
+                place->coreRank = prev->coreRank;
+                place->smt = prev->smt + 1;
+            }
+        }
+        qsort(places, numCpu, sizeof(cpu_place_t), compare);
+        for (i = 0; i < numCpu; i++) {
+            cpus[i] = places[i].cpu;
+        }
+    }
+
+    global_threadCpus = (int*)malloc(numThread * sizeof(int));
+    assert(global_threadCpus);
+    printf("<THREAD_PLACEMENT=%s", policy);
+    for (i = 0; i < numThread; i++) {
+        global_threadCpus[i] = cpus[i % numCpu];
+        printf(" %li:%i/n%i", i, global_threadCpus[i],
+               readCpuNode(global_threadCpus[i]));
+    }
+    printf(">\n");
+    fflush(stdout);
+
+    free(cpus);
+    free(places);
+}
+
+
+/* =============================================================================
+ * placeThread
+ * -- Pins the calling thread to the cpu chosen for it, if any
+ * =============================================================================
+ */
+static void
+placeThread (long threadId)
+{
+    cpu_set_t cpuset;
+
+    if (global_threadCpus == NULL) {
+        return;
+    }
+    CPU_ZERO(&cpuset);
+    CPU_SET(global_threadCpus[threadId], &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        printf("<THREAD_PLACEMENT: cannot pin thread %li to cpu %i>\n",
+               threadId, global_threadCpus[threadId]);
+    }
+}
+
+#else /* !THREAD_PLACEMENT */
+
+static void
+placementInit (long numThread)
+{
+    if (getenv("THREAD_PLACEMENT") != NULL) {
+        printf("<THREAD_PLACEMENT is not supported on this platform>\n");
+    }
+}
+
+#  define placeThread(threadId) /* nothing */
+
+#endif /* !THREAD_PLACEMENT */
+
+
 /* =============================================================================
  * threadWait
  * -- Synchronizes all threads to start/stop parallel section
@@ -100,7 +412,10 @@ threadWait (void* argPtr)
 {
     long threadId = *(long*)argPtr;
 
-    THREAD_KEY_SET(global_threadId, (long)threadId);
+    global_threadId = threadId;
+    if (threadId != 0) {
+        placeThread(threadId); /* primary was placed by thread_startup */
+    }
 
     while (1) {
         THREAD_BARRIER(global_barrierPtr, threadId); /* wait for start parallel */
@@ -137,7 +452,6 @@ thread_startup (long numThread)
     THREAD_BARRIER_INIT(global_barrierPtr, numThread);
 
     /* Set up ids */
-    THREAD_KEY_INIT(global_threadId);
     assert(global_threadIds == NULL);
     global_threadIds = (long*)malloc(numThread * sizeof(long));
     assert(global_threadIds);
@@ -145,6 +459,11 @@ thread_startup (long numThread)
         global_threadIds[i] = i;
     }
 
+    /* Place primary before it touches shared data */
+    assert(global_threadCpus == NULL);
+    placementInit(numThread);
+    placeThread(0);
+
     /* Set up thread list */
     assert(global_threads == NULL);
     global_threads = (THREAD_T*)malloc(numThread * sizeof(THREAD_T));
@@ -216,6 +535,9 @@ thread_shutdown ()
     free(global_threads);
     global_threads = NULL;
 
+    free(global_threadCpus);
+    global_threadCpus = NULL;
+
     global_numThread = 1;
 }
 
@@ -391,7 +713,7 @@ thread_barrier_wait()
 long
 thread_getId()
 {
-    return (long)THREAD_KEY_GET(global_threadId);
+    return global_threadId;
 }
 
 
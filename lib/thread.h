@@ -100,6 +100,10 @@ extern "C" {
 #define THREAD_KEY_SET(key, val)          pthread_setspecific(key, (void*)(val))
 #define THREAD_KEY_GET(key)               pthread_getspecific(key)
 
+/* Static TLS of the executable: a load off the thread pointer, where
+   THREAD_KEY_GET() calls into libpthread */
+#define THREAD_LOCAL                      __thread __attribute__((tls_model("initial-exec")))
+
 #define THREAD_MUTEX_T                      pthread_mutex_t
 #define THREAD_MUTEX_INIT(lock)             pthread_mutex_init(&(lock), NULL)
 #define THREAD_MUTEX_LOCK(lock)             pthread_mutex_lock(&(lock))
@@ -74,6 +74,7 @@
 
 
 #include <sys/time.h>
+#include <time.h>
 
 
 #define TIMER_T                         struct timeval
@@ -89,6 +90,77 @@
      ((double)(start.tv_sec)*1000000 + (double)(start.tv_usec)))
 
 
+/* =============================================================================
+ * Ticks: a cheap clock for timing single transactions
+ *
+ * TICKS_READ() reads the time stamp counter on x86, the time base on
+ * POWER, and CLOCK_MONOTONIC_RAW nanoseconds elsewhere.  Differences of
+ * ticks convert to microseconds with TICKS_TO_MICROSEC(); the first call
+ * calibrates the rate against CLOCK_MONOTONIC_RAW for about 10 ms.
+ * =============================================================================
+ */
+
+#ifdef CLOCK_MONOTONIC_RAW
+#  define TICKS_CLOCK                   CLOCK_MONOTONIC_RAW
+#else
+#  define TICKS_CLOCK                   CLOCK_MONOTONIC
+#endif
+
+#define TICKS_T                         unsigned long long
+
+static inline unsigned long long
+ticks_clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(TICKS_CLOCK, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long
+ticks_read (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int lo;
+    unsigned int hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#elif (defined(__PPC__) || defined(_ARCH_PPC)) && defined(__64BIT__) || defined(__powerpc64__)
+    unsigned long long tb;
+    __asm__ __volatile__ ("mfspr %0, 268" : "=r" (tb)); /* mftb */
+    return tb;
+#else
+    return ticks_clock_ns();
+#endif
+}
+
+static inline double
+ticks_per_microsec (void)
+{
+    static double rate = 0;
+#if defined(__x86_64__) || defined(__i386__) || \
+    (defined(__PPC__) || defined(_ARCH_PPC)) && defined(__64BIT__) || defined(__powerpc64__)
+    if (rate == 0) {
+        unsigned long long ns0 = ticks_clock_ns();
+        unsigned long long t0 = ticks_read();
+        unsigned long long ns1;
+        unsigned long long t1;
+        do {
+            ns1 = ticks_clock_ns();
+            t1 = ticks_read();
+        } while (ns1 - ns0 < 10000000ULL);
+        rate = (double)(t1 - t0) * 1000 / (double)(ns1 - ns0);
+    }
+#else
+    rate = 1000;
+#endif
+    return rate;
+}
+
+#define TICKS_READ()                    ticks_read()
+
+#define TICKS_TO_MICROSEC(ticks)        ((double)(ticks) / ticks_per_microsec())
+
+
 
 #endif /* TIMER_H */
 
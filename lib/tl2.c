@@ -0,0 +1,419 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * tl2.c
+ *
+ * TL2 STM: a global version clock and a table of versioned write locks
+ * (ownership records, "orecs") hashed by word address; lazy write-back
+ * through a per-thread redo log.
+ *
+ * An orec holds version << 1 when free and (owner | 1) when locked.  A
+ * transaction samples the clock into rv at begin, and a read is valid if
+ * its orec is unlocked, unchanged across the load and no newer than rv.
+ * A writer locks the orecs of its write set, bumps the clock to wv,
+ * revalidates its read set unless no other writer committed since begin
+ * (wv == rv + 1), writes back and releases the orecs at version wv.
+ *
+ * TM_BEGIN_RO transactions keep no read log: each read is checked against
+ * rv and there is nothing left to validate at commit.  A store inside one
+ * restarts the transaction as a writer.
+ *
+ * =============================================================================
+ */
+
+#include <assert.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "tl2.h"
+#include "txlog.h"
+
+#define TL2_OREC_BITS     20
+#define TL2_OREC_SHIFT    3     /* one orec per 8-byte word */
+#define TL2_BACKOFF_MIN   4
+#define TL2_BACKOFF_MAX   4096
+#define TL2_LIMBO_BATCH   64
+
+#define OREC_OF(addr) \
+    (&tl2_orecs[((uintptr_t)(addr) >> TL2_OREC_SHIFT) & ((1UL << TL2_OREC_BITS) - 1)])
+#define OREC_LOCKED(v)    ((v) & 1)
+#define OREC_VERSION(v)   ((v) >> 1)
+
+struct tl2_thread {
+  long id;
+  txepoch_t epoch;              /* start = rv */
+  int active;
+  int readOnly;
+  int forceWrite;               /* a TM_BEGIN_RO block stored; rerun as writer */
+  uintptr_t rv;
+  unsigned long gen;
+  unsigned long backoff;
+  unsigned long seed;
+  sigjmp_buf checkpoint;
+  txlog_t reads;                /* addr = orec */
+  txlog_t writes;
+  txset_t write_index;
+  txlog_t locks;                /* addr = orec, value = orec before locking */
+  txset_t lock_index;
+  txlog_t allocs;
+  txlog_t frees;
+  txlog_t limbo;
+  long starts;
+  long aborts;
+};
+
+static union {
+  char two_cache_lines[512];
+  struct {
+    char one_cache_line[256];
+    volatile uintptr_t clock;
+    char another_cache_line[248];
+  } a;
+} tl2_gv;
+
+static volatile uintptr_t tl2_orecs[1UL << TL2_OREC_BITS];
+
+static volatile long global_starts = 0;
+static volatile long global_aborts = 0;
+
+static txepoch_registry_t global_threads;
+
+
+void
+tl2_startup (void)
+{
+  tl2_gv.a.clock = 0;
+  memset((void*)tl2_orecs, 0, sizeof(tl2_orecs));
+  global_starts = 0;
+  global_aborts = 0;
+}
+
+
+void
+tl2_shutdown (void)
+{
+  printf("TL2 system shutdown:\n"
+         "  GCLOCK=0x%lX Starts=%li Aborts=%li\n",
+         (unsigned long)tl2_gv.a.clock, global_starts, global_aborts);
+}
+
+
+tl2_thread_t*
+tl2_new_thread (void)
+{
+  tl2_thread_t* self = (tl2_thread_t*)malloc(sizeof(tl2_thread_t));
+  if (self == NULL) {
+    printf("malloc error\n");
+    exit(1);
+  }
+  memset(self, 0, sizeof(*self));
+  return self;
+}
+
+
+void
+tl2_init_thread (tl2_thread_t* self, long id)
+{
+  self->id = id;
+  self->seed = (unsigned long)id * 2654435761UL + 1;
+  txlog_alloc(&self->reads);
+  txlog_alloc(&self->writes);
+  txset_alloc(&self->write_index, TXLOG_INIT_SIZE);
+  txlog_alloc(&self->locks);
+  txset_alloc(&self->lock_index, TXLOG_INIT_SIZE);
+  txlog_alloc(&self->allocs);
+  txlog_alloc(&self->frees);
+  txlog_alloc(&self->limbo);
+  txepoch_register(&global_threads, &self->epoch);
+}
+
+
+void
+tl2_free_thread (tl2_thread_t* self)
+{
+  __sync_fetch_and_add(&global_starts, self->starts);
+  __sync_fetch_and_add(&global_aborts, self->aborts);
+
+  while (self->limbo.size != 0) {
+    txlog_reclaim(&self->limbo, txepoch_oldest(&global_threads));
+    txlog_relax();
+  }
+  txepoch_unregister(&global_threads, &self->epoch);
+
+  txlog_free(&self->reads);
+  txlog_free(&self->writes);
+  txset_free(&self->write_index);
+  txlog_free(&self->locks);
+  txset_free(&self->lock_index);
+  txlog_free(&self->allocs);
+  txlog_free(&self->frees);
+  txlog_free(&self->limbo);
+  free(self);
+}
+
+
+sigjmp_buf*
+tl2_checkpoint (tl2_thread_t* self)
+{
+  return &self->checkpoint;
+}
+
+
+void
+tl2_begin (tl2_thread_t* self, int readOnly)
+{
+  assert(!self->active);
+  self->gen++;
+  self->reads.size = 0;
+  self->writes.size = 0;
+  self->write_index.count = 0;
+  self->locks.size = 0;
+  self->lock_index.count = 0;
+  self->allocs.size = 0;
+  self->frees.size = 0;
+  self->readOnly = readOnly && !self->forceWrite;
+  self->starts++;
+  self->rv = tl2_gv.a.clock;
+  self->epoch.start = self->rv;
+  __sync_synchronize();
+  self->active = 1;
+}
+
+
+/* Randomized exponential backoff, so that writers which keep invalidating
+   each other do not restart in lockstep. */
+static void
+backoff (tl2_thread_t* self)
+{
+  unsigned long spins;
+
+  if (self->backoff < TL2_BACKOFF_MAX) {
+    self->backoff = self->backoff ? 2 * self->backoff : TL2_BACKOFF_MIN;
+  }
+  self->seed = self->seed * 6364136223846793005UL + 1442695040888963407UL;
+  spins = (self->seed >> 33) % self->backoff;
+  while (spins--) {
+    txlog_relax();
+  }
+}
+
+
+/* Undoes the effects of the current attempt: releases the orecs locked
+   so far and the blocks allocated by it. */
+static void
+rollback (tl2_thread_t* self)
+{
+  long i;
+
+  assert(self->active);
+  for (i = 0; i < self->locks.size; i++) {
+    txlog_entry_t* e = &self->locks.entries[i];
+    *(volatile uintptr_t*)e->addr = (uintptr_t)e->value;
+  }
+  self->active = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  for (i = 0; i < self->allocs.size; i++) {
+    free((void*)self->allocs.entries[i].addr);
+  }
+}
+
+
+void
+tl2_abort (tl2_thread_t* self)
+{
+  rollback(self);
+  self->aborts++;
+  backoff(self);
+  siglongjmp(self->checkpoint, 1);
+}
+
+
+static void
+lock_write_set (tl2_thread_t* self)
+{
+  uintptr_t mine = (uintptr_t)self | 1;
+  long i;
+
+  for (i = 0; i < self->writes.size; i++) {
+    volatile uintptr_t* orec = OREC_OF(self->writes.entries[i].addr);
+    long* idx = txset_lookup(&self->lock_index, (uintptr_t)orec, self->gen, 1);
+    uintptr_t v;
+    txlog_entry_t* e;
+
+    if (*idx >= 0) {
+      continue;
+    }
+    v = *orec;
+    if (OREC_LOCKED(v) || !__sync_bool_compare_and_swap(orec, v, mine)) {
+      tl2_abort(self);
+    }
+    *idx = self->locks.size;
+    e = txlog_append(&self->locks);
+    e->addr = orec;
+    e->value = v;
+  }
+}
+
+
+static void
+validate_read_set (tl2_thread_t* self)
+{
+  uintptr_t mine = (uintptr_t)self | 1;
+  long i;
+
+  for (i = 0; i < self->reads.size; i++) {
+    volatile uintptr_t* orec = (volatile uintptr_t*)self->reads.entries[i].addr;
+    uintptr_t v = *orec;
+
+    if (v == mine) {
+      v = (uintptr_t)self->locks.entries[*txset_lookup(&self->lock_index, (uintptr_t)orec, self->gen, 0)].value;
+    } else if (OREC_LOCKED(v)) {
+      tl2_abort(self);
+    }
+    if (OREC_VERSION(v) > self->rv) {
+      tl2_abort(self);
+    }
+  }
+}
+
+
+void
+tl2_commit (tl2_thread_t* self)
+{
+  uintptr_t wv = self->rv;
+  long i;
+
+  if (self->writes.size != 0) {
+    lock_write_set(self);
+    wv = __sync_add_and_fetch(&tl2_gv.a.clock, 1);
+    if (wv != self->rv + 1) {
+      validate_read_set(self);
+    }
+    for (i = 0; i < self->writes.size; i++) {
+      txlog_entry_t* e = &self->writes.entries[i];
+      txlog_store_word(e->addr, e->value, e->size);
+    }
+    __sync_synchronize();
+    for (i = 0; i < self->locks.size; i++) {
+      *(volatile uintptr_t*)self->locks.entries[i].addr = wv << 1;
+    }
+  }
+
+  self->active = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  self->forceWrite = 0;
+  self->backoff = 0;
+  for (i = 0; i < self->frees.size; i++) {
+    txlog_entry_t* e = txlog_append(&self->limbo);
+    e->addr = self->frees.entries[i].addr;
+    e->value = wv;
+  }
+  if (self->limbo.size >= TL2_LIMBO_BATCH) {
+    txlog_reclaim(&self->limbo, txepoch_oldest(&global_threads));
+  }
+}
+
+
+void
+tl2_load (tl2_thread_t* self, const volatile void* addr, void* buf, size_t size)
+{
+  volatile uintptr_t* orec;
+  uintptr_t pre;
+  uint64_t value;
+  long* idx;
+
+  if (!self->active) {
+    txlog_store_word(buf, txlog_load_word(addr, size), size);
+    return;
+  }
+
+  if (self->writes.size != 0) {
+    idx = txset_lookup(&self->write_index, (uintptr_t)addr, self->gen, 0);
+    if (idx != NULL) {
+      txlog_entry_t* e = &self->writes.entries[*idx];
+      assert(e->size == size);
+      txlog_store_word(buf, e->value, size);
+      return;
+    }
+  }
+
+  orec = OREC_OF(addr);
+  pre = *orec;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  value = txlog_load_word(addr, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (OREC_LOCKED(pre) || *orec != pre || OREC_VERSION(pre) > self->rv) {
+    tl2_abort(self);
+  }
+
+  if (!self->readOnly) {
+    txlog_append(&self->reads)->addr = orec;
+  }
+  txlog_store_word(buf, value, size);
+}
+
+
+void
+tl2_store (tl2_thread_t* self, volatile void* addr, const void* buf, size_t size)
+{
+  txlog_entry_t* e;
+  uint64_t value = txlog_load_word(buf, size);
+  long* idx;
+
+  if (!self->active) {
+    txlog_store_word(addr, value, size);
+    return;
+  }
+
+  if (self->readOnly) {
+    /* Not a conflict: restart right away, with a read log */
+    rollback(self);
+    self->forceWrite = 1;
+    siglongjmp(self->checkpoint, 1);
+  }
+
+  idx = txset_lookup(&self->write_index, (uintptr_t)addr, self->gen, 1);
+  if (*idx < 0) {
+    *idx = self->writes.size;
+    e = txlog_append(&self->writes);
+    e->addr = addr;
+    e->size = size;
+  } else {
+    e = &self->writes.entries[*idx];
+    assert(e->size == size);
+  }
+  e->value = value;
+}
+
+
+void*
+tl2_malloc (tl2_thread_t* self, size_t size)
+{
+  void* ptr = malloc(size);
+
+  if (self->active && ptr != NULL) {
+    txlog_append(&self->allocs)->addr = ptr;
+  }
+  return ptr;
+}
+
+
+void
+tl2_free (tl2_thread_t* self, void* ptr)
+{
+  if (self->active) {
+    txlog_append(&self->frees)->addr = ptr;
+  } else {
+    free(ptr);
+  }
+}
+
+
+/* =============================================================================
+ *
+ * End of tl2.c
+ *
+ * =============================================================================
+ */
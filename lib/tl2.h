@@ -0,0 +1,82 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * tl2.h
+ *
+ * TL2 software transactional memory (Dice, Shalev and Shavit, DISC'06).
+ * A global version clock and a hashed table of versioned write locks
+ * (ownership records); reads are checked against the clock value at
+ * begin, writes are buffered in a redo log and published at commit while
+ * holding the locks of the written stripes.  TM_BEGIN_RO transactions keep
+ * no read log at all.
+ *
+ * Exposes the STM_* interface that lib/tm.h expects from <stm.h>.
+ *
+ * =============================================================================
+ */
+
+#ifndef TL2_H
+#define TL2_H 1
+
+#include <setjmp.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tl2_thread tl2_thread_t;
+
+void tl2_startup (void);
+void tl2_shutdown (void);
+tl2_thread_t* tl2_new_thread (void);
+void tl2_init_thread (tl2_thread_t* self, long id);
+void tl2_free_thread (tl2_thread_t* self);
+sigjmp_buf* tl2_checkpoint (tl2_thread_t* self);
+void tl2_begin (tl2_thread_t* self, int readOnly);
+void tl2_commit (tl2_thread_t* self);
+void tl2_abort (tl2_thread_t* self);
+void tl2_load (tl2_thread_t* self, const volatile void* addr, void* buf, size_t size);
+void tl2_store (tl2_thread_t* self, volatile void* addr, const void* buf, size_t size);
+void* tl2_malloc (tl2_thread_t* self, size_t size);
+void tl2_free (tl2_thread_t* self, void* ptr);
+
+#define STM_THREAD_T                    tl2_thread_t
+#define STM_SELF                        Self
+
+#define STM_STARTUP()                   tl2_startup()
+#define STM_SHUTDOWN()                  tl2_shutdown()
+#define STM_NEW_THREAD()                tl2_new_thread()
+#define STM_INIT_THREAD(t, id)          tl2_init_thread(t, id)
+#define STM_FREE_THREAD(t)              tl2_free_thread(t)
+
+/* The checkpoint must be taken in the frame of the transaction body,
+   so it cannot live inside tl2_begin(). */
+#define STM_BEGIN(isReadOnly)           do { \
+                                            sigsetjmp(*tl2_checkpoint(STM_SELF), 0); \
+                                            tl2_begin(STM_SELF, isReadOnly); \
+                                        } while (0) /* enforce comma */
+#define STM_BEGIN_RD()                  STM_BEGIN(1)
+#define STM_BEGIN_WR()                  STM_BEGIN(0)
+#define STM_END()                       tl2_commit(STM_SELF)
+#define STM_RESTART()                   tl2_abort(STM_SELF)
+
+#define STM_LOAD(addr, buf, size)       tl2_load(STM_SELF, addr, buf, size)
+#define STM_STORE(addr, buf, size)      tl2_store(STM_SELF, addr, buf, size)
+
+#define STM_MALLOC(size)                tl2_malloc(STM_SELF, size)
+#define STM_FREE(ptr)                   tl2_free(STM_SELF, ptr)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TL2_H */
+
+
+/* =============================================================================
+ *
+ * End of tl2.h
+ *
+ * =============================================================================
+ */
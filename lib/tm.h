@@ -230,18 +230,60 @@
  * TM_BEGIN()
  *     Begin atomic block / transaction
  *
+ * TM_BEGIN_ID(id)
+ *     Begin atomic block / transaction number id (per-region statistics)
+ *
  * TM_BEGIN_RO()
  *     Begin atomic block / transaction that only reads shared data
  *
+ * TM_BEGIN_ROT(id)
+ *     Begin atomic block / transaction number id that mostly reads shared
+ *     data; with HTM_ROT, htm_ibm runs it as a rollback-only transaction
+ *     and validates its reads in software (see htm_ibm.c)
+ *
  * TM_END()
  *     End atomic block / transaction
  *
+ * TM_END_ID(id)
+ *     End atomic block / transaction begun with TM_BEGIN_ID(id)
+ *
+ * TM_BEGIN_IRREVOCABLE(id)
+ *     Begin atomic block / transaction number id that must not run more
+ *     than once (I/O, or a footprint no HTM can hold); htm_ibm and
+ *     hle_intel run it under their fallback lock right away.  End it with
+ *     TM_END_ID(id)
+ *
+ * TM_BECOME_IRREVOCABLE()
+ *     Make the rest of the atomic block / transaction run only once;
+ *     htm_ibm and hle_intel rerun the block under their fallback lock.
+ *     STM and OTM builds give no such guarantee
+ *
  * TM_RESTART()
  *     Restart atomic block / transaction
  *
  * TM_EARLY_RELEASE()
  *     Remove speculatively read line from the read set
  *
+ * TM_PREFETCH_THREADS(numMaster)
+ *     Number of threads to start for numMaster worker ("master") threads;
+ *     with PREFETCHING=<n>, htm_ibm gives each master n helper threads
+ *     (call after TM_STARTUP)
+ *
+ * TM_PREFETCH_MASTER()
+ *     Index of the master the calling thread works for
+ *
+ * TM_PREFETCH_HELPER()
+ *     Nonzero on a helper thread
+ *
+ * TM_PREFETCH_REGISTER(next, arg, size)
+ *     Declare the operations of the calling thread: next(arg, op) fills in
+ *     the size-byte operation op and returns 0 after the last one
+ *
+ * TM_PREFETCH_NEXT(op)
+ *     Copy the next operation into op; returns 0 after the last one.  A
+ *     master gets its own operations; a helper gets operations its master
+ *     will run soon, and its atomic blocks only prefetch their data
+ *
  * =============================================================================
  *
  * Example Usage:
@@ -315,7 +357,7 @@
 #  define TM_THREAD_EXIT()              /* nothing */
 
 #  define P_MALLOC(size)                memory_get(thread_getId(), size)
-#  define P_FREE(ptr)                   /* TODO: thread local free is non-trivial */
+#  define P_FREE(ptr)                   memory_free(thread_getId(), ptr)
 #  define TM_MALLOC(size)               memory_get(thread_getId(), size)
 #  define TM_FREE(ptr)                  /* TODO: thread local free is non-trivial */
 
@@ -327,8 +369,13 @@
 #    define thread_shutdown()           /* nothing */
 #    define thread_barrier_wait();      _Pragma ("omp barrier")
 #    define TM_BEGIN()                  _Pragma ("omp transaction") {
+#    define TM_BEGIN_ID(id)             TM_BEGIN()
+#    define TM_BEGIN_ROT(id)            TM_BEGIN()
 #    define TM_BEGIN_RO()               _Pragma ("omp transaction") {
 #    define TM_END()                    }
+#    define TM_END_ID(id)               TM_END()
+#    define TM_BEGIN_IRREVOCABLE(id)    TM_BEGIN()
+#    define TM_BECOME_IRREVOCABLE()     /* nothing */
 #    define TM_RESTART()                _TM_Abort()
 
 #    define TM_EARLY_RELEASE(var)       TM_Release(&(var))
@@ -336,8 +383,12 @@
 #  else /* !OTM */
 
 #    define TM_BEGIN()                    TM_BeginClosed()
+#    define TM_BEGIN_ROT(id)              TM_BeginClosed()
 #    define TM_BEGIN_RO()                 TM_BeginClosed()
 #    define TM_END()                      TM_EndClosed()
+#    define TM_END_ID(id)                 TM_EndClosed()
+#    define TM_BEGIN_IRREVOCABLE(id)      TM_BeginClosed()
+#    define TM_BECOME_IRREVOCABLE()       /* nothing */
 #    define TM_RESTART()                  _TM_Abort()
 #    define TM_EARLY_RELEASE(var)         TM_Release(&(var))
 
@@ -352,83 +403,74 @@
 #  define TM_ARGDECL_ALONE              /* nothing */
 #  define TM_CALLABLE                   /* nothing */
 
-#  define TM_STARTUP(numThread)         tm_startup_ibm()
+#  define TM_STARTUP(numThread)         tm_startup_ibm(numThread)
 #  define TM_SHUTDOWN()                 tm_shutdown_ibm()
 
 #  define TM_THREAD_ENTER()             tm_thread_enter_ibm()
 #  define TM_THREAD_EXIT()              tm_thread_exit_ibm()
 
-#ifdef USE_TLH
-#include "thread.h"
-#include "memory.h"
-#    define P_MALLOC(size)              memory_get(thread_getId(), size)
-#    define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
-#    define TM_MALLOC(size)             memory_get(thread_getId(), size)
-#    define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
-#else /* !USE_TLH */
+#if !defined(HTM_HYBRID) || defined(USE_TLH)
+/* Per-thread caches and epoch-deferred frees, see tmalloc.c; P_ and TM_
+   share it, since blocks move between the two.  Hybrid's software
+   transactions go through it as well with USE_TLH */
+#include "tmalloc.h"
+#    define P_MALLOC(size)              tmalloc_alloc(size)
+#    define P_FREE(ptr)                 tmalloc_free(ptr)
+#    define TM_MALLOC(size)             tmalloc_tx_alloc(size)
+#    define TM_FREE(ptr)                if(!tm_prefetch_helper_ibm) tmalloc_free(ptr)
+#else /* HTM_HYBRID && !USE_TLH */
 #    define P_MALLOC(size)              malloc(size)
 #    define P_FREE(ptr)                 free(ptr)
-#    define TM_MALLOC(size)             malloc(size)
-#    define TM_FREE(ptr)                if(!getenv("PREFETCHING") || thread_getId()%2==0) free(ptr)
-#endif /* !USE_TLH */
+#    define TM_MALLOC(size)             tm_malloc_ibm(size)
+#    define TM_FREE(ptr)                if(!tm_prefetch_helper_ibm) tm_free_ibm(ptr)
+#endif /* HTM_HYBRID && !USE_TLH */
 
 #ifdef __bgq__
 #    define TM_BEGIN()                    _Pragma("tm_atomic")	\
   {
 #    define TM_BEGIN_ID(id)               TM_BEGIN()
+#    define TM_BEGIN_ROT(id)              TM_BEGIN()
 #    define TM_BEGIN_RO()                 TM_BEGIN()
 #    define TM_END()                      }
+#    define TM_END_ID(id)                 TM_END()
+#    define TM_BEGIN_IRREVOCABLE(id)      TM_BEGIN()
+#    define TM_BECOME_IRREVOCABLE()       /* nothing */
 #    define TM_RESTART()                  write(1, "", 0)
 #    define TM_EARLY_RELEASE(var)         /* nothing */
 #else /* ! __bgq__ */
 #define CONTINUE 1
-#    define TM_BEGIN()                    if(tbegin_ibm(0)) goto tm_end0;
-#    define TM_BEGIN_ID(id)               if(tbegin_ibm(id)) goto tm_end ## id;
-#    define TM_BEGIN_RO()                 if(tbegin_ibm()) goto tm_end;
+#if defined(HTM_EMULATED) || defined(HTM_HYBRID)
+/* Software cannot roll back the caller's frame, so the region restarts
+   from a checkpoint taken before tbegin_ibm().  Locals the region changes
+   are indeterminate after the restart: set them inside the region, or
+   make them volatile */
+#    define TM_CHECKPOINT()               sigsetjmp(tm_checkpoint_ibm, 0)
+#else
+#    define TM_CHECKPOINT()               /* rolled back by the hardware */
+#endif
+/* A region skipped by tbegin_ibm() jumps to the label of its TM_END, so
+   TM_BEGIN_ID(n), TM_BEGIN_ROT(n) and TM_BEGIN_IRREVOCABLE(n) must be
+   closed by TM_END_ID(n), and TM_BEGIN() and TM_BEGIN_RO() by TM_END() */
+#    define TM_BEGIN()                    TM_CHECKPOINT(); if(tbegin_ibm(0)) goto tm_end0;
+#    define TM_BEGIN_ID(id)               TM_CHECKPOINT(); if(tbegin_ibm(id)) goto tm_end ## id;
+/* A software-validated region restarts from the checkpoint on any build */
+#    define TM_BEGIN_ROT(id)              sigsetjmp(tm_checkpoint_ibm, 0); if(tbegin_ibm_rot(id)) goto tm_end ## id;
+#    define TM_BEGIN_RO()                 sigsetjmp(tm_checkpoint_ibm, 0); if(tbegin_ibm_ro(0)) goto tm_end0;
 #    define TM_END()                      tend_ibm();  \
 tm_end0:
 #    define TM_END_ID(id)                      tend_ibm();  \
 tm_end ## id:
+#    define TM_BEGIN_IRREVOCABLE(id)      TM_CHECKPOINT(); if(tbegin_ibm_irrevocable(id)) goto tm_end ## id;
+#    define TM_BECOME_IRREVOCABLE()       tm_become_irrevocable_ibm()
 #    define TM_RESTART()                  tabort_ibm()
 #    define TM_EARLY_RELEASE(var)         /* nothing */
 #endif /* ! __bgq__ */
 
-/* Hardware Lock Elision on Haswell */
+/* Intel TSX: common/Makefile.hle_intel builds with HTM_IBM as well, so
+   the regions run on the RTM retry engine of htm_ibm.c, see hle_intel.c,
+   and follow the TM_BEGIN_ID/TM_END_ID pairing above */
 #elif defined(HLE_INTEL)
-#include "hle_intel.h"
-
-#  define TM_ARG                        /* nothing */
-#  define TM_ARG_ALONE                  /* nothing */
-#  define TM_ARGDECL                    /* nothing */
-#  define TM_ARGDECL_ALONE              /* nothing */
-#  define TM_CALLABLE                   /* nothing */
-
-#  define TM_STARTUP(numThread)         tm_startup_hle()
-#  define TM_SHUTDOWN()                 tm_shutdown_hle()
-
-#  define TM_THREAD_ENTER()             tm_thread_enter_hle()
-#  define TM_THREAD_EXIT()              tm_thread_exit_hle()
-
-#ifdef USE_TLH
-#include "thread.h"
-#include "memory.h"
-#    define P_MALLOC(size)              memory_get(thread_getId(), size)
-#    define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
-#    define TM_MALLOC(size)             memory_get(thread_getId(), size)
-#    define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
-#else /* !USE_TLH */
-#    define P_MALLOC(size)              malloc(size)
-#    define P_FREE(ptr)                 free(ptr)
-#    define TM_MALLOC(size)             malloc(size)
-#    define TM_FREE(ptr)                free(ptr)
-#endif /* !USE_TLH */
-
-#    define TM_BEGIN()                    tbegin_hle(0)
-#    define TM_BEGIN_ID(id)               tbegin_hle(id)
-#    define TM_BEGIN_RO()                 tbegin_hle()
-#    define TM_END()                      tend_hle()
-#    define TM_RESTART()                  tabort_hle()
-#    define TM_EARLY_RELEASE(var)         /* nothing */
+#  error HLE_INTEL needs HTM_IBM, see common/Makefile.hle_intel
 
 
 /* =============================================================================
@@ -478,7 +520,7 @@ tm_end ## id:
 #      define thread_barrier_wait();      _Pragma ("omp barrier")
 
 #      define P_MALLOC(size)              memory_get(thread_getId(), size)
-#      define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
+#      define P_FREE(ptr)                 memory_free(thread_getId(), ptr)
 #      define TM_MALLOC(size)             memory_get(thread_getId(), size)
 #      define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
 
@@ -495,7 +537,7 @@ tm_end ## id:
 #      define TM_THREAD_EXIT()            STM_FREE_THREAD(TM_ARG_ALONE)
 
 #      define P_MALLOC(size)              memory_get(thread_getId(), size)
-#      define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
+#      define P_FREE(ptr)                 memory_free(thread_getId(), ptr)
 #      define TM_MALLOC(size)             memory_get(thread_getId(), size)
 #      define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
 
@@ -541,8 +583,13 @@ tm_end ## id:
 #  ifdef OTM
 
 #    define TM_BEGIN()                  _Pragma ("omp transaction") {
+#    define TM_BEGIN_ID(id)             TM_BEGIN()
+#    define TM_BEGIN_ROT(id)            TM_BEGIN()
 #    define TM_BEGIN_RO()               _Pragma ("omp transaction") {
 #    define TM_END()                    }
+#    define TM_END_ID(id)               TM_END()
+#    define TM_BEGIN_IRREVOCABLE(id)    TM_BEGIN()
+#    define TM_BECOME_IRREVOCABLE()     /* nothing */
 #    define TM_RESTART()                omp_abort()
 
 #    define TM_EARLY_RELEASE(var)       /* nothing */
@@ -550,8 +597,13 @@ tm_end ## id:
 #  else /* !OTM */
 
 #    define TM_BEGIN()                  STM_BEGIN_WR()
+#    define TM_BEGIN_ID(id)             TM_BEGIN()
+#    define TM_BEGIN_ROT(id)            TM_BEGIN()
 #    define TM_BEGIN_RO()               STM_BEGIN_RD()
 #    define TM_END()                    STM_END()
+#    define TM_END_ID(id)               TM_END()
+#    define TM_BEGIN_IRREVOCABLE(id)    TM_BEGIN()
+#    define TM_BECOME_IRREVOCABLE()     /* nothing */
 #    define TM_RESTART()                STM_RESTART()
 
 #    define TM_EARLY_RELEASE(var)       /* nothing */
@@ -585,19 +637,20 @@ tm_end ## id:
 #    include "thread.h"
 
 #    define P_MALLOC(size)              memory_get(thread_getId(), size)
-#    define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
+#    define P_FREE(ptr)                 memory_free(thread_getId(), ptr)
 #    define TM_MALLOC(size)             memory_get(thread_getId(), size)
-#    define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
+#    define TM_FREE(ptr)                memory_free(thread_getId(), ptr)
 
 #  else /* !SIMULATOR */
 
 #ifdef USE_TLH
 #include "thread.h"
 #include "memory.h"
+/* Regions never abort here, so TM_FREE may recycle at once */
 #    define P_MALLOC(size)              memory_get(thread_getId(), size)
-#    define P_FREE(ptr)                 /* TODO: thread local free is non-trivial */
+#    define P_FREE(ptr)                 memory_free(thread_getId(), ptr)
 #    define TM_MALLOC(size)             memory_get(thread_getId(), size)
-#    define TM_FREE(ptr)                /* TODO: thread local free is non-trivial */
+#    define TM_FREE(ptr)                memory_free(thread_getId(), ptr)
 #else /* !USE_TLH */
 #    define P_MALLOC(size)              malloc(size)
 #    define P_FREE(ptr)                 free(ptr)
@@ -611,6 +664,12 @@ tm_end ## id:
 #include <stdlib.h>
 #include "thread.h"
 
+#ifdef USE_MUTEX
+extern THREAD_MUTEX_T global_lock;
+#else
+extern volatile int global_lock;
+#endif
+
 #ifdef USE_MUTEX
 #  define TM_BEGIN()			     \
   do {					     \
@@ -649,7 +708,11 @@ tm_end ## id:
   } while (0)
 #endif /* USE_MUTEX */
 #  define TM_BEGIN_ID(id) TM_BEGIN()
+#  define TM_BEGIN_ROT(id) TM_BEGIN()
 #  define TM_BEGIN_RO() TM_BEGIN()
+#  define TM_END_ID(id) TM_END()
+#  define TM_BEGIN_IRREVOCABLE(id) TM_BEGIN()
+#  define TM_BECOME_IRREVOCABLE()       /* nothing */
 #  define TM_RESTART()                  assert(0)
 #  define TM_EARLY_RELEASE(var)         /* nothing */
 
@@ -657,8 +720,12 @@ tm_end ## id:
 
 #  define TM_BEGIN()                    /* nothing */
 #  define TM_BEGIN_ID(id) TM_BEGIN()
+#  define TM_BEGIN_ROT(id) TM_BEGIN()
 #  define TM_BEGIN_RO()                 /* nothing */
 #  define TM_END()                      /* nothing */
+#  define TM_END_ID(id) TM_END()
+#  define TM_BEGIN_IRREVOCABLE(id) TM_BEGIN()
+#  define TM_BECOME_IRREVOCABLE()       /* nothing */
 #  define TM_RESTART()                  assert(0)
 
 #  define TM_EARLY_RELEASE(var)         /* nothing */
@@ -667,6 +734,30 @@ tm_end ## id:
 #endif /* SEQUENTIAL */
 
 
+/* =============================================================================
+ * Helper-thread prefetching: only htm_ibm has helper threads, elsewhere
+ * every thread is a master and runs its own operations
+ * =============================================================================
+ */
+#if defined(HTM_IBM) && !defined(__bgq__)
+#  define TM_PREFETCH_THREADS(n)        tm_prefetch_threads_ibm(n)
+#  define TM_PREFETCH_MASTER()          tm_prefetch_master_ibm()
+#  define TM_PREFETCH_HELPER()          __builtin_expect(tm_prefetch_helper_ibm, 0)
+#  define TM_PREFETCH_REGISTER(next, arg, size) \
+                                        tm_prefetch_register_ibm((next), (arg), (size))
+#  define TM_PREFETCH_NEXT(op)          tm_prefetch_next_ibm(op)
+#else
+typedef int (*tm_prefetch_producer_t)(void *arg, void *op);
+#  define TM_PREFETCH_THREADS(n)        (n)
+#  define TM_PREFETCH_MASTER()          thread_getId()
+#  define TM_PREFETCH_HELPER()          0
+#  define TM_PREFETCH_REGISTER(next, arg, size) \
+                                        tm_prefetch_producer_t __tm_prefetch_next = (next); \
+                                        void* __tm_prefetch_arg = (arg)
+#  define TM_PREFETCH_NEXT(op)          __tm_prefetch_next(__tm_prefetch_arg, (op))
+#endif
+
+
 /* =============================================================================
  * Transactional Memory System interface for shared memory accesses
  *
@@ -711,6 +802,23 @@ tm_end ## id:
 
 #else /* !STM */
 
+/* Rollback-only regions of htm_ibm: their reads are logged (and, without
+   a hardware ROT, validated) in software, and a write made while one runs
+   versions its stripe so that they notice it */
+#if defined(HTM_IBM) && !defined(__bgq__)
+#  define TM_ROT_ACTIVE()               __builtin_expect(tm_rot_ibm, 0)
+#  define TM_ROT_READ(var)              ({ \
+                                            char __rot_buf[sizeof(var)] __attribute__((aligned(8))); \
+                                            tm_rot_load_ibm(&(var), (void*)__rot_buf, sizeof(var)); \
+                                            *(__typeof__(var)*)__rot_buf; \
+                                        })
+#  define TM_ROT_WRITE(var)             do { if (__builtin_expect(tm_rot_enabled_ibm, 0)) tm_rot_store_ibm(&(var)); } while (0)
+#else
+#  define TM_ROT_ACTIVE()               0
+#  define TM_ROT_READ(var)              (var)
+#  define TM_ROT_WRITE(var)             do { } while (0)
+#endif
+
 #ifdef HTM_CONSERVE_RWBUF
 static inline void resume_tx() {
   asm volatile (".long 0x7c2005dd":::"cr0","memory");
@@ -777,15 +885,64 @@ static inline float resume_write_float(volatile float *varp,float val) {
 #  define TM_LOCAL_WRITE_P(var, val)    ({var = val; var;})
 #  define TM_LOCAL_WRITE_F(var, val)    ({var = val; var;})
 
+#elif defined(HTM_HYBRID)
+
+/* Plain (or emulated) accesses inside a hardware transaction, NOrec
+   barriers once the region has fallen back to software */
+#  ifdef HTM_EMULATED
+#    define TM_HW_READ(var)             tload(var)
+#    define TM_HW_WRITE(var, val)       tstore(var, val)
+#  else
+#    define TM_HW_READ(var)             (var)
+#    define TM_HW_WRITE(var, val)       ((var) = (val))
+#  endif
+
+#  define TM_SW_READ(var)               ({ \
+                                            char __sw_buf[sizeof(var)] __attribute__((aligned(8))); \
+                                            tm_sw_load_ibm(&(var), (void*)__sw_buf, sizeof(var)); \
+                                            *(__typeof__(var)*)__sw_buf; \
+                                        })
+#  define TM_SW_WRITE(var, val)         ({ \
+                                            __typeof__(var) __sw_val = (val); \
+                                            tm_sw_store_ibm(&(var), (const void*)&__sw_val, sizeof(var)); \
+                                            __sw_val; \
+                                        })
+
+#  define TM_SHARED_READ(var)           (__builtin_expect(tm_software_ibm, 0) ? TM_SW_READ(var) : TM_ROT_ACTIVE() ? TM_ROT_READ(var) : TM_HW_READ(var))
+#  define TM_SHARED_READ_P(var)         TM_SHARED_READ(var)
+#  define TM_SHARED_READ_F(var)         TM_SHARED_READ(var)
+
+#  define TM_SHARED_WRITE(var, val)     ({ if(!TM_PREFETCH_HELPER()) { if (__builtin_expect(tm_software_ibm, 0)) TM_SW_WRITE(var, val); else { TM_ROT_WRITE(var); TM_HW_WRITE(var, val); } } TM_SHARED_READ(var);})
+#  define TM_SHARED_WRITE_P(var, val)   TM_SHARED_WRITE(var, val)
+#  define TM_SHARED_WRITE_F(var, val)   TM_SHARED_WRITE(var, val)
+
+#  define TM_LOCAL_WRITE(var, val)      ({var = val; var;})
+#  define TM_LOCAL_WRITE_P(var, val)    ({var = val; var;})
+#  define TM_LOCAL_WRITE_F(var, val)    ({var = val; var;})
+
+#elif defined(HTM_EMULATED)
+
+#  define TM_SHARED_READ(var)           (TM_ROT_ACTIVE() ? TM_ROT_READ(var) : tload(var))
+#  define TM_SHARED_READ_P(var)         TM_SHARED_READ(var)
+#  define TM_SHARED_READ_F(var)         TM_SHARED_READ(var)
+
+#  define TM_SHARED_WRITE(var, val)     ({ if(!TM_PREFETCH_HELPER()) { TM_ROT_WRITE(var); tstore(var, val); } TM_SHARED_READ(var);})
+#  define TM_SHARED_WRITE_P(var, val)   TM_SHARED_WRITE(var, val)
+#  define TM_SHARED_WRITE_F(var, val)   TM_SHARED_WRITE(var, val)
+
+#  define TM_LOCAL_WRITE(var, val)      ({var = val; var;})
+#  define TM_LOCAL_WRITE_P(var, val)    ({var = val; var;})
+#  define TM_LOCAL_WRITE_F(var, val)    ({var = val; var;})
+
 #else /* HTM_CONSERVE_RWBUF */
 
-#  define TM_SHARED_READ(var)           (var)
-#  define TM_SHARED_READ_P(var)         (var)
-#  define TM_SHARED_READ_F(var)         (var)
+#  define TM_SHARED_READ(var)           (TM_ROT_ACTIVE() ? TM_ROT_READ(var) : (var))
+#  define TM_SHARED_READ_P(var)         TM_SHARED_READ(var)
+#  define TM_SHARED_READ_F(var)         TM_SHARED_READ(var)
 
-#  define TM_SHARED_WRITE(var, val)     ({ if(!getenv("PREFETCHING") || thread_getId()%2==0) var = val; var;})
-#  define TM_SHARED_WRITE_P(var, val)   ({ if(!getenv("PREFETCHING") || thread_getId()%2==0) var = val; var;})
-#  define TM_SHARED_WRITE_F(var, val)   ({ if(!getenv("PREFETCHING") || thread_getId()%2==0) var = val; var;})
+#  define TM_SHARED_WRITE(var, val)     ({ if(!TM_PREFETCH_HELPER()) { TM_ROT_WRITE(var); var = val; } var;})
+#  define TM_SHARED_WRITE_P(var, val)   ({ if(!TM_PREFETCH_HELPER()) { TM_ROT_WRITE(var); var = val; } var;})
+#  define TM_SHARED_WRITE_F(var, val)   ({ if(!TM_PREFETCH_HELPER()) { TM_ROT_WRITE(var); var = val; } var;})
 
 #  define TM_LOCAL_WRITE(var, val)      ({var = val; var;})
 #  define TM_LOCAL_WRITE_P(var, val)    ({var = val; var;})
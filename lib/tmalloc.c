@@ -0,0 +1,574 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * tmalloc.c
+ *
+ * Allocator for the hardware TM runtimes (htm_ibm.c, hle_intel.c).  Calling
+ * malloc() and free() inside a hardware transaction touches the allocator's
+ * shared metadata, which shows up as conflict and capacity aborts.
+ *
+ * Blocks of up to TMALLOC_MAX_SIZE bytes come from per-thread caches, one
+ * per size class.  tmalloc_attempt() tops up the caches of the classes a
+ * thread uses before each attempt, from a shared depot or from a fresh
+ * chunk of the arena that is touched while it is split, so an allocation
+ * inside a transaction only touches the thread's own lines.  A chunk holds
+ * blocks of a single class, so the class of a block follows from its
+ * address.  Blocks outside the arena (larger ones, or once the arena is
+ * used up) come from malloc().
+ *
+ * Frees are epoch-based.  A block freed inside a region is only logged;
+ * tmalloc_commit() moves it to the thread's limbo list tagged with one past
+ * the current epoch, and it is reused once every thread that is inside a
+ * region entered it at that epoch or later.  Threads bump the epoch each
+ * time their limbo list fills up.
+ *
+ * The hardware rolls back the cache and the logs of an aborted attempt by
+ * itself.  After an emulated abort or a software restart they are not, so
+ * the next tmalloc_attempt() forgets the frees of the attempt and retires
+ * the blocks it allocated with tmalloc_tx_alloc() (TM_MALLOC), as an STM
+ * does; a doomed reader may still hold one, so they go through the epoch
+ * too.  Blocks from tmalloc_alloc() (P_MALLOC) stay allocated: the
+ * region's private, uninstrumented writes are not rolled back either and
+ * may still point at them, and free them later.
+ *
+ * =============================================================================
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "tmalloc.h"
+#include "txlog.h"
+
+#define TMALLOC_CHUNK_SHIFT 16          /* 64KB chunks */
+#define TMALLOC_CHUNK       (1UL << TMALLOC_CHUNK_SHIFT)
+#define TMALLOC_ARENA_MAX   (1UL << 36) /* reserved, not committed */
+#define TMALLOC_ARENA_MIN   (1UL << 26)
+#define TMALLOC_MAX_SIZE    2048
+#define TMALLOC_CLASSES     24
+#define TMALLOC_RESERVE     16          /* blocks kept ahead per class */
+#define TMALLOC_BATCH       128         /* blocks moved to the depot at once */
+#define TMALLOC_LIMBO_BATCH 64
+
+static const size_t class_sizes[TMALLOC_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* A free block holds the next block of its list in its first word; the
+   first block of a depot batch holds the next batch in its second */
+typedef struct cache {
+  void *head;
+  long count;
+} cache_t;
+
+typedef struct depot {
+  void *batches;
+  volatile int lock;
+  char pad[256 - sizeof(void *) - sizeof(int)];
+} depot_t;
+
+typedef struct tmalloc_thread {
+  cache_t cache[TMALLOC_CLASSES];
+  unsigned long used;           /* classes refilled ahead */
+  int in_region;
+  txlog_t allocs;               /* of the current attempt */
+  txlog_t frees;                /* of the current attempt */
+  txlog_t limbo;                /* addr = block, value = epoch it is safe at */
+  txepoch_t epoch;              /* start = epoch the region entered at */
+} tmalloc_thread_t;
+
+static volatile int initialized = 0;
+static uintptr_t arena_base;
+static uintptr_t arena_size;
+static volatile uintptr_t arena_next;
+static unsigned char *chunk_class;
+static unsigned char size_class[TMALLOC_MAX_SIZE / 16 + 1];
+static depot_t depots[TMALLOC_CLASSES];
+static txepoch_registry_t tmalloc_threads;
+
+static union {
+  char two_cache_lines[512];
+  struct {
+    char one_cache_line[256];
+    volatile uintptr_t value;
+  } a;
+} global_epoch;
+
+static __thread tmalloc_thread_t *tmalloc_self;
+
+
+static void
+tmalloc_init (void)
+{
+  uintptr_t size;
+  void *base = MAP_FAILED;
+  int k;
+  size_t s;
+
+  if (initialized == 2) {
+    return;
+  }
+  if (!__sync_bool_compare_and_swap(&initialized, 0, 1)) {
+    while (initialized != 2) {
+      txlog_relax();
+    }
+    return;
+  }
+
+  for (k = 0, s = 0; s <= TMALLOC_MAX_SIZE; s += 16) {
+    while (class_sizes[k] < s) {
+      k++;
+    }
+    size_class[s / 16] = (unsigned char)k;
+  }
+
+  /* Reserve what the system lets us, aligned to a chunk */
+  for (size = TMALLOC_ARENA_MAX; size >= TMALLOC_ARENA_MIN; size >>= 1) {
+    base = mmap(NULL, size + TMALLOC_CHUNK, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base != MAP_FAILED) {
+      break;
+    }
+  }
+  if (base == MAP_FAILED) {
+    arena_size = 0;             /* everything from malloc() */
+  } else {
+    arena_base = ((uintptr_t)base + TMALLOC_CHUNK - 1) & ~(TMALLOC_CHUNK - 1);
+    arena_size = size;
+    chunk_class = (unsigned char *)calloc(size >> TMALLOC_CHUNK_SHIFT, 1);
+    if (chunk_class == NULL) {
+      printf("malloc error\n");
+      exit(1);
+    }
+  }
+  arena_next = arena_base;
+  global_epoch.a.value = 0;
+
+  __sync_synchronize();
+  initialized = 2;
+}
+
+static inline int
+owned (const void *ptr)
+{
+  return (uintptr_t)ptr - arena_base < arena_size;
+}
+
+static inline int
+class_of (const void *ptr)
+{
+  return chunk_class[((uintptr_t)ptr - arena_base) >> TMALLOC_CHUNK_SHIFT];
+}
+
+static void
+depot_lock (depot_t *d)
+{
+  while (__sync_lock_test_and_set(&d->lock, 1)) {
+    while (d->lock) {
+      txlog_relax();
+    }
+  }
+}
+
+static void
+depot_unlock (depot_t *d)
+{
+  __sync_lock_release(&d->lock);
+}
+
+/* Hands up to n blocks of the cache to the depot, after the first keep
+   (the most recently freed, likely still in cache) */
+static void
+depot_put (tmalloc_thread_t *self, int k, long keep, long n)
+{
+  cache_t *c = &self->cache[k];
+  depot_t *d = &depots[k];
+  void **link = &c->head;
+  void *batch;
+  void *tail;
+  long i;
+
+  for (i = 0; i < keep && *link != NULL; i++) {
+    link = (void **)*link;
+  }
+  batch = *link;
+  if (batch == NULL) {
+    return;
+  }
+  for (i = 1, tail = batch; i < n && *(void **)tail != NULL; i++) {
+    tail = *(void **)tail;
+  }
+  *link = *(void **)tail;
+  c->count -= i;
+  *(void **)tail = NULL;
+
+  depot_lock(d);
+  ((void **)batch)[1] = d->batches;
+  d->batches = batch;
+  depot_unlock(d);
+}
+
+/* Fills an empty or low cache from the depot, or carves a chunk.  Runs
+   inside a transaction only when a thread empties a class it has not used
+   yet; that transaction may abort, but once an attempt got through,
+   tmalloc_attempt() keeps the class topped up. */
+static void
+refill (tmalloc_thread_t *self, int k)
+{
+  cache_t *c = &self->cache[k];
+  depot_t *d = &depots[k];
+  void *batch = NULL;
+  void *tail;
+  long n;
+  uintptr_t chunk;
+  size_t size;
+
+  if (d->batches != NULL) {
+    depot_lock(d);
+    batch = d->batches;
+    if (batch != NULL) {
+      d->batches = ((void **)batch)[1];
+    }
+    depot_unlock(d);
+  }
+  if (batch != NULL) {
+    for (n = 1, tail = batch; *(void **)tail != NULL; n++) {
+      tail = *(void **)tail;
+    }
+    *(void **)tail = c->head;
+    c->head = batch;
+    c->count += n;
+    return;
+  }
+
+  chunk = __sync_fetch_and_add(&arena_next, TMALLOC_CHUNK);
+  if (chunk - arena_base >= arena_size) {
+    return;
+  }
+  chunk_class[(chunk - arena_base) >> TMALLOC_CHUNK_SHIFT] = (unsigned char)k;
+  size = class_sizes[k];
+  n = TMALLOC_CHUNK / size;
+  /* Linking the blocks touches every page of the chunk */
+  for (tail = (void *)chunk; --n > 0; tail = (char *)tail + size) {
+    *(void **)tail = (char *)tail + size;
+  }
+  *(void **)tail = c->head;
+  c->head = (void *)chunk;
+  c->count += TMALLOC_CHUNK / size;
+}
+
+static void
+release (tmalloc_thread_t *self, void *ptr)
+{
+  cache_t *c;
+  int k;
+
+  if (!owned(ptr)) {
+    free(ptr);
+    return;
+  }
+  k = class_of(ptr);
+  c = &self->cache[k];
+  *(void **)ptr = c->head;
+  c->head = ptr;
+  if (++c->count > 2 * TMALLOC_BATCH + TMALLOC_RESERVE) {
+    depot_put(self, k, TMALLOC_RESERVE, TMALLOC_BATCH);
+  }
+}
+
+/* Reuses the blocks that no thread inside a region can still see */
+static void
+reclaim (tmalloc_thread_t *self)
+{
+  uintptr_t oldest;
+  long i;
+  long n = 0;
+
+  __sync_fetch_and_add(&global_epoch.a.value, 1);
+  oldest = txepoch_oldest(&tmalloc_threads);
+  for (i = 0; i < self->limbo.size; i++) {
+    txlog_entry_t *e = &self->limbo.entries[i];
+    if (e->value <= oldest) {
+      release(self, (void *)e->addr);
+    } else {
+      self->limbo.entries[n++] = *e;
+    }
+  }
+  self->limbo.size = n;
+}
+
+static void
+retire (tmalloc_thread_t *self, void *ptr)
+{
+  txlog_entry_t *e = txlog_append(&self->limbo);
+
+  e->addr = ptr;
+  e->value = global_epoch.a.value + 1;
+  if (self->limbo.size >= TMALLOC_LIMBO_BATCH) {
+    reclaim(self);
+  }
+}
+
+static tmalloc_thread_t *
+thread_state (void)
+{
+  tmalloc_thread_t *self = tmalloc_self;
+
+  if (self != NULL) {
+    return self;
+  }
+  tmalloc_init();
+  self = (tmalloc_thread_t *)calloc(1, sizeof(tmalloc_thread_t));
+  if (self == NULL) {
+    printf("malloc error\n");
+    exit(1);
+  }
+  txlog_alloc(&self->allocs);
+  txlog_alloc(&self->frees);
+  txlog_alloc(&self->limbo);
+  txepoch_register(&tmalloc_threads, &self->epoch);
+  tmalloc_self = self;
+  return self;
+}
+
+
+void *
+tmalloc_alloc (size_t size)
+{
+  tmalloc_thread_t *self = thread_state();
+  cache_t *c;
+  void *ptr;
+  int k;
+
+  if (size <= TMALLOC_MAX_SIZE) {
+    k = size_class[(size + 15) / 16];
+    c = &self->cache[k];
+    if (c->head == NULL) {
+      refill(self, k);
+    }
+    ptr = c->head;
+    if (ptr != NULL) {
+      c->head = *(void **)ptr;
+      c->count--;
+      self->used |= 1UL << k;
+    } else {
+      ptr = malloc(size);
+    }
+  } else {
+    ptr = malloc(size);
+  }
+  return ptr;
+}
+
+void *
+tmalloc_tx_alloc (size_t size)
+{
+  void *ptr = tmalloc_alloc(size);
+  tmalloc_thread_t *self = tmalloc_self;
+
+  if (self->in_region && ptr != NULL) {
+    txlog_append(&self->allocs)->addr = ptr;
+  }
+  return ptr;
+}
+
+void
+tmalloc_free (void *ptr)
+{
+  tmalloc_thread_t *self = thread_state();
+
+  if (ptr == NULL) {
+    return;
+  }
+  if (self->in_region) {
+    txlog_append(&self->frees)->addr = ptr;
+  } else {
+    retire(self, ptr);
+  }
+}
+
+/* The blocks of an attempt that will not commit */
+static void
+retire_allocs (tmalloc_thread_t *self)
+{
+  long i;
+
+  for (i = 0; i < self->allocs.size; i++) {
+    retire(self, (void *)self->allocs.entries[i].addr);
+  }
+  self->allocs.size = 0;
+}
+
+void
+tmalloc_attempt (void)
+{
+  tmalloc_thread_t *self = thread_state();
+  unsigned long used;
+  int k;
+
+  self->frees.size = 0;
+
+  if (!self->in_region) {
+    self->in_region = 1;
+    self->epoch.start = global_epoch.a.value;
+    __sync_synchronize();
+  } else {
+    retire_allocs(self);
+  }
+
+  for (used = self->used, k = 0; used != 0; used >>= 1, k++) {
+    if ((used & 1) && self->cache[k].count < TMALLOC_RESERVE) {
+      refill(self, k);
+    }
+  }
+}
+
+void
+tmalloc_commit (void)
+{
+  tmalloc_thread_t *self = tmalloc_self;
+  long i;
+
+  self->in_region = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  self->allocs.size = 0;
+  for (i = 0; i < self->frees.size; i++) {
+    retire(self, (void *)self->frees.entries[i].addr);
+  }
+  self->frees.size = 0;
+}
+
+void
+tmalloc_abort (void)
+{
+  tmalloc_thread_t *self = tmalloc_self;
+
+  self->frees.size = 0;
+  retire_allocs(self);
+  self->in_region = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+}
+
+void
+tmalloc_thread_enter (void)
+{
+  thread_state();
+}
+
+/* Waits until the thread's limbo list is reused, and leaves its caches in
+   the depot for the threads of the next parallel phase */
+void
+tmalloc_thread_exit (void)
+{
+  tmalloc_thread_t *self = tmalloc_self;
+  int k;
+
+  if (self == NULL) {
+    return;
+  }
+  self->in_region = 0;
+  self->epoch.start = TXEPOCH_INACTIVE;
+  while (self->limbo.size != 0) {
+    reclaim(self);
+    if (self->limbo.size != 0) {
+      txlog_relax();
+    }
+  }
+  for (k = 0; k < TMALLOC_CLASSES; k++) {
+    while (self->cache[k].head != NULL) {
+      depot_put(self, k, 0, TMALLOC_BATCH);
+    }
+  }
+  txepoch_unregister(&tmalloc_threads, &self->epoch);
+  txlog_free(&self->allocs);
+  txlog_free(&self->frees);
+  txlog_free(&self->limbo);
+  free(self);
+  tmalloc_self = NULL;
+}
+
+
+/* =============================================================================
+ * TEST_TMALLOC
+ * =============================================================================
+ */
+#ifdef TEST_TMALLOC
+
+
+#define NUM_BLOCK 1000
+
+
+int
+main ()
+{
+    char* blocks[NUM_BLOCK];
+    char* ptr;
+    long i;
+
+    puts("Starting tests...");
+
+    tmalloc_thread_enter();
+
+    /* Blocks of every class and a few large ones, none overlapping */
+    for (i = 0; i < NUM_BLOCK; i++) {
+        size_t size = (i * 7) % (TMALLOC_MAX_SIZE + 512) + 1;
+        blocks[i] = (char*)tmalloc_alloc(size);
+        assert(blocks[i] != NULL);
+        assert(((uintptr_t)blocks[i] & 15) == 0);
+        memset(blocks[i], (int)(i & 0xff), size);
+    }
+    for (i = 0; i < NUM_BLOCK; i++) {
+        size_t size = (i * 7) % (TMALLOC_MAX_SIZE + 512) + 1;
+        assert(blocks[i][0] == (char)(i & 0xff));
+        assert(blocks[i][size - 1] == (char)(i & 0xff));
+    }
+
+    /* An aborted attempt forgets what it freed, and retires what it
+       allocated */
+    ptr = (char*)tmalloc_alloc(40);
+    tmalloc_attempt();
+    tmalloc_free(ptr);
+    assert(tmalloc_tx_alloc(40) != NULL);
+    assert(tmalloc_alloc(40) != NULL);
+    tmalloc_attempt();
+    assert(tmalloc_self->frees.size == 0);
+    assert(tmalloc_self->allocs.size == 0);
+    assert(tmalloc_self->limbo.size == 1);
+    tmalloc_free(ptr);
+    assert(tmalloc_tx_alloc(40) != NULL);
+    tmalloc_commit();
+    assert(tmalloc_self->allocs.size == 0);
+    assert(tmalloc_self->limbo.size == 2);
+
+    /* Frees in a region wait for the commit, then for the epoch */
+    tmalloc_attempt();
+    for (i = 0; i < NUM_BLOCK; i++) {
+        tmalloc_free(blocks[i]);
+    }
+    assert(tmalloc_self->limbo.size == 2);
+    tmalloc_commit();
+    assert(tmalloc_self->limbo.size < TMALLOC_LIMBO_BATCH);
+
+    tmalloc_thread_exit();
+    assert(tmalloc_self == NULL);
+
+    puts("All tests passed.");
+
+    return 0;
+}
+
+
+#endif /* TEST_TMALLOC */
+
+
+/* =============================================================================
+ *
+ * End of tmalloc.c
+ *
+ * =============================================================================
+ */
@@ -0,0 +1,60 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * tmalloc.h
+ *
+ * Allocator for TM_MALLOC/TM_FREE (and P_MALLOC/P_FREE) of the hardware TM
+ * runtimes, see tmalloc.c.
+ *
+ * =============================================================================
+ */
+
+#ifndef TMALLOC_H
+#define TMALLOC_H 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Inside or outside a region; never calls malloc() inside a transaction
+   unless the block is larger than any size class */
+void *tmalloc_alloc(size_t size);
+
+/* For TM_MALLOC: an attempt that aborts without the hardware rolling it
+   back gives the block back at its next tmalloc_attempt() */
+void *tmalloc_tx_alloc(size_t size);
+
+/* Inside a region the block is only released once the region commits
+   and no thread can still be reading it */
+void tmalloc_free(void *ptr);
+
+/* Before every attempt of a region, outside the transaction: forgets the
+   frees of an aborted attempt and retires its blocks, enters the epoch and
+   refills caches */
+void tmalloc_attempt(void);
+
+/* After the region committed, outside the transaction */
+void tmalloc_commit(void);
+
+/* After the last attempt of a region that gives up instead of committing
+   (a prefetch helper's) */
+void tmalloc_abort(void);
+
+void tmalloc_thread_enter(void);
+void tmalloc_thread_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TMALLOC_H */
+
+
+/* =============================================================================
+ *
+ * End of tmalloc.h
+ *
+ * =============================================================================
+ */
@@ -0,0 +1,304 @@
+/* Copyright (c) IBM Corp. 2014, and others. */
+/* =============================================================================
+ *
+ * txlog.h
+ *
+ * Read/write logs shared by the software TM runtimes (htm_emu.c, norec.c,
+ * tl2.c).  A log is a growable array of (address, value, size) entries; a
+ * set is an open-addressing map from a word (an address, a cache line or an
+ * ownership record) to a long, cleared in O(1) by bumping a generation
+ * number at transaction start.  A limbo log and an epoch registry let
+ * the STMs defer TM_FREE until no running transaction can still read
+ * the block.
+ *
+ * =============================================================================
+ */
+
+#ifndef TXLOG_H
+#define TXLOG_H 1
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TXLOG_INIT_SIZE 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define txlog_relax() _mm_pause()
+#elif defined(__PPC__) || defined(_ARCH_PPC)
+#define txlog_relax() __asm__ __volatile__("or 27,27,27" ::: "memory")
+#else
+#define txlog_relax() do { } while (0)
+#endif
+
+typedef struct txlog_entry {
+  volatile void *addr;
+  uint64_t value;
+  size_t size;
+} txlog_entry_t;
+
+typedef struct txlog {
+  txlog_entry_t *entries;
+  long size;
+  long capacity;
+} txlog_t;
+
+typedef struct txset {
+  uintptr_t *keys;
+  long *values;
+  unsigned long *gens;
+  long mask;
+  long count;
+} txset_t;
+
+
+static inline uint64_t
+txlog_load_word (const volatile void *addr, size_t size)
+{
+  switch (size) {
+  case 1: return *(const volatile uint8_t *)addr;
+  case 2: return *(const volatile uint16_t *)addr;
+  case 4: return *(const volatile uint32_t *)addr;
+  case 8: return *(const volatile uint64_t *)addr;
+  }
+  assert(0);
+  return 0;
+}
+
+static inline void
+txlog_store_word (volatile void *addr, uint64_t value, size_t size)
+{
+  switch (size) {
+  case 1: *(volatile uint8_t *)addr = (uint8_t)value; return;
+  case 2: *(volatile uint16_t *)addr = (uint16_t)value; return;
+  case 4: *(volatile uint32_t *)addr = (uint32_t)value; return;
+  case 8: *(volatile uint64_t *)addr = value; return;
+  }
+  assert(0);
+}
+
+
+static inline void
+txlog_alloc (txlog_t *log)
+{
+  log->capacity = TXLOG_INIT_SIZE;
+  log->size = 0;
+  log->entries = (txlog_entry_t *)malloc(log->capacity * sizeof(txlog_entry_t));
+  if (log->entries == NULL) {
+    printf("malloc error\n");
+    exit(1);
+  }
+}
+
+static inline void
+txlog_free (txlog_t *log)
+{
+  free(log->entries);
+}
+
+static inline txlog_entry_t *
+txlog_append (txlog_t *log)
+{
+  if (log->size == log->capacity) {
+    log->capacity *= 2;
+    log->entries = (txlog_entry_t *)realloc(log->entries, log->capacity * sizeof(txlog_entry_t));
+    if (log->entries == NULL) {
+      printf("malloc error\n");
+      exit(1);
+    }
+  }
+  return &log->entries[log->size++];
+}
+
+
+static inline void
+txset_alloc (txset_t *set, long min_size)
+{
+  long size = 16;
+
+  while (size < 2 * min_size) {
+    size <<= 1;
+  }
+  set->keys = (uintptr_t *)calloc(size, sizeof(uintptr_t));
+  set->values = (long *)calloc(size, sizeof(long));
+  set->gens = (unsigned long *)calloc(size, sizeof(unsigned long));
+  if (set->keys == NULL || set->values == NULL || set->gens == NULL) {
+    printf("malloc error\n");
+    exit(1);
+  }
+  set->mask = size - 1;
+  set->count = 0;
+}
+
+static inline void
+txset_free (txset_t *set)
+{
+  free(set->keys);
+  free(set->values);
+  free(set->gens);
+}
+
+static inline long
+txset_slot (txset_t *set, uintptr_t key, unsigned long gen)
+{
+  long i = (long)((key * 0x9e3779b97f4a7c15ULL) >> 20) & set->mask;
+
+  while (set->gens[i] == gen && set->keys[i] != key) {
+    i = (i + 1) & set->mask;
+  }
+  return i;
+}
+
+static inline void
+txset_grow (txset_t *set, unsigned long gen)
+{
+  txset_t old = *set;
+  long i;
+
+  txset_alloc(set, old.mask + 1);
+  for (i = 0; i <= old.mask; i++) {
+    if (old.gens[i] == gen) {
+      long j = txset_slot(set, old.keys[i], gen);
+      set->keys[j] = old.keys[i];
+      set->values[j] = old.values[i];
+      set->gens[j] = gen;
+    }
+  }
+  set->count = old.count;
+  txset_free(&old);
+}
+
+/* Returns the value slot of key, or NULL if key is absent and not added.
+   A freshly added slot holds -1. */
+static inline long *
+txset_lookup (txset_t *set, uintptr_t key, unsigned long gen, int add)
+{
+  long i = txset_slot(set, key, gen);
+
+  if (set->gens[i] != gen) {
+    if (!add) {
+      return NULL;
+    }
+    if (2 * (set->count + 1) > set->mask + 1) {
+      txset_grow(set, gen);
+      i = txset_slot(set, key, gen);
+    }
+    set->keys[i] = key;
+    set->values[i] = -1;
+    set->gens[i] = gen;
+    set->count++;
+  }
+  return &set->values[i];
+}
+
+
+/* Each thread publishes the clock value its current transaction started
+   from (TXEPOCH_INACTIVE outside transactions).  A block freed by a commit
+   at time t is safe to release once every published start is >= t. */
+#define TXEPOCH_INACTIVE (~(uintptr_t)0)
+
+typedef struct txepoch {
+  volatile uintptr_t start;
+  struct txepoch* next;
+} txepoch_t;
+
+typedef struct txepoch_registry {
+  txepoch_t* volatile head;
+  volatile int lock;
+} txepoch_registry_t;
+
+static inline void
+txepoch_lock (txepoch_registry_t *reg)
+{
+  while (__sync_lock_test_and_set(&reg->lock, 1)) {
+    while (reg->lock) {
+      txlog_relax();
+    }
+  }
+}
+
+static inline void
+txepoch_unlock (txepoch_registry_t *reg)
+{
+  __sync_lock_release(&reg->lock);
+}
+
+static inline void
+txepoch_register (txepoch_registry_t *reg, txepoch_t *e)
+{
+  e->start = TXEPOCH_INACTIVE;
+  txepoch_lock(reg);
+  e->next = reg->head;
+  reg->head = e;
+  txepoch_unlock(reg);
+}
+
+static inline void
+txepoch_unregister (txepoch_registry_t *reg, txepoch_t *e)
+{
+  txepoch_t* volatile* pp;
+
+  txepoch_lock(reg);
+  for (pp = &reg->head; *pp != e; pp = &(*pp)->next) {
+    /* nothing */
+  }
+  *pp = e->next;
+  txepoch_unlock(reg);
+}
+
+static inline uintptr_t
+txepoch_oldest (txepoch_registry_t *reg)
+{
+  uintptr_t oldest = TXEPOCH_INACTIVE;
+  txepoch_t *e;
+
+  __sync_synchronize();
+  txepoch_lock(reg);
+  for (e = reg->head; e != NULL; e = e->next) {
+    uintptr_t start = e->start;
+    if (start < oldest) {
+      oldest = start;
+    }
+  }
+  txepoch_unlock(reg);
+  return oldest;
+}
+
+/* Limbo entries hold the block in addr and the freeing commit time in
+   value.  Frees those that no transaction started before. */
+static inline void
+txlog_reclaim (txlog_t *limbo, uintptr_t oldest)
+{
+  long i;
+  long n = 0;
+
+  for (i = 0; i < limbo->size; i++) {
+    txlog_entry_t *e = &limbo->entries[i];
+    if (e->value <= oldest) {
+      free((void *)e->addr);
+    } else {
+      limbo->entries[n++] = *e;
+    }
+  }
+  limbo->size = n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TXLOG_H */
+
+
+/* =============================================================================
+ *
+ * End of txlog.h
+ *
+ * =============================================================================
+ */
@@ -11,12 +11,23 @@ hostname := $(shell hostname)
 CFLAGS += -DUSE_TLH
 CFLAGS += -DLIST_NO_DUPLICATES
 
-ifeq ($(enable_IBM_optimizations),yes)
+# MAP=open_hashtable keeps the tables in lib/open_hashtable.c, MAP=btree in
+# the B+-tree of lib/btree.c
+ifeq ($(MAP),open_hashtable)
+CFLAGS += -DMAP_USE_OPEN_HASHTABLE
+else ifeq ($(MAP),btree)
+CFLAGS += -DMAP_USE_BTREE
+else ifeq ($(enable_IBM_optimizations),yes)
 CFLAGS += -DMAP_USE_CONCUREENT_HASHTABLE -DHASHTABLE_SIZE_FIELD -DHASHTABLE_RESIZABLE
 else
 CFLAGS += -DMAP_USE_RBTREE
 endif
 
+# HASHTABLE_STATS=yes reports the resize work of the hash table maps
+ifeq ($(HASHTABLE_STATS),yes)
+CFLAGS += -DHASHTABLE_STATS
+endif
+
 PROG := vacation
 
 SRCS += \
@@ -30,8 +41,10 @@ SRCS += \
 	$(LIB)/mt19937ar.c \
 	$(LIB)/random.c \
 	$(LIB)/rbtree.c \
+	$(LIB)/btree.c \
 	$(LIB)/hashtable.c \
 	$(LIB)/conc_hashtable.c \
+	$(LIB)/open_hashtable.c \
 	$(LIB)/thread.c \
 	$(LIB)/memory.c
 #
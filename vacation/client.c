@@ -105,17 +105,10 @@ client_alloc (long id,
     }
     random_seed(clientPtr->randomPtr, id);
 
-    if(getenv("PREFETCHING")){
-        clientPtr->randomPtrH = random_alloc();
-        if (clientPtr->randomPtrH == NULL) {
-            return NULL;
-        }
-        random_seed(clientPtr->randomPtrH, id);
-    }
-
     clientPtr->id = id;
     clientPtr->managerPtr = managerPtr;
     clientPtr->numOperation = numOperation;
+    clientPtr->numOperationLeft = numOperation;
     clientPtr->numQueryPerTransaction = numQueryPerTransaction;
     clientPtr->queryRange = queryRange;
     clientPtr->percentUser = percentUser;
@@ -156,6 +149,81 @@ selectAction (long r, long percentUser)
 }
 
 
+/* =============================================================================
+ * operation_t
+ * -- One client operation; query holds the types, ids, ops and prices
+ *    arrays of numQueryPerTransaction entries each
+ * =============================================================================
+ */
+typedef struct operation {
+    action_t action;
+    long customerId;
+    long numQuery;
+    long query[1];
+} operation_t;
+
+#define OPERATION_SIZE(numQueryPerTransaction) \
+    (sizeof(operation_t) + (4 * (numQueryPerTransaction) - 1) * sizeof(long))
+
+
+/* =============================================================================
+ * client_nextOperation
+ * -- Draws the next operation of the client; returns 0 after the last one
+ * =============================================================================
+ */
+static int
+client_nextOperation (void* argPtr, void* opPtr)
+{
+    client_t* clientPtr = (client_t*)argPtr;
+    operation_t* operationPtr = (operation_t*)opPtr;
+    random_t* randomPtr = clientPtr->randomPtr;
+    long numQueryPerTransaction = clientPtr->numQueryPerTransaction;
+    long queryRange = clientPtr->queryRange;
+    long* types  = operationPtr->query;
+    long* ids    = types + numQueryPerTransaction;
+    long* ops    = ids + numQueryPerTransaction;
+    long* prices = ops + numQueryPerTransaction;
+    long n;
+
+    if (clientPtr->numOperationLeft == 0) {
+        return 0;
+    }
+    clientPtr->numOperationLeft--;
+
+    long r = random_generate(randomPtr) % 100;
+    operationPtr->action = selectAction(r, clientPtr->percentUser);
+
+    switch (operationPtr->action) {
+        case ACTION_MAKE_RESERVATION:
+            operationPtr->numQuery = random_generate(randomPtr) % numQueryPerTransaction + 1;
+            operationPtr->customerId = random_generate(randomPtr) % queryRange + 1;
+            for (n = 0; n < operationPtr->numQuery; n++) {
+                types[n] = random_generate(randomPtr) % NUM_RESERVATION_TYPE;
+                ids[n] = (random_generate(randomPtr) % queryRange) + 1;
+            }
+            break;
+        case ACTION_DELETE_CUSTOMER:
+            operationPtr->customerId = random_generate(randomPtr) % queryRange + 1;
+            break;
+        case ACTION_UPDATE_TABLES:
+            operationPtr->numQuery = random_generate(randomPtr) % numQueryPerTransaction + 1;
+            for (n = 0; n < operationPtr->numQuery; n++) {
+                types[n] = random_generate(randomPtr) % NUM_RESERVATION_TYPE;
+                ids[n] = (random_generate(randomPtr) % queryRange) + 1;
+                ops[n] = random_generate(randomPtr) % 2;
+                if (ops[n]) {
+                    prices[n] = ((random_generate(randomPtr) % 5) * 10) + 50;
+                }
+            }
+            break;
+        default:
+            assert(0);
+    }
+
+    return 1;
+}
+
+
 /* =============================================================================
  * client_run
  * -- Execute list operations on the database
@@ -166,49 +234,47 @@ client_run (void* argPtr)
 {
     TM_THREAD_ENTER();
 
-    long myId = getenv("PREFETCHING") ? thread_getId()/2 : thread_getId();
+    long myId = TM_PREFETCH_MASTER();
 
     client_t* clientPtr = ((client_t**)argPtr)[myId];
 
     manager_t* managerPtr = clientPtr->managerPtr;
-    random_t*  randomPtr  = clientPtr->randomPtr;
-
-    if(getenv("PREFETCHING") && thread_getId()%2 == 1){
-        randomPtr = clientPtr->randomPtrH;
-    }
 
-    long numOperation           = clientPtr->numOperation;
     long numQueryPerTransaction = clientPtr->numQueryPerTransaction;
-    long queryRange             = clientPtr->queryRange;
-    long percentUser            = clientPtr->percentUser;
 
-    long* types  = (long*)P_MALLOC(numQueryPerTransaction * sizeof(long));
-    long* ids    = (long*)P_MALLOC(numQueryPerTransaction * sizeof(long));
-    long* ops    = (long*)P_MALLOC(numQueryPerTransaction * sizeof(long));
-    long* prices = (long*)P_MALLOC(numQueryPerTransaction * sizeof(long));
+    operation_t* operationPtr =
+        (operation_t*)P_MALLOC(OPERATION_SIZE(numQueryPerTransaction));
+    assert(operationPtr != NULL);
 
-    long i;
+    long* types  = operationPtr->query;
+    long* ids    = types + numQueryPerTransaction;
+    long* ops    = ids + numQueryPerTransaction;
+    long* prices = ops + numQueryPerTransaction;
 
-    for (i = 0; i < numOperation; i++) {
+    /* The client's random_t draws each operation once; the helpers of
+       this client get a copy of it from the ring */
+    TM_PREFETCH_REGISTER(client_nextOperation,
+                         clientPtr,
+                         OPERATION_SIZE(numQueryPerTransaction));
 
-        long r = random_generate(randomPtr) % 100;
-        action_t action = selectAction(r, percentUser);
-//printf("%d %d\n", thread_getId(), i);
+    while (TM_PREFETCH_NEXT(operationPtr)) {
 
-        switch (action) {
+        switch (operationPtr->action) {
 
             case ACTION_MAKE_RESERVATION: {
-                long maxPrices[NUM_RESERVATION_TYPE] = { -1, -1, -1 };
-                long maxIds[NUM_RESERVATION_TYPE] = { -1, -1, -1 };
+                long maxPrices[NUM_RESERVATION_TYPE];
+                long maxIds[NUM_RESERVATION_TYPE];
                 long n;
-                long numQuery = random_generate(randomPtr) % numQueryPerTransaction + 1;
-                long customerId = random_generate(randomPtr) % queryRange + 1;
-                for (n = 0; n < numQuery; n++) {
-                    types[n] = random_generate(randomPtr) % NUM_RESERVATION_TYPE;
-                    ids[n] = (random_generate(randomPtr) % queryRange) + 1;
-                }
-                bool_t isFound = FALSE;
+                long numQuery = operationPtr->numQuery;
+                long customerId = operationPtr->customerId;
+                bool_t isFound;
                 TM_BEGIN_ID(0);
+                /* Set inside the region, so a restart starts over */
+                for (n = 0; n < NUM_RESERVATION_TYPE; n++) {
+                    maxPrices[n] = -1;
+                    maxIds[n] = -1;
+                }
+                isFound = FALSE;
 
                 for (n = 0; n < numQuery; n++) {
                     long t = types[n];
@@ -259,7 +325,7 @@ client_run (void* argPtr)
             }
 
             case ACTION_DELETE_CUSTOMER: {
-                long customerId = random_generate(randomPtr) % queryRange + 1;
+                long customerId = operationPtr->customerId;
                 TM_BEGIN_ID(1);
                 long bill = MANAGER_QUERY_CUSTOMER_BILL(managerPtr, customerId);
                 if (bill >= 0) {
@@ -270,16 +336,8 @@ client_run (void* argPtr)
             }
 
             case ACTION_UPDATE_TABLES: {
-                long numUpdate = random_generate(randomPtr) % numQueryPerTransaction + 1;
+                long numUpdate = operationPtr->numQuery;
                 long n;
-                for (n = 0; n < numUpdate; n++) {
-                    types[n] = random_generate(randomPtr) % NUM_RESERVATION_TYPE;
-                    ids[n] = (random_generate(randomPtr) % queryRange) + 1;
-                    ops[n] = random_generate(randomPtr) % 2;
-                    if (ops[n]) {
-                        prices[n] = ((random_generate(randomPtr) % 5) * 10) + 50;
-                    }
-                }
                 TM_BEGIN_ID(2);
                 for (n = 0; n < numUpdate; n++) {
                     long t = types[n];
@@ -325,7 +383,9 @@ client_run (void* argPtr)
 
         } /* switch (action) */
 
-    } /* for i */
+    } /* while operation */
+
+    P_FREE(operationPtr);
 
     TM_THREAD_EXIT();
 }
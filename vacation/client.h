@@ -82,8 +82,8 @@ typedef struct client {
     long id;
     manager_t* managerPtr;
     random_t* randomPtr;
-    random_t* randomPtrH;
     long numOperation;
+    long numOperationLeft;
     long numQueryPerTransaction;
     long queryRange;
     long percentUser;
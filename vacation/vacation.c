@@ -468,14 +468,15 @@ MAIN(argc, argv)
     }
 #endif
     SIM_GET_NUM_CPU(global_params[PARAM_CLIENTS]);
+    TM_STARTUP(global_params[PARAM_CLIENTS]);
+    long numThread = TM_PREFETCH_THREADS(global_params[PARAM_CLIENTS]);
+    P_MEMORY_STARTUP(numThread);
+    /* Before the tables, which size their segments to the threads */
+    thread_startup(numThread);
     managerPtr = initializeManager();
     assert(managerPtr != NULL);
     clients = initializeClients(managerPtr);
     assert(clients != NULL);
-    long numThread = getenv("PREFETCHING") ? global_params[PARAM_CLIENTS]*2 : global_params[PARAM_CLIENTS];
-    TM_STARTUP(numThread);
-    P_MEMORY_STARTUP(numThread);
-    thread_startup(numThread);
 
     /* Run transactions */
     printf("Running clients... \n");
@@ -496,6 +497,12 @@ MAIN(argc, argv)
     printf("Time = %0.6lf\n",
            TIMER_DIFF_SECONDS(start, stop));
     fflush(stdout);
+#ifdef HASHTABLE_STATS
+    MAP_PRINT_STATS(managerPtr->carTablePtr);
+    MAP_PRINT_STATS(managerPtr->flightTablePtr);
+    MAP_PRINT_STATS(managerPtr->roomTablePtr);
+    MAP_PRINT_STATS(managerPtr->customerTablePtr);
+#endif
     checkTables(managerPtr);
 
     /* Clean up */
@@ -215,7 +215,7 @@ process ()
 
         TM_BEGIN_ID(0);
         elementPtr = TMHEAP_REMOVE(workHeapPtr);
-        TM_END();
+        TM_END_ID(0);
         if (elementPtr == NULL) {
             break;
         }
@@ -223,7 +223,7 @@ process ()
         bool_t isGarbage;
         TM_BEGIN_ID(1);
         isGarbage = TMELEMENT_ISGARBAGE(elementPtr);
-        TM_END();
+        TM_END_ID(1);
         if (isGarbage) {
             /*
              * Handle delayed deallocation
@@ -237,12 +237,12 @@ process ()
         TM_BEGIN_ID(2);
         PREGION_CLEARBAD(regionPtr);
         numAdded = TMREGION_REFINE(regionPtr, elementPtr, meshPtr);
-        TM_END();
+        TM_END_ID(2);
 
         TM_BEGIN_ID(3);
         TMELEMENT_SETISREFERENCED(elementPtr, FALSE);
         isGarbage = TMELEMENT_ISGARBAGE(elementPtr);
-        TM_END();
+        TM_END_ID(3);
         if (isGarbage) {
             /*
              * Handle delayed deallocation
@@ -254,7 +254,7 @@ process ()
 
         TM_BEGIN_ID(4);
         TMREGION_TRANSFERBAD(regionPtr, workHeapPtr);
-        TM_END();
+        TM_END_ID(4);
 
         numProcess++;
 
@@ -265,7 +265,7 @@ process ()
                     TM_SHARED_READ(global_totalNumAdded) + totalNumAdded);
     TM_SHARED_WRITE(global_numProcess,
                     TM_SHARED_READ(global_numProcess) + numProcess);
-    TM_END();
+    TM_END_ID(5);
 
     PREGION_FREE(regionPtr);
 